@@ -3,6 +3,23 @@
 #include "../loxrot/crontab.h"
 #include "../loxrot/config.h"
 #include "../loxrot/rotate.h"
+#include "../loxrot/watchdog.h"
+#include "../loxrot/plan.h"
+#include "../loxrot/executor.h"
+#include "../loxrot/reaper.h"
+#include "../loxrot/container.h"
+#include "../loxrot/fileio.h"
+#include "../loxrot/seekable.h"
+#include "../loxrot/catalog.h"
+#include "../loxrot/bloom.h"
+#include "../loxrot/search.h"
+#include "../loxrot/tail.h"
+#include "../loxrot/tools.h"
+#include "../loxrot/simulator.h"
+#include "../loxrot/memfs.h"
+#include "../loxrot/glob.h"
+#include "../loxrot/coordinator.h"
+#include "../loxrot/control.h"
 //#include "../loxrot/config.h"
 
 #include <iostream>
@@ -11,11 +28,58 @@
 #include <fstream>
 #include <filesystem>
 #include <string>
+#include <chrono>
+#include <sstream>
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
 namespace loxrotTest
 {
+	// A temporary directory of its own and an in-memory file system on a virtual clock, for tests that rotate without
+	// touching the disk. The directory is removed again at the end of the test.
+	class Fixture
+	{
+	public:
+		std::filesystem::path dir; ///< %TEMP%\loxrot<name>Test
+		VirtualClock clock;
+		MemoryFileSystem fileSystem;
+		Config config;
+
+		explicit Fixture(const std::wstring& name) : dir(std::filesystem::temp_directory_path() / (L"loxrot" + name + L"Test")), clock(1000000), fileSystem(clock, 0.1)
+		{
+			std::filesystem::remove_all(dir);
+			std::filesystem::create_directories(dir);
+		}
+
+		~Fixture()
+		{
+			std::error_code ec;
+			std::filesystem::remove_all(dir, ec);
+		}
+
+		// A section rotating <name>.log in the logs directory every minute
+		std::wstring section(const std::wstring& name, const std::wstring& settings = L"KeepFiles = 3\n")
+		{
+			return L"[" + name + L"]\nDirectory = " + (dir / L"logs").wstring() + L"\nFilePattern = ^" + name + L"\\.log$\nTimer = * * * * *\n" + settings;
+		}
+
+		// Write the configuration to loxrot.conf and load it
+		Config& load(const std::wstring& content)
+		{
+			std::wofstream out(dir / L"loxrot.conf");
+			out << content;
+			out.close();
+			config.load((dir / L"loxrot.conf").wstring());
+			return config;
+		}
+
+		// The full path of a log file in the logs directory
+		std::wstring log(const std::wstring& name)
+		{
+			return (dir / L"logs" / (name + L".log")).wstring();
+		}
+	};
+
 	TEST_CLASS(CrontabTest)
 	{
 	public:
@@ -175,8 +239,1298 @@ namespace loxrotTest
 			Assert::IsFalse(crontab.parse(L"* * * * 1,0,8,9,12"));
 			Assert::IsFalse(crontab.parse(L"* * * * a *"));
 		}
+
+		TEST_METHOD(Extended)
+		{
+			Crontab crontab;
+			Assert::IsTrue(crontab.parse(L"*/15 * * * * *"));
+			Assert::AreEqual(4, static_cast<int>(crontab.seconds.size()));
+			Assert::AreEqual(45, crontab.seconds[3]);
+			Assert::IsTrue(crontab.parse(L"0 1-30/5 * * jan-Mar MON-FRI"));
+			Assert::AreEqual(6, static_cast<int>(crontab.minutes.size()));
+			Assert::AreEqual(26, crontab.minutes[5]);
+			Assert::AreEqual(3, static_cast<int>(crontab.months.size()));
+			Assert::AreEqual(5, static_cast<int>(crontab.weekdays.size()));
+			Assert::IsTrue(crontab.parse(L"@hourly"));
+			Assert::AreEqual(1, static_cast<int>(crontab.minutes.size()));
+			Assert::AreEqual(24, static_cast<int>(crontab.hours.size()));
+			Assert::IsTrue(crontab.parse(L"@DAILY"));
+			Assert::AreEqual(1, static_cast<int>(crontab.hours.size()));
+			// Sunday is 0 and 7, December matches *
+			Assert::IsTrue(crontab.parse(L"0 0 * * 7"));
+			Assert::AreEqual(0, crontab.weekdays[0]);
+			Assert::IsTrue(crontab.parse(L"* * * * *"));
+			Assert::AreEqual(12, crontab.months.back());
+			Assert::IsFalse(crontab.parse(L"@reboot"));
+			Assert::IsFalse(crontab.parse(L"* * * foo *"));
+			Assert::IsFalse(crontab.parse(L"30-1 * * * *"));
+			Assert::IsFalse(crontab.parse(L"60 * * * * *"));
+
+			tm start = {};
+			start.tm_year = 126;
+			start.tm_mon = 11;
+			start.tm_mday = 31;
+			start.tm_hour = 23;
+			start.tm_min = 59;
+			start.tm_sec = 50;
+			time_t now = _mkgmtime(&start);
+			Assert::IsTrue(crontab.parse(L"*/20 * * * * *"));
+			Assert::IsTrue(crontab.setTimeZone(L"UTC"));
+			Assert::AreEqual(now + 10, crontab.fireAfter(now));
+			Assert::AreEqual(now + 30, crontab.fireAfter(now + 10));
+			Assert::IsTrue(crontab.parse(L"@yearly"));
+			Assert::AreEqual(now + 10, crontab.fireAfter(now));
+		}
+
+		TEST_METHOD(Splay)
+		{
+			// The same name always gets the same offset, different names spread over the window
+			Crontab a, b, c;
+			a.setSplay(L"tenant1", 600);
+			b.setSplay(L"tenant1", 600);
+			c.setSplay(L"tenant2", 600);
+			Assert::AreEqual(a.getDelay(), b.getDelay());
+			Assert::IsTrue(a.getDelay() != c.getDelay());
+			Assert::IsTrue(a.getDelay() >= 0 && a.getDelay() < 600);
+			Assert::AreEqual(Tools::hash(L"tenant1"), Tools::hash(L"tenant1"));
+			Assert::IsTrue(Tools::hash(L"tenant1") % 600 != Tools::hash(L"tenant2") % 600);
+			c.setSplay(L"tenant2", 0);
+			Assert::AreEqual(0LL, static_cast<long long>(c.getDelay()));
+
+			tm start = {};
+			start.tm_year = 126;
+			start.tm_mon = 9;
+			start.tm_mday = 18;
+			start.tm_hour = 11;
+			start.tm_min = 59;
+			time_t now = _mkgmtime(&start);
+			Assert::IsTrue(a.parse(L"0 * * * *"));
+			Assert::IsTrue(a.setTimeZone(L"UTC"));
+			time_t fire = now + 60 + a.getDelay();
+			Assert::IsFalse(a.isTimeToRotate(now));
+			Assert::IsFalse(a.isTimeToRotate(fire - 1));
+			Assert::IsTrue(a.isTimeToRotate(fire));
+			Assert::IsFalse(a.isTimeToRotate(fire + 1));
+			Assert::IsTrue(a.isTimeToRotate(fire + 3600));
+		}
+
+		TEST_METHOD(CatchUp)
+		{
+			tm start = {};
+			start.tm_year = 126;
+			start.tm_mon = 4;
+			start.tm_mday = 1;
+			start.tm_hour = 10;
+			start.tm_sec = 30;
+			time_t now = _mkgmtime(&start);
+			for (const wchar_t* policy : { L"once", L"all", L"skip" }) {
+				Crontab crontab;
+				Assert::IsTrue(crontab.parse(L"*/10 * * * *"));
+				Assert::IsTrue(crontab.setTimeZone(L"UTC"));
+				Assert::IsTrue(crontab.setCatchUp(policy));
+				// Due at the start of the current minute
+				Assert::IsTrue(crontab.isTimeToRotate(now));
+				Assert::IsFalse(crontab.isTimeToRotate(now + 1));
+				Assert::AreEqual(now - 30 + 600, crontab.next);
+				// Six rotations were due while asleep for an hour
+				int rotations = 0;
+				for (int i = 0; i < 20; i++) {
+					rotations += crontab.isTimeToRotate(now + 3600 + i) ? 1 : 0;
+				}
+				Assert::AreEqual(std::wstring(policy) == L"all" ? 6 : 1, rotations);
+				Assert::AreEqual(now - 30 + 4200, crontab.next);
+			}
+			Crontab never;
+			Assert::IsTrue(never.parse(L"0 0 31 2 *"));
+			Assert::AreEqual(time_t(-1), never.fireAfter(now));
+			Assert::IsFalse(never.setTimeZone(L"Nowhere Standard Time"));
+			Assert::IsFalse(never.setCatchUp(L"sometimes"));
+		}
+	};
+
+	TEST_CLASS(SuffixTest)
+	{
+	public:
+		TEST_METHOD(Timestamp)
+		{
+			time_t now = time(0);
+			Assert::IsTrue(now == Rotate::parseTimestamp(Rotate::formatTimestamp(now)));
+			Assert::AreEqual(15, static_cast<int>(Rotate::formatTimestamp(now).length()));
+			Assert::IsTrue(Rotate::parseTimestamp(L"20261016-000000") < Rotate::parseTimestamp(L"20261016-000001"));
+			Assert::IsTrue(Rotate::parseTimestamp(L"20261016000000") == -1);
+			Assert::IsTrue(Rotate::parseTimestamp(L"20261016_000000") == -1);
+		}
+
+		TEST_METHOD(Parse)
+		{
+			std::wstring file;
+			Rotate::Generation indexed;
+			Assert::IsTrue(Rotate::parseGeneration(L"c:\\logs\\app.log.12.gz", file, indexed));
+			Assert::AreEqual(std::wstring(L"c:\\logs\\app.log"), file);
+			Assert::AreEqual(12, indexed.index);
+			Assert::IsTrue(indexed.compressed);
+			Rotate::Generation timestamped;
+			Assert::IsTrue(Rotate::parseGeneration(L"c:\\logs\\app.log.20261016-000000_2", file, timestamped));
+			Assert::AreEqual(std::wstring(L"c:\\logs\\app.log"), file);
+			Assert::IsTrue(timestamped.timestamp == Rotate::parseTimestamp(L"20261016-000000"));
+			Assert::AreEqual(2, timestamped.index);
+			Assert::IsFalse(timestamped.compressed);
+			Rotate::Generation merged;
+			Assert::IsTrue(Rotate::parseGeneration(L"c:\\logs\\app.log.2026-W42.gz", file, merged));
+			Assert::IsTrue(merged.merged);
+			Rotate::Generation other;
+			Assert::IsFalse(Rotate::parseGeneration(L"c:\\logs\\app.log", file, other));
+			Assert::IsFalse(Rotate::parseGeneration(L"c:\\logs\\app.log.gz", file, other));
+			Assert::IsFalse(Rotate::parseGeneration(L"c:\\logs\\app.log.2026-10", file, other));
+			Assert::IsFalse(Rotate::parseGeneration(L"c:\\logs\\app.log.1234567890", file, other));
+			Assert::IsFalse(Rotate::parseGeneration(L"c:\\logs\\app.log.20261016-000000_", file, other));
+			Assert::IsFalse(Rotate::parseGeneration(L".5", file, other));
+		}
+	};
+
+	TEST_CLASS(MaxTotalSizeTest)
+	{
+	public:
+		TEST_METHOD(Units)
+		{
+			Config c;
+			Assert::AreEqual(4LL, c.convertToBytes(L"4"));
+			Assert::AreEqual(4096LL, c.convertToBytes(L"4k"));
+			Assert::AreEqual(4194304LL, c.convertToBytes(L"4M"));
+			Assert::AreEqual(4294967296LL, c.convertToBytes(L"4G"));
+			Assert::AreEqual(4398046511104LL, c.convertToBytes(L"4T"));
+			Assert::ExpectException<std::invalid_argument>([&c]() { c.convertToBytes(L"4x"); });
+			Assert::ExpectException<std::invalid_argument>([&c]() { c.convertToBytes(L"k"); });
+		}
+	};
+
+	TEST_CLASS(WatchdogTest)
+	{
+	public:
+		TEST_METHOD(Threshold)
+		{
+			Assert::AreEqual(1000ULL, Watchdog::getThreshold(L"10%", 10000ULL));
+			Assert::AreEqual(4096ULL, Watchdog::getThreshold(L"4096", 10000ULL));
+			Assert::AreEqual(0ULL, Watchdog::getThreshold(L"0", 10000ULL));
+		}
+
+		// An emergency pass deletes the oldest history first, not the largest generation
+		TEST_METHOD(Reclaim)
+		{
+			Fixture fixture(L"Reclaim");
+			Config& config = fixture.load(fixture.section(L"app", L"KeepFiles = 5\nMinKeepFiles = 1\nTimestampRegex = ^(\\d+)\n"));
+			Rotate rotate(fixture.fileSystem, fixture.clock);
+			std::wstring log = fixture.log(L"app");
+			time_t now = fixture.clock.now();
+			fixture.fileSystem.write(log, 10);
+			// The catalog lives on disk, the generations in memory
+			std::wstring catalogFile = Catalog::fileName((fixture.dir / L"logs").wstring(), L"app");
+			std::filesystem::create_directories(fixture.dir / L"logs");
+			Catalog catalog;
+			for (int i = 0; i < 4; i++) {
+				fixture.fileSystem.create(log + L"." + std::to_wstring(i) + L".gz", i == 1 ? 500 : 100 - i * 10, now - (i + 1) * 3600, now - (i + 1) * 3600);
+				Catalog::Entry range;
+				range.first = i * 100;
+				range.last = i * 100 + 50;
+				catalog.set(L"app.log." + std::to_wstring(i) + L".gz", range);
+			}
+			Assert::IsTrue(catalog.save(catalogFile, false));
+			std::vector<std::pair<const std::wstring, Config::Section>*> sections = { &*config.getConfigs().find(L"app") };
+			Assert::AreEqual(150ULL, rotate.reclaimSpace(sections, 100));
+			Assert::IsTrue(fixture.fileSystem.exists(log + L".1.gz"));
+			Assert::IsFalse(fixture.fileSystem.exists(log + L".2.gz"));
+			Assert::IsFalse(fixture.fileSystem.exists(log + L".3.gz"));
+			// The catalog no longer knows the removed generations
+			catalog.load(catalogFile);
+			Assert::AreEqual(size_t(2), catalog.getEntries().size());
+			Assert::IsTrue(catalog.getEntries().at(L"app.log.1.gz").first == 100);
+			// MinKeepFiles protects the newest generation
+			Assert::AreEqual(500ULL, rotate.reclaimSpace(sections, 1000));
+			Assert::IsTrue(fixture.fileSystem.exists(log + L".0.gz"));
+		}
+	};
+
+	TEST_CLASS(PlanTest)
+	{
+	public:
+		TEST_METHOD(Json)
+		{
+			Plan plan;
+			Assert::IsTrue(plan.empty());
+			plan.add(Plan::rename, L"c:\\log\\a.log.0", L"c:\\log\\a.log.1", 0);
+			plan.add(Plan::copy, L"c:\\log\\a.log", L"c:\\log\\a.log.0", 100);
+			plan.add(Plan::truncate, L"c:\\log\\a.log", L"", 100);
+			Assert::AreEqual(200ULL, plan.getTotalBytes());
+			std::wstring json = plan.toJson(L"sec\"tion");
+			Assert::IsTrue(json.find(L"\"section\":\"sec\\\"tion\"") != std::wstring::npos);
+			Assert::IsTrue(json.find(L"\"source\":\"c:\\\\log\\\\a.log.0\"") != std::wstring::npos);
+			Assert::IsTrue(json.find(L"\"copy\":{\"count\":1,\"bytes\":100}") != std::wstring::npos);
+			Assert::IsTrue(json.find(L"\"totals\":{\"operations\":3,\"bytes\":200") != std::wstring::npos);
+		}
+	};
+
+	TEST_CLASS(ExecutorTest)
+	{
+	public:
+		TEST_METHOD(Batches)
+		{
+			Plan plan;
+			plan.add(Plan::remove, L"c:\\log\\a.log.9", L"", 0);
+			plan.add(Plan::remove, L"c:\\log\\b.log.9", L"", 0);
+			plan.add(Plan::rename, L"c:\\log\\a.log.8", L"c:\\log\\A.LOG.9", 0);
+			plan.add(Plan::rename, L"c:\\log\\a.log.7", L"c:\\log\\a.log.8", 0);
+			plan.add(Plan::rename, L"c:\\log\\b.log.8", L"c:\\log\\b.log.9", 0);
+			std::vector<const Plan::Operation*> operations;
+			for (const auto& operation : plan.getOperations()) {
+				operations.push_back(&operation);
+			}
+			// The rename into a.log.9 has to wait for its removal, the rename of a.log.7 for the one of a.log.8
+			Assert::AreEqual(size_t(2), Executor::batchEnd(operations, 0));
+			Assert::AreEqual(size_t(3), Executor::batchEnd(operations, 2));
+			Assert::AreEqual(size_t(5), Executor::batchEnd(operations, 3));
+		}
+
+		// Sequential and batched execution leave the directory in the same state
+		TEST_METHOD(Execute)
+		{
+			const int generations = 100;
+			std::filesystem::path path = std::filesystem::temp_directory_path() / L"loxrotExecutorTest";
+			for (bool batched : { false, true }) {
+				Executor::Options options;
+				options.batched = batched;
+				std::filesystem::remove_all(path);
+				std::filesystem::create_directories(path);
+				Plan plan;
+				for (int i = 0; i < generations; i++) {
+					std::wstring name = (path / (L"test.log." + std::to_wstring(i))).wstring();
+					std::ofstream(name) << "test";
+					plan.add(i % 2 == 0 ? Plan::remove : Plan::rename, name, i % 2 == 0 ? L"" : name + L".old", 4);
+				}
+				Executor executor;
+				std::map<std::wstring, uintmax_t> sizes;
+				Assert::IsTrue(executor.execute(plan, sizes, options));
+				for (int i = 0; i < generations; i++) {
+					std::filesystem::path name = path / (L"test.log." + std::to_wstring(i));
+					Assert::IsFalse(std::filesystem::exists(name));
+					Assert::AreEqual(i % 2 != 0, std::filesystem::exists(name.wstring() + L".old"));
+				}
+				std::filesystem::remove_all(path);
+			}
+		}
+
+		// Timing of sequential and batched execution on a directory of 10,000 generations, only run on demand
+		BEGIN_TEST_METHOD_ATTRIBUTE(Benchmark)
+			TEST_IGNORE()
+		END_TEST_METHOD_ATTRIBUTE()
+		TEST_METHOD(Benchmark)
+		{
+			const int generations = 10000;
+			std::filesystem::path path = std::filesystem::temp_directory_path() / L"loxrotExecutorBenchmark";
+			for (bool batched : { false, true }) {
+				Executor::Options options;
+				options.batched = batched;
+				std::filesystem::remove_all(path);
+				std::filesystem::create_directories(path);
+				Plan plan;
+				for (int i = 0; i < generations; i++) {
+					std::wstring name = (path / (L"test.log." + std::to_wstring(i))).wstring();
+					std::ofstream(name) << "test";
+					plan.add(i % 2 == 0 ? Plan::remove : Plan::rename, name, i % 2 == 0 ? L"" : name + L".old", 4);
+				}
+				Executor executor;
+				std::map<std::wstring, uintmax_t> sizes;
+				auto start = std::chrono::steady_clock::now();
+				Assert::IsTrue(executor.execute(plan, sizes, options));
+				auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+				std::wstring message = std::wstring(batched ? L"batched" : L"sequential") + L": " + std::to_wstring(generations) + L" operations in " + std::to_wstring(elapsed.count()) + L" ms\n";
+				Logger::WriteMessage(message.c_str());
+				std::filesystem::remove_all(path);
+			}
+		}
+
+		TEST_METHOD(CatchUp)
+		{
+			std::filesystem::path path = std::filesystem::temp_directory_path() / L"loxrotCatchUpTest.log";
+			std::filesystem::path copy = path.wstring() + L".0";
+			std::filesystem::remove(copy);
+			std::ofstream(path, std::ios::binary) << "copied\n";
+			Assert::IsTrue(FileIO::copyFile(path.wstring(), copy.wstring()));
+			// Written between the copy and the truncation
+			std::ofstream(path, std::ios::binary | std::ios::app) << "late\n";
+			unsigned long long size = 0;
+			Assert::IsTrue(FileIO::catchUpAndTruncate(path.wstring(), copy.wstring(), false, size));
+			Assert::AreEqual(12ULL, size);
+			Assert::AreEqual(uintmax_t(0), std::filesystem::file_size(path));
+			std::ifstream file(copy, std::ios::binary);
+			std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			file.close();
+			Assert::AreEqual(std::string("copied\nlate\n"), content);
+			std::filesystem::remove(path);
+			std::filesystem::remove(copy);
+		}
+	};
+
+	TEST_CLASS(ReaperTest)
+	{
+	public:
+		TEST_METHOD(Remove)
+		{
+			std::filesystem::path path = std::filesystem::temp_directory_path() / L"loxrotReaperTest.log.9";
+			std::ofstream(path) << std::string(10000, 'x');
+			{
+				Reaper reaper;
+				Assert::IsTrue(reaper.remove(path.wstring(), 4096));
+				// The name is free at once, the file itself is deleted in the background
+				Assert::IsFalse(std::filesystem::exists(path));
+			}
+			for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::temp_directory_path())) {
+				Assert::IsFalse(entry.path().filename().wstring().rfind(L"loxrotReaperTest", 0) == 0);
+			}
+			Assert::IsTrue(Reaper::isQueuedName(L"c:\\log\\a.log.9.12-0.loxrot-delete"));
+			Assert::IsFalse(Reaper::isQueuedName(L"c:\\log\\a.log.9"));
+		}
+	};
+
+	TEST_CLASS(ContainerTest)
+	{
+	public:
+		TEST_METHOD(Period)
+		{
+			Assert::AreEqual(std::wstring(L"2026-W01"), Container::formatPeriod(Container::parsePeriod(L"2026-W01"), true));
+			Assert::AreEqual(std::wstring(L"2026-W53"), Container::formatPeriod(Container::parsePeriod(L"2026-W53"), true));
+			Assert::AreEqual(std::wstring(L"2026-10"), Container::formatPeriod(Container::parsePeriod(L"2026-10"), false));
+			Assert::IsTrue(Container::parsePeriod(L"2026-13") == -1);
+			Assert::IsTrue(Container::parsePeriod(L"2026-10-01") == -1);
+		}
+
+		TEST_METHOD(AppendExtract)
+		{
+			std::filesystem::path path = std::filesystem::temp_directory_path() / L"loxrotContainerTest";
+			std::filesystem::remove_all(path);
+			std::filesystem::create_directories(path);
+			std::wstring container = (path / L"test.log.2026-10.gz").wstring();
+			std::ofstream(path / L"test.log.5.gz", std::ios::binary) << "first";
+			std::ofstream(path / L"test.log.4.gz", std::ios::binary) << "second";
+			Assert::IsTrue(Container::append(container, (path / L"test.log.5.gz").wstring(), false));
+			// Left behind by an interrupted append, cut off by the next one
+			std::ofstream(container, std::ios::binary | std::ios::app) << "partial";
+			Assert::IsTrue(Container::append(container, (path / L"test.log.4.gz").wstring(), false));
+			Assert::IsTrue(Container::append(container, (path / L"test.log.4.gz").wstring(), false));
+			Assert::AreEqual(uintmax_t(11), std::filesystem::file_size(container));
+			Assert::AreEqual(size_t(2), Container::readIndex(container).size());
+			Assert::IsTrue(Container::extract(container, L"test.log.4.gz", (path / L"extracted").wstring()));
+			std::ifstream extracted(path / L"extracted", std::ios::binary);
+			Assert::AreEqual(std::string("second"), std::string(std::istreambuf_iterator<char>(extracted), {}));
+			extracted.close();
+			Assert::IsFalse(Container::extract(container, L"test.log.3.gz", (path / L"missing").wstring()));
+			// Numbered generations come back under the same name with other content
+			std::ofstream(path / L"test.log.4.gz", std::ios::binary) << "third";
+			Assert::IsTrue(Container::append(container, (path / L"test.log.4.gz").wstring(), false));
+			Assert::AreEqual(std::wstring(L"test.log.4.gz#2"), Container::readIndex(container).back().name);
+			Assert::AreEqual(uintmax_t(16), std::filesystem::file_size(container));
+			// Without its index the container is not touched
+			std::filesystem::remove(container + L".idx");
+			Assert::IsFalse(Container::append(container, (path / L"test.log.5.gz").wstring(), false));
+			Assert::AreEqual(uintmax_t(16), std::filesystem::file_size(container));
+			std::filesystem::remove_all(path);
+		}
+	};
+
+	TEST_CLASS(CatalogTest)
+	{
+	public:
+		TEST_METHOD(Parse)
+		{
+			Catalog catalog;
+			catalog.setFormat(L"^(\\w{3} +\\d+ \\d{2}:\\d{2}:\\d{2})", L"%b %d %H:%M:%S");
+			std::string line = "Oct 18 12:30:05 host app: started";
+			time_t parsed = catalog.parse(line.c_str(), line.size());
+			std::tm tm;
+			localtime_s(&tm, &parsed);
+			Assert::AreEqual(9, tm.tm_mon);
+			Assert::AreEqual(18, tm.tm_mday);
+			Assert::AreEqual(12 * 3600 + 30 * 60 + 5, tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec);
+			line = "  at continuation of the line before";
+			Assert::IsTrue(catalog.parse(line.c_str(), line.size()) == -1);
+		}
+
+		TEST_METHOD(Apply)
+		{
+			Catalog catalog;
+			Catalog::Entry a;
+			a.first = 100;
+			a.last = 200;
+			Catalog::Entry b;
+			b.first = 300;
+			b.last = 400;
+			catalog.set(L"app.log.1", a);
+			catalog.set(L"app.log.2.gz", b);
+			Plan plan;
+			plan.add(Plan::rename, L"c:\\logs\\app.log.1", L"c:\\logs\\app.log.2", 0);
+			plan.add(Plan::copy, L"c:\\logs\\app.log", L"c:\\logs\\app.log.1", 0);
+			plan.add(Plan::compress, L"c:\\logs\\app.log.2", L"c:\\logs\\app.log.2.gz", 0);
+			plan.add(Plan::merge, L"c:\\logs\\app.log.2.gz", L"c:\\logs\\app.log.2026-10.gz", 0);
+			plan.add(Plan::remove, L"c:\\logs\\app.log.3.gz", L"", 0);
+			catalog.apply(plan);
+			Assert::AreEqual(size_t(2), catalog.getEntries().size());
+			Assert::IsTrue(catalog.getEntries().at(L"app.log.1").first == -1);
+			Assert::IsTrue(catalog.getEntries().at(L"app.log.2026-10.gz").first == 100);
+			Assert::IsTrue(catalog.getEntries().at(L"app.log.2026-10.gz").last == 200);
+		}
+	};
+
+	TEST_CLASS(BloomTest)
+	{
+	public:
+		TEST_METHOD(Tokens)
+		{
+			Bloom bloom(1024 * 1024, 0.01, "_-");
+			std::string text = "GET /api request_id=req-42 user=alice\nPOST /api request_id=req-43 user=bob";
+			// Tokens may continue in the next piece of data
+			bloom.add(text.data(), 20);
+			bloom.add(text.data() + 20, text.size() - 20);
+			bloom.finish();
+			Assert::IsTrue(bloom.words.size() * 64 < 1024 * 1024 / Bloom::bytesPerToken);
+			Assert::IsTrue(bloom.mayContain("req-42"));
+			Assert::IsTrue(bloom.mayContain("bob"));
+			int falsePositives = 0;
+			for (int i = 0; i < 1000; i++) {
+				falsePositives += bloom.mayContain("absent-" + std::to_string(i)) ? 1 : 0;
+			}
+			Assert::IsTrue(falsePositives < 50);
+			Assert::IsTrue(bloom.isToken("req-42"));
+			Assert::IsFalse(bloom.isToken("req 42"));
+			std::string line = "request_id=req-420 request_id=req-42";
+			Assert::IsTrue(bloom.lineContains(line.data(), line.size(), "req-42"));
+			Assert::IsFalse(bloom.lineContains(line.data(), 18, "req-42"));
+		}
+	};
+
+	TEST_CLASS(SearchTest)
+	{
+	public:
+		TEST_METHOD(Grep)
+		{
+			std::string text = "aab\nabab";
+			Assert::IsTrue(Search::findLiteral(text.data(), text.data() + text.size(), "ab") == text.data() + 1);
+			Assert::IsTrue(Search::findLiteral(text.data(), text.data() + 3, "abc") == nullptr);
+			std::filesystem::path path = std::filesystem::temp_directory_path() / L"loxrotSearchTest.log";
+			std::ofstream(path, std::ios::binary) << "first match\nnothing\nlast match";
+			std::string result;
+			Assert::IsTrue(Search::grepFile(path.wstring(), "match", nullptr, result));
+			Assert::AreEqual(std::string("loxrotSearchTest.log:first match\nloxrotSearchTest.log:last match\n"), result);
+			std::regex regex("^n.t");
+			result.clear();
+			Assert::IsTrue(Search::grepFile(path.wstring(), "", &regex, result));
+			Assert::AreEqual(std::string("loxrotSearchTest.log:nothing\n"), result);
+			std::filesystem::remove(path);
+		}
+	};
+
+	TEST_CLASS(TailTest)
+	{
+	public:
+		TEST_METHOD(Rotation)
+		{
+			std::filesystem::path path = std::filesystem::temp_directory_path() / L"loxrotTailTest.log";
+			std::filesystem::path generation = path.wstring() + L".0";
+			std::filesystem::remove(Tail::markerName(path.wstring()));
+			std::ofstream(path, std::ios::binary) << "before\n";
+			Tail tail(path.wstring(), true);
+			std::string result;
+			Seekable::Consumer consumer = [&](const char* data, size_t length) { result.append(data, length); return true; };
+			std::ofstream(path, std::ios::binary | std::ios::app) << "first\nsec";
+			Assert::IsTrue(tail.poll(consumer));
+			Assert::AreEqual(std::string("first\n"), result);
+			// Written before the rotation and not read yet, it must come from the copy
+			std::ofstream(path, std::ios::binary | std::ios::app) << "ond\n";
+			Plan plan;
+			plan.add(Plan::copy, path.wstring(), generation.wstring(), 0);
+			plan.add(Plan::truncate, path.wstring(), L"", 0);
+			Executor executor;
+			std::map<std::wstring, uintmax_t> sizes;
+			Executor::Options options;
+			options.tailMarker = true;
+			Assert::IsTrue(executor.execute(plan, sizes, options));
+			std::ofstream(path, std::ios::binary | std::ios::app) << "third\n";
+			Assert::IsTrue(tail.poll(consumer));
+			Assert::AreEqual(std::string("first\nsecond\nthird\n"), result);
+			Tail::Marker marker;
+			Assert::IsTrue(Tail::readMarker(Tail::markerName(path.wstring()), marker));
+			Assert::IsTrue(marker.done);
+			Assert::AreEqual(1ULL, marker.sequence);
+			Assert::AreEqual(20ULL, marker.size);
+			std::filesystem::remove(path);
+			std::filesystem::remove(generation);
+			std::filesystem::remove(Tail::markerName(path.wstring()));
+		}
+	};
+
+	TEST_CLASS(MemoryFileSystemTest)
+	{
+	public:
+		TEST_METHOD(RenameChain)
+		{
+			Fixture fixture(L"RenameChain");
+			Config::Section& section = fixture.load(fixture.section(L"app")).getConfigs().at(L"app");
+			VirtualClock& clock = fixture.clock;
+			MemoryFileSystem& fileSystem = fixture.fileSystem;
+			Rotate rotate(fileSystem, clock);
+			std::wstring log = fixture.log(L"app");
+			for (int i = 1; i <= 5; i++) {
+				fileSystem.write(log, i * 100);
+				clock.set(clock.now() + 60);
+				rotate.rotateFile(L"app", section);
+			}
+			// The three latest rotations, newest first
+			Assert::AreEqual(0ULL, fileSystem.fileSize(log));
+			Assert::AreEqual(500ULL, fileSystem.fileSize(log + L".0"));
+			Assert::AreEqual(400ULL, fileSystem.fileSize(log + L".1"));
+			Assert::AreEqual(300ULL, fileSystem.fileSize(log + L".2"));
+			Assert::IsFalse(fileSystem.exists(log + L".3"));
+			Assert::AreEqual(size_t(4), fileSystem.list((fixture.dir / L"logs").wstring()).size());
+		}
+
+		TEST_METHOD(Faults)
+		{
+			Fixture fixture(L"Faults");
+			Config::Section& section = fixture.load(fixture.section(L"app")).getConfigs().at(L"app");
+			MemoryFileSystem& fileSystem = fixture.fileSystem;
+			Rotate rotate(fileSystem, fixture.clock);
+			std::wstring log = fixture.log(L"app");
+			fileSystem.write(log, 1000);
+
+			// No room for the copy, the log file keeps its data
+			fileSystem.setCapacity(1500);
+			rotate.rotateFile(L"app", section);
+			Assert::IsTrue(fileSystem.getLastError() == std::errc::no_space_on_device);
+			Assert::AreEqual(1000ULL, fileSystem.fileSize(log));
+			Assert::IsFalse(fileSystem.exists(log + L".0"));
+			fileSystem.setCapacity(0);
+			rotate.rotateFile(L"app", section);
+			Assert::AreEqual(0ULL, fileSystem.fileSize(log));
+			Assert::AreEqual(1000ULL, fileSystem.fileSize(log + L".0"));
+
+			// A failed rename stops the rotation before the log file is touched, the next one catches up
+			fileSystem.write(log, 500);
+			fileSystem.failRename(log + L".0", 1);
+			rotate.rotateFile(L"app", section);
+			Assert::IsTrue(fileSystem.getLastError() == std::errc::device_or_resource_busy);
+			Assert::AreEqual(500ULL, fileSystem.fileSize(log));
+			Assert::AreEqual(1000ULL, fileSystem.fileSize(log + L".0"));
+			rotate.rotateFile(L"app", section);
+			Assert::AreEqual(500ULL, fileSystem.fileSize(log + L".0"));
+			Assert::AreEqual(1000ULL, fileSystem.fileSize(log + L".1"));
+
+			// A generation that cannot be accessed holds up the chain, a directory that cannot be read the section
+			fileSystem.write(log, 200);
+			fileSystem.deny(log + L".1");
+			rotate.rotateFile(L"app", section);
+			Assert::IsTrue(fileSystem.getLastError() == std::errc::permission_denied);
+			Assert::AreEqual(200ULL, fileSystem.fileSize(log));
+			fileSystem.allow(log + L".1");
+			fileSystem.deny((fixture.dir / L"logs").wstring());
+			Assert::ExpectException<std::filesystem::filesystem_error>([&]() { rotate.rotateFile(L"app", section); });
+			fileSystem.allow((fixture.dir / L"logs").wstring());
+			rotate.rotateFile(L"app", section);
+			Assert::AreEqual(200ULL, fileSystem.fileSize(log + L".0"));
+			Assert::AreEqual(1000ULL, fileSystem.fileSize(log + L".2"));
+		}
+
+		// A file that cannot be rotated does not hold up the other files of the directory or the retention
+		TEST_METHOD(IndependentFiles)
+		{
+			Fixture fixture(L"IndependentFiles");
+			Config::Section& section = fixture.load(L"[app]\nDirectory = " + (fixture.dir / L"logs").wstring()
+				+ L"\nFilePattern = ^.*\\.log$\nKeepFiles = 5\nMaxAge = 1d\nTimer = * * * * *\nTimestampRegex = ^(\\d+)\n").getConfigs().at(L"app");
+			MemoryFileSystem& fileSystem = fixture.fileSystem;
+			Rotate rotate(fileSystem, fixture.clock);
+			time_t old = fixture.clock.now() - 3 * 86400;
+			std::wstring a = fixture.log(L"a");
+			std::wstring b = fixture.log(L"b");
+			// The catalog lives on disk, the generations in memory
+			std::wstring catalogFile = Catalog::fileName((fixture.dir / L"logs").wstring(), L"app");
+			std::filesystem::create_directories(fixture.dir / L"logs");
+			Catalog catalog;
+			Catalog::Entry range;
+			range.first = 100;
+			range.last = 200;
+			catalog.set(L"a.log.0", range);
+			range.first = 300;
+			range.last = 400;
+			catalog.set(L"b.log.0", range);
+			Assert::IsTrue(catalog.save(catalogFile, false));
+			fileSystem.write(a, 100);
+			fileSystem.create(a + L".0", 10, fixture.clock.now(), fixture.clock.now());
+			fileSystem.write(b, 200);
+			fileSystem.create(b + L".0", 20, old, old);
+			fileSystem.failRename(a + L".0", 1);
+			rotate.rotateFile(L"app", section);
+			// The chain of a stopped before its log file was touched
+			Assert::AreEqual(100ULL, fileSystem.fileSize(a));
+			Assert::AreEqual(10ULL, fileSystem.fileSize(a + L".0"));
+			// b was rotated and its expired generation removed
+			Assert::AreEqual(0ULL, fileSystem.fileSize(b));
+			Assert::AreEqual(200ULL, fileSystem.fileSize(b + L".0"));
+			Assert::IsFalse(fileSystem.exists(b + L".1"));
+			// The catalog followed only the operations that were executed
+			catalog.load(catalogFile);
+			Assert::AreEqual(size_t(1), catalog.getEntries().size());
+			Assert::IsTrue(catalog.getEntries().at(L"a.log.0").first == 100);
+		}
+
+		// Many log files with many generations in one directory, each rotated with one scan of the directory
+		TEST_METHOD(ManyFiles)
+		{
+			const int logFiles = 20;
+			const int keepFiles = 10;
+			Fixture fixture(L"ManyFiles");
+			std::filesystem::path& dir = fixture.dir;
+			Config::Section& section = fixture.load(L"[app]\nDirectory = " + (dir / L"logs").wstring() + L"\nFilePattern = ^.*\\.log$\nKeepFiles = "
+				+ std::to_wstring(keepFiles) + L"\nTimer = * * * * *\nMaxTotalSize = 1G\n").getConfigs().at(L"app");
+			VirtualClock& clock = fixture.clock;
+			MemoryFileSystem& fileSystem = fixture.fileSystem;
+			Rotate rotate(fileSystem, clock);
+			for (int i = 0; i < logFiles; i++) {
+				std::wstring log = fixture.log(L"app" + std::to_wstring(i));
+				for (int generation = 0; generation < keepFiles; generation++) {
+					fileSystem.create(log + L"." + std::to_wstring(generation), 100 + generation, clock.now() - generation * 3600, clock.now() - generation * 3600);
+				}
+				fileSystem.write(log, 1000);
+			}
+			clock.set(clock.now() + 3600);
+			int operations = rotate.rotateFile(L"app", section);
+			// One removal, the renames, the copy and the truncation per log file
+			Assert::AreEqual(logFiles * (keepFiles + 2), operations);
+			Assert::AreEqual(size_t(logFiles * (keepFiles + 1)), fileSystem.list((dir / L"logs").wstring()).size());
+			for (int i = 0; i < logFiles; i++) {
+				std::wstring log = fixture.log(L"app" + std::to_wstring(i));
+				Assert::AreEqual(1000ULL, fileSystem.fileSize(log + L".0"));
+				Assert::AreEqual(100ULL + keepFiles - 2, fileSystem.fileSize(log + L"." + std::to_wstring(keepFiles - 1)));
+				Assert::IsFalse(fileSystem.exists(log + L"." + std::to_wstring(keepFiles)));
+			}
+		}
+
+		// Timing of planning and executing 1,000 log files with 100 generations each, only run on demand
+		BEGIN_TEST_METHOD_ATTRIBUTE(Benchmark)
+			TEST_IGNORE()
+		END_TEST_METHOD_ATTRIBUTE()
+		TEST_METHOD(Benchmark)
+		{
+			const int logFiles = 1000;
+			const int keepFiles = 100;
+			Fixture fixture(L"MemoryFileSystemBenchmark");
+			std::filesystem::path& dir = fixture.dir;
+			Config::Section& section = fixture.load(L"[app]\nDirectory = " + (dir / L"logs").wstring() + L"\nFilePattern = ^.*\\.log$\nKeepFiles = "
+				+ std::to_wstring(keepFiles) + L"\nTimer = * * * * *\nMaxTotalSize = 1G\n").getConfigs().at(L"app");
+			VirtualClock& clock = fixture.clock;
+			MemoryFileSystem& fileSystem = fixture.fileSystem;
+			Rotate rotate(fileSystem, clock);
+			for (int i = 0; i < logFiles; i++) {
+				std::wstring log = fixture.log(L"app" + std::to_wstring(i));
+				for (int generation = 0; generation < keepFiles; generation++) {
+					fileSystem.create(log + L"." + std::to_wstring(generation), 1000, clock.now() - generation * 3600, clock.now() - generation * 3600);
+				}
+				fileSystem.write(log, 1000);
+			}
+			clock.set(clock.now() + 3600);
+			auto start = std::chrono::steady_clock::now();
+			int operations = rotate.rotateFile(L"app", section);
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+			Assert::AreEqual(logFiles * (keepFiles + 2), operations);
+			std::wstring message = std::to_wstring(logFiles * (keepFiles + 1)) + L" files, " + std::to_wstring(operations) + L" operations planned and executed in " + std::to_wstring(elapsed.count()) + L" ms\n";
+			Logger::WriteMessage(message.c_str());
+		}
 	};
 
+	TEST_CLASS(GlobTest)
+	{
+	public:
+		TEST_METHOD(Match)
+		{
+			Assert::IsTrue(DirectoryGlob::match(L"*", L"tenant1"));
+			Assert::IsTrue(DirectoryGlob::match(L"tenant?", L"Tenant1"));
+			Assert::IsTrue(DirectoryGlob::match(L"t*n*1", L"tenant1"));
+			Assert::IsTrue(DirectoryGlob::match(L"*1", L"tenant11"));
+			Assert::IsFalse(DirectoryGlob::match(L"tenant?", L"tenant12"));
+			Assert::IsFalse(DirectoryGlob::match(L"*2", L"tenant1"));
+			Assert::IsTrue(DirectoryGlob::isPattern(L"c:\\logs\\*\\app"));
+			Assert::IsFalse(DirectoryGlob::isPattern(L"c:\\logs\\app"));
+		}
+
+		TEST_METHOD(Expand)
+		{
+			Fixture fixture(L"Glob");
+			std::filesystem::path& dir = fixture.dir;
+			MemoryFileSystem& fileSystem = fixture.fileSystem;
+			for (const wchar_t* path : { L"a/app/a.log", L"b/app/b.log", L"b/app/old/b.log", L"c/web/c.log" }) {
+				fileSystem.write((dir / path).wstring(), 10);
+			}
+			std::wstring pattern = (dir / L"*" / L"app").wstring();
+			DirectoryGlob glob(pattern, false, 2);
+			std::vector<std::wstring> directories = glob.expand(fileSystem);
+			Assert::AreEqual(size_t(2), directories.size());
+			Assert::AreEqual((dir / L"a" / L"app").wstring(), directories[0]);
+			Assert::AreEqual((dir / L"b" / L"app").wstring(), directories[1]);
+			Assert::AreEqual(dir.wstring(), glob.getRoot());
+
+			// Recursively the directories below the matches as well
+			DirectoryGlob recursive(pattern, true, 2);
+			directories = recursive.expand(fileSystem);
+			Assert::AreEqual(size_t(3), directories.size());
+			Assert::AreEqual((dir / L"b" / L"app" / L"old").wstring(), directories[2]);
+
+			// A new tenant is found on the next expansion
+			fileSystem.write((dir / L"d" / L"app" / L"d.log").wstring(), 10);
+			Assert::AreEqual(size_t(3), glob.expand(fileSystem).size());
+
+			// A plain directory is not looked at
+			DirectoryGlob plain((dir / L"x").wstring(), false, 2);
+			Assert::AreEqual(size_t(1), plain.expand(fileSystem).size());
+		}
+
+		TEST_METHOD(Links)
+		{
+			Fixture fixture(L"GlobLinks");
+			std::filesystem::path& dir = fixture.dir;
+			std::filesystem::create_directories(dir / L"a" / L"app" / L"old");
+			// Symbolic links need developer mode or administrator rights on Windows
+			std::error_code ec;
+			std::filesystem::create_directory_symlink(dir / L"a", dir / L"a" / L"app" / L"loop", ec);
+			if (ec) {
+				Logger::WriteMessage(L"Symbolic links cannot be created, skipped\n");
+				return;
+			}
+			// A link back up the tree is not followed
+			DirectoryGlob recursive((dir / L"*" / L"app").wstring(), true, 2);
+			std::vector<std::wstring> directories = recursive.expand(FileSystem::disk());
+			Assert::AreEqual(size_t(2), directories.size());
+			Assert::AreEqual((dir / L"a" / L"app").wstring(), directories[0]);
+			Assert::AreEqual((dir / L"a" / L"app" / L"old").wstring(), directories[1]);
+		}
+
+		TEST_METHOD(Tenants)
+		{
+			Fixture fixture(L"GlobRotate");
+			std::filesystem::path& dir = fixture.dir;
+			Config::Section& section = fixture.load(L"DirectoryWalkers = 2\n[app]\nDirectory = " + (dir / L"*" / L"app").wstring()
+				+ L"\nFilePattern = ^app\\.log$\nKeepFiles = 2\nTimer = * * * * *\n").getConfigs().at(L"app");
+			VirtualClock& clock = fixture.clock;
+			MemoryFileSystem& fileSystem = fixture.fileSystem;
+			Rotate rotate(fileSystem, clock);
+			std::vector<std::wstring> logs;
+			for (const wchar_t* tenant : { L"a", L"b", L"c" }) {
+				logs.push_back((dir / tenant / L"app" / L"app.log").wstring());
+				fileSystem.write(logs.back(), 100);
+			}
+			clock.set(clock.now() + 60);
+			rotate.rotateFile(L"app", section);
+			// Every tenant has its own generations
+			for (const auto& log : logs) {
+				Assert::AreEqual(0ULL, fileSystem.fileSize(log));
+				Assert::AreEqual(100ULL, fileSystem.fileSize(log + L".0"));
+			}
+		}
+
+		TEST_METHOD(Settings)
+		{
+			Fixture fixture(L"GlobSettings");
+			const wchar_t* invalid[] = {
+				L"[app]\nDirectory = c:\\logs\nFilePattern = ^app\\.log$\nRecursive = yes\n",
+				L"DirectoryWalkers = 0\n[app]\nDirectory = c:\\logs\nFilePattern = ^app\\.log$\n",
+				L"[app]\nDirectory = c:\\logs\nFilePattern = ^app\\.log$\nDirectoryWalkers = 2\n"
+			};
+			for (const wchar_t* content : invalid) {
+				bool thrown = false;
+				try {
+					fixture.load(content);
+				}
+				catch (const std::runtime_error&) {
+					thrown = true;
+				}
+				Assert::IsTrue(thrown);
+			}
+		}
+	};
+
+	TEST_CLASS(FragmentTest)
+	{
+	public:
+		TEST_METHOD(Include)
+		{
+			Fixture fixture(L"Include");
+			std::filesystem::path& dir = fixture.dir;
+			std::filesystem::create_directories(dir / L"conf.d");
+			std::wofstream root(dir / L"loxrot.conf");
+			root << L"Splay = 5m\nInclude = conf.d\n[main]\nDirectory = c:\\logs\nFilePattern = ^main\\.log$\n";
+			root.close();
+			std::wofstream a(dir / L"conf.d" / L"a.conf");
+			a << L"[a]\r\nDirectory = c:\\logs\\a\r\nFilePattern = ^a\\.log$\r\nKeepFiles = 3\r\n";
+			a.close();
+			std::wofstream b(dir / L"conf.d" / L"b.conf");
+			b << L"MaxConcurrentRotations = 2\n[b]\nDirectory = c:\\logs\\b\nFilePattern = ^b\\.log$\n";
+			b.close();
+			std::wofstream ignored(dir / L"conf.d" / L"notes.txt");
+			ignored << L"[c]\nDirectory = c:\\logs\\c\nFilePattern = ^c\\.log$\n";
+			ignored.close();
+
+			Config config;
+			config.load((dir / L"loxrot.conf").wstring());
+			Assert::AreEqual(size_t(3), config.getConfigs().size());
+			Assert::AreEqual(std::wstring(L"3"), config.getConfigs().at(L"a").entries.at(L"KeepFiles"));
+			Assert::AreEqual(std::wstring(L"300"), config.getConfigs().at(L"b").entries.at(L"Splay"));
+			Assert::AreEqual(std::wstring(L"2"), config.getGlobals().at(L"MaxConcurrentRotations"));
+
+			// The directory on its own has the fragments but not the main file
+			Config fragments;
+			fragments.load((dir / L"conf.d").wstring());
+			Assert::AreEqual(size_t(2), fragments.getConfigs().size());
+			Assert::AreEqual(std::wstring(L"0"), fragments.getConfigs().at(L"a").entries.at(L"Splay"));
+
+			// A section in two files and a missing include are errors
+			const wchar_t* invalid[] = { L"[a]\nDirectory = c:\\logs\nFilePattern = ^x$\n", L"Include = missing.conf\n" };
+			for (const wchar_t* content : invalid) {
+				std::wofstream out(dir / L"conf.d" / L"x.conf");
+				out << content;
+				out.close();
+				bool thrown = false;
+				try {
+					Config other;
+					other.load((dir / L"loxrot.conf").wstring());
+				}
+				catch (const std::runtime_error&) {
+					thrown = true;
+				}
+				Assert::IsTrue(thrown);
+			}
+		}
+
+		TEST_METHOD(Reload)
+		{
+			Fixture fixture(L"Reload");
+			std::filesystem::path& dir = fixture.dir;
+			for (const wchar_t* name : { L"a", L"b" }) {
+				std::wofstream out(dir / (std::wstring(name) + L".conf"));
+				out << L"[" << name << L"]\nDirectory = c:\\logs\nFilePattern = ^" << name << L"\\.log$\n";
+				out.close();
+			}
+			Config config;
+			config.load(dir.wstring());
+			DirectoryGlob* a = config.getConfigs().at(L"a").directories.get();
+			DirectoryGlob* b = config.getConfigs().at(L"b").directories.get();
+			Assert::AreEqual(size_t(0), config.reload());
+
+			// Only the changed file is parsed, the section of the other one is kept as it is
+			std::wofstream changed(dir / L"b.conf");
+			changed << L"[b]\nDirectory = c:\\logs\nFilePattern = ^b\\.log$\nKeepFiles = 7\n";
+			changed.close();
+			Assert::AreEqual(size_t(1), config.reload());
+			Assert::IsTrue(a == config.getConfigs().at(L"a").directories.get());
+			Assert::IsFalse(b == config.getConfigs().at(L"b").directories.get());
+			Assert::AreEqual(std::wstring(L"7"), config.getConfigs().at(L"b").entries.at(L"KeepFiles"));
+
+			// A touched file with the same content is not parsed
+			std::filesystem::last_write_time(dir / L"a.conf", std::filesystem::last_write_time(dir / L"a.conf") + std::chrono::seconds(10));
+			Assert::AreEqual(size_t(0), config.reload());
+			Assert::IsTrue(a == config.getConfigs().at(L"a").directories.get());
+
+			// An invalid file leaves the configuration as it was
+			std::wofstream invalid(dir / L"c.conf");
+			invalid << L"[c]\nDirectory = c:\\logs\nFilePattern = ^c\\.log$\nKeepFiles = many\n";
+			invalid.close();
+			bool thrown = false;
+			try {
+				config.reload();
+			}
+			catch (const std::runtime_error&) {
+				thrown = true;
+			}
+			Assert::IsTrue(thrown);
+			Assert::AreEqual(size_t(2), config.getConfigs().size());
+
+			// Added and removed files change the sections
+			std::filesystem::remove(dir / L"c.conf");
+			std::filesystem::remove(dir / L"b.conf");
+			Assert::AreEqual(size_t(1), config.reload());
+			Assert::AreEqual(size_t(1), config.getConfigs().size());
+			Assert::IsTrue(a == config.getConfigs().at(L"a").directories.get());
+
+			// An emptied or missing directory leaves the configuration as it was
+			std::filesystem::remove(dir / L"a.conf");
+			for (int missing = 0; missing < 2; missing++) {
+				if (missing == 1) {
+					std::filesystem::remove_all(dir);
+				}
+				thrown = false;
+				try {
+					config.reload();
+				}
+				catch (const std::runtime_error&) {
+					thrown = true;
+				}
+				Assert::IsTrue(thrown);
+				Assert::AreEqual(size_t(1), config.getConfigs().size());
+			}
+		}
+	};
+
+	TEST_CLASS(CoordinatorTest)
+	{
+	public:
+		// The instances share nothing but the lease directory, as separate processes would
+		TEST_METHOD(Sharding)
+		{
+			Fixture fixture(L"Sharding");
+			std::filesystem::path& dir = fixture.dir;
+			VirtualClock& clock = fixture.clock;
+			std::vector<std::unique_ptr<Coordinator>> instances;
+			for (const wchar_t* name : { L"node1", L"node2", L"node3" }) {
+				instances.emplace_back(new Coordinator(dir.wstring(), name, 60, clock));
+				instances.back()->heartbeat();
+			}
+			for (auto& instance : instances) {
+				instance->heartbeat();
+				Assert::AreEqual(size_t(3), instance->getMembers().size());
+			}
+			// Every section has one owner all instances agree on
+			std::map<std::wstring, std::wstring> owners;
+			std::map<std::wstring, int> counts;
+			for (int i = 0; i < 300; i++) {
+				std::wstring section = L"service" + std::to_wstring(i);
+				owners[section] = instances[0]->getOwner(section);
+				Assert::AreEqual(owners[section], instances[1]->getOwner(section));
+				Assert::AreEqual(owners[section], instances[2]->getOwner(section));
+				counts[owners[section]]++;
+			}
+			for (const auto& count : counts) {
+				Assert::IsTrue(count.second > 50);
+			}
+
+			// node3 stops, after the lease duration only its sections move
+			for (int i = 0; i < 4; i++) {
+				clock.set(clock.now() + 20);
+				instances[0]->heartbeat();
+				instances[1]->heartbeat();
+			}
+			Assert::AreEqual(size_t(2), instances[0]->getMembers().size());
+			for (const auto& owner : owners) {
+				std::wstring now = instances[0]->getOwner(owner.first);
+				Assert::AreEqual(now, instances[1]->getOwner(owner.first));
+				if (owner.second != L"node3") {
+					Assert::AreEqual(owner.second, now);
+				}
+				else {
+					Assert::IsTrue(now != L"node3");
+				}
+			}
+
+			// node2 leaves on purpose and is gone at once
+			instances[1]->leave();
+			instances[0]->heartbeat();
+			Assert::AreEqual(size_t(1), instances[0]->getMembers().size());
+		}
+
+		TEST_METHOD(Lease)
+		{
+			Fixture fixture(L"Lease");
+			std::filesystem::path& dir = fixture.dir;
+			VirtualClock& clock = fixture.clock;
+			Coordinator a(dir.wstring(), L"a", 60, clock);
+			a.heartbeat();
+			// b is not among the members a knows, so a takes every section for its own
+			Coordinator b(dir.wstring(), L"b", 60, clock);
+			b.heartbeat();
+			std::wstring section;
+			for (int i = 0; section.empty(); i++) {
+				if (b.isOwner(L"app" + std::to_wstring(i))) {
+					section = L"app" + std::to_wstring(i);
+				}
+			}
+			Assert::IsTrue(a.isOwner(section));
+			unsigned long long tokenA = 0, tokenB = 0;
+			Assert::IsTrue(a.acquire(section, tokenA));
+			Assert::AreEqual(1ULL, tokenA);
+			// The lease is renewed in the background while a holds it
+			Assert::AreEqual(tokenA, a.held.at(section));
+			Assert::IsFalse(b.acquire(section, tokenB));
+			Assert::IsTrue(a.check(section, tokenA));
+
+			// a hangs, its lease expires and b takes over with a newer token that fences a out
+			clock.set(clock.now() + 61);
+			Assert::IsTrue(b.acquire(section, tokenB));
+			Assert::AreEqual(2ULL, tokenB);
+			Assert::IsFalse(a.check(section, tokenA));
+			Assert::IsTrue(b.check(section, tokenB));
+			Assert::IsFalse(std::filesystem::exists(dir / (section + L".1.lease")));
+
+			// A released lease can be taken at once, and two instances creating the same token do not both win
+			Assert::IsTrue(a.held.empty());
+			b.release(section, tokenB);
+			Assert::IsTrue(b.held.empty());
+			Assert::IsFalse(b.check(section, tokenB));
+			std::ofstream racer(dir / (section + L".3.lease"));
+			racer.close();
+			Assert::IsFalse(b.acquire(section, tokenB));
+
+			// A lease left empty by a holder that died expires a duration after it was written
+			std::filesystem::last_write_time(dir / (section + L".3.lease"),
+				std::chrono::file_clock::from_sys(std::chrono::system_clock::from_time_t(clock.now() - 61)));
+			Assert::IsTrue(b.acquire(section, tokenB));
+			Assert::AreEqual(4ULL, tokenB);
+		}
+
+		// An emergency pass leaves a section alone while another instance holds its lease
+		TEST_METHOD(Reclaim)
+		{
+			Fixture fixture(L"CoordinatorReclaim");
+			std::filesystem::path& dir = fixture.dir;
+			std::filesystem::create_directories(dir / L"leases");
+			Config& config = fixture.load(fixture.section(L"app", L"KeepFiles = 5\nMinKeepFiles = 0\n"));
+			VirtualClock& clock = fixture.clock;
+			Coordinator coordinator((dir / L"leases").wstring(), L"first", 60, clock);
+			coordinator.heartbeat();
+			Rotate rotate(fixture.fileSystem, clock);
+			rotate.setCoordinator(&coordinator);
+			std::wstring log = fixture.log(L"app");
+			fixture.fileSystem.write(log, 10);
+			fixture.fileSystem.create(log + L".0.gz", 100, clock.now() - 3600, clock.now() - 3600);
+			std::ofstream(dir / L"leases" / L"app.1.lease") << "second\t" << static_cast<long long>(clock.now() + 60) << "\n";
+			std::vector<std::pair<const std::wstring, Config::Section>*> sections = { &*config.getConfigs().find(L"app") };
+			Assert::AreEqual(0ULL, rotate.reclaimSpace(sections, 100));
+			Assert::IsTrue(fixture.fileSystem.exists(log + L".0.gz"));
+
+			// Once the lease has expired the section is reclaimed, and its lease given up again
+			clock.set(clock.now() + 61);
+			coordinator.heartbeat();
+			Assert::AreEqual(100ULL, rotate.reclaimSpace(sections, 100));
+			Assert::IsFalse(fixture.fileSystem.exists(log + L".0.gz"));
+			Assert::IsTrue(coordinator.held.empty());
+			unsigned long long token = 0;
+			Coordinator second((dir / L"leases").wstring(), L"second", 60, clock);
+			Assert::IsTrue(second.acquire(L"app", token));
+		}
+
+		TEST_METHOD(SharedRotation)
+		{
+			Fixture fixture(L"SharedRotation");
+			std::filesystem::path& dir = fixture.dir;
+			std::wstring sections;
+			for (int i = 0; i < 8; i++) {
+				sections += fixture.section(L"app" + std::to_wstring(i));
+			}
+			Config& config = fixture.load(sections);
+			VirtualClock& clock = fixture.clock;
+			MemoryFileSystem& fileSystem = fixture.fileSystem;
+			std::filesystem::create_directories(dir / L"leases");
+			Coordinator first((dir / L"leases").wstring(), L"first", 60, clock);
+			Coordinator second((dir / L"leases").wstring(), L"second", 60, clock);
+			first.heartbeat();
+			second.heartbeat();
+			first.heartbeat();
+			Rotate rotateFirst(fileSystem, clock);
+			Rotate rotateSecond(fileSystem, clock);
+			rotateFirst.setCoordinator(&first);
+			rotateSecond.setCoordinator(&second);
+			for (int i = 0; i < 8; i++) {
+				fileSystem.write(fixture.log(L"app" + std::to_wstring(i)), 100);
+			}
+			// Each instance has its own timers, both find every section due
+			std::map<std::wstring, Config::Section> copy = config.getConfigs();
+			clock.set(clock.now() + 60);
+			rotateFirst.doRotates(config.getConfigs(), 1);
+			rotateSecond.doRotates(copy, 1);
+			// Every file was rotated exactly once, by the instance its section belongs to
+			for (int i = 0; i < 8; i++) {
+				std::wstring log = fixture.log(L"app" + std::to_wstring(i));
+				Assert::AreEqual(100ULL, fileSystem.fileSize(log + L".0"));
+				Assert::IsFalse(fileSystem.exists(log + L".1"));
+			}
+		}
+	};
+
+	TEST_CLASS(ControlTest)
+	{
+	public:
+		// The commands are answered from the published state, the pipe itself is not needed
+		TEST_METHOD(Commands)
+		{
+			Fixture fixture(L"Control");
+			std::filesystem::path& dir = fixture.dir;
+			std::wstring sections;
+			for (int i = 0; i < 8; i++) {
+				sections += fixture.section(L"app" + std::to_wstring(i));
+			}
+			Config& config = fixture.load(sections);
+			Assert::AreEqual(std::wstring(L"true"), config.getGlobals().at(L"Control"));
+			VirtualClock& clock = fixture.clock;
+			MemoryFileSystem& fileSystem = fixture.fileSystem;
+			std::filesystem::create_directories(dir / L"leases");
+			Coordinator first((dir / L"leases").wstring(), L"first", 60, clock);
+			Coordinator second((dir / L"leases").wstring(), L"second", 60, clock);
+			first.heartbeat();
+			second.heartbeat();
+			first.heartbeat();
+			Rotate rotate(fileSystem, clock);
+			rotate.setCoordinator(&first);
+			std::wstring mine, theirs;
+			for (int i = 0; i < 8; i++) {
+				std::wstring name = L"app" + std::to_wstring(i);
+				(rotate.isOwner(name) ? mine : theirs) = name;
+				fileSystem.write(fixture.log(name), 100);
+			}
+			Assert::IsFalse(mine.empty() || theirs.empty());
+
+			Control control(L"\\\\.\\pipe\\loxrot-test");
+			control.publish(config.getConfigs(), rotate, clock.now());
+			std::wstring status = control.handle(L"status");
+			Assert::AreEqual(0, (int)status.find(L"running, 8 sections\n"));
+			Assert::IsTrue(status.find(theirs + L": next ") != std::wstring::npos);
+			Assert::IsTrue(status.find(L"rotated by another instance") != std::wstring::npos);
+			// Without a section only the sections of this instance are listed
+			std::wstring fires = control.handle(L"next-fire");
+			Assert::IsTrue(fires.find(mine + L": ") != std::wstring::npos);
+			Assert::IsTrue(fires.find(theirs + L": ") == std::wstring::npos);
+			Assert::AreEqual(0, (int)control.handle(L"next-fire " + theirs).find(theirs + L": "));
+			Assert::AreEqual(0, (int)control.handle(L"next-fire app9").find(L"error:"));
+
+			// Rotations are queued once each and only for sections of this instance
+			Assert::AreEqual(0, (int)control.handle(L"rotate app9").find(L"error:"));
+			Assert::AreEqual(0, (int)control.handle(L"rotate " + theirs).find(L"error:"));
+			Assert::AreEqual(0, (int)control.handle(L"rotate").find(L"error:"));
+			Assert::AreEqual(std::wstring(L"rotation of " + mine + L" queued\n"), control.handle(L"rotate " + mine));
+			control.handle(L"rotate " + mine);
+			std::vector<std::wstring> requests = control.takeRequests();
+			Assert::AreEqual(size_t(1), requests.size());
+			Assert::AreEqual(mine, requests[0]);
+			Assert::IsTrue(control.takeRequests().empty());
+
+			Assert::IsFalse(control.isPaused());
+			control.handle(L"pause");
+			Assert::IsTrue(control.isPaused());
+			Assert::AreEqual(0, (int)control.handle(L"status").find(L"paused, 8 sections\n"));
+			control.handle(L"resume");
+			Assert::IsFalse(control.isPaused());
+			Assert::AreEqual(0, (int)control.handle(L"restart").find(L"error:"));
+			Assert::AreEqual(0, (int)control.handle(L"pause now").find(L"error:"));
+
+			// The sections rotated by this instance are reported and counted
+			std::vector<std::wstring> rotated;
+			clock.set(clock.now() + 60);
+			rotate.doRotates(config.getConfigs(), 2, &rotated);
+			Assert::IsFalse(rotated.empty());
+			Assert::IsTrue(std::find(rotated.begin(), rotated.end(), mine) != rotated.end());
+			Assert::IsTrue(std::find(rotated.begin(), rotated.end(), theirs) == rotated.end());
+			// The Rotate of the second thread is kept for the next pass
+			Assert::AreEqual(size_t(1), rotate.workers.size());
+			Rotate* worker = rotate.workers[0].get();
+			clock.set(clock.now() + 60);
+			rotated.clear();
+			rotate.doRotates(config.getConfigs(), 2, &rotated);
+			Assert::IsTrue(worker == rotate.workers[0].get());
+			control.rotated(rotated, clock.now());
+			control.publish(config.getConfigs(), rotate, clock.now());
+			status = control.handle(L"status");
+			Assert::IsTrue(status.find(mine + L": next " + Control::formatTime(config.getConfigs()[mine].crontab.nextRotation(clock.now())) + L", last "
+				+ Control::formatTime(clock.now()) + L", 1 rotations\n") != std::wstring::npos);
+			Assert::IsTrue(status.find(theirs + L": next " + Control::formatTime(config.getConfigs()[theirs].crontab.nextRotation(clock.now())) + L", last never, 0 rotations, rotated by another instance\n") != std::wstring::npos);
+		}
+
+		TEST_METHOD(Pipe)
+		{
+			std::wstring pipe = L"\\\\.\\pipe\\loxrot-unittest";
+			std::wstring answer;
+			Assert::IsFalse(Control::send(pipe, L"status", answer));
+			Control control(pipe);
+			Assert::IsTrue(control.start());
+			// Only one program serves a pipe
+			Control other(pipe);
+			Assert::IsFalse(other.start());
+			Assert::IsTrue(Control::send(pipe, L"pause", answer));
+			Assert::AreEqual(std::wstring(L"scheduled rotations paused\n"), answer);
+			Assert::IsTrue(control.isPaused());
+			Assert::IsTrue(Control::send(pipe, L"status", answer));
+			Assert::AreEqual(std::wstring(L"paused, 0 sections\n"), answer);
+			Assert::IsFalse(Control::send(pipe, L"rotate app", answer));
+			Assert::AreEqual(std::wstring(L"error: unknown section app"), answer);
+			// A client that connects and sends nothing keeps neither the others out nor the pipe from stopping
+			HANDLE silent = CreateFileW(pipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+			Assert::IsTrue(silent != INVALID_HANDLE_VALUE);
+			Assert::IsTrue(Control::send(pipe, L"status", answer));
+			CloseHandle(silent);
+			silent = CreateFileW(pipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+			Assert::IsTrue(silent != INVALID_HANDLE_VALUE);
+			control.stop();
+			CloseHandle(silent);
+			Assert::IsFalse(Control::send(pipe, L"status", answer));
+		}
+	};
+
+	TEST_CLASS(SimulatorTest)
+	{
+	public:
+		TEST_METHOD(Retention)
+		{
+			Fixture fixture(L"Simulator");
+			std::filesystem::path& dir = fixture.dir;
+			std::filesystem::create_directories(dir / L"logs");
+			Config& config = fixture.load(L"[hourly]\n"
+				L"Directory = " + (dir / L"logs").wstring() + L"\n"
+				L"FilePattern = ^.*\\.log$\n"
+				L"KeepFiles = 4\n"
+				L"Timer = 0 * * * *\n"
+				L"TimeZone = UTC\n"
+				L"SimulatedFiles = app.log, web.log\n"
+				L"SimulatedGrowth = 24M\n");
+
+			tm midnight = {};
+			midnight.tm_year = 126;
+			midnight.tm_mon = 9;
+			midnight.tm_mday = 18;
+			Simulator simulator(config.getConfigs(), _mkgmtime(&midnight), 0.1, 1e-8);
+			simulator.run(2 * 24 * 60 * 60);
+			const Simulator::Result& result = simulator.getResults().at(L"hourly");
+			Assert::AreEqual(2ULL, result.files);
+			// Midnight itself and every hour after it
+			Assert::AreEqual(49ULL, result.rotations);
+			// Two files of a MiB an hour, each with the live file and four generations at most
+			Assert::IsTrue(result.peakBytes > 9ULL * 1024 * 1024 && result.peakBytes <= 10ULL * 1024 * 1024);
+			Assert::AreEqual(result.peakBytes, simulator.getPeakBytes());
+			Assert::AreEqual(0ULL, result.compressedBytes);
+			// Nothing on the disk changed
+			Assert::IsTrue(std::filesystem::is_empty(dir / L"logs"));
+		}
+	};
+
+#ifdef WITH_ZLIB
+	TEST_CLASS(SeekableTest)
+	{
+	public:
+		TEST_METHOD(Ranges)
+		{
+			std::filesystem::path path = std::filesystem::temp_directory_path() / L"loxrotSeekableTest.log";
+			std::filesystem::remove(path.wstring() + L".gz");
+			std::ostringstream data;
+			for (int i = 1; i <= 100000; i++) {
+				data << "line " << i << "\n";
+			}
+			std::ofstream(path, std::ios::binary) << data.str();
+			Assert::IsTrue(FileIO::compressFile(path.wstring(), 4096));
+			std::vector<Seekable::Block> blocks;
+			Assert::IsTrue(Seekable::readIndex(path.wstring() + L".gz", blocks));
+			Assert::AreEqual(static_cast<unsigned long long>(data.str().size()), blocks.back().uncompressed);
+			Assert::AreEqual(100000ULL, blocks.back().lines);
+			std::ostringstream bytes;
+			Assert::IsTrue(Seekable::extract(path.wstring() + L".gz", false, 10000, 20000, bytes));
+			Assert::AreEqual(data.str().substr(10000, 10001), bytes.str());
+			std::ostringstream lines;
+			Assert::IsTrue(Seekable::extract(path.wstring() + L".gz", true, 50000, 50001, lines));
+			Assert::AreEqual(std::string("line 50000\nline 50001\n"), lines.str());
+			std::filesystem::remove(path);
+			std::filesystem::remove(path.wstring() + L".gz");
+		}
+	};
+#endif
+
 	TEST_CLASS(MinAgeTest)
 	{
 	public:
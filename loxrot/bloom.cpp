@@ -0,0 +1,280 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+#include "bloom.h"
+#include "fileio.h"
+#include "logging.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <windows.h>
+
+// Spread the bits of a hash, the finalizer of SplitMix64
+static unsigned long long mix(unsigned long long x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Constructor for an empty filter
+Bloom::Bloom(const std::string& tokenChars) : tokenChars(tokenChars) {
+    setTokenChars();
+}
+
+// Constructor for a filter of a file
+Bloom::Bloom(unsigned long long bytes, double rate, const std::string& tokenChars) : tokenChars(tokenChars) {
+    setTokenChars();
+    hashes = std::max(1u, static_cast<unsigned int>(std::lround(-std::log2(rate))));
+    // Start large enough for every token to be distinct, finish folds it down to what the distinct tokens need
+    double bitsPerToken = hashes / std::log(2.0);
+    unsigned long long wanted = static_cast<unsigned long long>(std::max<unsigned long long>(1, bytes / bytesPerToken) * bitsPerToken);
+    unsigned long long bits = std::clamp<unsigned long long>(std::bit_ceil(wanted), 512, maxBits);
+    words.assign(bits / 64, 0);
+}
+
+// Destructor
+Bloom::~Bloom() {
+}
+
+// Set up the table of token characters
+void Bloom::setTokenChars() {
+    for (int c = 0; c < 256; c++) {
+        table[c] = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c >= 0x80;
+    }
+    for (char c : tokenChars) {
+        table[static_cast<unsigned char>(c)] = true;
+    }
+}
+
+// Add the tokens of the next piece of data
+void Bloom::add(const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (table[c]) {
+            hash = (hash ^ c) * prime;
+            inToken = true;
+        }
+        else if (inToken) {
+            insert(hash);
+            hash = offsetBasis;
+            inToken = false;
+        }
+    }
+}
+
+// Set the bits of a token
+void Bloom::insert(unsigned long long value) {
+    unsigned long long mask = words.size() * 64 - 1;
+    unsigned long long first = mix(value);
+    unsigned long long step = mix(value ^ 0x9e3779b97f4a7c15ULL) | 1;
+    for (unsigned int i = 0; i < hashes; i++) {
+        unsigned long long bit = (first + i * step) & mask;
+        words[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+// Add the last token and fold the filter down to the size its false positive rate needs
+void Bloom::finish() {
+    if (inToken) {
+        insert(hash);
+        hash = offsetBasis;
+        inToken = false;
+    }
+    unsigned long long set = 0;
+    for (unsigned long long word : words) {
+        set += std::popcount(word);
+    }
+    double bits = static_cast<double>(words.size() * 64);
+    if (set >= words.size() * 64) {
+        return;
+    }
+    // Estimate the number of distinct tokens from the share of bits set
+    double tokens = -(bits / hashes) * std::log(1.0 - set / bits);
+    double needed = std::max(512.0, tokens * hashes / std::log(2.0));
+    while (words.size() * 32 >= needed) {
+        fold();
+    }
+}
+
+// Fold the filter in half
+void Bloom::fold() {
+    size_t half = words.size() / 2;
+    for (size_t i = 0; i < half; i++) {
+        words[i] |= words[i + half];
+    }
+    words.resize(half);
+}
+
+// Check whether a token may be in the filter
+bool Bloom::mayContain(const std::string& token) const {
+    if (words.empty()) {
+        return true;
+    }
+    unsigned long long value = offsetBasis;
+    for (char c : token) {
+        value = (value ^ static_cast<unsigned char>(c)) * prime;
+    }
+    unsigned long long mask = words.size() * 64 - 1;
+    unsigned long long first = mix(value);
+    unsigned long long step = mix(value ^ 0x9e3779b97f4a7c15ULL) | 1;
+    for (unsigned int i = 0; i < hashes; i++) {
+        unsigned long long bit = (first + i * step) & mask;
+        if ((words[bit / 64] & (1ULL << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Check whether a string is exactly one token
+bool Bloom::isToken(const std::string& text) const {
+    return !text.empty() && std::all_of(text.begin(), text.end(), [this](char c) { return table[static_cast<unsigned char>(c)]; });
+}
+
+// Check whether a line contains a token as a whole token
+bool Bloom::lineContains(const char* line, size_t length, const std::string& token) const {
+    std::string_view view(line, length);
+    for (size_t position = view.find(token); position != std::string_view::npos; position = view.find(token, position + 1)) {
+        size_t end = position + token.size();
+        if ((position == 0 || !table[static_cast<unsigned char>(line[position - 1])]) && (end == length || !table[static_cast<unsigned char>(line[end])])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Get the characters that belong to a token
+const std::string& Bloom::getTokenChars() const {
+    return tokenChars;
+}
+
+// Read a filter from a stream
+bool Bloom::read(std::istream& in) {
+    char magic[4] = {};
+    unsigned int version = 0;
+    unsigned int length = 0;
+    unsigned long long count = 0;
+    if (!in.read(magic, 4) || memcmp(magic, "LXBF", 4) != 0 || !in.read(reinterpret_cast<char*>(&version), 4) || version != 1
+        || !in.read(reinterpret_cast<char*>(&hashes), 4) || !in.read(reinterpret_cast<char*>(&length), 4) || length > 256) {
+        return false;
+    }
+    tokenChars.resize(length);
+    if (!in.read(&tokenChars[0], length) || !in.read(reinterpret_cast<char*>(&count), 8) || count == 0 || count > maxBits / 64 || !std::has_single_bit(count)) {
+        return false;
+    }
+    words.resize(static_cast<size_t>(count));
+    if (!in.read(reinterpret_cast<char*>(words.data()), count * 8)) {
+        words.clear();
+        return false;
+    }
+    setTokenChars();
+    return true;
+}
+
+// Check whether a token may be in the generation or container a filter file belongs to
+bool Bloom::fileMayContain(const std::wstring& filename, const std::string& tokenChars, const std::string& token) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        return true;
+    }
+    bool any = false;
+    while (file.peek() != std::char_traits<char>::eof()) {
+        // A filter cut off by an interrupted merge or built with other token characters cannot rule anything out
+        Bloom bloom;
+        if (!bloom.read(file) || bloom.getTokenChars() != tokenChars || bloom.mayContain(token)) {
+            return true;
+        }
+        any = true;
+    }
+    return !any;
+}
+
+// Save the filter to a file
+bool Bloom::save(const std::wstring& filename, bool durable) const {
+    std::wstring temporary = filename + L".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        unsigned int version = 1;
+        unsigned int length = static_cast<unsigned int>(tokenChars.size());
+        unsigned long long count = words.size();
+        file.write("LXBF", 4);
+        file.write(reinterpret_cast<const char*>(&version), 4);
+        file.write(reinterpret_cast<const char*>(&hashes), 4);
+        file.write(reinterpret_cast<const char*>(&length), 4);
+        file.write(tokenChars.data(), length);
+        file.write(reinterpret_cast<const char*>(&count), 8);
+        file.write(reinterpret_cast<const char*>(words.data()), count * 8);
+        if (!file) {
+            Logging::error(L"Could not write " + temporary);
+            return false;
+        }
+    }
+    if ((durable && !FileIO::flush(temporary)) || !MoveFileExW(temporary.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        Logging::error(L"Could not replace " + filename);
+        return false;
+    }
+    return true;
+}
+
+// Carry the filter of a generation over to the container it was merged into
+void Bloom::mergeFile(const std::wstring& member, const std::wstring& container, bool first, bool durable) {
+    std::wstring memberFile = fileName(member);
+    std::wstring containerFile = fileName(container);
+    std::error_code ec;
+    if (!std::filesystem::exists(memberFile, ec)) {
+        // The container now holds tokens its filter does not know
+        std::filesystem::remove(containerFile, ec);
+        return;
+    }
+    if (first) {
+        std::filesystem::rename(memberFile, containerFile, ec);
+        return;
+    }
+    if (std::filesystem::exists(containerFile, ec)) {
+        std::ifstream in(memberFile, std::ios::binary);
+        {
+            std::ofstream out(containerFile, std::ios::binary | std::ios::app);
+            out << in.rdbuf();
+            if (!out) {
+                Logging::error(L"Could not append " + memberFile + L" to " + containerFile);
+            }
+        }
+        if (durable) {
+            FileIO::flush(containerFile);
+        }
+    }
+    std::filesystem::remove(memberFile, ec);
+}
+
+// Get the name of the filter of a generation
+std::wstring Bloom::fileName(const std::wstring& generation) {
+    return generation + L".bloom";
+}
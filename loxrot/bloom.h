@@ -0,0 +1,175 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <istream>
+#include <string>
+#include <vector>
+
+/**
+ * \class Bloom
+ * \brief A Bloom filter of the tokens of a compressed generation, stored next to it. Tokens are maximal runs of
+ *        letters, digits, bytes of UTF-8 sequences and the configured token characters. The filter is filled while
+ *        the generation is compressed and is sized from the file size, then folded down to the size the number of
+ *        distinct tokens actually needs. A search only inflates the generations whose filter may contain the token.
+ */
+class Bloom
+{
+public:
+    /**
+     * \brief Create an empty filter to be loaded from a file or only to find tokens.
+     * \param tokenChars The characters that belong to a token besides letters, digits and UTF-8 sequences.
+     */
+    explicit Bloom(const std::string& tokenChars = "");
+
+    /**
+     * \brief Create a filter for a file.
+     * \param bytes The size of the file, it decides the size the filter starts with.
+     * \param rate The false positive rate the filter is folded down to, between 0 and 1.
+     * \param tokenChars The characters that belong to a token besides letters, digits and UTF-8 sequences.
+     */
+    Bloom(unsigned long long bytes, double rate, const std::string& tokenChars);
+
+    /**
+     * \brief Destructor for Bloom.
+     */
+    ~Bloom();
+
+    /**
+     * \brief Add the tokens of the next piece of data. A token may continue in the next piece.
+     * \param data The data.
+     * \param length The length of the data.
+     */
+    void add(const char* data, size_t length);
+
+    /**
+     * \brief Add the token the data ended with and fold the filter down to the size its false positive rate needs.
+     */
+    void finish();
+
+    /**
+     * \brief Check whether a token may be in the filter.
+     * \param token The token.
+     * \return False if the token is definitely not in the filter.
+     */
+    bool mayContain(const std::string& token) const;
+
+    /**
+     * \brief Check whether a string is exactly one token.
+     * \param text The string.
+     * \return true or false
+     */
+    bool isToken(const std::string& text) const;
+
+    /**
+     * \brief Check whether a line contains a token as a whole token.
+     * \param line The line.
+     * \param length The length of the line.
+     * \param token The token.
+     * \return true or false
+     */
+    bool lineContains(const char* line, size_t length, const std::string& token) const;
+
+    /**
+     * \brief Get the characters that belong to a token besides letters, digits and UTF-8 sequences.
+     * \return The characters.
+     */
+    const std::string& getTokenChars() const;
+
+    /**
+     * \brief Read a filter from a stream.
+     * \param in The stream.
+     * \return False if the stream holds no valid filter.
+     */
+    bool read(std::istream& in);
+
+    /**
+     * \brief Check whether a token may be in the generation or container a filter file belongs to. The file of a
+     *        container holds the filters of all its members one after the other.
+     * \param filename The filter file.
+     * \param tokenChars The token characters the search uses, filters built with others cannot rule anything out.
+     * \param token The token.
+     * \return False only if every filter in the file rules the token out.
+     */
+    static bool fileMayContain(const std::wstring& filename, const std::string& tokenChars, const std::string& token);
+
+    /**
+     * \brief Save the filter to a file through a temporary file that is renamed over it.
+     * \param filename The file.
+     * \param durable If true, the temporary file is flushed to disk before the rename.
+     * \return true or false
+     */
+    bool save(const std::wstring& filename, bool durable) const;
+
+    /**
+     * \brief Carry the filter of a generation over to the container it was merged into by appending it to the filter
+     *        file of the container. Folding the filters into one would saturate it. A container only has a filter file
+     *        as long as all its members had one.
+     * \param member The merged generation.
+     * \param container The container.
+     * \param first True if the generation is the first member of the container.
+     * \param durable If true, a changed filter is flushed to disk.
+     */
+    static void mergeFile(const std::wstring& member, const std::wstring& container, bool first, bool durable);
+
+    /**
+     * \brief Get the name of the filter of a generation.
+     * \param generation The generation.
+     * \return The name of the filter.
+     */
+    static std::wstring fileName(const std::wstring& generation);
+
+    static const unsigned long long maxBits = 1ULL << 28; ///< The largest filter, 32 MiB, for files with very many tokens.
+    static const unsigned long long bytesPerToken = 8; ///< Assumed bytes per token when the filter is sized from the file size.
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \brief Set the bits of a token.
+     * \param value The FNV-1a hash of the token.
+     */
+    void insert(unsigned long long value);
+
+    /**
+     * \brief Fold the filter in half by combining both halves, the bit positions are taken modulo the size.
+     */
+    void fold();
+
+    /**
+     * \brief Set up the table of token characters.
+     */
+    void setTokenChars();
+
+    std::vector<unsigned long long> words; ///< The bits of the filter, the number of bits is a power of two.
+    unsigned int hashes = 1; ///< The number of bits set per token.
+    std::string tokenChars; ///< The characters that belong to a token besides letters, digits and UTF-8 sequences.
+    bool table[256] = {}; ///< Whether a byte belongs to a token.
+    unsigned long long hash = offsetBasis; ///< The hash of the token being read.
+    bool inToken = false; ///< Whether the last byte added belongs to a token.
+
+    static const unsigned long long offsetBasis = 14695981039346656037ULL; ///< FNV-1a offset basis.
+    static const unsigned long long prime = 1099511628211ULL; ///< FNV-1a prime.
+};
@@ -0,0 +1,227 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+#include "catalog.h"
+#include "fileio.h"
+#include "logging.h"
+#include "seekable.h"
+#include "tools.h"
+#include <algorithm>
+#include <climits>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <windows.h>
+
+// Constructor
+Catalog::Catalog() {
+}
+
+// Destructor
+Catalog::~Catalog() {
+}
+
+// Set how timestamps are found in a line
+void Catalog::setFormat(const std::wstring& regex, const std::wstring& format) {
+    enabled = !regex.empty();
+    if (enabled) {
+        pattern = std::regex(Tools::wstringToString(regex), std::regex::optimize);
+    }
+    this->format = Tools::wstringToString(format);
+    time_t now = time(nullptr);
+    std::tm ltm;
+    localtime_s(&ltm, &now);
+    year = ltm.tm_year;
+}
+
+// Parse the timestamp of a line
+time_t Catalog::parse(const char* line, size_t length) const {
+    std::cmatch match;
+    if (!enabled || !std::regex_search(line, line + std::min(length, maxPrefix), match, pattern)) {
+        return -1;
+    }
+    std::istringstream text(match.size() > 1 && match[1].matched ? match[1].str() : match[0].str());
+    std::tm tm = {};
+    tm.tm_year = INT_MIN;
+    text >> std::get_time(&tm, format.c_str());
+    if (text.fail()) {
+        return -1;
+    }
+    if (tm.tm_year == INT_MIN) {
+        tm.tm_year = year;
+    }
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+// Find the first and last timestamp of a file
+bool Catalog::scanFile(const std::wstring& filename, Entry& entry) const {
+    entry = Entry();
+    auto first = [&](const char* line, size_t length) {
+        entry.first = parse(line, length);
+        return entry.first == -1;
+    };
+    auto last = [&](const char* line, size_t length) {
+        entry.last = std::max(entry.last, parse(line, length));
+        return true;
+    };
+    std::vector<Seekable::Block> blocks;
+    bool compressed = filename.size() > 3 && filename.compare(filename.size() - 3, 3, L".gz") == 0;
+    if (compressed && Seekable::readIndex(filename, blocks) && blocks.size() > 1) {
+        // Only the first block and the last block with a timestamp are inflated
+        Seekable::readLines(filename, blocks.front().compressed, false, first);
+        for (size_t i = blocks.size() - 1; i-- > 0 && entry.last == -1;) {
+            Seekable::readLines(filename, blocks[i].compressed, i > 0, last);
+        }
+    }
+    else if (compressed) {
+        Seekable::readLines(filename, 0, false, [&](const char* line, size_t length) {
+            time_t timestamp = parse(line, length);
+            entry.first = entry.first == -1 ? timestamp : entry.first;
+            entry.last = std::max(entry.last, timestamp);
+            return true;
+        });
+    }
+    else {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(filename, ec);
+        if (ec) {
+            return false;
+        }
+        Seekable::readLines(filename, 0, false, first);
+        unsigned long long offset = size > tailSize ? size - tailSize : 0;
+        Seekable::readLines(filename, offset, offset > 0, last);
+        if (entry.last == -1 && offset > 0) {
+            Seekable::readLines(filename, 0, false, last);
+        }
+    }
+    return entry.first != -1;
+}
+
+// Load the catalog from its file
+void Catalog::load(const std::wstring& filename) {
+    entries.clear();
+    std::ifstream file(filename, std::ios::binary);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        long long first = 0;
+        long long last = 0;
+        std::string name;
+        if (fields >> first >> last && fields.get() == '\t' && std::getline(fields, name) && !name.empty()) {
+            Entry& entry = entries[Tools::stringToWstring(name)];
+            entry.first = static_cast<time_t>(first);
+            entry.last = static_cast<time_t>(last);
+        }
+    }
+}
+
+// Save the catalog to its file
+bool Catalog::save(const std::wstring& filename, bool durable) const {
+    std::wstring temporary = filename + L".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        for (const auto& entry : entries) {
+            file << static_cast<long long>(entry.second.first) << ' ' << static_cast<long long>(entry.second.last) << '\t' << Tools::wstringToString(entry.first) << '\n';
+        }
+        if (!file) {
+            Logging::error(L"Could not write " + temporary);
+            return false;
+        }
+    }
+    if ((durable && !FileIO::flush(temporary)) || !MoveFileExW(temporary.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        Logging::error(L"Could not replace " + filename);
+        return false;
+    }
+    return true;
+}
+
+// Follow the generations through the operations of a plan
+void Catalog::apply(const Plan& plan) {
+    for (const auto& operation : plan.getOperations()) {
+        std::wstring source = std::filesystem::path(operation.source).filename().wstring();
+        std::wstring target = std::filesystem::path(operation.target).filename().wstring();
+        std::map<std::wstring, Entry>::iterator it = entries.find(source);
+        switch (operation.type) {
+        case Plan::rename:
+        case Plan::compress:
+            if (it != entries.end()) {
+                Entry entry = it->second;
+                entries.erase(it);
+                entries[target] = entry;
+            }
+            break;
+        case Plan::remove:
+            if (it != entries.end()) {
+                entries.erase(it);
+            }
+            break;
+        case Plan::copy:
+            entries[target] = Entry();
+            break;
+        case Plan::merge: {
+            Entry entry = it != entries.end() ? it->second : Entry();
+            if (it != entries.end()) {
+                entries.erase(it);
+            }
+            std::map<std::wstring, Entry>::iterator container = entries.find(target);
+            if (container == entries.end()) {
+                entries[target] = entry;
+            }
+            else if (container->second.first == -1 || entry.first == -1) {
+                // A member of unknown range makes the whole container unknown
+                container->second = Entry();
+            }
+            else {
+                container->second.first = std::min(container->second.first, entry.first);
+                container->second.last = std::max(container->second.last, entry.last);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+// Set the range of a generation
+void Catalog::set(const std::wstring& name, const Entry& entry) {
+    entries[name] = entry;
+}
+
+// Remove a generation
+void Catalog::erase(const std::wstring& name) {
+    entries.erase(name);
+}
+
+// Get the ranges of all generations
+const std::map<std::wstring, Catalog::Entry>& Catalog::getEntries() const {
+    return entries;
+}
+
+// Get the name of the catalog file of a section
+std::wstring Catalog::fileName(const std::wstring& directory, const std::wstring& section) {
+    return (std::filesystem::path(directory) / (L"loxrot-" + section + L".catalog")).wstring();
+}
@@ -0,0 +1,144 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <ctime>
+#include <map>
+#include <regex>
+#include <string>
+#include "plan.h"
+
+/**
+ * \class Catalog
+ * \brief The first and last log timestamp of each generation of a section, kept in a small sidecar file next to the
+ *        generations. A query for a time window only has to open the generations whose range overlaps it.
+ */
+class Catalog
+{
+public:
+    /**
+     * \struct Entry
+     * \brief The time range of a generation.
+     */
+    struct Entry {
+        time_t first = -1; ///< The first timestamp found in the generation, -1 if unknown.
+        time_t last = -1; ///< The last timestamp found in the generation, -1 if unknown.
+    };
+
+    /**
+     * \brief Default constructor for Catalog.
+     */
+    Catalog();
+
+    /**
+     * \brief Destructor for Catalog.
+     */
+    ~Catalog();
+
+    /**
+     * \brief Set how timestamps are found in a line.
+     * \param regex The regular expression that finds the timestamp, the first capture group if there is one.
+     * \param format The std::get_time format of the timestamp. If it has no year, the current year is assumed.
+     */
+    void setFormat(const std::wstring& regex, const std::wstring& format);
+
+    /**
+     * \brief Parse the timestamp of a line. Only the first maxPrefix bytes of the line are searched.
+     * \param line The line.
+     * \param length The length of the line.
+     * \return The timestamp (local time) or -1 if the line has none.
+     */
+    time_t parse(const char* line, size_t length) const;
+
+    /**
+     * \brief Find the first and last timestamp of a file. Plain files are read at the head and the tail, seekable files
+     *        in their first and last block, other compressed files completely.
+     * \param filename The file.
+     * \param entry Receives the range.
+     * \return True if a timestamp was found.
+     */
+    bool scanFile(const std::wstring& filename, Entry& entry) const;
+
+    /**
+     * \brief Load the catalog from its file. A missing file leaves the catalog empty.
+     * \param filename The file.
+     */
+    void load(const std::wstring& filename);
+
+    /**
+     * \brief Save the catalog to its file through a temporary file that is renamed over it.
+     * \param filename The file.
+     * \param durable If true, the temporary file is flushed to disk before the rename.
+     * \return true or false
+     */
+    bool save(const std::wstring& filename, bool durable) const;
+
+    /**
+     * \brief Follow the generations through the operations of an executed plan. Renamed and compressed generations
+     *        keep their range, removed ones are dropped, merged ones widen the range of their container and the
+     *        target of a copy is a new generation of unknown range.
+     * \param plan The plan.
+     */
+    void apply(const Plan& plan);
+
+    /**
+     * \brief Set the range of a generation.
+     * \param name The file name of the generation.
+     * \param entry The range.
+     */
+    void set(const std::wstring& name, const Entry& entry);
+
+    /**
+     * \brief Remove a generation.
+     * \param name The file name of the generation.
+     */
+    void erase(const std::wstring& name);
+
+    /**
+     * \brief Get the ranges of all generations.
+     * \return The ranges by file name.
+     */
+    const std::map<std::wstring, Entry>& getEntries() const;
+
+    /**
+     * \brief Get the name of the catalog file of a section.
+     * \param directory The directory of the section.
+     * \param section The name of the section.
+     * \return The full path of the catalog file.
+     */
+    static std::wstring fileName(const std::wstring& directory, const std::wstring& section);
+
+    static const size_t maxPrefix = 256; ///< Number of bytes at the start of a line that are searched for a timestamp.
+    static const unsigned long long tailSize = 64 * 1024; ///< Number of bytes at the end of a plain file searched for the last timestamp.
+
+#ifndef UNITTEST
+private:
+#endif
+    std::map<std::wstring, Entry> entries; ///< The ranges by file name.
+    std::regex pattern; ///< Finds the timestamp in a line.
+    std::string format; ///< The std::get_time format of the timestamp.
+    bool enabled = false; ///< Whether a timestamp regex was set.
+    int year = 0; ///< The year assumed for timestamps without one, years since 1900.
+};
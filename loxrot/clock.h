@@ -0,0 +1,90 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <atomic>
+#include <ctime>
+
+/**
+ * \class Clock
+ * \brief The source of the current time of the rotations. The default reads the system time, a VirtualClock is set
+ *        by hand, so a simulation can run days of rotations in seconds.
+ */
+class Clock
+{
+public:
+    /**
+     * \brief Default constructor for Clock.
+     */
+    Clock();
+
+    /**
+     * \brief Destructor for Clock.
+     */
+    virtual ~Clock();
+
+    /**
+     * \brief Get the current time.
+     * \return The current time.
+     */
+    virtual time_t now() const;
+
+    /**
+     * \brief Get the clock of the system time shared by everything that is not simulated.
+     * \return The clock.
+     */
+    static Clock& system();
+};
+
+/**
+ * \class VirtualClock
+ * \brief A clock that only moves when it is set.
+ */
+class VirtualClock : public Clock
+{
+public:
+    /**
+     * \brief Constructor for VirtualClock.
+     * \param start The time the clock starts at.
+     */
+    explicit VirtualClock(time_t start);
+
+    /**
+     * \brief Get the time the clock was set to.
+     * \return The time.
+     */
+    time_t now() const override;
+
+    /**
+     * \brief Set the clock.
+     * \param t The new time.
+     */
+    void set(time_t t);
+
+#ifndef UNITTEST
+private:
+#endif
+    std::atomic<time_t> current; ///< The time the clock was set to, read by the threads of the executor.
+};
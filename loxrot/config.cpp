@@ -24,10 +24,19 @@
 */
 
 #include "config.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <exception>
+#include <fstream>
+#include <functional>
 #include <regex>
+#include <set>
+#include <sstream>
+#include <thread>
 #include "logging.h"
 #include "crontab.h"
+#include "tools.h"
 #include <map>
 
 // Default constructor for Config
@@ -46,6 +55,12 @@ const std::map<std::wstring, std::wstring>& Config::getSection(const std::wstrin
     return configs[section].entries;
 }
 
+// Get the settings that apply to all sections
+const std::map<std::wstring, std::wstring>& Config::getGlobals()
+{
+    return globals;
+}
+
 // Get all the configurations
 std::map<std::wstring, Config::Section>& Config::getConfigs()
 {
@@ -83,19 +98,297 @@ int Config::convertToSeconds(const std::wstring& duration) {
     }
 }
 
-// Load the configuration from a file
+// Converts a size string to bytes
+long long Config::convertToBytes(const std::wstring& size) {
+    std::wregex re(L"(\\d+)([kMGT]?)");
+    std::wsmatch match;
+
+    if (std::regex_match(size, match, re)) {
+        long long value = std::stoll(match[1].str());
+        std::wstring unit = match[2].str();
+
+        if (unit == L"") { // Bytes
+            return value;
+        }
+        switch (unit[0]) {
+        case L'k': // Kilobytes
+            return value * 1024;
+        case L'M': // Megabytes
+            return value * 1024 * 1024;
+        case L'G': // Gigabytes
+            return value * 1024 * 1024 * 1024;
+        case L'T': // Terabytes
+            return value * 1024 * 1024 * 1024 * 1024;
+        default:
+            throw std::invalid_argument("Invalid unit in the size string in the config. Only 'k', 'M', 'G' or 'T' allowed.");
+        }
+    }
+    else {
+        throw std::invalid_argument("Invalid unit in the size string in the config. Only 'k', 'M', 'G' or 'T' allowed.");
+    }
+}
+
+// Load the configuration from a file or a directory of fragments
 void Config::load(const std::wstring& configfile)
 {
     // Log that the configuration parsing has started
     Logging::debug(L"Entered parseConfig");
+    this->configfile = configfile;
+    fragments.clear();
+    configs.clear();
+    globals.clear();
+    reload();
+    // Log that the configuration parsing has finished
+    Logging::debug(L"Leaving parseConfig");
+}
+
+// Load the configuration again, parsing only the fragments that changed
+size_t Config::reload()
+{
+    // The fragments are found level by level, the fragments of a level are parsed in parallel
+    std::map<std::wstring, Fragment> loaded;
+    std::map<std::wstring, std::vector<std::wstring>> included;
+    // A configuration that went missing since the last load is not taken as one without sections
+    std::error_code ec;
+    if (!fragments.empty() && !std::filesystem::exists(configfile, ec)) {
+        std::wstring msg = L"Config file " + configfile + L" not found";
+        Logging::error(msg);
+        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+    }
+    std::vector<std::wstring> roots = listFragments(configfile, L"");
+    std::set<std::wstring> seen(roots.begin(), roots.end());
+    size_t changed = 0;
+    for (std::vector<std::wstring> level = roots; !level.empty();) {
+        changed += loadFragments(level, loaded);
+        std::vector<std::wstring> next;
+        for (const auto& path : level) {
+            for (const auto& include : loaded[path].includes) {
+                if (included.find(include) == included.end()) {
+                    included[include] = listFragments(include, path);
+                }
+                for (const auto& file : included[include]) {
+                    if (seen.insert(file).second) {
+                        next.push_back(file);
+                    }
+                }
+            }
+        }
+        level = next;
+    }
+    for (const auto& fragment : fragments) {
+        if (loaded.find(fragment.first) == loaded.end()) {
+            changed++;
+        }
+    }
+
+    // The settings of a fragment come before those of the fragments it includes
+    std::vector<std::wstring> order;
+    std::set<std::wstring> visited;
+    std::function<void(const std::wstring&)> visit = [&](const std::wstring& path) {
+        if (!visited.insert(path).second) {
+            return;
+        }
+        order.push_back(path);
+        for (const auto& include : loaded[path].includes) {
+            for (const auto& file : included[include]) {
+                visit(file);
+            }
+        }
+    };
+    for (const auto& root : roots) {
+        visit(root);
+    }
+
+    // Later fragments override the settings that apply to all sections
+    std::map<std::wstring, std::wstring> settings;
+    for (const auto& path : order) {
+        for (const auto& setting : loaded[path].globals) {
+            settings[setting.first] = setting.second;
+        }
+    }
+    if (settings.find(L"Splay") == settings.end()) {
+        settings[L"Splay"] = L"0";
+    }
+    if (settings.find(L"MaxConcurrentRotations") == settings.end()) {
+        settings[L"MaxConcurrentRotations"] = L"1";
+    }
+    if (settings.find(L"DirectoryWalkers") == settings.end()) {
+        settings[L"DirectoryWalkers"] = L"4";
+    }
+    if (settings.find(L"ReloadInterval") == settings.end()) {
+        settings[L"ReloadInterval"] = L"60";
+    }
+    if (settings.find(L"LeaseDirectory") == settings.end()) {
+        settings[L"LeaseDirectory"] = L"";
+    }
+    if (settings.find(L"LeaseDuration") == settings.end()) {
+        settings[L"LeaseDuration"] = L"300";
+    }
+    if (settings.find(L"Control") == settings.end()) {
+        settings[L"Control"] = L"true";
+    }
+
+    // The sections of unchanged fragments keep their state, such as the next rotation, unless the defaults changed
+    std::map<std::wstring, Section> sections;
+    std::map<std::wstring, std::wstring> owners;
+    for (const auto& path : order) {
+        const Fragment& fragment = loaded[path];
+        for (const auto& entries : fragment.sections) {
+            std::map<std::wstring, std::wstring>::iterator owner = owners.find(entries.first);
+            if (owner != owners.end()) {
+                std::wstring msg = L"Section " + entries.first + L" in config file " + path + L" is already defined in config file " + owner->second;
+                Logging::fatal(msg + L". Aborting program.");
+                throw std::runtime_error(std::string(msg.begin(), msg.end()));
+            }
+            owners[entries.first] = path;
+            std::map<std::wstring, Section>::iterator previous = configs.find(entries.first);
+            if (!fragment.parsed && settings == globals && previous != configs.end()) {
+                sections[entries.first] = previous->second;
+            }
+            else {
+                sections[entries.first].entries = entries.second;
+                applyDefaults(entries.first, sections[entries.first], settings, path);
+            }
+        }
+    }
+    if (settings != globals) {
+        changed++;
+    }
+    // An emptied directory or file would stop the program, which is never what a change meant
+    if (sections.empty() && !configs.empty()) {
+        std::wstring msg = L"No sections left in config file " + configfile;
+        Logging::error(msg);
+        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+    }
+
+    // Nothing is replaced unless every fragment is valid
+    for (auto& fragment : loaded) {
+        fragment.second.parsed = false;
+    }
+    fragments = std::move(loaded);
+    globals = std::move(settings);
+    configs = std::move(sections);
+    return changed;
+}
+
+// Get the fragment files a path stands for
+std::vector<std::wstring> Config::listFragments(const std::wstring& path, const std::wstring& from)
+{
+    std::vector<std::wstring> files;
+    std::error_code ec;
+    if (std::filesystem::is_directory(path, ec)) {
+        for (const auto& entry : std::filesystem::directory_iterator(path, ec)) {
+            if (entry.is_regular_file(ec) && _wcsicmp(entry.path().extension().wstring().c_str(), L".conf") == 0) {
+                files.push_back(entry.path().lexically_normal().wstring());
+            }
+        }
+        std::sort(files.begin(), files.end());
+    }
+    else if (from.empty() || std::filesystem::is_regular_file(path, ec)) {
+        // A missing configuration file has no sections
+        files.push_back(std::filesystem::path(path).lexically_normal().wstring());
+    }
+    else {
+        std::wstring msg = L"Include " + path + L" not found in config file " + from;
+        Logging::fatal(msg + L". Aborting program.");
+        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+    }
+    return files;
+}
 
-    // Open the configuration file
-    std::wifstream file(configfile);
+// Load fragments from the cache or parse them in parallel
+size_t Config::loadFragments(const std::vector<std::wstring>& paths, std::map<std::wstring, Fragment>& loaded)
+{
+    // A fragment with the same time and size is taken as it is without reading it
+    std::vector<std::wstring> pending;
+    for (const auto& path : paths) {
+        std::error_code ec;
+        std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, ec);
+        unsigned long long size = ec ? 0 : std::filesystem::file_size(path, ec);
+        std::map<std::wstring, Fragment>::const_iterator cached = fragments.find(path);
+        if (!ec && cached != fragments.end() && cached->second.modified == modified && cached->second.size == size) {
+            loaded[path] = cached->second;
+        }
+        else {
+            pending.push_back(path);
+        }
+    }
+    std::vector<Fragment> results(pending.size());
+    std::vector<std::exception_ptr> errors(pending.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < pending.size(); i = next++) {
+            try {
+                results[i] = readFragment(pending[i]);
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    size_t threadCount = std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()), pending.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+        try {
+            threads.emplace_back(worker);
+        }
+        catch (const std::system_error&) {
+            // The threads that did start and this one share the rest
+            break;
+        }
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    size_t parsed = 0;
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (errors[i]) {
+            std::rethrow_exception(errors[i]);
+        }
+        // A touched fragment with the same content keeps its parsed settings
+        std::map<std::wstring, Fragment>::const_iterator cached = fragments.find(pending[i]);
+        if (cached != fragments.end() && cached->second.hash == results[i].hash) {
+            Fragment& fragment = loaded[pending[i]];
+            fragment = cached->second;
+            fragment.modified = results[i].modified;
+            fragment.size = results[i].size;
+        }
+        else {
+            loaded[pending[i]] = std::move(results[i]);
+            parsed++;
+        }
+    }
+    return parsed;
+}
+
+// Read and parse a fragment
+Config::Fragment Config::readFragment(const std::wstring& path)
+{
+    Fragment fragment;
+    std::error_code ec;
+    fragment.modified = std::filesystem::last_write_time(path, ec);
+    // Read the file at once, each byte is a character as before
+    std::ifstream file(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    fragment.size = bytes.size();
+    std::wstring text;
+    text.reserve(bytes.size());
+    for (char c : bytes) {
+        text.push_back(static_cast<unsigned char>(c));
+    }
+    fragment.hash = Tools::hash(text);
+    fragment.parsed = true;
+
+    std::wistringstream lines(text);
     std::wstring line;
     std::wstring section;
 
     // Read the file line by line
-    while (std::getline(file, line)) {
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == L'\r') {
+            line.pop_back();
+        }
 
         // Skip comments and empty lines
         if (std::regex_match(line, std::wregex(L"(\\s*#.*)|(\\s*;.*)")))
@@ -113,17 +406,27 @@ void Config::load(const std::wstring& configfile)
                 std::wstring key = match[1];
                 std::wstring value = match[2];
 
+                // Other fragments are loaded after this one, relative to its directory
+                if (key == L"Include") {
+                    std::filesystem::path target(value);
+                    if (target.is_relative()) {
+                        target = std::filesystem::path(path).parent_path() / target;
+                    }
+                    fragment.includes.push_back(target.lexically_normal().wstring());
+                    continue;
+                }
+
                 // Validate and process specific keys
                 if (key == L"KeepFiles") {
                     if (!regex_match(value, std::wregex(L"^(\\-*\\d+)$"))) {
-                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + configfile;
+                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
                         Logging::fatal(msg + L". Aborting program.");
                         throw std::runtime_error(std::string(msg.begin(), msg.end()));
                     }
                 }
                 else if (key == L"Simulation") {
                     if(value != L"true" && value != L"false") {
-						std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + configfile;
+						std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
                         Logging::fatal(msg + L". Aborting program.");
                         throw std::runtime_error(std::string(msg.begin(), msg.end()));
 					}
@@ -133,51 +436,373 @@ void Config::load(const std::wstring& configfile)
 						value = std::to_wstring(convertToSeconds(value));
 					}
 					catch (std::invalid_argument&) {
-						std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + configfile;
+						std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"MaxAge") {
+                    try {
+                        value = std::to_wstring(convertToSeconds(value));
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"MaxTotalSize") {
+                    try {
+                        value = std::to_wstring(convertToBytes(value));
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"MinFreeSpace") {
+                    try {
+                        if (!regex_match(value, std::wregex(L"^(\\d+)%$"))) {
+                            value = std::to_wstring(convertToBytes(value));
+                        }
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"MinKeepFiles") {
+                    if (!regex_match(value, std::wregex(L"^(\\-*\\d+)$"))) {
+                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"Suffix") {
+                    if (value != L"index" && value != L"timestamp") {
+                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"Executor") {
+                    if (value != L"sequential" && value != L"batched") {
+                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"Durable") {
+                    if (value != L"true" && value != L"false") {
+                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"TailMarker") {
+                    if (value != L"true" && value != L"false") {
+                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"BackgroundDelete") {
+                    if (value != L"true" && value != L"false") {
+                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"ShrinkStep") {
+                    try {
+                        value = std::to_wstring(convertToBytes(value));
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"MergeAfter") {
+                    try {
+                        value = std::to_wstring(convertToSeconds(value));
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"MergeInto") {
+                    if (value != L"week" && value != L"month") {
+                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"BlockSize") {
+                    try {
+                        value = std::to_wstring(convertToBytes(value));
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"BloomFalsePositiveRate") {
+                    // A rate is given as a fraction (0.01) or in percent (1%)
+                    double rate = -1;
+                    try {
+                        size_t end = 0;
+                        rate = std::stod(value, &end);
+                        if (end + 1 == value.size() && value[end] == L'%') {
+                            rate /= 100;
+                        }
+                        else if (end != value.size()) {
+                            rate = -1;
+                        }
+                    }
+                    catch (std::exception&) {
+                    }
+                    if (rate < 0 || rate >= 1) {
+                        std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                    value = std::to_wstring(rate);
+                }
+                else if (key == L"Splay") {
+                    try {
+                        if (value != L"0") {
+                            value = std::to_wstring(convertToSeconds(value));
+                        }
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"SimulatedGrowth") {
+                    try {
+                        if (value != L"observed") {
+                            value = std::to_wstring(convertToBytes(value));
+                        }
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"MaxConcurrentRotations") {
+                    if (!regex_match(value, std::wregex(L"^([1-9]\\d{0,3})$"))) {
+                        std::wstring msg = L"Invalid value " + key + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"Recursive") {
+                    if (value != L"true" && value != L"false") {
+                        std::wstring msg = L"Invalid value " + key + L" in section " + section + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"DirectoryWalkers") {
+                    if (!regex_match(value, std::wregex(L"^([1-9]\\d{0,2})$"))) {
+                        std::wstring msg = L"Invalid value " + key + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"ReloadInterval") {
+                    try {
+                        if (value != L"0") {
+                            value = std::to_wstring(convertToSeconds(value));
+                        }
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"LeaseDuration") {
+                    try {
+                        value = std::to_wstring(convertToSeconds(value));
+                        if (value == L"0") {
+                            throw std::invalid_argument("A lease must last");
+                        }
+                    }
+                    catch (std::invalid_argument&) {
+                        std::wstring msg = L"Invalid value of " + key + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"Control") {
+                    if (value != L"true" && value != L"false") {
+                        std::wstring msg = L"Invalid value " + key + L" in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                }
+                else if (key == L"TimestampRegex") {
+                    try {
+                        std::regex test(std::string(value.begin(), value.end()));
+                    }
+                    catch (std::regex_error&) {
+                        std::wstring msg = L"Invalid regular expression " + key + L" in section " + section + L" in config file " + path;
                         Logging::fatal(msg + L". Aborting program.");
                         throw std::runtime_error(std::string(msg.begin(), msg.end()));
                     }
                 }
-                else if(key == L"Timer") {
-                    configs[section].crontab.parse(value);
-				}
 
-                // Store the key-value pair in the current section
-                configs[section].entries[key] = value;
+                // Settings before the first section apply to all sections
+                if (section.empty()) {
+                    if (key != L"Splay" && key != L"MaxConcurrentRotations" && key != L"DirectoryWalkers" && key != L"ReloadInterval"
+                        && key != L"LeaseDirectory" && key != L"LeaseDuration" && key != L"Control") {
+                        std::wstring msg = L"Invalid setting " + key + L" outside of a section in config file " + path;
+                        Logging::fatal(msg + L". Aborting program.");
+                        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                    }
+                    fragment.globals[key] = value;
+                }
+                else if (key == L"MaxConcurrentRotations" || key == L"DirectoryWalkers" || key == L"ReloadInterval"
+                    || key == L"LeaseDirectory" || key == L"LeaseDuration" || key == L"Control") {
+                    std::wstring msg = L"Setting " + key + L" in section " + section + L" in config file " + path + L" is only valid before the first section";
+                    Logging::fatal(msg + L". Aborting program.");
+                    throw std::runtime_error(std::string(msg.begin(), msg.end()));
+                }
+                else {
+                    // Store the key-value pair in the current section
+                    fragment.sections[section][key] = value;
+                }
             }
         }
     }
-    
-    // After all lines are processed, check the configurations and add default values if necessary
-    for (std::map<std::wstring, Section>::iterator it = configs.begin(); it != configs.end(); it++) {
-        if(it->second.entries.find(L"KeepFiles") == it->second.entries.end()) {
-			it->second.entries[L"KeepFiles"] = L"-1";
-		}
-        if(it->second.entries.find(L"Directory") == it->second.entries.end()) {
-			std::wstring msg = L"Directory not found in section " + it->first + L" in config file " + configfile;
-            Logging::fatal(msg + L". Aborting program.");
-			throw std::runtime_error(std::string(msg.begin(), msg.end()));
-		}
-        if(it->second.entries.find(L"FilePattern") == it->second.entries.end()) {
-			std::wstring msg = L"FilePattern not found in section " + it->first + L" in config file " + configfile;
-            Logging::fatal(msg + L". Aborting program.");
-			throw std::runtime_error(std::string(msg.begin(), msg.end()));
-		}
-        if(it->second.entries.find(L"Timer") == it->second.entries.end()) {
-            it->second.entries[L"Timer"] = L"0 * * * *";
-        }
-        if (it->second.entries.find(L"Simulation") == it->second.entries.end()) {
-            it->second.entries[L"Simulation"] = L"false";
-        }
-        if (it->second.entries.find(L"MinAge") == it->second.entries.end()) {
-            it->second.entries[L"MinAge"] = L"0m";
-        }
+    return fragment;
+}
+
+// Check a section and add the default values
+void Config::applyDefaults(const std::wstring& name, Section& section, std::map<std::wstring, std::wstring>& settings, const std::wstring& file)
+{
+    if (section.entries.find(L"KeepFiles") == section.entries.end()) {
+        section.entries[L"KeepFiles"] = L"-1";
+    }
+    if (section.entries.find(L"Directory") == section.entries.end()) {
+        std::wstring msg = L"Directory not found in section " + name + L" in config file " + file;
+        Logging::fatal(msg + L". Aborting program.");
+        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+    }
+    if (section.entries.find(L"Recursive") == section.entries.end()) {
+        section.entries[L"Recursive"] = L"false";
+    }
+    section.directories = std::make_shared<DirectoryGlob>(section.entries[L"Directory"], section.entries[L"Recursive"] == L"true", std::stoul(settings[L"DirectoryWalkers"]));
+    if (section.entries.find(L"FilePattern") == section.entries.end()) {
+        std::wstring msg = L"FilePattern not found in section " + name + L" in config file " + file;
+        Logging::fatal(msg + L". Aborting program.");
+        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+    }
+    if (section.entries.find(L"Timer") == section.entries.end()) {
+        section.entries[L"Timer"] = L"0 * * * *";
+    }
+    if (section.entries.find(L"TimeZone") == section.entries.end()) {
+        section.entries[L"TimeZone"] = L"local";
+    }
+    if (section.entries.find(L"CatchUp") == section.entries.end()) {
+        section.entries[L"CatchUp"] = L"once";
+    }
+    // The timer is checked once all of its settings are known
+    std::wstring invalid;
+    if (!section.crontab.parse(section.entries[L"Timer"])) {
+        invalid = L"Timer";
+    }
+    else if (!section.crontab.setTimeZone(section.entries[L"TimeZone"])) {
+        invalid = L"TimeZone";
+    }
+    else if (!section.crontab.setCatchUp(section.entries[L"CatchUp"])) {
+        invalid = L"CatchUp";
+    }
+    if (section.entries.find(L"Splay") == section.entries.end()) {
+        section.entries[L"Splay"] = settings[L"Splay"];
+    }
+    section.crontab.setSplay(name, std::stoll(section.entries[L"Splay"]));
+    if (!invalid.empty()) {
+        std::wstring msg = L"Invalid value " + invalid + L" in section " + name + L" in config file " + file;
+        Logging::fatal(msg + L". Aborting program.");
+        throw std::runtime_error(std::string(msg.begin(), msg.end()));
+    }
+    if (section.entries.find(L"Simulation") == section.entries.end()) {
+        section.entries[L"Simulation"] = L"false";
+    }
+    if (section.entries.find(L"MinAge") == section.entries.end()) {
+        section.entries[L"MinAge"] = L"0m";
+    }
+    if (section.entries.find(L"MaxAge") == section.entries.end()) {
+        section.entries[L"MaxAge"] = L"-1";
+    }
+    if (section.entries.find(L"MaxTotalSize") == section.entries.end()) {
+        section.entries[L"MaxTotalSize"] = L"-1";
+    }
+    if (section.entries.find(L"MinFreeSpace") == section.entries.end()) {
+        section.entries[L"MinFreeSpace"] = L"0";
+    }
+    if (section.entries.find(L"MinKeepFiles") == section.entries.end()) {
+        section.entries[L"MinKeepFiles"] = L"-1";
+    }
+    if (section.entries.find(L"Suffix") == section.entries.end()) {
+        section.entries[L"Suffix"] = L"index";
+    }
+    if (section.entries.find(L"Executor") == section.entries.end()) {
+        section.entries[L"Executor"] = L"sequential";
+    }
+    if (section.entries.find(L"Durable") == section.entries.end()) {
+        section.entries[L"Durable"] = L"false";
+    }
+    if (section.entries.find(L"TailMarker") == section.entries.end()) {
+        section.entries[L"TailMarker"] = L"false";
+    }
+    if (section.entries.find(L"BackgroundDelete") == section.entries.end()) {
+        section.entries[L"BackgroundDelete"] = L"false";
+    }
+    if (section.entries.find(L"ShrinkStep") == section.entries.end()) {
+        section.entries[L"ShrinkStep"] = L"0";
+    }
+    if (section.entries.find(L"MergeAfter") == section.entries.end()) {
+        section.entries[L"MergeAfter"] = L"-1";
+    }
+    if (section.entries.find(L"MergeInto") == section.entries.end()) {
+        section.entries[L"MergeInto"] = L"month";
+    }
+    if (section.entries.find(L"BlockSize") == section.entries.end()) {
+        section.entries[L"BlockSize"] = L"0";
+    }
+    if (section.entries.find(L"BloomFalsePositiveRate") == section.entries.end()) {
+        section.entries[L"BloomFalsePositiveRate"] = L"0";
+    }
+    if (section.entries.find(L"BloomTokenChars") == section.entries.end()) {
+        section.entries[L"BloomTokenChars"] = L"_-";
+    }
+    if (section.entries.find(L"TimestampRegex") == section.entries.end()) {
+        section.entries[L"TimestampRegex"] = L"";
+    }
+    if (section.entries.find(L"TimestampFormat") == section.entries.end()) {
+        section.entries[L"TimestampFormat"] = L"%Y-%m-%d %H:%M:%S";
+    }
+    if (section.entries.find(L"SimulatedGrowth") == section.entries.end()) {
+        section.entries[L"SimulatedGrowth"] = L"observed";
+    }
+    if (section.entries.find(L"SimulatedFiles") == section.entries.end()) {
+        section.entries[L"SimulatedFiles"] = L"";
+    }
 #ifdef WITH_ZLIB
-        if (it->second.entries.find(L"FirstCompress") == it->second.entries.end()) {
-            it->second.entries[L"FirstCompress"] = L"-1";
-        }
+    if (section.entries.find(L"FirstCompress") == section.entries.end()) {
+        section.entries[L"FirstCompress"] = L"-1";
+    }
 #endif
-	}
-    // Log that the configuration parsing has finished
-    Logging::debug(L"Leaving parseConfig");
 }
@@ -24,8 +24,12 @@
 */
 #pragma once
 #include "crontab.h"
+#include "glob.h"
+#include <filesystem>
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
 
 /**
  * \class Config
@@ -62,14 +66,26 @@ public:
 
         std::map<std::wstring, std::wstring> entries; ///< Map of entries in the section.
         Crontab crontab; ///< Crontab for the section.
+        std::shared_ptr<DirectoryGlob> directories; ///< The directories of Directory and Recursive, shared by the copies of the section.
     };
 
     /**
-     * \brief Load configuration from a file.
-     * \param configfile The path to the configuration file.
+     * \brief Load configuration from a file, or from all .conf files of a directory in the order of their names.
+     *        Include in a file loads another file or directory after it, relative to the directory of the file. A
+     *        section must be defined in one file only, later files override the settings before the first section.
+     * \param configfile The path to the configuration file or directory.
      */
     void load(const std::wstring& configfile);
 
+    /**
+     * \brief Load the configuration again from the same path. Files with the time and size of the last load are not
+     *        read, files with the same content are not parsed, and their sections keep their state. Nothing changes
+     *        if a file is invalid, if the path is gone, or if a configuration with sections would have none.
+     * \return The number of files that were parsed again, added or removed, plus one if the settings before the
+     *         first section changed. 0 if the configuration is unchanged.
+     */
+    size_t reload();
+
     /**
      * \brief Get a section from the configuration.
      * \param section The name of the section.
@@ -77,6 +93,14 @@ public:
      */
     const std::map<std::wstring, std::wstring>& getSection(const std::wstring& section);
 
+    /**
+     * \brief Get the settings given before the first section, which apply to all sections: Splay (the default of
+     *        the sections, in seconds), MaxConcurrentRotations, DirectoryWalkers, ReloadInterval (in seconds),
+     *        LeaseDirectory (empty without other instances), LeaseDuration (in seconds) and Control (true or false).
+     * \return A map of the settings.
+     */
+    const std::map<std::wstring, std::wstring>& getGlobals();
+
     /**
      * \brief Get all configurations.
      * \return A map of all configurations.
@@ -86,6 +110,52 @@ public:
 #ifndef UNITTEST
 private:
 #endif
+    /**
+     * \struct Fragment
+     * \brief The parsed content of one configuration file.
+     */
+    struct Fragment {
+        std::filesystem::file_time_type modified; ///< The last write time of the file when it was read.
+        unsigned long long size = 0; ///< The size of the file when it was read.
+        unsigned long long hash = 0; ///< The hash of the content of the file.
+        bool parsed = false; ///< Whether the file was parsed by the current load rather than taken from the last one.
+        std::map<std::wstring, std::wstring> globals; ///< The settings before the first section.
+        std::map<std::wstring, std::map<std::wstring, std::wstring>> sections; ///< The entries of the sections.
+        std::vector<std::wstring> includes; ///< The files and directories to include, in the order given.
+    };
+
+    /**
+     * \brief Get the configuration files a path stands for.
+     * \param path A file, or a directory whose .conf files are returned sorted by name.
+     * \param from The file that includes the path, empty for the path given to load. Only that path may be missing.
+     * \return The files.
+     */
+    static std::vector<std::wstring> listFragments(const std::wstring& path, const std::wstring& from);
+
+    /**
+     * \brief Take fragments from the last load if they are unchanged, read and parse the others in parallel.
+     * \param paths The files.
+     * \param loaded The fragments are added to this map.
+     * \return The number of files that were parsed.
+     */
+    size_t loadFragments(const std::vector<std::wstring>& paths, std::map<std::wstring, Fragment>& loaded);
+
+    /**
+     * \brief Read and parse a configuration file, checking the values of its settings.
+     * \param path The file.
+     * \return The fragment.
+     */
+    Fragment readFragment(const std::wstring& path);
+
+    /**
+     * \brief Check that a section has its required settings, add the default values and set up its timer.
+     * \param name The name of the section.
+     * \param section The section.
+     * \param settings The settings before the first section.
+     * \param file The configuration file of the section, for messages.
+     */
+    void applyDefaults(const std::wstring& name, Section& section, std::map<std::wstring, std::wstring>& settings, const std::wstring& file);
+
     /**
      * \brief Convert a duration string to seconds.
      * \param duration The duration string.
@@ -93,7 +163,16 @@ private:
      */
     int convertToSeconds(const std::wstring& duration);
 
+    /**
+     * \brief Convert a size string to bytes.
+     * \param size The size string.
+     * \return The size in bytes.
+     */
+    long long convertToBytes(const std::wstring& size);
+
     std::map<std::wstring, Section> configs; ///< Map of all configurations.
-    std::wstring configfile; ///< The path to the configuration file.
+    std::map<std::wstring, std::wstring> globals; ///< The settings before the first section.
+    std::wstring configfile; ///< The path to the configuration file or directory.
+    std::map<std::wstring, Fragment> fragments; ///< The files of the last load by path.
 };
 
@@ -0,0 +1,251 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "container.h"
+#include "fileio.h"
+#include "logging.h"
+#include "tools.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <regex>
+#include <sstream>
+
+// Get the name of the index of a container
+std::wstring Container::indexName(const std::wstring& container) {
+    return container + L".idx";
+}
+
+// Format the week or month a point in time belongs to
+std::wstring Container::formatPeriod(time_t time, bool weekly) {
+    struct tm ltm;
+    localtime_s(&ltm, &time);
+    wchar_t buffer[16];
+    wcsftime(buffer, sizeof(buffer) / sizeof(buffer[0]), weekly ? L"%G-W%V" : L"%Y-%m", &ltm);
+    return buffer;
+}
+
+// Parse the name of a week or month
+time_t Container::parsePeriod(const std::wstring& period) {
+    static const std::wregex format(L"^(\\d{4})-(?:W(\\d{2})|(\\d{2}))$");
+    std::wsmatch match;
+    if (!std::regex_match(period, match, format)) {
+        return -1;
+    }
+    struct tm ltm = {};
+    ltm.tm_year = std::stoi(match[1].str()) - 1900;
+    ltm.tm_isdst = -1;
+    if (match[3].matched) {
+        ltm.tm_mon = std::stoi(match[3].str()) - 1;
+        ltm.tm_mday = 1;
+        return ltm.tm_mon < 12 ? mktime(&ltm) : -1;
+    }
+    int week = std::stoi(match[2].str());
+    if (week < 1 || week > 53) {
+        return -1;
+    }
+    // Week 1 is the week with January 4th, weeks start on Monday
+    ltm.tm_mday = 4;
+    mktime(&ltm);
+    ltm.tm_mday = 4 - (ltm.tm_wday + 6) % 7 + (week - 1) * 7;
+    ltm.tm_isdst = -1;
+    return mktime(&ltm);
+}
+
+// Read the index of a container
+std::vector<Container::Member> Container::readIndex(const std::wstring& container) {
+    std::vector<Member> members;
+    std::wstring indexFile = indexName(container);
+    std::ifstream index(indexFile, std::ios::binary);
+    std::string line;
+    while (std::getline(index, line)) {
+        std::istringstream fields(line);
+        Member member;
+        std::string name;
+        if (fields >> member.offset >> member.length && fields.get() == '\t' && std::getline(fields, name) && !name.empty()) {
+            member.name = Tools::stringToWstring(name);
+            members.push_back(member);
+        }
+    }
+    return members;
+}
+
+// Copy bytes from one file to another
+bool Container::copyBytes(HANDLE input, HANDLE output, unsigned long long length) {
+    FileIO::Buffer buffer(FileIO::bufferSize);
+    while (length > 0) {
+        DWORD toRead = static_cast<DWORD>(std::min<unsigned long long>(length, buffer.size));
+        DWORD bytes = 0;
+        if (!ReadFile(input, buffer.data, toRead, &bytes, NULL) || bytes == 0) {
+            return false;
+        }
+        DWORD written = 0;
+        if (!WriteFile(output, buffer.data, bytes, &written, NULL) || written != bytes) {
+            return false;
+        }
+        length -= bytes;
+    }
+    return true;
+}
+
+// Compare a range of one file with the start of another
+bool Container::sameBytes(HANDLE file, unsigned long long offset, HANDLE other, unsigned long long length) {
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(offset);
+    LARGE_INTEGER start;
+    start.QuadPart = 0;
+    if (!SetFilePointerEx(file, position, NULL, FILE_BEGIN) || !SetFilePointerEx(other, start, NULL, FILE_BEGIN)) {
+        return false;
+    }
+    std::vector<char> first(FileIO::bufferSize);
+    std::vector<char> second(FileIO::bufferSize);
+    while (length > 0) {
+        DWORD toRead = static_cast<DWORD>(std::min<unsigned long long>(length, first.size()));
+        DWORD bytes = 0;
+        DWORD otherBytes = 0;
+        if (!ReadFile(file, first.data(), toRead, &bytes, NULL) || !ReadFile(other, second.data(), toRead, &otherBytes, NULL)
+            || bytes != toRead || otherBytes != toRead || memcmp(first.data(), second.data(), toRead) != 0) {
+            return false;
+        }
+        length -= bytes;
+    }
+    return true;
+}
+
+// Append a compressed generation to a container
+bool Container::append(const std::wstring& container, const std::wstring& member, bool durable) {
+    std::wstring name = std::filesystem::path(member).filename().wstring();
+    std::vector<Member> members = readIndex(container);
+    unsigned long long end = 0;
+    size_t sameName = 0;
+    auto isNamed = [&name](const Member& existing) { return existing.name == name || existing.name.compare(0, name.size() + 1, name + L"#") == 0; };
+    for (const auto& existing : members) {
+        sameName += isNamed(existing) ? 1 : 0;
+        end = std::max(end, existing.offset + existing.length);
+    }
+
+    HANDLE input = CreateFileW(member.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (input == INVALID_HANDLE_VALUE) {
+        Logging::error(L"Could not open " + member + L" for merging");
+        return false;
+    }
+    HANDLE output = CreateFileW(container.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (output == INVALID_HANDLE_VALUE) {
+        CloseHandle(input);
+        Logging::error(L"Could not open " + container + L" for merging");
+        return false;
+    }
+    // Without its index the end of the last member is unknown, and cutting off behind it would wipe the container
+    LARGE_INTEGER containerSize;
+    if (members.empty() && (!GetFileSizeEx(output, &containerSize) || containerSize.QuadPart > 0)) {
+        CloseHandle(output);
+        CloseHandle(input);
+        Logging::error(L"The index of " + container + L" is missing or unreadable, not merging " + member + L" into it");
+        return false;
+    }
+    LARGE_INTEGER size;
+    FILETIME memberTime, containerTime;
+    // Writing changes the time of the container, so take it before
+    bool hasTime = end > 0 && GetFileTime(output, NULL, NULL, &containerTime);
+    bool ok = GetFileSizeEx(input, &size) != 0;
+    // Numbered generations reuse their names, so only the same bytes as the last member mean it was merged before
+    // and only the deletion of the generation was missing
+    if (ok && !members.empty() && isNamed(members.back()) && members.back().length == static_cast<unsigned long long>(size.QuadPart)
+        && sameBytes(output, members.back().offset, input, members.back().length)) {
+        CloseHandle(output);
+        CloseHandle(input);
+        return true;
+    }
+    if (sameName > 0) {
+        name += L"#" + std::to_wstring(sameName + 1);
+    }
+    LARGE_INTEGER start;
+    start.QuadPart = 0;
+    ok = ok && SetFilePointerEx(input, start, NULL, FILE_BEGIN);
+    if (ok) {
+        // Cut off what an interrupted append left behind the last indexed member
+        LARGE_INTEGER position;
+        position.QuadPart = static_cast<LONGLONG>(end);
+        ok = SetFilePointerEx(output, position, NULL, FILE_BEGIN) && SetEndOfFile(output) && copyBytes(input, output, size.QuadPart);
+    }
+    // The container is as old as its newest member, so MaxAge treats it like one generation
+    if (ok && GetFileTime(input, NULL, NULL, &memberTime)) {
+        SetFileTime(output, NULL, NULL, !hasTime || CompareFileTime(&memberTime, &containerTime) > 0 ? &memberTime : &containerTime);
+    }
+    if (ok && durable) {
+        ok = FlushFileBuffers(output) != 0;
+    }
+    CloseHandle(output);
+    CloseHandle(input);
+    if (!ok) {
+        Logging::error(L"Could not append " + member + L" to " + container);
+        return false;
+    }
+
+    std::wstring indexFile = indexName(container);
+    std::ofstream index(indexFile, std::ios::binary | std::ios::app);
+    index << end << ' ' << size.QuadPart << '\t' << Tools::wstringToString(name) << '\n';
+    index.close();
+    if (!index || (durable && !FileIO::flush(indexFile))) {
+        Logging::error(L"Could not update the index of " + container);
+        return false;
+    }
+    Logging::info(L"Merged " + member + L" into " + container);
+    return true;
+}
+
+// Extract a merged generation from a container
+bool Container::extract(const std::wstring& container, const std::wstring& name, const std::wstring& target) {
+    for (const auto& member : readIndex(container)) {
+        if (member.name != name) {
+            continue;
+        }
+        HANDLE input = CreateFileW(container.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (input == INVALID_HANDLE_VALUE) {
+            Logging::error(L"Could not open " + container);
+            return false;
+        }
+        HANDLE output = CreateFileW(target.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (output == INVALID_HANDLE_VALUE) {
+            CloseHandle(input);
+            Logging::error(L"Could not create " + target);
+            return false;
+        }
+        LARGE_INTEGER position;
+        position.QuadPart = static_cast<LONGLONG>(member.offset);
+        bool ok = SetFilePointerEx(input, position, NULL, FILE_BEGIN) && copyBytes(input, output, member.length);
+        CloseHandle(output);
+        CloseHandle(input);
+        if (!ok) {
+            std::error_code ec;
+            std::filesystem::remove(target, ec);
+            Logging::error(L"Could not extract " + name + L" from " + container);
+        }
+        return ok;
+    }
+    Logging::error(name + L" is not in " + container);
+    return false;
+}
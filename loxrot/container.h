@@ -0,0 +1,121 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <ctime>
+#include <string>
+#include <vector>
+#include <windows.h>
+
+/**
+ * \class Container
+ * \brief A class for merging compressed generations into one file per week or month. Gzip members can be concatenated
+ *        as they are, so the container is a valid gzip file itself. A sidecar index records where each merged
+ *        generation starts, so it can still be extracted byte for byte.
+ */
+class Container
+{
+public:
+    /**
+     * \struct Member
+     * \brief A generation merged into a container.
+     */
+    struct Member {
+        unsigned long long offset; ///< Where the generation starts in the container.
+        unsigned long long length; ///< The size of the generation.
+        std::wstring name; ///< The file name the generation had before it was merged, with #2, #3 ... if an earlier member had the same name.
+    };
+
+    /**
+     * \brief Append a compressed generation to a container and record it in the index of the container. Data after the
+     *        last indexed member, left by an interrupted append, is cut off first. A generation that is byte for byte
+     *        the last member is not appended again. A generation named like an earlier member (e.g. app.log.1.gz of
+     *        numbered suffixes) is indexed as name#2, name#3 and so on. A container that is not empty but has no
+     *        readable index is left alone.
+     * \param container The container, created if it does not exist.
+     * \param member The compressed generation. It is not deleted.
+     * \param durable If true, the container is flushed to disk before the index and the index before returning.
+     * \return true or false
+     */
+    static bool append(const std::wstring& container, const std::wstring& member, bool durable);
+
+    /**
+     * \brief Extract a merged generation from a container.
+     * \param container The container.
+     * \param name The name of the generation in the index.
+     * \param target The file to create.
+     * \return true or false
+     */
+    static bool extract(const std::wstring& container, const std::wstring& name, const std::wstring& target);
+
+    /**
+     * \brief Read the index of a container.
+     * \param container The container.
+     * \return The merged generations in the order they were appended, empty if there is no index.
+     */
+    static std::vector<Member> readIndex(const std::wstring& container);
+
+    /**
+     * \brief Get the name of the index of a container.
+     * \param container The container.
+     * \return The name of the index.
+     */
+    static std::wstring indexName(const std::wstring& container);
+
+    /**
+     * \brief Format the week (e.g. 2026-W42, ISO 8601) or month (e.g. 2026-10) a point in time belongs to.
+     * \param time The point in time.
+     * \param weekly True for the week, false for the month.
+     * \return The name of the period.
+     */
+    static std::wstring formatPeriod(time_t time, bool weekly);
+
+    /**
+     * \brief Parse the name of a week or month as created by formatPeriod.
+     * \param period The name of the period.
+     * \return The start of the period, -1 if the name is invalid.
+     */
+    static time_t parsePeriod(const std::wstring& period);
+
+private:
+    /**
+     * \brief Copy bytes from the current position of one file to the current position of another.
+     * \param input The file to read.
+     * \param output The file to write.
+     * \param length The number of bytes to copy.
+     * \return true or false
+     */
+    static bool copyBytes(HANDLE input, HANDLE output, unsigned long long length);
+
+    /**
+     * \brief Compare a range of one file with the start of another.
+     * \param file The file with the range.
+     * \param offset The start of the range.
+     * \param other The other file.
+     * \param length The length of the range.
+     * \return True if the bytes are the same.
+     */
+    static bool sameBytes(HANDLE file, unsigned long long offset, HANDLE other, unsigned long long length);
+};
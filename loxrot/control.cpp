@@ -0,0 +1,275 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+#include "control.h"
+#include "logging.h"
+#include "tools.h"
+#include <algorithm>
+#include <sstream>
+
+// Constructor
+Control::Control(const std::wstring& pipe) : pipe(pipe), running(false), paused(false) {
+}
+
+// Destructor
+Control::~Control() {
+    stop();
+}
+
+// Start serving the pipe
+bool Control::start() {
+    // Creating the first instance fails if another process serves the pipe
+    HANDLE handle = CreateNamedPipeW(pipe.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE | FILE_FLAG_OVERLAPPED,
+        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, bufferSize, bufferSize, 0, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        Logging::error(L"Could not create the control pipe " + pipe + L", error " + std::to_wstring(GetLastError()));
+        return false;
+    }
+    running = true;
+    try {
+        thread = std::thread(&Control::serve, this, handle);
+    }
+    catch (const std::system_error&) {
+        running = false;
+        CloseHandle(handle);
+        Logging::error(L"Could not start serving the control pipe " + pipe);
+        return false;
+    }
+    Logging::info(L"Serving the control pipe " + pipe);
+    return true;
+}
+
+// Stop serving the pipe
+void Control::stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+    // The thread waits on the pipe in slices and notices this, even while a client holds the pipe
+    running = false;
+    thread.join();
+}
+
+// Answer the clients of the pipe
+void Control::serve(HANDLE instance) {
+    std::vector<char> buffer(bufferSize);
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (overlapped.hEvent == NULL) {
+        Logging::error(L"Could not create an event for the control pipe " + pipe + L", error " + std::to_wstring(GetLastError()));
+        CloseHandle(instance);
+        return;
+    }
+    while (running) {
+        DWORD read = 0;
+        if (ConnectNamedPipe(instance, &overlapped) || GetLastError() == ERROR_PIPE_CONNECTED
+            || finish(instance, overlapped, FALSE, INFINITE, read)) {
+            // A client that sends nothing or does not read the answer would keep the others out
+            if (finish(instance, overlapped, ReadFile(instance, buffer.data(), bufferSize, NULL, &overlapped), clientTimeout, read)) {
+                std::string answer = Tools::wstringToString(handle(Tools::stringToWstring(std::string(buffer.data(), read))));
+                DWORD written = 0;
+                BOOL started = WriteFile(instance, answer.data(), static_cast<DWORD>(answer.size()), NULL, &overlapped);
+                if (finish(instance, overlapped, started, clientTimeout, written)) {
+                    // The client closes its end after reading the answer, disconnecting before would discard it
+                    finish(instance, overlapped, ReadFile(instance, buffer.data(), bufferSize, NULL, &overlapped), clientTimeout, read);
+                }
+            }
+            DisconnectNamedPipe(instance);
+        }
+        else if (running) {
+            Logging::error(L"Could not connect a client to the control pipe " + pipe + L", error " + std::to_wstring(GetLastError()));
+            // E.g. a client that closed before the connect (ERROR_NO_DATA) leaves the instance to be disconnected
+            DisconnectNamedPipe(instance);
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+    CloseHandle(overlapped.hEvent);
+    CloseHandle(instance);
+}
+
+// Wait for an overlapped operation on the pipe
+bool Control::finish(HANDLE instance, OVERLAPPED& overlapped, BOOL started, DWORD timeout, DWORD& transferred) {
+    if (!started && GetLastError() != ERROR_IO_PENDING) {
+        return false;
+    }
+    DWORD waited = 0;
+    while (WaitForSingleObject(overlapped.hEvent, pollInterval) == WAIT_TIMEOUT) {
+        waited += pollInterval;
+        if (!running || (timeout != INFINITE && waited >= timeout)) {
+            // The operation has to end before its buffer can be used again
+            CancelIo(instance);
+            GetOverlappedResult(instance, &overlapped, &transferred, TRUE);
+            return false;
+        }
+    }
+    return GetOverlappedResult(instance, &overlapped, &transferred, FALSE) != FALSE;
+}
+
+// Publish the state of the sections
+void Control::publish(std::map<std::wstring, Config::Section>& configs, Rotate& rotate, time_t now) {
+    // Only the main loop changes the states, it reads them without the lock
+    std::map<std::wstring, State> current;
+    for (auto& config : configs) {
+        State& state = current[config.first];
+        std::map<std::wstring, State>::const_iterator previous = states.find(config.first);
+        if (previous != states.end()) {
+            state = previous->second;
+        }
+        state.next = config.second.crontab.nextRotation(now);
+        state.owned = rotate.isOwner(config.first);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    states = std::move(current);
+}
+
+// Record rotations of sections
+void Control::rotated(const std::vector<std::wstring>& sections, time_t now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& section : sections) {
+        State& state = states[section];
+        state.last = now;
+        state.rotations++;
+    }
+}
+
+// Take the sections asked to be rotated
+std::vector<std::wstring> Control::takeRequests() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::wstring> taken;
+    taken.swap(requests);
+    return taken;
+}
+
+// Check whether the scheduled rotations are paused
+bool Control::isPaused() const {
+    return paused;
+}
+
+// Answer a command
+std::wstring Control::handle(const std::wstring& command) {
+    std::wistringstream words(command);
+    std::wstring verb, argument, extra;
+    words >> verb >> argument >> extra;
+    if (!extra.empty()) {
+        return L"error: too many arguments";
+    }
+    std::wstringstream answer;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (verb == L"status" && argument.empty()) {
+        answer << (paused ? L"paused" : L"running") << L", " << states.size() << L" sections\n";
+        for (const auto& state : states) {
+            answer << state.first << L": next " << formatTime(state.second.next) << L", last " << formatTime(state.second.last)
+                << L", " << state.second.rotations << L" rotations" << (state.second.owned ? L"" : L", rotated by another instance") << L"\n";
+        }
+    }
+    else if (verb == L"next-fire") {
+        // The sections of this instance, soonest first
+        std::vector<std::pair<time_t, std::wstring>> fires;
+        for (const auto& state : states) {
+            if ((argument.empty() && state.second.owned && state.second.next != -1) || state.first == argument) {
+                fires.push_back({ state.second.next, state.first });
+            }
+        }
+        if (!argument.empty() && fires.empty()) {
+            return L"error: unknown section " + argument;
+        }
+        std::sort(fires.begin(), fires.end());
+        for (const auto& fire : fires) {
+            answer << fire.second << L": " << formatTime(fire.first) << L"\n";
+        }
+    }
+    else if (verb == L"rotate" && !argument.empty()) {
+        std::map<std::wstring, State>::const_iterator state = states.find(argument);
+        if (state == states.end()) {
+            return L"error: unknown section " + argument;
+        }
+        if (!state->second.owned) {
+            return L"error: section " + argument + L" is rotated by another instance";
+        }
+        if (std::find(requests.begin(), requests.end(), argument) == requests.end()) {
+            requests.push_back(argument);
+        }
+        answer << L"rotation of " << argument << L" queued\n";
+    }
+    else if (verb == L"pause" && argument.empty()) {
+        paused = true;
+        answer << L"scheduled rotations paused\n";
+    }
+    else if (verb == L"resume" && argument.empty()) {
+        paused = false;
+        answer << L"scheduled rotations resumed\n";
+    }
+    else {
+        return L"error: unknown command, use status, next-fire [<section>], rotate <section>, pause or resume";
+    }
+    return answer.str();
+}
+
+// Send a command to a running program
+bool Control::send(const std::wstring& pipe, const std::wstring& command, std::wstring& answer) {
+    HANDLE handle = CreateFileW(pipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    // All instances of the pipe are busy, wait for one
+    if (handle == INVALID_HANDLE_VALUE && WaitNamedPipeW(pipe.c_str(), 2000)) {
+        handle = CreateFileW(pipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    }
+    if (handle == INVALID_HANDLE_VALUE) {
+        answer = L"error: no program serves " + pipe;
+        return false;
+    }
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    SetNamedPipeHandleState(handle, &mode, NULL, NULL);
+    std::string request = Tools::wstringToString(command);
+    DWORD written = 0;
+    bool ok = WriteFile(handle, request.data(), static_cast<DWORD>(request.size()), &written, NULL) != FALSE;
+    // The answer is one message, read in parts if it is larger than the buffer
+    std::string received;
+    std::vector<char> buffer(bufferSize);
+    while (ok) {
+        DWORD read = 0;
+        BOOL complete = ReadFile(handle, buffer.data(), bufferSize, &read, NULL);
+        received.append(buffer.data(), read);
+        if (complete || GetLastError() != ERROR_MORE_DATA) {
+            ok = complete != FALSE;
+            break;
+        }
+    }
+    CloseHandle(handle);
+    if (!ok) {
+        answer = L"error: no answer from " + pipe;
+        return false;
+    }
+    answer = Tools::stringToWstring(received);
+    return answer.rfind(L"error:", 0) != 0;
+}
+
+// Format a point in time as local time
+std::wstring Control::formatTime(time_t t) {
+    if (t == 0 || t == -1) {
+        return L"never";
+    }
+    tm ltm;
+    localtime_s(&ltm, &t);
+    wchar_t buffer[32];
+    wcsftime(buffer, sizeof(buffer) / sizeof(buffer[0]), L"%Y-%m-%d %H:%M:%S", &ltm);
+    return buffer;
+}
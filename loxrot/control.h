@@ -0,0 +1,166 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+#pragma once
+#include "config.h"
+#include "rotate.h"
+#include <atomic>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <windows.h>
+
+/**
+ * \class Control
+ * \brief A local endpoint to control the running program, a named pipe that takes one command per connection and
+ *        answers it from the state the main loop publishes after each pass, without touching the files:
+ *        status, next-fire [<section>], rotate <section> (rotated by the main loop on its next pass), pause and
+ *        resume (of the scheduled rotations). The pipe refuses remote clients, and its default security lets only
+ *        administrators and the account of the program send commands. A client that does not send its command
+ *        or read the answer in time is dropped.
+ */
+class Control
+{
+public:
+    /**
+     * \struct State
+     * \brief What is known about a section.
+     */
+    struct State {
+        time_t next = -1; ///< The next scheduled rotation, -1 if there is none.
+        time_t last = 0; ///< The last rotation by this instance, 0 if there was none.
+        unsigned long long rotations = 0; ///< The number of rotations by this instance.
+        bool owned = true; ///< Whether this instance rotates the section.
+    };
+
+    /**
+     * \brief Constructor for Control.
+     * \param pipe The full name of the pipe, \\.\pipe\<name>.
+     */
+    explicit Control(const std::wstring& pipe);
+
+    /**
+     * \brief Destructor for Control, stops serving the pipe.
+     */
+    ~Control();
+
+    Control(const Control&) = delete;
+    Control& operator=(const Control&) = delete;
+
+    /**
+     * \brief Start serving the pipe on a thread of its own.
+     * \return False if the pipe is served by another process already or could not be created.
+     */
+    bool start();
+
+    /**
+     * \brief Stop serving the pipe and wait for the thread.
+     */
+    void stop();
+
+    /**
+     * \brief Publish the state of the sections after a pass of the main loop. Sections that are gone are dropped.
+     * \param configs The sections.
+     * \param rotate The Rotate of the main loop, which knows the sections of this instance.
+     * \param now The current time.
+     */
+    void publish(std::map<std::wstring, Config::Section>& configs, Rotate& rotate, time_t now);
+
+    /**
+     * \brief Record rotations of sections.
+     * \param sections The names of the rotated sections.
+     * \param now When they were rotated.
+     */
+    void rotated(const std::vector<std::wstring>& sections, time_t now);
+
+    /**
+     * \brief Take the sections asked to be rotated since the last call.
+     * \return The names, in the order asked, each once.
+     */
+    std::vector<std::wstring> takeRequests();
+
+    /**
+     * \brief Check whether the scheduled rotations are paused.
+     * \return True if they are.
+     */
+    bool isPaused() const;
+
+    /**
+     * \brief Answer a command.
+     * \param command The command and its arguments, separated by blanks.
+     * \return The answer, starting with "error:" if the command failed.
+     */
+    std::wstring handle(const std::wstring& command);
+
+    /**
+     * \brief Send a command to a running program and wait for the answer.
+     * \param pipe The full name of the pipe.
+     * \param command The command.
+     * \param answer Receives the answer.
+     * \return False if no program answered or the command failed.
+     */
+    static bool send(const std::wstring& pipe, const std::wstring& command, std::wstring& answer);
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \brief Answer the clients of the pipe one after the other until stopped.
+     * \param instance The only instance of the pipe.
+     */
+    void serve(HANDLE instance);
+
+    /**
+     * \brief Wait for an overlapped operation on the pipe to finish. It is cancelled when it takes too long or the
+     *        pipe is stopped.
+     * \param instance The instance of the pipe.
+     * \param overlapped The OVERLAPPED the operation was started with.
+     * \param started The result of starting the operation.
+     * \param timeout How long to wait in milliseconds, INFINITE to wait until stopped.
+     * \param transferred Receives the number of bytes transferred.
+     * \return True if the operation succeeded.
+     */
+    bool finish(HANDLE instance, OVERLAPPED& overlapped, BOOL started, DWORD timeout, DWORD& transferred);
+
+    /**
+     * \brief Format a point in time as local time.
+     * \param t The point in time.
+     * \return The formatted time, "never" for 0 and -1.
+     */
+    static std::wstring formatTime(time_t t);
+
+    std::wstring pipe; ///< The full name of the pipe.
+    std::thread thread; ///< Serves the pipe.
+    std::atomic<bool> running; ///< Cleared to stop serving.
+    std::atomic<bool> paused; ///< Whether the scheduled rotations are paused.
+    mutable std::mutex mutex; ///< Guards the states and the requests.
+    std::map<std::wstring, State> states; ///< The sections as of the last pass.
+    std::vector<std::wstring> requests; ///< The sections asked to be rotated.
+    static const DWORD bufferSize = 64 * 1024; ///< The size of the buffers of the pipe and of a read.
+    static const DWORD pollInterval = 200; ///< Milliseconds between the checks for stop() while waiting on the pipe.
+    static const DWORD clientTimeout = 1000; ///< Milliseconds a client has to send and to read, less than send() waits.
+};
@@ -0,0 +1,295 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+#include "coordinator.h"
+#include "logging.h"
+#include "tools.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <windows.h>
+
+// Constructor
+Coordinator::Coordinator(const std::wstring& directory, const std::wstring& instance, time_t duration, const Clock& clock)
+    : directory(directory), instance(instance), duration(duration), clock(clock), renewed(0), stopping(false) {
+    members.push_back(instance);
+    for (int i = 0; i < pointsPerInstance; i++) {
+        ring[Tools::hash(instance + L"#" + std::to_wstring(i))] = instance;
+    }
+    try {
+        renewer = std::thread(&Coordinator::renewLeases, this);
+    }
+    catch (const std::system_error&) {
+        // The leases are still renewed whenever a rotation checks them
+        Logging::warning(L"Could not start the thread that renews the leases");
+    }
+}
+
+// Destructor
+Coordinator::~Coordinator() {
+    {
+        std::lock_guard<std::mutex> lock(leaseMutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    if (renewer.joinable()) {
+        renewer.join();
+    }
+}
+
+// Renew the heartbeat of this instance and read those of the others
+void Coordinator::heartbeat() {
+    time_t now = clock.now();
+    std::filesystem::path heartbeat = std::filesystem::path(directory) / (instance + L".instance");
+    if (renewed == 0 || now - renewed >= duration / 2) {
+        std::wstring temporary = heartbeat.wstring() + L".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file << static_cast<long long>(now + duration) << '\n';
+        }
+        if (!MoveFileExW(temporary.c_str(), heartbeat.wstring().c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+            Logging::error(L"Could not write the heartbeat " + heartbeat.wstring());
+        }
+        else {
+            renewed = now;
+        }
+    }
+    // The others with a heartbeat that has not expired
+    std::vector<std::wstring> current = { instance };
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+        if (entry.path().extension() != L".instance" || entry.path().stem().wstring() == instance) {
+            continue;
+        }
+        std::ifstream file(entry.path(), std::ios::binary);
+        long long expires = 0;
+        if (file >> expires && expires > now) {
+            current.push_back(entry.path().stem().wstring());
+        }
+    }
+    if (ec) {
+        Logging::error(L"Could not read the lease directory " + directory + L": " + Tools::stringToWstring(ec.message()));
+    }
+    std::sort(current.begin(), current.end());
+    std::lock_guard<std::mutex> lock(mutex);
+    if (current == members) {
+        return;
+    }
+    Logging::info(L"Instances sharing the sections: " + std::to_wstring(current.size()));
+    members = current;
+    ring.clear();
+    for (const auto& member : members) {
+        for (int i = 0; i < pointsPerInstance; i++) {
+            ring[Tools::hash(member + L"#" + std::to_wstring(i))] = member;
+        }
+    }
+}
+
+// Remove the heartbeat of this instance
+void Coordinator::leave() {
+    std::error_code ec;
+    std::filesystem::remove(std::filesystem::path(directory) / (instance + L".instance"), ec);
+    renewed = 0;
+}
+
+// Get the instances with a current heartbeat
+std::vector<std::wstring> Coordinator::getMembers() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return members;
+}
+
+// Get the instance a section belongs to, the next point on the ring after the hash of its name
+std::wstring Coordinator::getOwner(const std::wstring& section) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<unsigned long long, std::wstring>::const_iterator it = ring.lower_bound(Tools::hash(section));
+    return it != ring.end() ? it->second : ring.begin()->second;
+}
+
+// Check whether a section belongs to this instance
+bool Coordinator::isOwner(const std::wstring& section) {
+    return getOwner(section) == instance;
+}
+
+// Take the lease of a section
+bool Coordinator::acquire(const std::wstring& section, unsigned long long& token) {
+    if (!isOwner(section)) {
+        return false;
+    }
+    time_t now = clock.now();
+    Lease lease = findLease(section);
+    if (lease.token != 0 && lease.holder != instance && lease.expires > now) {
+        Logging::debug(L"Lease of section " + section + L" is held by " + lease.holder);
+        return false;
+    }
+    // Of several instances creating the next token only one succeeds
+    std::wstring path = leasePath(section, lease.token + 1);
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        Logging::debug(L"Lease of section " + section + L" was taken by another instance");
+        return false;
+    }
+    std::string content = Tools::wstringToString(instance) + '\t' + std::to_string(static_cast<long long>(now + duration)) + '\n';
+    DWORD written = 0;
+    bool ok = WriteFile(handle, content.data(), static_cast<DWORD>(content.size()), &written, NULL) && written == content.size();
+    CloseHandle(handle);
+    if (!ok) {
+        Logging::error(L"Could not write the lease " + path);
+        // An empty lease would hold the section until it expires
+        DeleteFileW(path.c_str());
+        return false;
+    }
+    token = lease.token + 1;
+    {
+        std::lock_guard<std::mutex> lock(leaseMutex);
+        held[section] = token;
+    }
+    // The older leases are of no use any more
+    std::error_code ec;
+    for (unsigned long long old = lease.token; old > 0; old--) {
+        if (!std::filesystem::remove(leasePath(section, old), ec)) {
+            break;
+        }
+    }
+    return true;
+}
+
+// Check that a lease is still the newest one and renew it
+bool Coordinator::check(const std::wstring& section, unsigned long long token) {
+    std::lock_guard<std::mutex> lock(leaseMutex);
+    return renew(section, token);
+}
+
+// Give up a lease
+void Coordinator::release(const std::wstring& section, unsigned long long token) {
+    std::lock_guard<std::mutex> lock(leaseMutex);
+    std::map<std::wstring, unsigned long long>::iterator it = held.find(section);
+    if (it != held.end() && it->second == token) {
+        held.erase(it);
+    }
+    Lease lease = findLease(section);
+    if (lease.token == token && lease.holder == instance) {
+        writeLease(section, token, 0);
+    }
+}
+
+// Check a lease and renew it
+bool Coordinator::renew(const std::wstring& section, unsigned long long token) {
+    time_t now = clock.now();
+    Lease lease = findLease(section);
+    if (lease.token != token || lease.holder != instance || lease.expires <= now) {
+        Logging::warning(L"Lease " + std::to_wstring(token) + L" of section " + section + L" was lost");
+        std::map<std::wstring, unsigned long long>::iterator it = held.find(section);
+        if (it != held.end() && it->second == token) {
+            held.erase(it);
+        }
+        return false;
+    }
+    if (lease.expires - now < duration / 2) {
+        writeLease(section, token, now + duration);
+    }
+    return true;
+}
+
+// Renew the held leases until the Coordinator is destroyed
+void Coordinator::renewLeases() {
+    std::unique_lock<std::mutex> lock(leaseMutex);
+    while (!stopping) {
+        // A lease is renewed once half of it has passed, waking up every quarter does so before it expires
+        wakeup.wait_for(lock, std::chrono::seconds(std::max<time_t>(1, duration / 4)), [this]() { return stopping; });
+        std::map<std::wstring, unsigned long long> leases = held;
+        for (const auto& lease : leases) {
+            if (stopping) {
+                break;
+            }
+            renew(lease.first, lease.second);
+        }
+    }
+}
+
+// Find the newest lease of a section
+Coordinator::Lease Coordinator::findLease(const std::wstring& section) {
+    Lease lease;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+        // <section>.<token>.lease
+        std::wstring name = entry.path().filename().wstring();
+        if (name.size() < section.size() + 8 || name.compare(0, section.size(), section) != 0 || name[section.size()] != L'.'
+            || name.compare(name.size() - 6, 6, L".lease") != 0) {
+            continue;
+        }
+        std::wstring digits = name.substr(section.size() + 1, name.size() - section.size() - 7);
+        if (digits.empty() || digits.size() > 19 || digits.find_first_not_of(L"0123456789") != std::wstring::npos) {
+            continue;
+        }
+        unsigned long long token = std::stoull(digits);
+        if (token > lease.token) {
+            lease.token = token;
+        }
+    }
+    if (lease.token != 0) {
+        std::wstring path = leasePath(section, lease.token);
+        std::ifstream file(path, std::ios::binary);
+        std::string holder;
+        long long expires = 0;
+        if (std::getline(file, holder, '\t') && file >> expires) {
+            lease.holder = Tools::stringToWstring(holder);
+            lease.expires = static_cast<time_t>(expires);
+        }
+        else {
+            // Being written by its holder, who has just created it, or left empty by a holder that died
+            std::error_code ec;
+            std::filesystem::file_time_type written = std::filesystem::last_write_time(path, ec);
+            lease.expires = ec ? clock.now() + duration
+                : std::chrono::system_clock::to_time_t(std::chrono::clock_cast<std::chrono::system_clock>(written)) + duration;
+        }
+    }
+    return lease;
+}
+
+// Write a lease file through a temporary file
+bool Coordinator::writeLease(const std::wstring& section, unsigned long long token, time_t expires) {
+    std::wstring path = leasePath(section, token);
+    std::wstring temporary = path + L"." + instance + L".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file << Tools::wstringToString(instance) << '\t' << static_cast<long long>(expires) << '\n';
+        if (!file) {
+            Logging::error(L"Could not write " + temporary);
+            return false;
+        }
+    }
+    if (!MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        Logging::error(L"Could not replace the lease " + path);
+        return false;
+    }
+    return true;
+}
+
+// Get the path of a lease file
+std::wstring Coordinator::leasePath(const std::wstring& section, unsigned long long token) const {
+    return (std::filesystem::path(directory) / (section + L"." + std::to_wstring(token) + L".lease")).wstring();
+}
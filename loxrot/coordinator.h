@@ -0,0 +1,189 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+#pragma once
+#include "clock.h"
+#include <condition_variable>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * \class Coordinator
+ * \brief Shares the sections between several instances of loxrot that rotate the same directories, e.g. on a file
+ *        share. Every instance keeps a heartbeat file in a common lease directory, the instances with a current
+ *        heartbeat are placed on a ring by consistent hashing, and each section belongs to the next instance on the
+ *        ring after the hash of its name. When an instance stops, only its sections move to others.
+ *
+ * Ownership alone does not rule out two rotations of a section while the instances see different members. A
+ * rotation therefore takes the lease of its section first: a file <section>.<token>.lease created exclusively, so
+ * of two instances asking for the same token only one succeeds. The lease names its holder and expires after a
+ * while, so the section of an instance that died is taken over. The token only grows and fences a holder whose lease
+ * was taken over: it checks that its token is still the newest before changing files. A background thread renews the
+ * leases this instance holds, so a rotation that takes longer than a lease, e.g. a large compression, keeps it. The
+ * expiry times are absolute, the clocks of the machines have to be synchronized.
+ */
+class Coordinator
+{
+public:
+    /**
+     * \brief Constructor for Coordinator.
+     * \param directory The lease directory shared by all instances.
+     * \param instance The name of this instance, unique among the instances.
+     * \param duration How long heartbeats and leases last, in seconds.
+     * \param clock The source of the current time.
+     */
+    Coordinator(const std::wstring& directory, const std::wstring& instance, time_t duration, const Clock& clock = Clock::system());
+
+    /**
+     * \brief Destructor for Coordinator. Stops renewing the leases.
+     */
+    ~Coordinator();
+
+    /**
+     * \brief Renew the heartbeat of this instance once half of its duration has passed and read the heartbeats of
+     *        the others. To be called regularly, at least once per duration.
+     */
+    void heartbeat();
+
+    /**
+     * \brief Remove the heartbeat of this instance, so the others take over its sections without waiting.
+     */
+    void leave();
+
+    /**
+     * \brief Get the instances with a current heartbeat as of the last call of heartbeat.
+     * \return The names, sorted. This instance is always one of them.
+     */
+    std::vector<std::wstring> getMembers();
+
+    /**
+     * \brief Get the instance a section belongs to.
+     * \param section The name of the section.
+     * \return The name of the instance.
+     */
+    std::wstring getOwner(const std::wstring& section);
+
+    /**
+     * \brief Check whether a section belongs to this instance.
+     * \param section The name of the section.
+     * \return True if it does.
+     */
+    bool isOwner(const std::wstring& section);
+
+    /**
+     * \brief Take the lease of a section of this instance, unless another instance holds a lease that has not expired.
+     *        The lease is renewed in the background until it is released or lost.
+     * \param section The name of the section.
+     * \param token Receives the fencing token of the lease.
+     * \return True if the lease was taken.
+     */
+    bool acquire(const std::wstring& section, unsigned long long& token);
+
+    /**
+     * \brief Check that a lease is still the newest one of its section and has not expired, and renew it once half of
+     *        its duration has passed.
+     * \param section The name of the section.
+     * \param token The fencing token of the lease.
+     * \return True if the holder may go on changing files.
+     */
+    bool check(const std::wstring& section, unsigned long long token);
+
+    /**
+     * \brief Give up a lease, so the section can be taken at once. The lease file is kept for its token.
+     * \param section The name of the section.
+     * \param token The fencing token of the lease.
+     */
+    void release(const std::wstring& section, unsigned long long token);
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \struct Lease
+     * \brief The newest lease of a section.
+     */
+    struct Lease {
+        unsigned long long token = 0; ///< The fencing token, 0 if the section never had a lease.
+        std::wstring holder; ///< The instance that took it.
+        time_t expires = 0; ///< When it expires.
+    };
+
+    /**
+     * \brief Check a lease and renew it once half of its duration has passed. A lost lease is no longer renewed.
+     *        leaseMutex has to be held.
+     * \param section The name of the section.
+     * \param token The fencing token of the lease.
+     * \return True if the lease is still held.
+     */
+    bool renew(const std::wstring& section, unsigned long long token);
+
+    /**
+     * \brief Renew the held leases regularly until the Coordinator is destroyed. Runs on its own thread.
+     */
+    void renewLeases();
+
+    /**
+     * \brief Find the newest lease of a section. A lease file that cannot be read yet expires a duration after it was
+     *        written last, so one left behind by a holder that died is taken over in the end.
+     * \param section The name of the section.
+     * \return The lease.
+     */
+    Lease findLease(const std::wstring& section);
+
+    /**
+     * \brief Write a lease file through a temporary file, so a reader never sees half of it.
+     * \param section The name of the section.
+     * \param token The fencing token.
+     * \param expires When the lease expires.
+     * \return True if it was written.
+     */
+    bool writeLease(const std::wstring& section, unsigned long long token, time_t expires);
+
+    /**
+     * \brief Get the path of a lease file.
+     * \param section The name of the section.
+     * \param token The fencing token.
+     * \return The path.
+     */
+    std::wstring leasePath(const std::wstring& section, unsigned long long token) const;
+
+    std::wstring directory; ///< The lease directory shared by all instances.
+    std::wstring instance; ///< The name of this instance.
+    time_t duration; ///< How long heartbeats and leases last.
+    const Clock& clock; ///< The source of the current time.
+    time_t renewed; ///< When the heartbeat was written last, 0 before the first one.
+    std::mutex mutex; ///< Guards the members and the ring.
+    std::vector<std::wstring> members; ///< The instances with a current heartbeat.
+    std::map<unsigned long long, std::wstring> ring; ///< The points of the instances on the hash ring.
+    std::map<std::wstring, unsigned long long> held; ///< The tokens of the leases this instance holds, by section.
+    std::mutex leaseMutex; ///< Guards held and the lease files this instance writes.
+    std::condition_variable wakeup; ///< Wakes the renewing thread up to stop.
+    bool stopping; ///< Set when the renewing thread has to stop.
+    std::thread renewer; ///< Renews the held leases.
+    static const int pointsPerInstance = 64; ///< Points per instance on the ring, more spread the sections more evenly.
+};
@@ -24,300 +24,433 @@
 */
 
 #include "crontab.h"
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <iostream>
 #include <windows.h>
 #include "logging.h"
-#include <regex>
+#include "tools.h"
+#include <cwctype>
 
-Crontab::Crontab()
+Crontab::Crontab() : secondMask(0), minuteMask(0), hourMask(0), dayMask(0), monthMask(0), weekdayMask(0), hasSeconds(false),
+    next(0), delay(0), catchUp(CatchUp::once), zone(Zone::local)
 {
-	last.tm_sec = 0;
-	last.tm_min = 0;
-	last.tm_hour = 0;
-	last.tm_mday = 0;
-	last.tm_mon = 0;
-	last.tm_year = 0;
-	last.tm_wday = 0;
-	last.tm_yday = 0;
-	last.tm_isdst = 0;
+	memset(&zoneInfo, 0, sizeof(zoneInfo));
 }
 
 Crontab::~Crontab()
 {
 }
 
+// Set the time zone the fields of the crontab are in
+bool Crontab::setTimeZone(const std::wstring& name)
+{
+    next = 0;
+    if (name == L"local") {
+        zone = Zone::local;
+        return true;
+    }
+    if (name == L"UTC") {
+        zone = Zone::utc;
+        return true;
+    }
+    DYNAMIC_TIME_ZONE_INFORMATION info;
+    for (DWORD i = 0; EnumDynamicTimeZoneInformation(i, &info) == ERROR_SUCCESS; i++) {
+        if (_wcsicmp(info.TimeZoneKeyName, name.c_str()) == 0) {
+            zoneInfo = info;
+            zone = Zone::named;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Set what to do about missed rotations
+bool Crontab::setCatchUp(const std::wstring& policy)
+{
+    if (policy == L"once") {
+        catchUp = CatchUp::once;
+    }
+    else if (policy == L"all") {
+        catchUp = CatchUp::all;
+    }
+    else if (policy == L"skip") {
+        catchUp = CatchUp::skip;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Delay every rotation by an offset within a window derived from a name
+void Crontab::setSplay(const std::wstring& name, time_t window)
+{
+    delay = window > 0 ? static_cast<time_t>(Tools::hash(name) % static_cast<unsigned long long>(window)) : 0;
+}
+
+// Get the offset every rotation is delayed by
+time_t Crontab::getDelay() const
+{
+    return delay;
+}
+
+// Check if it's time to rotate
 bool Crontab::isTimeToRotate()
 {
-	// Get the current time
-    time_t now = time(0);
-    tm ltm;
-    localtime_s(&ltm, &now);
+    return isTimeToRotate(time(nullptr));
+}
+
+// Check if a rotation is due at a point in time
+bool Crontab::isTimeToRotate(time_t now)
+{
+    time_t fire = nextRotation(now);
+    if (fire == -1 || now < fire) {
+        return false;
+    }
+    // A delayed schedule is the undelayed one seen from an earlier point in time
+    now -= delay;
+    time_t due = next;
+    time_t following = fireAfter(due);
+    if (following == -1 || now < following) {
+        // The usual case, only one rotation is due
+        next = following;
+        if (catchUp == CatchUp::skip && now - due >= lateGrace) {
+            Logging::warning(L"Skipped the rotation of timer " + crontabstring + L" that was due " + std::to_wstring(now - due) + L" seconds ago");
+            return false;
+        }
+        return true;
+    }
+    // More than one rotation is due, find the last one
+    int missed = 2;
+    time_t latest = following;
+    for (time_t t = fireAfter(following); t != -1 && t <= now && missed < 1000; t = fireAfter(t)) {
+        latest = t;
+        missed++;
+    }
+    switch (catchUp) {
+    case CatchUp::all:
+        // The next check runs the next one
+        next = following;
+        Logging::info(L"Catching up " + std::to_wstring(missed) + L" missed rotations of timer " + crontabstring);
+        return true;
+    case CatchUp::skip:
+        next = fireAfter(now);
+        Logging::warning(L"Skipped " + std::to_wstring(missed) + L" missed rotations of timer " + crontabstring);
+        return now - latest < lateGrace;
+    default:
+        next = fireAfter(now);
+        Logging::info(L"Running " + std::to_wstring(missed) + L" due rotations of timer " + crontabstring + L" once");
+        return true;
+    }
+}
+
+// Get the instant of the next rotation
+time_t Crontab::nextRotation(time_t now)
+{
+    if (next == 0) {
+        // A rotation due in the current minute still runs
+        now -= delay;
+        next = fireAfter(hasSeconds ? now - 1 : now - now % 60 - 1);
+    }
+    return next == -1 ? -1 : next + delay;
+}
 
-	// Check if the current time is in the crontab
-    if (std::find(weekdays.begin(), weekdays.end(), ltm.tm_wday) != weekdays.end() &&
-		std::find(months.begin(), months.end(), ltm.tm_mon + 1) != months.end() &&
-		std::find(days.begin(), days.end(), ltm.tm_mday) != days.end() &&
-		std::find(hours.begin(), hours.end(), ltm.tm_hour) != hours.end() &&
-		std::find(minutes.begin(), minutes.end(), ltm.tm_min) != minutes.end())
-    {
-		// Check if the current time is different from the last time the roation was done
-		Logging::debug(L"ltm.tm_min: " + std::to_wstring(ltm.tm_min) + L" last.tm_min: " + std::to_wstring(last.tm_min));
-		if (ltm.tm_wday == last.tm_wday && ltm.tm_min == last.tm_min && ltm.tm_hour == last.tm_hour && ltm.tm_mday == last.tm_mday && ltm.tm_mon == last.tm_mon && ltm.tm_year == last.tm_year) {
-			return false;
-		}
-		last.tm_year = ltm.tm_year;
-		last.tm_mon = ltm.tm_mon;
-		last.tm_mday = ltm.tm_mday;
-		last.tm_hour = ltm.tm_hour;
-		last.tm_min = ltm.tm_min;
-		last.tm_wday = ltm.tm_wday;
-		return true;
-	}
+// Get the first instant after a point in time at which the crontab matches
+time_t Crontab::fireAfter(time_t t) const
+{
+    tm wall;
+    if (!toWall(t, wall)) {
+        return -1;
+    }
+    wall.tm_sec++;
+    for (int i = 0; i < 10; i++) {
+        if (!nextMatch(wall)) {
+            return -1;
+        }
+        time_t fire = fromWall(wall);
+        if (fire == -1) {
+            return -1;
+        }
+        // A wall clock time repeated by a DST change maps to its first occurrence, which may have passed
+        if (fire > t) {
+            return fire;
+        }
+        wall.tm_sec += static_cast<int>(t - fire) + 1;
+    }
+    return -1;
+}
+
+// Check if a wall clock time matches all fields
+bool Crontab::matches(const tm& wall) const
+{
+    return (weekdayMask >> wall.tm_wday & 1) && (monthMask >> (wall.tm_mon + 1) & 1) && (dayMask >> wall.tm_mday & 1) &&
+        (hourMask >> wall.tm_hour & 1) && (minuteMask >> wall.tm_min & 1) && (secondMask >> wall.tm_sec & 1);
+}
+
+// Advance a wall clock time to the next second that matches all fields
+bool Crontab::nextMatch(tm& wall) const
+{
+    // Wall clock arithmetic without time zone, UTC has no DST
+    tm w = wall;
+    w.tm_isdst = 0;
+    time_t t = _mkgmtime(&w);
+    for (int i = 0; i < maxSearchSteps && t != -1; i++) {
+        gmtime_s(&w, &t);
+        if (matches(w)) {
+            wall = w;
+            return true;
+        }
+        // Move to the next matching value of the first field that does not match, a value past the end carries over
+        if (!(monthMask >> (w.tm_mon + 1) & 1)) {
+            w.tm_mon = nextBit(monthMask, w.tm_mon + 2, 13) - 1;
+            w.tm_mday = 1;
+            w.tm_hour = 0;
+            w.tm_min = 0;
+            w.tm_sec = 0;
+        }
+        else if (!(dayMask >> w.tm_mday & 1) || !(weekdayMask >> w.tm_wday & 1)) {
+            w.tm_mday++;
+            w.tm_hour = 0;
+            w.tm_min = 0;
+            w.tm_sec = 0;
+        }
+        else if (!(hourMask >> w.tm_hour & 1)) {
+            w.tm_hour = nextBit(hourMask, w.tm_hour + 1, 24);
+            w.tm_min = 0;
+            w.tm_sec = 0;
+        }
+        else if (!(minuteMask >> w.tm_min & 1)) {
+            w.tm_min = nextBit(minuteMask, w.tm_min + 1, 60);
+            w.tm_sec = 0;
+        }
+        else {
+            w.tm_sec = nextBit(secondMask, w.tm_sec + 1, 60);
+        }
+        t = _mkgmtime(&w);
+    }
     return false;
 }
 
-bool Crontab::parse(const std::wstring& crontabstring)
+// Get the wall clock time of an instant in the time zone
+bool Crontab::toWall(time_t t, tm& wall) const
 {
-	// Clear the vectors
-	minutes.clear();
-	hours.clear();
-	days.clear();
-	months.clear();
-	weekdays.clear();
-	 
-	// trim the string
-	std::wstring::size_type start = crontabstring.find_first_not_of(L" ");
-	std::wstring::size_type end = crontabstring.find_last_not_of(L" ");
-	std::wstring trimmed = crontabstring.substr(start, end - start + 1);
+    switch (zone) {
+    case Zone::utc:
+        return gmtime_s(&wall, &t) == 0;
+    case Zone::named: {
+        tm utc;
+        if (gmtime_s(&utc, &t) != 0) {
+            return false;
+        }
+        SYSTEMTIME system = { static_cast<WORD>(utc.tm_year + 1900), static_cast<WORD>(utc.tm_mon + 1), static_cast<WORD>(utc.tm_wday),
+            static_cast<WORD>(utc.tm_mday), static_cast<WORD>(utc.tm_hour), static_cast<WORD>(utc.tm_min), static_cast<WORD>(utc.tm_sec), 0 };
+        SYSTEMTIME local;
+        if (!SystemTimeToTzSpecificLocalTimeEx(&zoneInfo, &system, &local)) {
+            return false;
+        }
+        memset(&wall, 0, sizeof(wall));
+        wall.tm_year = local.wYear - 1900;
+        wall.tm_mon = local.wMonth - 1;
+        wall.tm_mday = local.wDay;
+        wall.tm_hour = local.wHour;
+        wall.tm_min = local.wMinute;
+        wall.tm_sec = local.wSecond;
+        // Normalize to get the weekday
+        tm w = wall;
+        time_t days = _mkgmtime(&w);
+        return days != -1 && gmtime_s(&wall, &days) == 0;
+    }
+    default:
+        return localtime_s(&wall, &t) == 0;
+    }
+}
 
-	// split the string
-	std::wstringstream ss(trimmed);
-	std::vector<std::vector<int>*> fields = {&minutes, &hours, &days, &months, &weekdays};
+// Get the instant of a wall clock time in the time zone
+time_t Crontab::fromWall(const tm& wall) const
+{
+    tm w = wall;
+    switch (zone) {
+    case Zone::utc:
+        return _mkgmtime(&w);
+    case Zone::named: {
+        SYSTEMTIME local = { static_cast<WORD>(w.tm_year + 1900), static_cast<WORD>(w.tm_mon + 1), static_cast<WORD>(w.tm_wday),
+            static_cast<WORD>(w.tm_mday), static_cast<WORD>(w.tm_hour), static_cast<WORD>(w.tm_min), static_cast<WORD>(w.tm_sec), 0 };
+        SYSTEMTIME system;
+        if (!TzSpecificLocalTimeToSystemTimeEx(&zoneInfo, &local, &system)) {
+            return -1;
+        }
+        tm utc;
+        memset(&utc, 0, sizeof(utc));
+        utc.tm_year = system.wYear - 1900;
+        utc.tm_mon = system.wMonth - 1;
+        utc.tm_mday = system.wDay;
+        utc.tm_hour = system.wHour;
+        utc.tm_min = system.wMinute;
+        utc.tm_sec = system.wSecond;
+        return _mkgmtime(&utc);
+    }
+    default:
+        // Let the C runtime decide whether DST applies
+        w.tm_isdst = -1;
+        return mktime(&w);
+    }
+}
 
-	// parse the string
-    int vecnum(0);
-	std::wstring token;
-	std::wsmatch match;
-	while (getline(ss, token, L' ')) {
-		if (token == L"*") {
-			if (vecnum == 0) { // min
-				for (int i = 0; i < 60; i++) {
-					minutes.push_back(i);
-				}
-			}
-			else if (vecnum == 1) { // hour
-				for (int i = 0; i < 24; i++) {
-					fields[vecnum]->push_back(i);
-				}
-			}
-			else if (vecnum == 2) { // day
-				for (int i = 1; i < 32; i++) {
-					fields[vecnum]->push_back(i);
-				}
-			}
-			else if (vecnum == 3) { // month 0-11
-				for (int i = 0; i < 12; i++) {
-					fields[vecnum]->push_back(i);
-				}
-			}
-			else if (vecnum == 4) { // weekday
-				for (int i = 0; i < 7; i++) {
-					fields[vecnum]->push_back(i);
-				}
-			}
-		}
-		else if (token.find(L',') != std::wstring::npos) {
-			if (!std::regex_match(token, std::wregex(L"(\\d+,\\d+)(,\\d+)*"))) {
-				return false;
-			}
-			std::wstringstream ss2(token);
-			std::wstring token2;
-			while (std::getline(ss2, token2, L',')) {
-				if (token2.length() == 0) {
-					return false;
-				}
-				if (vecnum == 0) { // min
-					if (std::stoi(token2) < 0 || std::stoi(token2) > 59) {
-						return false;
-					}
-				}
-				else if (vecnum == 1) { // hour
-					if (std::stoi(token2) < 0 || std::stoi(token2) > 23) {
-						return false;
-					}
-				}
-				else if (vecnum == 2) { // day
-					if (std::stoi(token2) < 1 || std::stoi(token2) > 31) {
-						return false;
-					}
-				}
-				else if (vecnum == 3) { // month 0-11
-					if (std::stoi(token2) < 0 || std::stoi(token2) > 11) {
-						return false;
-					}
-				}
-				else if (vecnum == 4) { // weekday
-					if (std::stoi(token2) < 0 || std::stoi(token2) > 6) {
-						return false;
-					}
-				}
-				fields[vecnum]->push_back(std::stoi(token2));
-			}
-		}
-		else if (token.find(L"-") != std::wstring::npos) {
-			if (!std::regex_match(token, match, std::wregex(L"(\\d+)-(\\d+)"))) {
-				return false;
-			}
-			int start(std::stoi(match[1]));
-			end = std::stoi(match[2]);
-			if (vecnum == 0) { // min
-				if (start < 0 || start > 59 || end < 0 || end > 59) {
-					return false;
-				}
-			}
-			else if (vecnum == 1) { // hour
-				if (start < 0 || start > 23 || end < 0 || end > 23) {
-					return false;
-				}
-			}
-			else if (vecnum == 2) { // day
-				if (start < 1 || start > 31 || end < 1 || end > 31) {
-					return false;
-				}
-			}
-			else if (vecnum == 3) { // month 0-11
-				if (start < 0 || start > 11 || end < 0 || end > 11) {
-					return false;
-				}
-			}
-			else if (vecnum == 4) { // weekday
-				if (start < 0 || start > 6 || end < 0 || end > 6) {
-					return false;
-				}
-			}
-			for (int i = start; i <= end; i++) {
-				fields[vecnum]->push_back(i);
-			}
-		}
-		else if (token.find(L'/') != std::wstring::npos) {
-			if (!std::regex_match(token, match, std::wregex(L"(\\d+|\\*+)\\/(\\d+)"))) {
-				return false;
-			}
+// Parse a crontab string
+bool Crontab::parse(const std::wstring& crontabstring)
+{
+    static const wchar_t* const monthNames[] = { L"JAN", L"FEB", L"MAR", L"APR", L"MAY", L"JUN", L"JUL", L"AUG", L"SEP", L"OCT", L"NOV", L"DEC" };
+    static const wchar_t* const weekdayNames[] = { L"SUN", L"MON", L"TUE", L"WED", L"THU", L"FRI", L"SAT", L"SUN" };
+    static const Field fields[] = {
+        { 0, 59, 59, nullptr }, // second
+        { 0, 59, 59, nullptr }, // minute
+        { 0, 23, 23, nullptr }, // hour
+        { 1, 31, 31, nullptr }, // day
+        { 1, 12, 12, monthNames }, // month
+        { 0, 7, 6, weekdayNames } // weekday, 7 is Sunday as well
+    };
+    static const std::pair<const wchar_t*, const wchar_t*> macros[] = {
+        { L"@yearly", L"0 0 1 1 *" }, { L"@annually", L"0 0 1 1 *" }, { L"@monthly", L"0 0 1 * *" },
+        { L"@weekly", L"0 0 * * 0" }, { L"@daily", L"0 0 * * *" }, { L"@midnight", L"0 0 * * *" }, { L"@hourly", L"0 * * * *" }
+    };
+    this->crontabstring = crontabstring;
+    next = 0;
+    seconds.clear();
+    minutes.clear();
+    hours.clear();
+    days.clear();
+    months.clear();
+    weekdays.clear();
 
-			int start;
-			if (match[1] == L"*") {
-				if (vecnum == 2) {	// days start at 1
-					start = 1;
-				}
-				else {				// rest starts at 0
-					start = 0;
-				}
-			}
-			else {
-				start = std::stoi(match[1]);
-			}
+    // Split the string at blanks
+    std::vector<std::wstring> tokens;
+    std::wstringstream ss(crontabstring);
+    std::wstring token;
+    while (ss >> token) {
+        tokens.push_back(token);
+    }
+    if (tokens.size() == 1 && tokens[0][0] == L'@') {
+        std::wstring macro = tokens[0];
+        std::transform(macro.begin(), macro.end(), macro.begin(), [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+        tokens.clear();
+        for (const auto& item : macros) {
+            if (macro == item.first) {
+                std::wstringstream expanded(item.second);
+                while (expanded >> token) {
+                    tokens.push_back(token);
+                }
+            }
+        }
+    }
+    if (tokens.size() == 5) {
+        tokens.insert(tokens.begin(), L"0");
+        hasSeconds = false;
+    }
+    else if (tokens.size() == 6 && tokens[0] != L"*") {
+        hasSeconds = true;
+    }
+    else {
+        return false;
+    }
+    unsigned long long* masks[] = { &secondMask, &minuteMask, &hourMask, &dayMask, &monthMask, &weekdayMask };
+    for (size_t i = 0; i < 6; i++) {
+        if (!parseField(tokens[i], fields[i], *masks[i])) {
+            return false;
+        }
+    }
+    // Sunday is bit 0
+    if (weekdayMask & (1ULL << 7)) {
+        weekdayMask = (weekdayMask | 1ULL) & ~(1ULL << 7);
+    }
+    std::vector<int>* lists[] = { &seconds, &minutes, &hours, &days, &months, &weekdays };
+    for (size_t i = 0; i < 6; i++) {
+        for (int value = fields[i].first; value <= fields[i].lastOfAll; value++) {
+            if (*masks[i] & (1ULL << value)) {
+                lists[i]->push_back(value);
+            }
+        }
+    }
+    return true;
+}
 
-			int step = std::stoi(match[2]);
-			if (step <= 0) {
-				return false;
-			}
-			if (vecnum == 0) {	// minutes
-				if (start < 0 || start > 59) {
-					return false;
-				}
-				for (int i = start; i < 60; i += step) {
-					fields[vecnum]->push_back(i);
-				}
-			}
-			else if (vecnum == 1) {	// hours
-				if (start < 0 || start > 23) {
-					return false;
-				}
-				for (int i = start; i < 24; i += step) {
-					fields[vecnum]->push_back(i);
-				}
-			}
-			else if (vecnum == 2) {	// days
-				if (start < 1 || start > 31) {
-					return false;
-				}
-				for (int i = start; i < 32; i += step) {
-					fields[vecnum]->push_back(i);
-				}
-			}
-			else if (vecnum == 3) {	// months
-				if (start < 0 || start > 11) {
-					return false;
-				}
-				for (int i = start; i < 12; i += step) {
-					fields[vecnum]->push_back(i);
-				}
-			}
-			else if (vecnum == 4) {	// weekdays
-				if (start < 0 || start > 6) {
-					return false;
-				}
-				for (int i = start; i < 7; i += step) {
-					fields[vecnum]->push_back(i);
-				}
-			}
-		}
-		else if (token == L"") {
-			continue;
-		}
-		else if(std::regex_match(token, std::wregex(L"\\d+"))) {
-			if (vecnum == 0) {
-				if (std::stoi(token) < 0 || std::stoi(token) > 59) {
-					return false;
-				}
-			}
-			else if (vecnum == 1) {
-				if (std::stoi(token) < 0 || std::stoi(token) > 23) {
-					return false;
-				}
-			}
-			else if (vecnum == 2) {
-				if (std::stoi(token) < 1 || std::stoi(token) > 31) {
-					return false;
-				}
-			}
-			else if (vecnum == 3) {
-				if (std::stoi(token) < 0 || std::stoi(token) > 11) {
-					return false;
-				}
-			}
-			else if (vecnum == 4) {
-				if (std::stoi(token) < 0 || std::stoi(token) > 6) {
-					return false;
-				}
-			}
-			fields[vecnum]->push_back(std::stoi(token));
-		}
-		else
-			return false;
-		vecnum++;
+// Parse one field into a bit mask
+bool Crontab::parseField(const std::wstring& token, const Field& field, unsigned long long& mask)
+{
+    mask = 0;
+    size_t start = 0;
+    while (start <= token.size()) {
+        size_t comma = token.find(L',', start);
+        std::wstring item = token.substr(start, comma == std::wstring::npos ? std::wstring::npos : comma - start);
+        start = comma == std::wstring::npos ? token.size() + 1 : comma + 1;
+        // Range or value, optionally followed by a step
+        int step = 1;
+        size_t slash = item.find(L'/');
+        std::wstring range = item.substr(0, slash);
+        if (slash != std::wstring::npos) {
+            std::wstring stepText = item.substr(slash + 1);
+            if (stepText.empty() || stepText.size() > 2 || stepText.find_first_not_of(L"0123456789") != std::wstring::npos) {
+                return false;
+            }
+            step = std::stoi(stepText);
+            if (step <= 0) {
+                return false;
+            }
+        }
+        int low = field.first;
+        int high = field.lastOfAll;
+        size_t dash = range.find(L'-');
+        if (range != L"*") {
+            if (!parseValue(range.substr(0, dash), field, low)) {
+                return false;
+            }
+            if (dash != std::wstring::npos) {
+                if (!parseValue(range.substr(dash + 1), field, high) || high < low) {
+                    return false;
+                }
+            }
+            else if (slash == std::wstring::npos) {
+                high = low;
+            }
+            // A start with a step runs to the end like *
+            else {
+                high = field.lastOfAll;
+            }
+        }
+        for (int value = low; value <= high; value += step) {
+            mask |= 1ULL << value;
+        }
     }
+    return mask != 0;
+}
 
-	if (vecnum != 5) {
-		return false;
-	}
+// Parse a number or a name of a value
+bool Crontab::parseValue(const std::wstring& text, const Field& field, int& value)
+{
+    if (text.empty() || text.size() > 3) {
+        return false;
+    }
+    if (text.find_first_not_of(L"0123456789") == std::wstring::npos) {
+        value = std::stoi(text);
+        return value >= field.first && value <= field.last;
+    }
+    for (int i = 0; field.names && i <= field.last - field.first; i++) {
+        if (_wcsicmp(text.c_str(), field.names[i]) == 0) {
+            value = field.first + i;
+            return true;
+        }
+    }
+    return false;
+}
 
-	// Check if all fields are set
-	if (minutes.empty()) {
-		return false;
-	}
-	if (hours.empty()) {
-		return false;
-	}
-	if (days.empty()) {
-		return false;
-	}
-	if (months.empty()) {
-		return false;
-	}
-	if (weekdays.empty()) {
-		return false;
-	}
-	return true;
+// Find the first set bit of a mask from a position on
+int Crontab::nextBit(unsigned long long mask, int from, int limit)
+{
+    for (int bit = from; bit < limit; bit++) {
+        if (mask & (1ULL << bit)) {
+            return bit;
+        }
+    }
+    return limit;
 }
@@ -24,8 +24,10 @@
 */
 
 #pragma once
+#include <ctime>
 #include <string>
 #include <vector>
+#include <windows.h>
 
 /**
  * \class Crontab
@@ -45,26 +47,181 @@ public:
     ~Crontab();
 
     /**
-     * \brief Parse a crontab string.
+     * \brief Parse a crontab string: five fields (minute, hour, day, month, weekday) or six with a leading seconds
+     *        field, or one of @yearly, @annually, @monthly, @weekly, @daily, @midnight and @hourly. A field is a list
+     *        of *, numbers, names (JAN-DEC, SUN-SAT) and ranges, each optionally with a step (*\/5, 1-30/5, 5/10).
+     *        Weekday 7 is Sunday as well. The seconds field must not be *, a rotation every second is not intended.
+     *        The fields are compiled to bit masks, so checking a time takes no parsing.
      * \param crontabstring The crontab string to parse.
      * \return True if the parsing was successful, false otherwise.
      */
     bool parse(const std::wstring& crontabstring);
 
+    /**
+     * \enum CatchUp
+     * \brief What to do about rotations that were due while the process was busy or asleep.
+     */
+    enum class CatchUp {
+        once, ///< Rotate once for all of them.
+        all, ///< Rotate once for each of them, one after the other.
+        skip ///< Rotate only if the last one was due less than a minute ago.
+    };
+
+    /**
+     * \brief Set the time zone the fields of the crontab are in.
+     * \param name local for the time zone of the system, UTC, or the name of a Windows time zone (e.g. W. Europe Standard Time).
+     * \return True if the time zone is known.
+     */
+    bool setTimeZone(const std::wstring& name);
+
+    /**
+     * \brief Set what to do about missed rotations.
+     * \param policy once, all or skip.
+     * \return True if the policy is valid.
+     */
+    bool setCatchUp(const std::wstring& policy);
+
+    /**
+     * \brief Delay every rotation by a fixed offset within a window, so sections sharing a timer do not all start at
+     *        the same second. The offset is derived from a hash of the name, the same name always gets the same one.
+     * \param name The name the offset is derived from, usually the name of the section.
+     * \param window The window in seconds, 0 for no delay.
+     */
+    void setSplay(const std::wstring& name, time_t window);
+
+    /**
+     * \brief Get the offset every rotation is delayed by.
+     * \return The offset in seconds.
+     */
+    time_t getDelay() const;
+
     /**
      * \brief Check if it's time to rotate.
      * \return True if it's time to rotate, false otherwise.
      */
     bool isTimeToRotate();
+
+    /**
+     * \brief Check if a rotation is due at a point in time. The first call schedules the first rotation at the start
+     *        of the current minute (or second, with a seconds field) or later, later calls compare with the scheduled
+     *        instant, so a rotation is not lost if no call falls into its minute.
+     * \param now The point in time.
+     * \return True if it's time to rotate, false otherwise.
+     */
+    bool isTimeToRotate(time_t now);
+
+    /**
+     * \brief Get the instant of the next rotation including the delay, without checking or consuming it. The first
+     *        call schedules the first rotation like the first check does.
+     * \param now The point in time.
+     * \return The instant, in the past if a rotation is overdue, or -1 if the crontab never matches.
+     */
+    time_t nextRotation(time_t now);
+
+    /**
+     * \brief Get the first instant after a point in time at which the crontab matches. Each wall clock time fires once:
+     *        a time skipped by a DST change fires at the end of the gap, a time repeated by it only the first time.
+     * \param t The point in time.
+     * \return The instant or -1 if the crontab never matches.
+     */
+    time_t fireAfter(time_t t) const;
+
 #ifndef UNITTEST
 private:
 #endif
-    tm last; ///< The last time the crontab was checked.
+    /**
+     * \struct Field
+     * \brief The valid values of a field.
+     */
+    struct Field {
+        int first; ///< The smallest value.
+        int last; ///< The largest value.
+        int lastOfAll; ///< The largest value of *, differs from last for the weekdays.
+        const wchar_t* const* names; ///< The names of the values from first on, or null.
+    };
+
+    /**
+     * \brief Parse one field into a bit mask.
+     * \param token The field.
+     * \param field The valid values.
+     * \param mask The bit of each value is set here.
+     * \return True if the field is valid.
+     */
+    static bool parseField(const std::wstring& token, const Field& field, unsigned long long& mask);
+
+    /**
+     * \brief Parse a number or a name of a value.
+     * \param text The text.
+     * \param field The valid values.
+     * \param value The value is returned here.
+     * \return True if the text is a valid value.
+     */
+    static bool parseValue(const std::wstring& text, const Field& field, int& value);
+
+    /**
+     * \brief Find the first set bit of a mask from a position on.
+     * \param mask The mask.
+     * \param from The position.
+     * \param limit The position after the last one to look at.
+     * \return The position of the bit or limit if there is none.
+     */
+    static int nextBit(unsigned long long mask, int from, int limit);
+
+    /**
+     * \brief Check if a wall clock time matches all fields.
+     * \param wall The wall clock time.
+     * \return True if it matches.
+     */
+    bool matches(const tm& wall) const;
+
+    /**
+     * \brief Advance a wall clock time to the next second that matches all fields, by whole months, days, hours and
+     *        minutes where those fields do not match.
+     * \param wall The wall clock time to start at, returned at the match.
+     * \return False if nothing matches within maxSearchSteps.
+     */
+    bool nextMatch(tm& wall) const;
+
+    /**
+     * \brief Get the wall clock time of an instant in the time zone.
+     * \param t The instant.
+     * \param wall The wall clock time is returned here.
+     * \return True on success.
+     */
+    bool toWall(time_t t, tm& wall) const;
+
+    /**
+     * \brief Get the instant of a wall clock time in the time zone.
+     * \param wall The wall clock time.
+     * \return The instant or -1 on error.
+     */
+    time_t fromWall(const tm& wall) const;
+
+    /**
+     * \enum Zone
+     * \brief The kind of time zone.
+     */
+    enum class Zone { local, utc, named };
+
     std::wstring crontabstring; ///< The crontab string.
+    std::vector<int> seconds; ///< The seconds field of the crontab, 0 without one.
     std::vector<int> minutes; ///< The minutes field of the crontab.
     std::vector<int> hours; ///< The hours field of the crontab.
     std::vector<int> days; ///< The days field of the crontab.
     std::vector<int> months; ///< The months field of the crontab.
     std::vector<int> weekdays; ///< The weekdays field of the crontab.
+    unsigned long long secondMask; ///< Bit n is set if second n matches.
+    unsigned long long minuteMask; ///< Bit n is set if minute n matches.
+    unsigned long long hourMask; ///< Bit n is set if hour n matches.
+    unsigned long long dayMask; ///< Bit n is set if day n of the month matches.
+    unsigned long long monthMask; ///< Bit n is set if month n (1-12) matches.
+    unsigned long long weekdayMask; ///< Bit n is set if weekday n (0 is Sunday) matches.
+    bool hasSeconds; ///< Whether the crontab has a seconds field.
+    time_t next; ///< The instant of the next rotation without the delay, 0 before the first check.
+    time_t delay; ///< The offset every rotation is delayed by.
+    CatchUp catchUp; ///< What to do about missed rotations.
+    Zone zone; ///< The kind of time zone of the fields.
+    DYNAMIC_TIME_ZONE_INFORMATION zoneInfo; ///< The rules of a named time zone.
+    static const int maxSearchSteps = 100000; ///< Bounds the search for a match, enough for every valid crontab.
+    static const time_t lateGrace = 60; ///< With skip, how late a rotation may still run.
 };
-
@@ -0,0 +1,410 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "executor.h"
+#include "bloom.h"
+#include "fileio.h"
+#include "logging.h"
+#include "tail.h"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <cwctype>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// Constructor
+Executor::Executor() : Executor(FileSystem::disk()) {
+}
+
+// Constructor for another file system
+Executor::Executor(FileSystem& fileSystem) : fileSystem(fileSystem), flushMicroseconds(0), flushCount(0) {
+}
+
+// Destructor
+Executor::~Executor() {
+}
+
+// Execute a single operation unless it depends on one that failed
+bool Executor::runChained(const Plan::Operation& operation) {
+    std::wstring source = fileKey(operation.source);
+    std::wstring target = fileKey(operation.target);
+    bool skipped;
+    {
+        std::lock_guard<std::mutex> lock(failedMutex);
+        skipped = failed.count(source) > 0 || (!target.empty() && failed.count(target) > 0);
+    }
+    if (skipped) {
+        Logging::warning(L"Skipped " + Plan::typeName(operation.type) + L" of " + operation.source + L", it depends on a failed operation");
+    }
+    bool ok = !skipped && run(operation);
+    std::lock_guard<std::mutex> lock(failedMutex);
+    if (ok) {
+        succeeded.insert(&operation);
+        return true;
+    }
+    failed.insert(source);
+    if (!target.empty()) {
+        failed.insert(target);
+    }
+    return false;
+}
+
+// Check whether a file of the last executed plan was touched by an operation that failed or was skipped
+bool Executor::hasFailed(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(failedMutex);
+    return failed.count(fileKey(path)) > 0;
+}
+
+// Get the operations of the last executed plan that succeeded
+Plan Executor::getExecuted(const Plan& plan) {
+    std::lock_guard<std::mutex> lock(failedMutex);
+    Plan executed;
+    for (const auto& operation : plan.getOperations()) {
+        if (succeeded.count(&operation) > 0) {
+            executed.add(operation.type, operation.source, operation.target, operation.bytes);
+        }
+    }
+    return executed;
+}
+
+// Get the key of a file for comparisons
+std::wstring Executor::fileKey(const std::wstring& path) {
+    std::wstring lower(path);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+    return lower;
+}
+
+// Execute a single operation
+bool Executor::run(const Plan::Operation& operation) {
+    switch (operation.type) {
+    case Plan::remove:
+        if (options.backgroundDelete) {
+            return reaper.remove(operation.source, options.shrinkStep);
+        }
+        if (!fileSystem.remove(operation.source)) {
+            Logging::error(L"Could not remove " + operation.source);
+            return false;
+        }
+        Logging::debug(L"Removed " + operation.source);
+        return true;
+    case Plan::rename:
+        if (!fileSystem.rename(operation.source, operation.target)) {
+            Logging::error(L"Could not rename " + operation.source + L" to " + operation.target);
+            return false;
+        }
+        Logging::debug(L"Renamed " + operation.source + L" to " + operation.target);
+        return true;
+    case Plan::copy: {
+        // The copy has to be on disk before the truncation of its source
+        if (!fileSystem.copy(operation.source, operation.target) || !flush(operation.target)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(copiesMutex);
+        copies[operation.source] = operation.target;
+        return true;
+    }
+    case Plan::truncate: {
+        std::wstring copy;
+        {
+            std::lock_guard<std::mutex> lock(copiesMutex);
+            std::map<std::wstring, std::wstring>::iterator it = copies.find(operation.source);
+            if (it != copies.end()) {
+                copy = it->second;
+            }
+        }
+        // Followers stop reading the file until the marker says where the copy ends and the truncation is done
+        std::wstring markerFile = Tail::markerName(operation.source);
+        Tail::Marker previous;
+        bool hadMarker = options.tailMarker && Tail::readMarker(markerFile, previous);
+        Tail::Marker marker = previous;
+        if (options.tailMarker) {
+            marker.generation = copy;
+            marker.size = 0;
+            marker.sequence++;
+            marker.time = time(nullptr);
+            marker.done = false;
+            if (!Tail::writeMarker(markerFile, marker)) {
+                return false;
+            }
+        }
+        // What was written during the copy goes to the copy as well
+        if (!fileSystem.truncate(operation.source, copy, options.durable, marker.size)) {
+            Logging::error(L"Could not truncate " + operation.source);
+            // Nothing was truncated, followers go on reading where they are
+            if (hadMarker) {
+                Tail::writeMarker(markerFile, previous);
+            }
+            else if (options.tailMarker) {
+                std::error_code ec;
+                std::filesystem::remove(markerFile, ec);
+            }
+            return false;
+        }
+        if (options.tailMarker) {
+            marker.done = true;
+            Tail::writeMarker(markerFile, marker);
+        }
+        if (!copy.empty()) {
+            flush(copy);
+        }
+        flush(operation.source);
+        Logging::info(L"Truncated " + operation.source);
+        return true;
+    }
+    case Plan::compress: {
+#ifdef WITH_ZLIB
+        std::unique_ptr<Bloom> bloom;
+        if (options.bloomRate > 0) {
+            bloom.reset(new Bloom(operation.bytes, options.bloomRate, options.bloomTokenChars));
+        }
+        if (!fileSystem.compress(operation.source, options.blockSize, bloom.get())) {
+            Logging::error(L"Could not compress " + operation.source);
+            return false;
+        }
+        // Keep the uncompressed file until the compressed one is on disk
+        if (!flush(operation.target)) {
+            return false;
+        }
+        // Without its filter a generation is only searched completely
+        if (bloom) {
+            bloom->save(Bloom::fileName(operation.target), options.durable);
+        }
+        fileSystem.remove(operation.source);
+        Logging::info(L"Compressed " + operation.source);
+        return true;
+#else
+        return false;
+#endif
+    }
+    case Plan::merge: {
+        if (!fileSystem.append(operation.target, operation.source, options.durable)) {
+            return false;
+        }
+        fileSystem.remove(operation.source);
+        return true;
+    }
+    }
+    return false;
+}
+
+// Find the end of the batch starting at an operation
+size_t Executor::batchEnd(const std::vector<const Plan::Operation*>& operations, size_t begin) {
+    std::set<std::wstring> touched;
+    size_t end = begin;
+    for (; end < operations.size(); end++) {
+        std::wstring source = fileKey(operations[end]->source);
+        std::wstring target = fileKey(operations[end]->target);
+        if (touched.count(source) > 0 || (!target.empty() && touched.count(target) > 0)) {
+            break;
+        }
+        touched.insert(source);
+        if (!target.empty()) {
+            touched.insert(target);
+        }
+    }
+    return end;
+}
+
+// Execute a batch of independent operations on parallel threads
+bool Executor::runBatch(const std::vector<const Plan::Operation*>& operations) {
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    auto worker = [&]() {
+        for (size_t i = next++; i < operations.size(); i = next++) {
+            if (!runChained(*operations[i])) {
+                ok = false;
+            }
+        }
+    };
+    size_t threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), operations.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+        try {
+            threads.emplace_back(worker);
+        }
+        catch (const std::system_error&) {
+            // The threads that did start and this one share the rest
+            break;
+        }
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return ok;
+}
+
+// Hand a file left over from an earlier background deletion to the background thread again
+void Executor::reap(const std::wstring& path, unsigned long long shrinkStep) {
+    reaper.reap(path, shrinkStep);
+}
+
+// Flush a file or directory to disk if the plan is executed durable
+bool Executor::flush(const std::wstring& path) {
+    if (!options.durable) {
+        return true;
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool ok = FileIO::flush(path);
+    flushMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    flushCount++;
+    return ok;
+}
+
+// Flush changed directories to disk and forget them
+bool Executor::flushDirectories(std::set<std::wstring>& directories) {
+    bool ok = true;
+    for (const auto& directory : directories) {
+        ok = flush(directory) && ok;
+    }
+    directories.clear();
+    return ok;
+}
+
+// Execute a plan
+bool Executor::execute(const Plan& plan, std::map<std::wstring, uintmax_t>& sizes, const Options& options) {
+    this->options = options;
+    copies.clear();
+    failed.clear();
+    succeeded.clear();
+    flushMicroseconds = 0;
+    flushCount = 0;
+    std::set<std::wstring> directories;
+    bool ok = executeOperations(plan, sizes, directories);
+    // One flush per directory covers all renames and removals since the last one
+    ok = flushDirectories(directories) && ok;
+    if (options.durable && flushCount > 0) {
+        Logging::info(L"Flushed " + std::to_wstring(flushCount) + L" files and directories in " + std::to_wstring(flushMicroseconds) + L" microseconds");
+    }
+    return ok;
+}
+
+// Execute the operations of a plan
+bool Executor::executeOperations(const Plan& plan, std::map<std::wstring, uintmax_t>& sizes, std::set<std::wstring>& directories) {
+    std::vector<const Plan::Operation*> compressions;
+    std::vector<const Plan::Operation*> merges;
+    std::vector<const Plan::Operation*> operations;
+    for (const auto& operation : plan.getOperations()) {
+        if (operation.type == Plan::compress) {
+            compressions.push_back(&operation);
+        }
+        else if (operation.type == Plan::merge) {
+            merges.push_back(&operation);
+            if (options.durable) {
+                directories.insert(std::filesystem::path(operation.target).parent_path().wstring());
+            }
+        }
+        else {
+            operations.push_back(&operation);
+        }
+    }
+    bool ok = true;
+    for (size_t begin = 0; begin < operations.size();) {
+        size_t end = options.batched ? batchEnd(operations, begin) : begin + 1;
+        bool truncates = std::any_of(operations.begin() + begin, operations.begin() + end, [](const Plan::Operation* operation) { return operation->type == Plan::truncate; });
+        // A truncation destroys data, so the renamed and copied generations have to be in their directories on disk first
+        if (truncates && !flushDirectories(directories)) {
+            // Nothing that is left is safe to do
+            std::lock_guard<std::mutex> lock(failedMutex);
+            for (const auto* list : { &operations, &compressions, &merges }) {
+                for (size_t i = list == &operations ? begin : 0; i < list->size(); i++) {
+                    failed.insert(fileKey((*list)[i]->source));
+                    if (!(*list)[i]->target.empty()) {
+                        failed.insert(fileKey((*list)[i]->target));
+                    }
+                }
+            }
+            return false;
+        }
+        for (size_t i = begin; options.durable && i < end; i++) {
+            directories.insert(std::filesystem::path(operations[i]->source).parent_path().wstring());
+            if (!operations[i]->target.empty()) {
+                directories.insert(std::filesystem::path(operations[i]->target).parent_path().wstring());
+            }
+        }
+        // Later operations that rely on a failed one (e.g. a truncate on its copy) are skipped, the others still run
+        if (!(end - begin == 1 ? runChained(*operations[begin]) : runBatch(std::vector<const Plan::Operation*>(operations.begin() + begin, operations.begin() + end)))) {
+            ok = false;
+        }
+        begin = end;
+    }
+    if (options.durable) {
+        for (const auto* compression : compressions) {
+            directories.insert(std::filesystem::path(compression->target).parent_path().wstring());
+        }
+    }
+    ok = (compressions.empty() || runCompressions(compressions, sizes)) && ok;
+    // Merges append compressed generations, possibly the ones just compressed, so they come last
+    for (const auto* merge : merges) {
+        ok = runChained(*merge) && ok;
+    }
+    return ok;
+}
+
+// Execute compressions on parallel threads
+bool Executor::runCompressions(std::vector<const Plan::Operation*>& compressions, std::map<std::wstring, uintmax_t>& sizes) {
+    // Largest first, so the threads finish at about the same time
+    std::sort(compressions.begin(), compressions.end(), [](const Plan::Operation* a, const Plan::Operation* b) { return a->bytes > b->bytes; });
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    std::mutex sizesMutex;
+    auto worker = [&]() {
+        for (size_t i = next++; i < compressions.size(); i = next++) {
+            if (!runChained(*compressions[i])) {
+                ok = false;
+                continue;
+            }
+            uintmax_t size = 0;
+            try {
+                size = fileSystem.fileSize(compressions[i]->target);
+            }
+            catch (const std::filesystem::filesystem_error&) {
+            }
+            std::lock_guard<std::mutex> lock(sizesMutex);
+            sizes[compressions[i]->target] = size;
+        }
+    };
+    size_t threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), compressions.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+        try {
+            threads.emplace_back(worker);
+        }
+        catch (const std::system_error&) {
+            // The threads that did start and this one share the rest
+            break;
+        }
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return ok;
+}
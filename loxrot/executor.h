@@ -0,0 +1,197 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "plan.h"
+#include "reaper.h"
+#include "vfs.h"
+
+/**
+ * \class Executor
+ * \brief A class to carry out the operations of a plan.
+ */
+class Executor
+{
+public:
+    /**
+     * \struct Options
+     * \brief How a plan is executed.
+     */
+    struct Options {
+        bool batched = false; ///< Submit consecutive operations that touch different files together to parallel threads.
+        bool durable = false; ///< Flush new data files to disk and flush the changed directories once per batch of renames.
+        bool backgroundDelete = false; ///< Move files out of the way and delete them on a background thread.
+        unsigned long long shrinkStep = 0; ///< With backgroundDelete, truncate larger files in steps of this size before deleting them.
+        unsigned long long blockSize = 0; ///< If not 0, compress into the seekable format with blocks of this size.
+        double bloomRate = 0; ///< If above 0, build a Bloom filter of the tokens of each compressed file with this false positive rate.
+        std::string bloomTokenChars; ///< The characters that belong to a token of the Bloom filter besides letters and digits.
+        bool tailMarker = false; ///< Write a marker around each truncation, so Tail knows where the truncation happened.
+    };
+
+    /**
+     * \brief Default constructor for Executor, works on the disk.
+     */
+    Executor();
+
+    /**
+     * \brief Constructor for an Executor that works on another file system. Flushing, tail markers, Bloom filters and
+     *        background deletion always work on the disk, so they must not be used with a file system in memory.
+     * \param fileSystem The file system to execute the operations on.
+     */
+    Executor(FileSystem& fileSystem);
+
+    /**
+     * \brief Destructor for Executor.
+     */
+    ~Executor();
+
+    /**
+     * \brief Execute a plan. Removals, renames, copies and truncations run in the planned order. Compressions only
+     *        depend on those, so they run afterwards on parallel threads. Merges may take the results of compressions,
+     *        so they run last in the planned order. A failed operation only stops the operations that depend on it:
+     *        every later operation that touches one of its files is skipped, and in turn the ones touching the files of
+     *        a skipped operation. The chain of one log file does not share files with the chains of the others, so
+     *        they are still executed.
+     * \param plan The plan to execute.
+     * \param sizes The size of every file created by a compression is returned here, keyed by its path.
+     * \param options With batched, consecutive operations that touch different files are submitted together as a batch
+     *        to parallel threads instead of one after the other, operations sharing a file stay ordered. With durable,
+     *        copies, truncated files and compressed files are flushed to disk when they are written, and the directories
+     *        of all renames and removals are flushed once before a truncation destroys data and once at the end.
+     * \return True if all operations succeeded.
+     */
+    bool execute(const Plan& plan, std::map<std::wstring, uintmax_t>& sizes, const Options& options);
+
+    /**
+     * \brief Check whether a file of the last executed plan was touched by an operation that failed or was skipped.
+     * \param path The file.
+     * \return True if its chain of operations stopped.
+     */
+    bool hasFailed(const std::wstring& path);
+
+    /**
+     * \brief Get the operations of the last executed plan that succeeded.
+     * \param plan The last executed plan.
+     * \return The operations that succeeded, in the planned order.
+     */
+    Plan getExecuted(const Plan& plan);
+
+    /**
+     * \brief Hand a file left over from an earlier background deletion to the background thread again.
+     * \param path The file renamed out of the way for deletion.
+     * \param shrinkStep If not 0, a file larger than this is truncated in steps of this many bytes before it is deleted.
+     */
+    void reap(const std::wstring& path, unsigned long long shrinkStep);
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \brief Execute a single operation.
+     * \param operation The operation.
+     * \return True on success.
+     */
+    bool run(const Plan::Operation& operation);
+
+    /**
+     * \brief Execute a single operation unless it depends on one that failed. The files of a failed or skipped
+     *        operation are remembered, so the operations after it that depend on it are skipped as well.
+     * \param operation The operation.
+     * \return True on success.
+     */
+    bool runChained(const Plan::Operation& operation);
+
+    /**
+     * \brief Get the key of a file for comparisons, file names are case insensitive.
+     * \param path The file.
+     * \return The path in lower case.
+     */
+    static std::wstring fileKey(const std::wstring& path);
+
+    /**
+     * \brief Find the end of the batch starting at an operation. A batch ends before the first operation that touches a
+     *        file an earlier operation of the batch touches, because it has to wait for that one.
+     * \param operations The operations in planned order.
+     * \param begin The index of the first operation of the batch.
+     * \return The index after the last operation of the batch.
+     */
+    static size_t batchEnd(const std::vector<const Plan::Operation*>& operations, size_t begin);
+
+    /**
+     * \brief Execute a batch of independent operations on parallel threads. If no thread can be started the calling
+     *        thread executes the whole batch on its own.
+     * \param operations The operations of the batch.
+     * \return True if all operations succeeded.
+     */
+    bool runBatch(const std::vector<const Plan::Operation*>& operations);
+
+    /**
+     * \brief Execute compressions on parallel threads, largest first.
+     * \param compressions The compressions.
+     * \param sizes The size of every file created by a compression is returned here, keyed by its path.
+     * \return True if all compressions succeeded.
+     */
+    bool runCompressions(std::vector<const Plan::Operation*>& compressions, std::map<std::wstring, uintmax_t>& sizes);
+
+    /**
+     * \brief Execute the operations of a plan, see execute.
+     * \param plan The plan to execute.
+     * \param sizes The size of every file created by a compression is returned here, keyed by its path.
+     * \param directories The directories changed by the executed operations are added here.
+     * \return True if all operations succeeded.
+     */
+    bool executeOperations(const Plan& plan, std::map<std::wstring, uintmax_t>& sizes, std::set<std::wstring>& directories);
+
+    /**
+     * \brief Flush a file or directory to disk if the plan is executed durable and account for the time it takes.
+     * \param path The file or directory.
+     * \return True on success or if nothing has to be flushed.
+     */
+    bool flush(const std::wstring& path);
+
+    /**
+     * \brief Flush changed directories to disk and forget them.
+     * \param directories The changed directories.
+     * \return True on success.
+     */
+    bool flushDirectories(std::set<std::wstring>& directories);
+
+    FileSystem& fileSystem; ///< The file system the operations are executed on.
+    Options options; ///< The options of the plan that is executed.
+    std::map<std::wstring, std::wstring> copies; ///< The copy of each file copied by the current plan, a truncation appends what was written since.
+    std::mutex copiesMutex; ///< Guards copies against parallel operations of a batch.
+    std::set<std::wstring> failed; ///< The keys of the files of the failed and skipped operations of the current plan.
+    std::set<const Plan::Operation*> succeeded; ///< The operations of the current plan that succeeded.
+    std::mutex failedMutex; ///< Guards failed and succeeded against parallel operations.
+    std::atomic<long long> flushMicroseconds; ///< Time spent flushing while executing the current plan.
+    std::atomic<int> flushCount; ///< Number of flushes while executing the current plan.
+    Reaper reaper; ///< Deletes files in the background.
+};
@@ -0,0 +1,529 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#ifdef WITH_ZLIB
+#ifdef _STATIC
+#pragma comment(lib, "zlibstat.lib") // Link with zlib statically
+#else
+#pragma comment(lib, "zlib.lib") // Link with zlib dynamically
+#endif
+#endif
+#include "fileio.h"
+#include "logging.h"
+#include "seekable.h"
+#include "bloom.h"
+#include <algorithm>
+#include <filesystem>
+#include <winioctl.h>
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+// Allocate a page-aligned buffer
+FileIO::Buffer::Buffer(DWORD size) : size(size) {
+    data = static_cast<char*>(VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (data == NULL) {
+        throw std::bad_alloc();
+    }
+}
+
+// Free the buffer
+FileIO::Buffer::~Buffer() {
+    VirtualFree(data, 0, MEM_RELEASE);
+}
+
+// Constructor
+FileIO::Output::Output() : handle(INVALID_HANDLE_VALUE), unbuffered(false), buffer(bufferSize), used(0), written(0) {
+}
+
+// Destructor
+FileIO::Output::~Output() {
+    if (handle != INVALID_HANDLE_VALUE) {
+        close();
+    }
+}
+
+// Create the file
+bool FileIO::Output::open(const std::wstring& filename) {
+    used = 0;
+    written = 0;
+    unbuffered = true;
+    handle = CreateFileW(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE && GetLastError() != ERROR_FILE_EXISTS) {
+        // The file system does not support unbuffered handles
+        unbuffered = false;
+        handle = CreateFileW(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    return handle != INVALID_HANDLE_VALUE;
+}
+
+// Append data to the file
+bool FileIO::Output::write(const char* data, size_t length) {
+    while (length > 0) {
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(length, buffer.size - used));
+        memcpy(buffer.data + used, data, chunk);
+        used += chunk;
+        data += chunk;
+        length -= chunk;
+        if (used == buffer.size) {
+            DWORD bytes = 0;
+            if (!WriteFile(handle, buffer.data, used, &bytes, NULL) || bytes != used) {
+                return false;
+            }
+            written += used;
+            used = 0;
+        }
+    }
+    return true;
+}
+
+// Write the rest of the buffer, cut the block padding off and close the file
+bool FileIO::Output::close() {
+    bool ok = true;
+    if (used > 0) {
+        // Unbuffered writes must cover whole blocks, the padding is cut off below
+        DWORD length = unbuffered ? static_cast<DWORD>(alignUp(used)) : used;
+        memset(buffer.data + used, 0, length - used);
+        DWORD bytes = 0;
+        ok = WriteFile(handle, buffer.data, length, &bytes, NULL) && bytes == length;
+    }
+    written += used;
+    used = 0;
+    LARGE_INTEGER end;
+    end.QuadPart = written;
+    if (ok && unbuffered) {
+        ok = SetFilePointerEx(handle, end, NULL, FILE_BEGIN) && SetEndOfFile(handle);
+    }
+    CloseHandle(handle);
+    handle = INVALID_HANDLE_VALUE;
+    return ok;
+}
+
+// Get the number of bytes appended so far
+long long FileIO::Output::size() const {
+    return written + used;
+}
+
+// Round a length up to the next multiple of alignment
+long long FileIO::alignUp(long long length) {
+    return (length + alignment - 1) / alignment * alignment;
+}
+
+// Open a file for sequential reading
+HANDLE FileIO::openInput(const std::wstring& filename, long long& size) {
+    std::error_code ec;
+    size = static_cast<long long>(std::filesystem::file_size(filename, ec));
+    if (ec) {
+        return INVALID_HANDLE_VALUE;
+    }
+    // The application may still write to the file, so share everything
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    if (size >= unbufferedThreshold) {
+        handle = CreateFileW(filename.c_str(), GENERIC_READ, share, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    if (handle == INVALID_HANDLE_VALUE) {
+        handle = CreateFileW(filename.c_str(), GENERIC_READ, share, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    return handle;
+}
+
+// Read from the current position of a file opened by openInput
+long long FileIO::read(HANDLE file, Buffer& buffer, long long length) {
+    DWORD toRead = static_cast<DWORD>(std::min<long long>(alignUp(length), buffer.size));
+    DWORD bytes = 0;
+    if (!ReadFile(file, buffer.data, toRead, &bytes, NULL)) {
+        return -1;
+    }
+    return std::min<long long>(bytes, length);
+}
+
+// Get the ranges of a file that contain data
+bool FileIO::getDataRanges(HANDLE file, long long size, std::vector<Range>& ranges) {
+    ranges.clear();
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    query.FileOffset.QuadPart = 0;
+    query.Length.QuadPart = size;
+    FILE_ALLOCATED_RANGE_BUFFER allocated[64];
+    while (query.Length.QuadPart > 0) {
+        DWORD bytes = 0;
+        BOOL ok = DeviceIoControl(file, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), allocated, sizeof(allocated), &bytes, NULL);
+        DWORD error = ok ? ERROR_SUCCESS : GetLastError();
+        if (!ok && error != ERROR_MORE_DATA) {
+            // The file system does not support the query, so treat the file as all data
+            ranges.clear();
+            ranges.push_back({ 0, size });
+            return false;
+        }
+        DWORD count = bytes / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+        for (DWORD i = 0; i < count; i++) {
+            ranges.push_back({ allocated[i].FileOffset.QuadPart, allocated[i].Length.QuadPart });
+        }
+        if (error != ERROR_MORE_DATA || count == 0) {
+            break;
+        }
+        // Continue the query behind the last returned range
+        long long next = allocated[count - 1].FileOffset.QuadPart + allocated[count - 1].Length.QuadPart;
+        query.Length.QuadPart = size - next;
+        query.FileOffset.QuadPart = next;
+    }
+    // Clamp the ranges to the size, the file system may report allocation beyond it
+    long long dataBytes = 0;
+    for (auto& range : ranges) {
+        if (range.offset + range.length > size) {
+            range.length = size > range.offset ? size - range.offset : 0;
+        }
+        dataBytes += range.length;
+    }
+    return dataBytes < size;
+}
+
+// Copy a file while keeping holes as holes
+bool FileIO::copyFile(const std::wstring& source, const std::wstring& target) {
+    long long size = 0;
+    HANDLE hSource = openInput(source, size);
+    if (hSource == INVALID_HANDLE_VALUE) {
+        Logging::error(L"Could not open " + source + L" for copying");
+        return false;
+    }
+    // The target is written unbuffered as well if the source is large; data ranges start at cluster boundaries,
+    // so every write starts aligned and only the last one needs padding, which SetEndOfFile cuts off again
+    bool unbuffered = size >= unbufferedThreshold;
+    HANDLE hTarget = CreateFileW(target.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, (unbuffered ? FILE_FLAG_NO_BUFFERING : 0) | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hTarget == INVALID_HANDLE_VALUE && unbuffered && GetLastError() != ERROR_FILE_EXISTS) {
+        unbuffered = false;
+        hTarget = CreateFileW(target.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    if (hTarget == INVALID_HANDLE_VALUE) {
+        Logging::error(L"Could not create " + target);
+        CloseHandle(hSource);
+        return false;
+    }
+
+    std::vector<Range> ranges;
+    if (getDataRanges(hSource, size, ranges)) {
+        // Mark the target as sparse, so the skipped ranges stay unallocated
+        DWORD bytes = 0;
+        DeviceIoControl(hTarget, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL);
+    }
+
+    Buffer buffer(bufferSize);
+    bool ok = true;
+    // Where the copy ends, before the end of the source if it shrank while copying
+    long long copied = size;
+    for (const auto& range : ranges) {
+        LARGE_INTEGER offset;
+        offset.QuadPart = range.offset;
+        if (!SetFilePointerEx(hSource, offset, NULL, FILE_BEGIN) || !SetFilePointerEx(hTarget, offset, NULL, FILE_BEGIN)) {
+            ok = false;
+            break;
+        }
+        long long remaining = range.length;
+        while (remaining > 0) {
+            long long bytesRead = read(hSource, buffer, remaining);
+            if (bytesRead < 0) {
+                ok = false;
+                break;
+            }
+            if (bytesRead == 0) {
+                // The file shrank while copying, nothing behind this point is left to copy
+                copied = range.offset + range.length - remaining;
+                break;
+            }
+            DWORD length = static_cast<DWORD>(unbuffered ? alignUp(bytesRead) : bytesRead);
+            memset(buffer.data + bytesRead, 0, length - static_cast<DWORD>(bytesRead));
+            DWORD written = 0;
+            if (!WriteFile(hTarget, buffer.data, length, &written, NULL) || written != length) {
+                ok = false;
+                break;
+            }
+            remaining -= bytesRead;
+        }
+        if (!ok || copied < size) {
+            break;
+        }
+    }
+    // Cut off the padding; a trailing hole is created by setting the size as well
+    LARGE_INTEGER end;
+    end.QuadPart = copied;
+    if (ok && (!SetFilePointerEx(hTarget, end, NULL, FILE_BEGIN) || !SetEndOfFile(hTarget))) {
+        ok = false;
+    }
+    CloseHandle(hTarget);
+    CloseHandle(hSource);
+    if (!ok) {
+        Logging::error(L"Could not copy " + source + L" to " + target);
+        DeleteFileW(target.c_str());
+    }
+    return ok;
+}
+
+// Append what was written to a file since it was copied to the copy and truncate the file
+bool FileIO::catchUpAndTruncate(const std::wstring& source, const std::wstring& target, bool durable, unsigned long long& size) {
+    HANDLE hSource = CreateFileW(source.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hSource == INVALID_HANDLE_VALUE) {
+        Logging::error(L"Could not open " + source + L" for truncating");
+        return false;
+    }
+    // The delta starts at any offset, so the copy is appended to buffered
+    HANDLE hTarget = CreateFileW(target.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER copied;
+    if (hTarget == INVALID_HANDLE_VALUE || !GetFileSizeEx(hTarget, &copied) ||
+        !SetFilePointerEx(hSource, copied, NULL, FILE_BEGIN) || !SetFilePointerEx(hTarget, copied, NULL, FILE_BEGIN)) {
+        Logging::error(L"Could not append to " + target);
+        if (hTarget != INVALID_HANDLE_VALUE) {
+            CloseHandle(hTarget);
+        }
+        CloseHandle(hSource);
+        return false;
+    }
+    Buffer buffer(bufferSize);
+    bool ok = true;
+    long long total = 0;
+    int passes = 0;
+    bool flushed = !durable;
+    while (ok) {
+        long long pass = 0;
+        DWORD bytes = 0;
+        while ((ok = ReadFile(hSource, buffer.data, buffer.size, &bytes, NULL) != 0) && bytes > 0) {
+            DWORD written = 0;
+            if (!WriteFile(hTarget, buffer.data, bytes, &written, NULL) || written != bytes) {
+                ok = false;
+                break;
+            }
+            pass += bytes;
+        }
+        total += pass;
+        passes++;
+        if (!ok || ((pass < catchUpThreshold || passes >= maxCatchUpPasses) && flushed)) {
+            break;
+        }
+        // Flushing takes a while, the data written meanwhile is picked up by another short pass
+        if (!flushed && (pass < catchUpThreshold || passes >= maxCatchUpPasses)) {
+            ok = FlushFileBuffers(hTarget) != 0;
+            flushed = true;
+        }
+    }
+    // Right after the end of the file was read
+    LARGE_INTEGER start;
+    start.QuadPart = 0;
+    if (ok && (!SetFilePointerEx(hSource, start, NULL, FILE_BEGIN) || !SetEndOfFile(hSource))) {
+        Logging::error(L"Could not truncate " + source);
+        ok = false;
+    }
+    // The file keeps all its data, so the copy must not have any of it twice
+    if (!ok && (!SetFilePointerEx(hTarget, copied, NULL, FILE_BEGIN) || !SetEndOfFile(hTarget))) {
+        Logging::error(L"Could not restore the size of " + target);
+    }
+    size = static_cast<unsigned long long>(ok ? copied.QuadPart + total : copied.QuadPart);
+    CloseHandle(hTarget);
+    CloseHandle(hSource);
+    if (ok && total > 0) {
+        Logging::debug(L"Copied " + std::to_wstring(total) + L" bytes written to " + source + L" during the copy in " + std::to_wstring(passes) + L" passes");
+    }
+    return ok;
+}
+
+// Set the creation time of a file
+void FileIO::setCreationTime(const std::wstring& filename) {
+    // Open the file
+    HANDLE hFile = CreateFileW(filename.c_str(), FILE_WRITE_ATTRIBUTES, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        Logging::error(L"Could not open file " + filename + L" for setting creation time");
+
+    // Get the current system time
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+
+    // Set the creation time of the file
+    if (!SetFileTime(hFile, &ft, NULL, NULL)) {
+        CloseHandle(hFile);
+        Logging::error(L"Could not set creation time of " + filename);
+    }
+    
+    CloseHandle(hFile);
+}
+
+// Write a file or directory to disk
+bool FileIO::flush(const std::wstring& path) {
+    // Directories can only be opened with backup semantics, files do not mind
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        Logging::error(L"Could not open " + path + L" for flushing");
+        return false;
+    }
+    bool ok = FlushFileBuffers(handle) != 0;
+    if (!ok) {
+        Logging::error(L"Could not flush " + path);
+    }
+    CloseHandle(handle);
+    return ok;
+}
+
+#ifdef WITH_ZLIB
+// Compress a file into gzip format
+bool FileIO::compressFile(const std::wstring& filename, unsigned long long blockSize, Bloom* bloom) {
+    long long size = 0;
+    HANDLE hFile = openInput(filename, size);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        Logging::error(L"Could not open " + filename + L" for reading");
+        return false;
+    }
+    Output output;
+    if (!output.open(filename + L".gz")) {
+		Logging::error(L"Could not open " + filename + L".gz for writing");
+        CloseHandle(hFile);
+        return false;
+	}
+    // Deflate with a gzip header and trailer, so the output stays readable by gzip and zcat
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        output.close();
+        CloseHandle(hFile);
+        std::filesystem::remove(filename + L".gz");
+        return false;
+    }
+    Buffer input(bufferSize);
+    Buffer compressed(bufferSize);
+    // Feed a chunk to deflate and append everything it produces to the output
+    auto deflateChunk = [&](const char* data, long long length, int flush) {
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = static_cast<uInt>(length);
+        do {
+            stream.next_out = reinterpret_cast<Bytef*>(compressed.data);
+            stream.avail_out = compressed.size;
+            if (deflate(&stream, flush) == Z_STREAM_ERROR) {
+                return false;
+            }
+            if (!output.write(compressed.data, compressed.size - stream.avail_out)) {
+                return false;
+            }
+        } while (stream.avail_out == 0);
+        return true;
+    };
+
+    // In the seekable format every block is a gzip member of its own, so it can be inflated without the ones before
+    std::vector<Seekable::Block> blocks;
+    unsigned long long inBlock = 0;
+    unsigned long long lineFeeds = 0;
+    long long uncompressed = 0;
+    auto feed = [&](const char* data, long long length) {
+        if (bloom) {
+            bloom->add(data, static_cast<size_t>(length));
+        }
+        if (blockSize == 0) {
+            return deflateChunk(data, length, Z_NO_FLUSH);
+        }
+        while (length > 0) {
+            if (inBlock == 0) {
+                blocks.push_back({ static_cast<unsigned long long>(output.size()), static_cast<unsigned long long>(uncompressed), lineFeeds });
+            }
+            long long part = static_cast<long long>(std::min<unsigned long long>(length, blockSize - inBlock));
+            if (!deflateChunk(data, part, Z_NO_FLUSH)) {
+                return false;
+            }
+            lineFeeds += std::count(data, data + part, '\n');
+            inBlock += part;
+            uncompressed += part;
+            data += part;
+            length -= part;
+            if (inBlock == blockSize) {
+                if (!deflateChunk(NULL, 0, Z_FINISH) || deflateReset(&stream) != Z_OK) {
+                    return false;
+                }
+                inBlock = 0;
+            }
+        }
+        return true;
+    };
+
+    // Only the ranges containing data are read, holes are fed to deflate from a zeroed buffer
+    std::vector<Range> ranges;
+    getDataRanges(hFile, size, ranges);
+    ranges.push_back({ size, 0 });
+    std::vector<char> zeros;
+    long long position = 0;
+    bool ok = true;
+    for (const auto& range : ranges) {
+        if (position < range.offset && zeros.empty()) {
+            zeros.resize(bufferSize, 0);
+        }
+        while (ok && position < range.offset) {
+            long long hole = std::min<long long>(range.offset - position, bufferSize);
+            ok = feed(zeros.data(), hole);
+            position += hole;
+        }
+        LARGE_INTEGER offset;
+        offset.QuadPart = range.offset;
+        if (!ok || !SetFilePointerEx(hFile, offset, NULL, FILE_BEGIN)) {
+            ok = false;
+            break;
+        }
+        long long remaining = range.length;
+        while (remaining > 0) {
+            long long bytesRead = read(hFile, input, remaining);
+            if (bytesRead <= 0) {
+                ok = bytesRead == 0;
+                break;
+            }
+            if (!feed(input.data, bytesRead)) {
+                ok = false;
+                break;
+            }
+            remaining -= bytesRead;
+            position += bytesRead;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    // Finish the last member, unless the data ended exactly at a block boundary
+    if (ok && (blockSize == 0 || inBlock > 0 || blocks.empty())) {
+        if (blockSize > 0 && blocks.empty()) {
+            blocks.push_back({ 0, 0, 0 });
+        }
+        ok = deflateChunk(NULL, 0, Z_FINISH);
+    }
+    if (ok && blockSize > 0) {
+        blocks.push_back({ static_cast<unsigned long long>(output.size()), static_cast<unsigned long long>(uncompressed), lineFeeds });
+        std::string index = Seekable::formatIndex(blocks, blockSize);
+        ok = output.write(index.data(), index.size());
+    }
+    deflateEnd(&stream);
+    if (!output.close()) {
+        ok = false;
+    }
+    CloseHandle(hFile);
+    if (!ok) {
+        std::error_code ec;
+        std::filesystem::remove(filename + L".gz", ec);
+    }
+    else if (bloom) {
+        bloom->finish();
+    }
+    return ok;
+}
+#endif
@@ -0,0 +1,215 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <windows.h>
+
+class Bloom;
+
+/**
+ * \class FileIO
+ * \brief A class for the file operations of a rotation that need more than std::filesystem offers.
+ *
+ * Large files are read and written unbuffered (FILE_FLAG_NO_BUFFERING) through page-aligned buffers, so copying
+ * and compressing a generation does not push the working set of other processes out of the file system cache.
+ * If a file system refuses unbuffered handles, the cached path with FILE_FLAG_SEQUENTIAL_SCAN is used instead.
+ */
+class FileIO
+{
+public:
+    /**
+     * \struct Range
+     * \brief A range of a file that contains data, everything between two ranges is a hole.
+     */
+    struct Range {
+        long long offset; ///< Start of the range.
+        long long length; ///< Length of the range.
+    };
+
+    /**
+     * \class Buffer
+     * \brief A page-aligned buffer as required for unbuffered I/O.
+     */
+    class Buffer {
+    public:
+        /**
+         * \brief Allocate the buffer.
+         * \param size The size of the buffer, a multiple of alignment.
+         */
+        Buffer(DWORD size);
+
+        /**
+         * \brief Free the buffer.
+         */
+        ~Buffer();
+
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        char* data; ///< The aligned memory.
+        DWORD size; ///< The size of the memory.
+    };
+
+    /**
+     * \class Output
+     * \brief A sequential output file that collects data in an aligned buffer and writes it in whole blocks.
+     */
+    class Output {
+    public:
+        /**
+         * \brief Default constructor for Output.
+         */
+        Output();
+
+        /**
+         * \brief Destructor for Output. Closes the file if it is still open.
+         */
+        ~Output();
+
+        /**
+         * \brief Create the file. The file must not exist.
+         * \param filename The file to create.
+         * \return true or false
+         */
+        bool open(const std::wstring& filename);
+
+        /**
+         * \brief Append data to the file.
+         * \param data The data.
+         * \param length The length of the data.
+         * \return true or false
+         */
+        bool write(const char* data, size_t length);
+
+        /**
+         * \brief Write the rest of the buffer, cut the block padding off and close the file.
+         * \return true or false
+         */
+        bool close();
+
+        /**
+         * \brief Get the number of bytes appended so far.
+         * \return The size of the file.
+         */
+        long long size() const;
+
+    private:
+        HANDLE handle; ///< The handle of the file.
+        bool unbuffered; ///< Whether the handle bypasses the file system cache.
+        Buffer buffer; ///< Data not yet written.
+        DWORD used; ///< Number of bytes used in the buffer.
+        long long written; ///< Number of bytes already written to the file.
+    };
+
+    /**
+     * \brief Open a file for sequential reading, unbuffered if it is large enough to matter.
+     * \param filename The file to open.
+     * \param size The size of the file is returned here.
+     * \return The handle or INVALID_HANDLE_VALUE.
+     */
+    static HANDLE openInput(const std::wstring& filename, long long& size);
+
+    /**
+     * \brief Read from the current position of a file opened by openInput. The length is rounded up to alignment,
+     *        so the buffer must be large enough; only the returned number of bytes are valid.
+     * \param file The handle of the file.
+     * \param buffer The buffer to read into.
+     * \param length The number of bytes wanted.
+     * \return The number of bytes read (0 at the end of the file) or -1 on error.
+     */
+    static long long read(HANDLE file, Buffer& buffer, long long length);
+
+    /**
+     * \brief Get the ranges of a file that contain data (FSCTL_QUERY_ALLOCATED_RANGES).
+     *        If the file system cannot tell, the whole file is returned as one range.
+     * \param file The handle of the opened file.
+     * \param size The size of the file.
+     * \param ranges The ranges containing data, ordered by offset.
+     * \return true if the file contains holes, false otherwise.
+     */
+    static bool getDataRanges(HANDLE file, long long size, std::vector<Range>& ranges);
+
+    /**
+     * \brief Copy a file while keeping holes as holes. The target must not exist. If the source shrinks while it is
+     *        copied, the copy ends where the data ended.
+     * \param source The file to copy.
+     * \param target The file to create.
+     * \return true or false
+     */
+    static bool copyFile(const std::wstring& source, const std::wstring& target);
+
+    /**
+     * \brief Append what was written to a file since it was copied to the copy and truncate the file. The delta is
+     *        copied in passes, each up to the end of the file, until a pass is short; the last pass is followed by the
+     *        truncation on the same handle at once, so only data written in between is lost.
+     * \param source The file that was copied.
+     * \param target The copy, its size is where the delta starts.
+     * \param durable If true, the copy is flushed to disk before the last pass.
+     * \param size The final size of the copy is returned here.
+     * \return true or false
+     */
+    static bool catchUpAndTruncate(const std::wstring& source, const std::wstring& target, bool durable, unsigned long long& size);
+#ifdef WITH_ZLIB
+    /**
+     * \brief Compresses a file with zlib into gzip format. Holes of sparse files are not read but passed to zlib as
+     *        runs of zeros.
+     * \param filename The filename to be compressed. The orifinal file will not be deleted.
+     * \param blockSize If not 0, the output is seekable: every blockSize bytes of input start a new gzip member and the
+     *        offsets of the members are appended as an index (see Seekable).
+     * \param bloom If given, the tokens of the file are added to this filter in the same pass and the filter is finished.
+     * \return true or false
+     */
+    static bool compressFile(const std::wstring& filename, unsigned long long blockSize = 0, Bloom* bloom = nullptr);
+#endif
+    /**
+     * \brief Set the creation time of the truncated file to now.
+     * \param filename The name of the file.
+     * \return void
+     */
+    static void setCreationTime(const std::wstring& filename);
+
+    /**
+     * \brief Write the cached data and metadata of a file or of the entries of a directory to disk.
+     * \param path The file or directory.
+     * \return true or false
+     */
+    static bool flush(const std::wstring& path);
+
+    static const DWORD bufferSize = 1024 * 1024; ///< Size of the buffer used for copying and compressing.
+    static const DWORD alignment = 4096; ///< Alignment of unbuffered offsets and lengths, covers 512 and 4k sectors.
+    static const long long unbufferedThreshold = 8 * 1024 * 1024; ///< Files from this size on are read and written unbuffered.
+    static const long long catchUpThreshold = 64 * 1024; ///< A catch up pass shorter than this is followed by the truncation.
+    static const int maxCatchUpPasses = 8; ///< After this many catch up passes the file is truncated anyway.
+
+private:
+    /**
+     * \brief Round a length up to the next multiple of alignment.
+     * \param length The length.
+     * \return The rounded length.
+     */
+    static long long alignUp(long long length);
+};
@@ -0,0 +1,190 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "glob.h"
+#include "logging.h"
+#include "tools.h"
+#include <algorithm>
+#include <atomic>
+#include <cwctype>
+#include <filesystem>
+#include <system_error>
+#include <thread>
+
+// Constructor
+DirectoryGlob::DirectoryGlob(const std::wstring& pattern, bool recursive, size_t walkers)
+    : pattern(pattern), recursive(recursive), walkers(std::max<size_t>(walkers, 1)), valid(false), notification(INVALID_HANDLE_VALUE) {
+    // The root ends before the first segment with a wildcard
+    std::filesystem::path path(pattern);
+    std::filesystem::path fixed;
+    bool wild = false;
+    for (const auto& segment : path) {
+        if (!wild && !isPattern(segment.wstring())) {
+            fixed /= segment;
+        }
+        else if (!segment.empty()) {
+            wild = true;
+            segments.push_back(segment.wstring());
+        }
+    }
+    root = fixed.wstring();
+}
+
+// Destructor
+DirectoryGlob::~DirectoryGlob() {
+    if (notification != INVALID_HANDLE_VALUE) {
+        FindCloseChangeNotification(notification);
+    }
+}
+
+// Check whether a directory holds wildcards
+bool DirectoryGlob::isPattern(const std::wstring& directory) {
+    return directory.find_first_of(L"*?") != std::wstring::npos;
+}
+
+// Match a name against a pattern with wildcards
+bool DirectoryGlob::match(const std::wstring& pattern, const std::wstring& name) {
+    size_t p = 0;
+    size_t n = 0;
+    // Where the last * was and where the name stood then, to go back to when the rest does not match
+    size_t star = std::wstring::npos;
+    size_t resume = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == L'?' || std::towlower(pattern[p]) == std::towlower(name[n]))) {
+            p++;
+            n++;
+        }
+        else if (p < pattern.size() && pattern[p] == L'*') {
+            star = p++;
+            resume = n;
+        }
+        else if (star != std::wstring::npos) {
+            p = star + 1;
+            n = ++resume;
+        }
+        else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == L'*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+// Get the directories
+std::vector<std::wstring> DirectoryGlob::expand(FileSystem& fileSystem) {
+    if (segments.empty() && !recursive) {
+        return { pattern };
+    }
+    if (&fileSystem != &FileSystem::disk()) {
+        return walk(fileSystem);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (notification != INVALID_HANDLE_VALUE && WaitForSingleObject(notification, 0) == WAIT_OBJECT_0) {
+        valid = false;
+        FindNextChangeNotification(notification);
+    }
+    if (!valid) {
+        // Watched before the walk, so a change during the walk is not missed
+        if (notification == INVALID_HANDLE_VALUE) {
+            notification = FindFirstChangeNotificationW(root.c_str(), TRUE, FILE_NOTIFY_CHANGE_DIR_NAME);
+        }
+        cached = walk(fileSystem);
+        // Without a watch, e.g. while the root does not exist yet, every call walks again
+        valid = notification != INVALID_HANDLE_VALUE;
+    }
+    return cached;
+}
+
+// Get the fixed part of the pattern
+const std::wstring& DirectoryGlob::getRoot() {
+    return root;
+}
+
+// Walk the tree below the root level by level
+std::vector<std::wstring> DirectoryGlob::walk(FileSystem& fileSystem) {
+    std::vector<std::wstring> matches;
+    // The directories of the current level and the segment they are matched against next
+    std::vector<std::wstring> level = { root };
+    for (size_t depth = 0; !level.empty(); depth++) {
+        if (depth >= segments.size()) {
+            matches.insert(matches.end(), level.begin(), level.end());
+            if (!recursive) {
+                break;
+            }
+        }
+        std::vector<std::wstring> next;
+        std::mutex nextMutex;
+        std::atomic<size_t> index(0);
+        auto worker = [&]() {
+            std::vector<std::wstring> found;
+            for (size_t i = index++; i < level.size(); i = index++) {
+                for (auto& child : subdirectories(fileSystem, level[i])) {
+                    if (depth >= segments.size() || match(segments[depth], std::filesystem::path(child).filename().wstring())) {
+                        found.push_back(child);
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> lock(nextMutex);
+            next.insert(next.end(), found.begin(), found.end());
+        };
+        // A level of a few directories is not worth a thread
+        size_t threadCount = std::min(walkers, level.size());
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < threadCount; i++) {
+            try {
+                threads.emplace_back(worker);
+            }
+            catch (const std::system_error&) {
+                break;
+            }
+        }
+        worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        level.swap(next);
+    }
+    std::sort(matches.begin(), matches.end());
+    return matches;
+}
+
+// List the subdirectories of a directory
+std::vector<std::wstring> DirectoryGlob::subdirectories(FileSystem& fileSystem, const std::wstring& directory) {
+    std::vector<std::wstring> children;
+    try {
+        for (const auto& entry : fileSystem.list(directory)) {
+            // A link may point back up the tree, following it would walk in circles
+            if (entry.directory && !entry.link) {
+                children.push_back(entry.path);
+            }
+        }
+    }
+    catch (const std::filesystem::filesystem_error& e) {
+        Logging::warning(L"Could not read directory " + directory + L": " + Tools::stringToWstring(e.what()));
+    }
+    return children;
+}
@@ -0,0 +1,115 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+#include <windows.h>
+#include "vfs.h"
+
+/**
+ * \class DirectoryGlob
+ * \brief The directories a Directory setting stands for. Every path segment may hold the wildcards * and ?, which
+ *        match within the segment (e.g. c:\logs\tenants\*\app), recursively also every directory below a match. The
+ *        levels of the tree are walked by a bounded number of threads. The result is cached as long as no directory
+ *        below the fixed part of the pattern is created, deleted or renamed, which the disk reports as a change event.
+ */
+class DirectoryGlob
+{
+public:
+    /**
+     * \brief Constructor for DirectoryGlob.
+     * \param pattern The directory or pattern.
+     * \param recursive Whether the directories below the matching ones belong to it as well.
+     * \param walkers The largest number of threads listing directories at the same time.
+     */
+    DirectoryGlob(const std::wstring& pattern, bool recursive, size_t walkers);
+
+    /**
+     * \brief Destructor for DirectoryGlob.
+     */
+    ~DirectoryGlob();
+
+    DirectoryGlob(const DirectoryGlob&) = delete;
+    DirectoryGlob& operator=(const DirectoryGlob&) = delete;
+
+    /**
+     * \brief Check whether a directory holds wildcards.
+     * \param directory The directory.
+     * \return True if it holds * or ?.
+     */
+    static bool isPattern(const std::wstring& directory);
+
+    /**
+     * \brief Match a name against a pattern with the wildcards * and ?, without regard to case as Windows does.
+     * \param pattern The pattern.
+     * \param name The name.
+     * \return True if the name matches.
+     */
+    static bool match(const std::wstring& pattern, const std::wstring& name);
+
+    /**
+     * \brief Get the directories. A plain directory without recursion is returned as it is, without looking at it.
+     *        Only the disk reports changes, on any other file system the directories are walked on every call.
+     * \param fileSystem The file system to walk.
+     * \return The matching directories, sorted.
+     */
+    std::vector<std::wstring> expand(FileSystem& fileSystem);
+
+    /**
+     * \brief Get the fixed part of the pattern, the directory all matches are in.
+     * \return The directory.
+     */
+    const std::wstring& getRoot();
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \brief Walk the tree below the root level by level.
+     * \param fileSystem The file system to walk.
+     * \return The matching directories, sorted.
+     */
+    std::vector<std::wstring> walk(FileSystem& fileSystem);
+
+    /**
+     * \brief List the subdirectories of a directory.
+     * \param fileSystem The file system.
+     * \param directory The directory.
+     * \return The full paths of the subdirectories, empty if the directory cannot be read.
+     */
+    static std::vector<std::wstring> subdirectories(FileSystem& fileSystem, const std::wstring& directory);
+
+    std::wstring pattern; ///< The directory or pattern as configured.
+    std::wstring root; ///< The fixed part of the pattern.
+    std::vector<std::wstring> segments; ///< The segments of the pattern after the root.
+    bool recursive; ///< Whether the directories below the matching ones belong to it as well.
+    size_t walkers; ///< The largest number of threads listing directories at the same time.
+    std::mutex mutex; ///< Guards the cache.
+    std::vector<std::wstring> cached; ///< The directories of the last walk of the disk.
+    bool valid; ///< Whether no change was reported since the last walk.
+    HANDLE notification; ///< Signaled when a directory below the root changes.
+};
@@ -39,6 +39,7 @@ std::string Logging::syslogAddress = "127.0.0.1"; // Default syslog server addre
 int Logging::syslogPort = 514; // Default syslog server port
 std::string Logging::ownHostname = ""; // Hostname of the current machine
 int Logging::ownPid = 0; // Process ID of the current process
+std::mutex Logging::mutex; // Serializes messages logged from several threads
 
 // Constructor
 Logging::Logging() {
@@ -81,6 +82,7 @@ void Logging::_log(int loglevel_, std::wstring message) {
     if (loglevel_ < loglevel) {
         return;
     }
+    std::lock_guard<std::mutex> lock(mutex);
     time_t now = time(0);
     tm ltm;
     localtime_s(&ltm, &now);
@@ -104,6 +106,7 @@ void Logging::_log(int loglevel_, std::string message) {
     if (loglevel_ < loglevel) {
         return;
     }
+    std::lock_guard<std::mutex> lock(mutex);
     time_t now = time(0);
     tm ltm;
     localtime_s(&ltm, &now);
@@ -29,6 +29,7 @@
 #include <vector>
 #include <iomanip>
 #include <sstream>
+#include <mutex>
 
 /**
  * \class Logging
@@ -63,6 +64,7 @@ private:
     static int syslogPort; ///< Syslog server port.
     static std::string ownHostname; ///< Hostname of this machine.
     static int ownPid; ///< Process ID of this process.
+    static std::mutex mutex; ///< Serializes messages logged from several threads.
     std::vector<std::wstring> loglevelsW = { L"DEBUG", L"INFO", L"WARNING", L"ERROR", L"FATAL" }; ///< Log levels in wide characters.
     std::vector<std::string> loglevels = { "DEBUG", "INFO", "WARNING", "ERROR", "FATAL" }; ///< Log levels.
     void sendToSyslogViaUDP(const std::string& message); ///< Send a message to the syslog server via UDP.
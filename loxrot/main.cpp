@@ -26,11 +26,26 @@
 #include "logging.h"
 #include "config.h"
 #include "rotate.h"
+#include "watchdog.h"
+#include "container.h"
+#include "control.h"
+#include "coordinator.h"
+#include "seekable.h"
+#include "search.h"
+#include "simulator.h"
+#include "tail.h"
+#include "tools.h"
 #include "version.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <io.h>
 #include <iostream>
 #include <windows.h>
 #include <thread>
 #include <filesystem>
+#include <memory>
+#include <regex>
+#include <vector>
 
 // Define the service status and service status handle
 SERVICE_STATUS ServiceStatus;
@@ -50,6 +65,15 @@ struct Args {
     bool foreground = false; // Flag to indicate if the program should run in the foreground
     bool installservice = false; // Flag to indicate if the service should be installed
     bool uninstallservice = false; // Flag to indicate if the service should be uninstalled
+    std::vector<std::wstring> extract; // Container, generation and target file for extracting a merged generation
+    std::vector<std::wstring> extractRange; // File, unit (bytes or lines), first and last for extracting from a seekable file
+    std::vector<std::wstring> queryTime; // Section, start and end of a time window to read the lines of
+    std::vector<std::wstring> search; // Section and token to search for
+    std::vector<std::wstring> grep; // Section, literal or regex and the pattern to search for
+    std::wstring tail; // Section whose log files are followed across rotations
+    int simulateDays = 0; // Number of days to simulate the rotations of all sections for
+    std::wstring instance; // Name of this instance among those sharing a lease directory, the computer name if empty
+    std::vector<std::wstring> control; // Command and arguments to send to the running program
 };
 
 // Function to parse command line arguments
@@ -60,7 +84,15 @@ bool parseArgs(int argc, wchar_t** argv, Args* args) {
     args->loglevel = Logging::LogLevel::info;
     // Populate the help text with usage instructions
     helptext << PROGRAMNAMEW << L" v" << VERSION << std::endl
-        << L"Usage: " + PROGRAMNAMEW + L" --config <configfile> [--foreground] [--logfile <logfile|:stdout|syslog://<ip>:[<port>]] [--loglevel <loglevel>] [--installservice|--uninstallservice]" << std::endl;
+        << L"Usage: " + PROGRAMNAMEW + L" --config <configfile|configdir> [--foreground] [--logfile <logfile|:stdout|syslog://<ip>:[<port>]] [--loglevel <loglevel>] [--instance <name>] [--installservice|--uninstallservice]" << std::endl
+        << L"       " + PROGRAMNAMEW + L" --extract <container> <generation> <targetfile>" << std::endl
+        << L"       " + PROGRAMNAMEW + L" --extract-range <file> bytes|lines <first> <last>" << std::endl
+        << L"       " + PROGRAMNAMEW + L" --config <configfile> --query-time <section> <from> <to>" << std::endl
+        << L"       " + PROGRAMNAMEW + L" --config <configfile> --search <section> <token>" << std::endl
+        << L"       " + PROGRAMNAMEW + L" --config <configfile> --grep <section> literal|regex <pattern>" << std::endl
+        << L"       " + PROGRAMNAMEW + L" --config <configfile> --tail <section>" << std::endl
+        << L"       " + PROGRAMNAMEW + L" --config <configfile> --simulate-days <days>" << std::endl
+        << L"       " + PROGRAMNAMEW + L" [--instance <name>] --control status|next-fire [<section>]|rotate <section>|pause|resume" << std::endl;
     // If there are less than 2 command line arguments, print the help text
     if (argc < 2) {
         std::wcout << helptext.str() << std::endl;
@@ -133,6 +165,129 @@ bool parseArgs(int argc, wchar_t** argv, Args* args) {
             }
             i++;
         }
+        // If the argument is "--extract"
+        else if (wcscmp(argv[i], L"--extract") == 0) {
+            // If there are three more arguments
+            if (i + 3 < argc) {
+                // Set the container, the generation and the target file to the next arguments
+                args->extract.assign(argv + i + 1, argv + i + 4);
+                i += 3;
+            }
+            else {
+                // If there are not enough arguments, print an error message and return false
+                std::wcout << L"Missing arguments for --extract" << std::endl;
+                return false;
+            }
+        }
+        // If the argument is "--extract-range"
+        else if (wcscmp(argv[i], L"--extract-range") == 0) {
+            // If there are four more arguments and the unit is valid
+            if (i + 4 < argc && (wcscmp(argv[i + 2], L"bytes") == 0 || wcscmp(argv[i + 2], L"lines") == 0)
+                && wcsspn(argv[i + 3], L"0123456789") == wcslen(argv[i + 3]) && *argv[i + 3] && wcsspn(argv[i + 4], L"0123456789") == wcslen(argv[i + 4]) && *argv[i + 4]) {
+                // Set the file, the unit and the range to the next arguments
+                args->extractRange.assign(argv + i + 1, argv + i + 5);
+                i += 4;
+            }
+            else {
+                // If the arguments are missing or wrong, print an error message and return false
+                std::wcout << L"Wrong arguments for --extract-range. Usage: --extract-range <file> bytes|lines <first> <last>" << std::endl;
+                return false;
+            }
+        }
+        // If the argument is "--query-time"
+        else if (wcscmp(argv[i], L"--query-time") == 0) {
+            // If there are three more arguments and the times are valid
+            if (i + 3 < argc && Search::parseTime(argv[i + 2]) != -1 && Search::parseTime(argv[i + 3]) != -1) {
+                // Set the section and the window to the next arguments
+                args->queryTime.assign(argv + i + 1, argv + i + 4);
+                i += 3;
+            }
+            else {
+                // If the arguments are missing or wrong, print an error message and return false
+                std::wcout << L"Wrong arguments for --query-time. Usage: --query-time <section> <from> <to>, times as \"YYYY-MM-DD HH:MM[:SS]\"" << std::endl;
+                return false;
+            }
+        }
+        // If the argument is "--search"
+        else if (wcscmp(argv[i], L"--search") == 0) {
+            // If there are two more arguments
+            if (i + 2 < argc) {
+                // Set the section and the token to the next arguments
+                args->search.assign(argv + i + 1, argv + i + 3);
+                i += 2;
+            }
+            else {
+                // If there are not enough arguments, print an error message and return false
+                std::wcout << L"Missing arguments for --search. Usage: --search <section> <token>" << std::endl;
+                return false;
+            }
+        }
+        // If the argument is "--grep"
+        else if (wcscmp(argv[i], L"--grep") == 0) {
+            // If there are three more arguments, the kind is valid and the pattern is not empty
+            if (i + 3 < argc && (wcscmp(argv[i + 2], L"literal") == 0 || wcscmp(argv[i + 2], L"regex") == 0) && *argv[i + 3]) {
+                // Set the section, the kind and the pattern to the next arguments
+                args->grep.assign(argv + i + 1, argv + i + 4);
+                i += 3;
+            }
+            else {
+                // If the arguments are missing or wrong, print an error message and return false
+                std::wcout << L"Wrong arguments for --grep. Usage: --grep <section> literal|regex <pattern>" << std::endl;
+                return false;
+            }
+        }
+        // If the argument is "--tail"
+        else if (wcscmp(argv[i], L"--tail") == 0) {
+            // If there is another argument after this one
+            if (i + 1 < argc) {
+                // Set the section to the next argument
+                args->tail = argv[i + 1];
+                i++;
+            }
+            else {
+                // If there is no argument after this one, print an error message and return false
+                std::wcout << L"Missing argument for --tail. Usage: --tail <section>" << std::endl;
+                return false;
+            }
+        }
+        // If the argument is "--simulate-days"
+        else if (wcscmp(argv[i], L"--simulate-days") == 0) {
+            // If there is another argument after this one and it is a positive number of days
+            if (i + 1 < argc && std::regex_match(argv[i + 1], std::wregex(L"^[1-9]\\d{0,4}$"))) {
+                // Set the number of days to the next argument
+                args->simulateDays = std::stoi(argv[i + 1]);
+                i++;
+            }
+            else {
+                // If there is no argument after this one, print an error message and return false
+                std::wcout << L"Missing argument for --simulate-days. Usage: --simulate-days <days>" << std::endl;
+                return false;
+            }
+        }
+        // If the argument is "--instance"
+        else if (wcscmp(argv[i], L"--instance") == 0) {
+            // If there is another argument after this one
+            if (i + 1 < argc) {
+                // Set the name of the instance to the next argument
+                args->instance = argv[i + 1];
+                i++;
+            }
+            else {
+                // If there is no argument after this one, print an error message and return false
+                std::wcout << L"Missing argument for --instance. Usage: --instance <name>" << std::endl;
+                return false;
+            }
+        }
+        // If the argument is "--control", the rest of the arguments are the command
+        else if (wcscmp(argv[i], L"--control") == 0) {
+            args->control.assign(argv + i + 1, argv + argc);
+            if (args->control.empty()) {
+                // If there is no argument after this one, print an error message and return false
+                std::wcout << L"Missing arguments for --control. Usage: --control status|next-fire [<section>]|rotate <section>|pause|resume" << std::endl;
+                return false;
+            }
+            break;
+        }
         // If the argument is "--service", set the service flag to true
         else if (wcscmp(argv[i], L"--service") == 0) {
             args->service = true;
@@ -156,7 +311,7 @@ bool parseArgs(int argc, wchar_t** argv, Args* args) {
         }
     }
     // Check for the existance of neccessary arguments
-    if (args->configfile == L"" && args->uninstallservice == false) {
+    if (args->configfile == L"" && args->uninstallservice == false && args->extract.empty() && args->extractRange.empty() && args->control.empty()) {
         std::wcout << L"Missing argument --config" << std::endl;
         return false;
     }
@@ -165,6 +320,97 @@ bool parseArgs(int argc, wchar_t** argv, Args* args) {
     return true;
 }
 
+// Reload the changed files of the configuration once its reload interval has passed
+void reloadConfig(Config& config, time_t& lastReload) {
+    time_t interval = std::stoll(config.getGlobals().at(L"ReloadInterval"));
+    time_t now = time(nullptr);
+    if (interval <= 0 || now - lastReload < interval) {
+        return;
+    }
+    lastReload = now;
+    try {
+        size_t changed = config.reload();
+        if (changed > 0) {
+            Logging::info(L"Configuration reloaded, " + std::to_wstring(changed) + L" changes");
+        }
+    }
+    // An invalid file leaves the configuration as it was
+    catch (std::runtime_error&) {
+        Logging::error(L"Configuration not reloaded, keeping the previous one");
+    }
+}
+
+// Share the sections with the other instances if the configuration has a lease directory
+std::unique_ptr<Coordinator> createCoordinator(Config& config, const std::wstring& instance) {
+    const std::wstring& directory = config.getGlobals().at(L"LeaseDirectory");
+    if (directory.empty()) {
+        return nullptr;
+    }
+    std::wstring name = instance;
+    if (name.empty()) {
+        wchar_t buffer[MAX_COMPUTERNAME_LENGTH + 1];
+        DWORD size = MAX_COMPUTERNAME_LENGTH + 1;
+        if (GetComputerNameW(buffer, &size)) {
+            name.assign(buffer, size);
+        }
+    }
+    Logging::info(L"Sharing the sections with other instances in " + directory + L" as " + name);
+    return std::make_unique<Coordinator>(directory, name, std::stoll(config.getGlobals().at(L"LeaseDuration")));
+}
+
+// The name of the control pipe of an instance
+std::wstring controlPipe(const std::wstring& instance) {
+    return L"\\\\.\\pipe\\" + PROGRAMNAMEW + (instance.empty() ? L"" : L"-" + instance);
+}
+
+// Serve the control pipe if the configuration asks for it
+std::unique_ptr<Control> createControl(Config& config, const std::wstring& instance) {
+    if (config.getGlobals().at(L"Control") != L"true") {
+        return nullptr;
+    }
+    std::unique_ptr<Control> control = std::make_unique<Control>(controlPipe(instance));
+    if (!control->start()) {
+        return nullptr;
+    }
+    return control;
+}
+
+// Rotate the sections asked for on the control pipe and publish the state of all sections
+void serveControl(Control* control, Config& config, Rotate& rotate) {
+    if (control == nullptr) {
+        return;
+    }
+    std::vector<std::wstring> rotated;
+    for (const auto& name : control->takeRequests()) {
+        std::map<std::wstring, Config::Section>::iterator it = config.getConfigs().find(name);
+        // The section may have gone with a reload since it was asked for
+        if (it == config.getConfigs().end()) {
+            continue;
+        }
+        Logging::info(L"Rotating " + name + L" on request");
+        if (rotate.rotateSection(it->first, it->second)) {
+            rotated.push_back(name);
+        }
+    }
+    time_t now = time(nullptr);
+    control->rotated(rotated, now);
+    control->publish(config.getConfigs(), rotate, now);
+}
+
+// Perform the due log rotations of all sections unless they are paused on the control pipe
+void rotateDue(Control* control, Config& config, Rotate& rotate) {
+    if (control == nullptr) {
+        rotate.doRotates(config.getConfigs(), std::stoul(config.getGlobals().at(L"MaxConcurrentRotations")));
+        return;
+    }
+    if (control->isPaused()) {
+        return;
+    }
+    std::vector<std::wstring> rotated;
+    rotate.doRotates(config.getConfigs(), std::stoul(config.getGlobals().at(L"MaxConcurrentRotations")), &rotated);
+    control->rotated(rotated, time(nullptr));
+}
+
 // The main function for the service
 void ServiceMain(int argc, wchar_t** argv)
 {
@@ -214,13 +460,28 @@ void ServiceMain(int argc, wchar_t** argv)
 
         // Initialize a Rotate object to handle log rotation
         Rotate rotate;
+        // Share the sections with other instances
+        std::unique_ptr<Coordinator> coordinator = createCoordinator(config, args.instance);
+        rotate.setCoordinator(coordinator.get());
+        // Take commands on the control pipe
+        std::unique_ptr<Control> control = createControl(config, args.instance);
+        // Initialize a Watchdog object to react on low disk space
+        Watchdog watchdog;
+        time_t lastReload = time(nullptr);
         // While the service is running
         while (ServiceStatus.dwCurrentState == SERVICE_RUNNING) {
-            // For each section in the configuration
-            for (std::map<std::wstring, Config::Section>::iterator it = config.getConfigs().begin(); it != config.getConfigs().end(); it++) {
-                // Perform log rotation
-                rotate.doRotates((std::pair<std::wstring, Config::Section>*)(&(*it)));
+            // Pick up changes of the configuration files
+            reloadConfig(config, lastReload);
+            // Tell the other instances this one is alive and learn which of them are
+            if (coordinator) {
+                coordinator->heartbeat();
             }
+            // Perform the due log rotations of all sections
+            rotateDue(control.get(), config, rotate);
+            // Rotate the sections asked for on the control pipe
+            serveControl(control.get(), config, rotate);
+            // Reclaim space on volumes under pressure
+            watchdog.check(config.getConfigs(), rotate);
             // If there are no sections in the configuration, log an error and return
             if (config.getConfigs().size() == 0) {
                 Logging::error(L"No sections found in config file");
@@ -231,6 +492,13 @@ void ServiceMain(int argc, wchar_t** argv)
             // Sleep for 1 second
             std::this_thread::sleep_for(std::chrono::seconds(1));
         }
+        if (control) {
+            control->stop();
+        }
+        // The other instances take over the sections at once
+        if (coordinator) {
+            coordinator->leave();
+        }
         // Log that the service is leaving the ServiceMain function
         Logging::debug(L"Leaving ServiceMain");
     }
@@ -284,6 +552,139 @@ int wmain(int argc, wchar_t** argv) {
         try {
             // Log that the program has started
             Logging::info(PROGRAMNAMEW + L" " + VERSION + L" started");
+            // If a command is to be sent to the running program, print its answer and do only that
+            if (!args.control.empty()) {
+                std::wstring command, answer;
+                for (const auto& word : args.control) {
+                    command += (command.empty() ? L"" : L" ") + word;
+                }
+                bool ok = Control::send(controlPipe(args.instance), command, answer);
+                std::wcout << answer;
+                if (!answer.empty() && answer.back() != L'\n') {
+                    std::wcout << std::endl;
+                }
+                return ok ? 0 : 1;
+            }
+            // If a merged generation is to be extracted, do only that
+            if (!args.extract.empty()) {
+                return Container::extract(args.extract[0], args.extract[1], args.extract[2]) ? 0 : 1;
+            }
+            // If a range of a seekable file is to be extracted, write it to stdout and do only that
+            if (!args.extractRange.empty()) {
+#ifdef WITH_ZLIB
+                _setmode(_fileno(stdout), _O_BINARY);
+                return Seekable::extract(args.extractRange[0], args.extractRange[1] == L"lines", std::stoull(args.extractRange[2]), std::stoull(args.extractRange[3]), std::cout) ? 0 : 1;
+#else
+                std::wcout << L"--extract-range needs zlib support" << std::endl;
+                return 1;
+#endif
+            }
+            // If the lines of a time window are to be read, write them to stdout and do only that
+            if (!args.queryTime.empty()) {
+                Config config;
+                config.load(args.configfile);
+                std::map<std::wstring, Config::Section>::iterator it = config.getConfigs().find(args.queryTime[0]);
+                if (it == config.getConfigs().end()) {
+                    std::wcout << L"Section " << args.queryTime[0] << L" not found in config file" << std::endl;
+                    return 1;
+                }
+                _setmode(_fileno(stdout), _O_BINARY);
+                return Search::queryTime(it->first, it->second, Search::parseTime(args.queryTime[1]), Search::parseTime(args.queryTime[2]), std::cout) ? 0 : 1;
+            }
+            // If a token is to be searched, write the matching lines to stdout and do only that
+            if (!args.search.empty()) {
+                Config config;
+                config.load(args.configfile);
+                std::map<std::wstring, Config::Section>::iterator it = config.getConfigs().find(args.search[0]);
+                if (it == config.getConfigs().end()) {
+                    std::wcout << L"Section " << args.search[0] << L" not found in config file" << std::endl;
+                    return 1;
+                }
+                _setmode(_fileno(stdout), _O_BINARY);
+                return Search::searchToken(it->first, it->second, Tools::wstringToString(args.search[1]), std::cout) ? 0 : 1;
+            }
+            // If a pattern is to be searched, write the matching lines to stdout and do only that
+            if (!args.grep.empty()) {
+                Config config;
+                config.load(args.configfile);
+                std::map<std::wstring, Config::Section>::iterator it = config.getConfigs().find(args.grep[0]);
+                if (it == config.getConfigs().end()) {
+                    std::wcout << L"Section " << args.grep[0] << L" not found in config file" << std::endl;
+                    return 1;
+                }
+                _setmode(_fileno(stdout), _O_BINARY);
+                try {
+                    return Search::grep(it->first, it->second, args.grep[1] == L"regex", Tools::wstringToString(args.grep[2]), std::cout) ? 0 : 1;
+                }
+                catch (const std::regex_error&) {
+                    std::wcout << L"Invalid regular expression " << args.grep[2] << std::endl;
+                    return 1;
+                }
+            }
+            // If the log files of a section are to be followed, write what is appended to them to stdout until stopped
+            if (!args.tail.empty()) {
+                Config config;
+                config.load(args.configfile);
+                std::map<std::wstring, Config::Section>::iterator it = config.getConfigs().find(args.tail);
+                if (it == config.getConfigs().end()) {
+                    std::wcout << L"Section " << args.tail << L" not found in config file" << std::endl;
+                    return 1;
+                }
+                Rotate rotate;
+                std::vector<std::wstring> files;
+                for (const auto& directory : rotate.getDirectories(it->second)) {
+                    std::vector<std::wstring> found = rotate.getFilesInDirectory(directory, it->second.entries[L"FilePattern"], true);
+                    files.insert(files.end(), found.begin(), found.end());
+                }
+                if (files.empty()) {
+                    std::wcout << L"No log file of section " << args.tail << L" found" << std::endl;
+                    return 1;
+                }
+                // Lines of several files must not be torn apart
+                std::vector<std::unique_ptr<Tail>> tails;
+                for (const auto& file : files) {
+                    tails.emplace_back(new Tail(file, files.size() > 1));
+                }
+                // Write straight from the read buffer to the handle, there is no stream buffer in between
+                HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+                bool open = true;
+                Seekable::Consumer write = [output, &open](const char* data, size_t length) {
+                    DWORD written = 0;
+                    while (length > 0 && WriteFile(output, data, static_cast<DWORD>(length), &written, NULL) && written > 0) {
+                        data += written;
+                        length -= written;
+                    }
+                    open = length == 0;
+                    return open;
+                };
+                // Stop when the reader of stdout is gone
+                while (open) {
+                    for (auto& tail : tails) {
+                        tail->poll(write);
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+                }
+                return 0;
+            }
+            // If the rotations are to be simulated, print what they would do and do only that
+            if (args.simulateDays > 0) {
+                Config config;
+                config.load(args.configfile);
+                // Each simulated rotation would be logged otherwise
+                Logging::setLogOptions(std::max(args.loglevel, Logging::LogLevel::warning), args.logfile);
+                double compressionRatio = 1;
+                double secondsPerByte = 0;
+                Simulator::calibrate(config.getConfigs(), compressionRatio, secondsPerByte);
+                std::wcout << L"Simulating " << args.simulateDays << L" days, compression ratio " << compressionRatio;
+                if (secondsPerByte > 0) {
+                    std::wcout << L" at " << static_cast<long long>(1 / secondsPerByte / (1024 * 1024)) << L" MiB/s";
+                }
+                std::wcout << std::endl;
+                Simulator simulator(config.getConfigs(), time(nullptr), compressionRatio, secondsPerByte);
+                simulator.run(static_cast<time_t>(args.simulateDays) * 24 * 60 * 60);
+                simulator.report(std::wcout);
+                return 0;
+            }
             // If the install service flag is set
             if (args.installservice) {
                 // Log that the service is being installed
@@ -294,6 +695,9 @@ int wmain(int argc, wchar_t** argv) {
                 if (schSCManager) {
                     // Create the command line for the service
                     std::wstring path = L"\"" + std::filesystem::absolute(argv[0]).wstring() + L"\" --service --config " + args.configfile + L" --logfile " + args.logfile + L" --loglevel " + args.loglevelname;
+                    if (!args.instance.empty()) {
+                        path += L" --instance " + args.instance;
+                    }
                     // Create the service
                     SC_HANDLE schService = CreateService(schSCManager, PROGRAMNAMEW.c_str(), PROGRAMNAMEW.c_str(), SERVICE_ALL_ACCESS, SERVICE_WIN32_OWN_PROCESS, SERVICE_AUTO_START, SERVICE_ERROR_NORMAL, path.c_str(), NULL, NULL, NULL, NULL, NULL);
                     // If the service was created successfully
@@ -390,13 +794,28 @@ int wmain(int argc, wchar_t** argv) {
                     }
                     // Initialize a Rotate object to handle log rotation
                     Rotate rotate;
+                    // Share the sections with other instances
+                    std::unique_ptr<Coordinator> coordinator = createCoordinator(config, args.instance);
+                    rotate.setCoordinator(coordinator.get());
+                    // Take commands on the control pipe while running in the foreground
+                    std::unique_ptr<Control> control = args.foreground ? createControl(config, args.instance) : nullptr;
+                    // Initialize a Watchdog object to react on low disk space
+                    Watchdog watchdog;
+                    time_t lastReload = time(nullptr);
                     // While the program is running
                     while (1) {
-                        // For each section in the configuration
-                        for (std::map<std::wstring, Config::Section>::iterator it = config.getConfigs().begin(); it != config.getConfigs().end(); it++) {
-                            // Perform log rotation
-                            rotate.doRotates((std::pair<std::wstring, Config::Section>*)(&(*it)));
+                        // Pick up changes of the configuration files
+                        reloadConfig(config, lastReload);
+                        // Tell the other instances this one is alive and learn which of them are
+                        if (coordinator) {
+                            coordinator->heartbeat();
                         }
+                        // Perform the due log rotations of all sections
+                        rotateDue(control.get(), config, rotate);
+                        // Rotate the sections asked for on the control pipe
+                        serveControl(control.get(), config, rotate);
+                        // Reclaim space on volumes under pressure
+                        watchdog.check(config.getConfigs(), rotate);
                         // If the foreground flag is set, sleep for 1 second
                         if (args.foreground) {
                             std::this_thread::sleep_for(std::chrono::seconds(1));
@@ -407,6 +826,13 @@ int wmain(int argc, wchar_t** argv) {
                         }
 
                     }
+                    if (control) {
+                        control->stop();
+                    }
+                    // The other instances take over the sections at once
+                    if (coordinator) {
+                        coordinator->leave();
+                    }
                     // Log that the program has finished
                     Logging::info(PROGRAMNAMEW + L" " + VERSION + L" finished");
                 }
@@ -0,0 +1,329 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "memfs.h"
+#include <algorithm>
+#include <filesystem>
+
+// Constructor
+MemoryFileSystem::MemoryFileSystem(const Clock& clock, double compressionRatio)
+    : clock(clock), compressionRatio(compressionRatio), compressedBytes(0), usedBytes(0), capacity(0) {
+}
+
+// Append bytes to a file
+void MemoryFileSystem::write(const std::wstring& path, unsigned long long bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    time_t now = clock.now();
+    std::map<std::wstring, File>::iterator it = files.find(path);
+    if (it == files.end()) {
+        it = files.insert({ path, File() }).first;
+        it->second.created = now;
+    }
+    // The writer of a log file is not rotated, so a full disk does not stop it here
+    it->second.size += bytes;
+    it->second.modified = now;
+    usedBytes += bytes;
+}
+
+// Create a file or replace one
+void MemoryFileSystem::create(const std::wstring& path, unsigned long long size, time_t modified, time_t created) {
+    std::lock_guard<std::mutex> lock(mutex);
+    put(path, { size, modified, created });
+}
+
+// Get the number of bytes read by compressions so far
+unsigned long long MemoryFileSystem::getCompressedBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return compressedBytes;
+}
+
+// Limit the size of all files together
+void MemoryFileSystem::setCapacity(unsigned long long bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = bytes;
+}
+
+// Deny access to a file or directory
+void MemoryFileSystem::deny(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    denied.push_back(path);
+}
+
+// Allow access to a file or directory again
+void MemoryFileSystem::allow(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    denied.erase(std::remove(denied.begin(), denied.end(), path), denied.end());
+}
+
+// Let the next renames of a file fail
+void MemoryFileSystem::failRename(const std::wstring& path, unsigned int count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    renameFailures[path] = count;
+}
+
+// Get the error of the last operation that failed on an injected fault
+std::error_code MemoryFileSystem::getLastError() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return lastError;
+}
+
+// Check whether access to a file is denied
+bool MemoryFileSystem::isDenied(const std::wstring& path) {
+    for (const auto& item : denied) {
+        // The path itself or anything below it
+        if (path.compare(0, item.size(), item) == 0 && (path.size() == item.size() || path[item.size()] == L'\\' || path[item.size()] == L'/')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Check whether some more bytes fit into the capacity
+bool MemoryFileSystem::fits(unsigned long long bytes) {
+    return capacity == 0 || usedBytes + bytes <= capacity;
+}
+
+// Record an injected fault
+bool MemoryFileSystem::fail(std::errc error) {
+    lastError = std::make_error_code(error);
+    return false;
+}
+
+// Replace a file and keep track of the used bytes
+void MemoryFileSystem::put(const std::wstring& path, const File& file) {
+    std::map<std::wstring, File>::iterator it = files.find(path);
+    if (it != files.end()) {
+        usedBytes -= it->second.size;
+        it->second = file;
+    }
+    else {
+        files.insert({ path, file });
+    }
+    usedBytes += file.size;
+}
+
+// List the files of a directory
+std::vector<FileSystem::Entry> MemoryFileSystem::list(const std::wstring& directory) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (isDenied(directory)) {
+        fail(std::errc::permission_denied);
+        throw std::filesystem::filesystem_error("directory_iterator", std::filesystem::path(directory), lastError);
+    }
+    // The files of a directory are the ones starting with its path and a separator, without another one after it
+    std::wstring prefix = (std::filesystem::path(directory) / L"").wstring();
+    std::vector<Entry> entries;
+    for (std::map<std::wstring, File>::iterator it = files.lower_bound(prefix); it != files.end() && it->first.compare(0, prefix.size(), prefix) == 0; it++) {
+        // A directory exists as long as there are files in it, all of them follow each other
+        size_t separator = it->first.find_first_of(L"\\/", prefix.size());
+        if (separator != std::wstring::npos) {
+            Entry entry;
+            entry.path = it->first.substr(0, separator);
+            entry.directory = true;
+            entries.push_back(entry);
+            std::wstring below = it->first.substr(0, separator + 1);
+            while (std::next(it) != files.end() && std::next(it)->first.compare(0, below.size(), below) == 0) {
+                it++;
+            }
+            continue;
+        }
+        Entry entry;
+        entry.path = it->first;
+        entry.regular = true;
+        entry.size = it->second.size;
+        entry.modified = it->second.modified;
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+// Get the size of a file
+unsigned long long MemoryFileSystem::fileSize(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::wstring, File>::iterator it = files.find(path);
+    if (it == files.end()) {
+        throw std::filesystem::filesystem_error("file_size", std::filesystem::path(path), std::make_error_code(std::errc::no_such_file_or_directory));
+    }
+    return it->second.size;
+}
+
+// Get the creation time of a file
+time_t MemoryFileSystem::creationTime(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::wstring, File>::iterator it = files.find(path);
+    if (it == files.end()) {
+        return -1;
+    }
+    // Opening the file for its attributes is denied as well
+    if (isDenied(path)) {
+        fail(std::errc::permission_denied);
+        return -1;
+    }
+    return it->second.created;
+}
+
+// Check whether a file or directory exists
+bool MemoryFileSystem::exists(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (files.count(path) > 0) {
+        return true;
+    }
+    std::wstring prefix = (std::filesystem::path(path) / L"").wstring();
+    std::map<std::wstring, File>::iterator it = files.lower_bound(prefix);
+    return it != files.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Delete a file
+bool MemoryFileSystem::remove(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::wstring, File>::iterator it = files.find(path);
+    if (it == files.end()) {
+        return true;
+    }
+    if (isDenied(path)) {
+        return fail(std::errc::permission_denied);
+    }
+    usedBytes -= it->second.size;
+    files.erase(it);
+    return true;
+}
+
+// Rename a file
+bool MemoryFileSystem::rename(const std::wstring& source, const std::wstring& target) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::wstring, File>::iterator it = files.find(source);
+    if (it == files.end()) {
+        return false;
+    }
+    if (isDenied(source) || isDenied(target)) {
+        return fail(std::errc::permission_denied);
+    }
+    std::map<std::wstring, unsigned int>::iterator failure = renameFailures.find(source);
+    if (failure != renameFailures.end() && failure->second > 0) {
+        failure->second--;
+        return fail(std::errc::device_or_resource_busy);
+    }
+    File file = it->second;
+    usedBytes -= file.size;
+    files.erase(it);
+    put(target, file);
+    return true;
+}
+
+// Copy a file
+bool MemoryFileSystem::copy(const std::wstring& source, const std::wstring& target) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::wstring, File>::iterator it = files.find(source);
+    if (it == files.end()) {
+        return false;
+    }
+    if (isDenied(source) || isDenied(target)) {
+        return fail(std::errc::permission_denied);
+    }
+    // Like the disk, which creates the copy as a new file
+    if (files.find(target) != files.end()) {
+        return fail(std::errc::file_exists);
+    }
+    if (!fits(it->second.size)) {
+        return fail(std::errc::no_space_on_device);
+    }
+    // Like CopyFile, the copy keeps the last write time
+    File file = it->second;
+    file.created = clock.now();
+    put(target, file);
+    return true;
+}
+
+// Truncate a file
+bool MemoryFileSystem::truncate(const std::wstring& path, const std::wstring& copy, bool durable, unsigned long long& size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::wstring, File>::iterator it = files.find(path);
+    if (it == files.end()) {
+        return false;
+    }
+    if (isDenied(path)) {
+        return fail(std::errc::permission_denied);
+    }
+    // Nothing is written while the rotation runs, so the copy already has everything
+    if (!copy.empty()) {
+        std::map<std::wstring, File>::iterator target = files.find(copy);
+        if (target == files.end()) {
+            return false;
+        }
+        size = target->second.size;
+    }
+    usedBytes -= it->second.size;
+    it->second.size = 0;
+    it->second.modified = clock.now();
+    it->second.created = it->second.modified;
+    return true;
+}
+
+// Compress a file
+bool MemoryFileSystem::compress(const std::wstring& path, unsigned long long blockSize, Bloom* bloom) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::wstring, File>::iterator it = files.find(path);
+    if (it == files.end()) {
+        return false;
+    }
+    if (isDenied(path) || isDenied(path + L".gz")) {
+        return fail(std::errc::permission_denied);
+    }
+    File compressed;
+    compressed.size = static_cast<unsigned long long>(it->second.size * compressionRatio);
+    compressed.modified = clock.now();
+    compressed.created = compressed.modified;
+    // A compression cut short by a full disk removes what it wrote
+    if (!fits(compressed.size)) {
+        return fail(std::errc::no_space_on_device);
+    }
+    compressedBytes += it->second.size;
+    put(path + L".gz", compressed);
+    return true;
+}
+
+// Append a compressed file to a container
+bool MemoryFileSystem::append(const std::wstring& container, const std::wstring& member, bool durable) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::wstring, File>::iterator it = files.find(member);
+    if (it == files.end()) {
+        return false;
+    }
+    if (isDenied(member) || isDenied(container)) {
+        return fail(std::errc::permission_denied);
+    }
+    unsigned long long size = it->second.size;
+    if (!fits(size)) {
+        return fail(std::errc::no_space_on_device);
+    }
+    std::map<std::wstring, File>::iterator target = files.find(container);
+    if (target == files.end()) {
+        target = files.insert({ container, File() }).first;
+        target->second.created = clock.now();
+    }
+    target->second.size += size;
+    target->second.modified = clock.now();
+    usedBytes += size;
+    return true;
+}
@@ -0,0 +1,170 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "clock.h"
+#include "vfs.h"
+
+/**
+ * \class MemoryFileSystem
+ * \brief A file system that only exists in memory. Files have a size and times but no content: a write only makes a
+ *        file longer and a compression shrinks it by a fixed ratio. That is all the planning of a rotation looks at,
+ *        so weeks of rotations of thousands of files run in seconds. A directory exists as long as there are files in
+ *        it. Faults can be injected: a disk that is full
+ *        (ENOSPC), files and directories that cannot be accessed (EACCES) and renames that fail.
+ */
+class MemoryFileSystem : public FileSystem
+{
+public:
+    /**
+     * \brief Constructor for MemoryFileSystem.
+     * \param clock The clock that gives the times of writes, copies and truncations.
+     * \param compressionRatio The size of a compressed file relative to the original.
+     */
+    MemoryFileSystem(const Clock& clock, double compressionRatio);
+
+    /**
+     * \brief Append bytes to a file, creating it if it does not exist.
+     * \param path The file.
+     * \param bytes The number of bytes.
+     */
+    void write(const std::wstring& path, unsigned long long bytes);
+
+    /**
+     * \brief Create a file or replace one.
+     * \param path The file.
+     * \param size The size in bytes.
+     * \param modified The last write time.
+     * \param created The creation time.
+     */
+    void create(const std::wstring& path, unsigned long long size, time_t modified, time_t created);
+
+    /**
+     * \brief Get the number of bytes read by compressions so far.
+     * \return The number of bytes.
+     */
+    unsigned long long getCompressedBytes();
+
+    /**
+     * \brief Limit the size of all files together. A copy, compression or append that would exceed it fails as on a
+     *        full disk (ENOSPC) and leaves nothing behind.
+     * \param bytes The capacity in bytes, 0 for unlimited.
+     */
+    void setCapacity(unsigned long long bytes);
+
+    /**
+     * \brief Deny access to a file or to everything in a directory (EACCES), as an ACL or another process holding the
+     *        file open without sharing would. Listing a denied directory throws.
+     * \param path The file or directory.
+     */
+    void deny(const std::wstring& path);
+
+    /**
+     * \brief Allow access to a file or directory again.
+     * \param path The file or directory given to deny.
+     */
+    void allow(const std::wstring& path);
+
+    /**
+     * \brief Let the next renames of a file fail, e.g. as while a virus scanner has it open.
+     * \param path The file that is renamed.
+     * \param count How many renames fail.
+     */
+    void failRename(const std::wstring& path, unsigned int count);
+
+    /**
+     * \brief Get the error of the last operation that failed on an injected fault.
+     * \return The error, empty if none failed.
+     */
+    std::error_code getLastError();
+
+    std::vector<Entry> list(const std::wstring& directory) override;
+    unsigned long long fileSize(const std::wstring& path) override;
+    time_t creationTime(const std::wstring& path) override;
+    bool exists(const std::wstring& path) override;
+    bool remove(const std::wstring& path) override;
+    bool rename(const std::wstring& source, const std::wstring& target) override;
+    bool copy(const std::wstring& source, const std::wstring& target) override;
+    bool truncate(const std::wstring& path, const std::wstring& copy, bool durable, unsigned long long& size) override;
+    bool compress(const std::wstring& path, unsigned long long blockSize, Bloom* bloom) override;
+    bool append(const std::wstring& container, const std::wstring& member, bool durable) override;
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \struct File
+     * \brief A file in memory.
+     */
+    struct File {
+        unsigned long long size = 0; ///< The size in bytes.
+        time_t modified = 0; ///< The last write time.
+        time_t created = 0; ///< The creation time.
+    };
+
+    /**
+     * \brief Check whether access to a file is denied. The mutex is held.
+     * \param path The file.
+     * \return True if it or one of its directories is denied.
+     */
+    bool isDenied(const std::wstring& path);
+
+    /**
+     * \brief Check whether some more bytes fit into the capacity. The mutex is held.
+     * \param bytes The number of bytes added.
+     * \return True if they fit.
+     */
+    bool fits(unsigned long long bytes);
+
+    /**
+     * \brief Record an injected fault. The mutex is held.
+     * \param error The error.
+     * \return False, for the operation that failed to return.
+     */
+    bool fail(std::errc error);
+
+    /**
+     * \brief Replace a file and keep track of the used bytes. The mutex is held.
+     * \param path The file.
+     * \param file The new file.
+     */
+    void put(const std::wstring& path, const File& file);
+
+    const Clock& clock; ///< Gives the times of writes, copies and truncations.
+    double compressionRatio; ///< The size of a compressed file relative to the original.
+    std::map<std::wstring, File> files; ///< The files by their full path, sorted so a directory is one range.
+    unsigned long long compressedBytes; ///< Bytes read by compressions so far.
+    unsigned long long usedBytes; ///< The size of all files together.
+    unsigned long long capacity; ///< The largest size of all files together, 0 for unlimited.
+    std::vector<std::wstring> denied; ///< Files and directories that cannot be accessed.
+    std::map<std::wstring, unsigned int> renameFailures; ///< How many more renames of a file fail.
+    std::error_code lastError; ///< The error of the last operation that failed on an injected fault.
+    std::mutex mutex; ///< Guards the files against the parallel operations of the executor.
+};
@@ -0,0 +1,125 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "plan.h"
+#include <iomanip>
+#include <sstream>
+
+// Constructor
+Plan::Plan() {
+}
+
+// Destructor
+Plan::~Plan() {
+}
+
+// Append an operation
+void Plan::add(Type type, const std::wstring& source, const std::wstring& target, unsigned long long bytes) {
+    operations.push_back({ type, source, target, bytes });
+}
+
+// Append all operations of another plan
+void Plan::append(const Plan& other) {
+    operations.insert(operations.end(), other.operations.begin(), other.operations.end());
+}
+
+// Get the operations in the order they were planned
+const std::vector<Plan::Operation>& Plan::getOperations() const {
+    return operations;
+}
+
+// Check whether the plan has no operations
+bool Plan::empty() const {
+    return operations.empty();
+}
+
+// Sum up the estimated bytes of all operations
+unsigned long long Plan::getTotalBytes() const {
+    unsigned long long total = 0;
+    for (const auto& operation : operations) {
+        total += operation.bytes;
+    }
+    return total;
+}
+
+// Get the name of a kind of operation
+std::wstring Plan::typeName(Type type) {
+    switch (type) {
+    case remove:
+        return L"remove";
+    case rename:
+        return L"rename";
+    case copy:
+        return L"copy";
+    case truncate:
+        return L"truncate";
+    case compress:
+        return L"compress";
+    case merge:
+        return L"merge";
+    }
+    return L"unknown";
+}
+
+// Escape a string for a JSON string literal
+std::wstring Plan::escape(const std::wstring& text) {
+    std::wstringstream ss;
+    for (wchar_t c : text) {
+        if (c == L'"' || c == L'\\') {
+            ss << L'\\' << c;
+        }
+        else if (c < 0x20) {
+            ss << L"\\u" << std::hex << std::setw(4) << std::setfill(L'0') << static_cast<int>(c) << std::dec;
+        }
+        else {
+            ss << c;
+        }
+    }
+    return ss.str();
+}
+
+// Render the plan as a JSON object
+std::wstring Plan::toJson(const std::wstring& section) const {
+    std::wstringstream ss;
+    ss << L"{\"section\":\"" << escape(section) << L"\",\"operations\":[";
+    unsigned long long counts[merge + 1] = {};
+    unsigned long long bytes[merge + 1] = {};
+    for (size_t i = 0; i < operations.size(); i++) {
+        const Operation& operation = operations[i];
+        counts[operation.type]++;
+        bytes[operation.type] += operation.bytes;
+        ss << (i > 0 ? L"," : L"") << L"{\"op\":\"" << typeName(operation.type) << L"\",\"source\":\"" << escape(operation.source) << L"\"";
+        if (!operation.target.empty()) {
+            ss << L",\"target\":\"" << escape(operation.target) << L"\"";
+        }
+        ss << L",\"bytes\":" << operation.bytes << L"}";
+    }
+    ss << L"],\"totals\":{\"operations\":" << operations.size() << L",\"bytes\":" << getTotalBytes();
+    for (int type = remove; type <= merge; type++) {
+        ss << L",\"" << typeName(static_cast<Type>(type)) << L"\":{\"count\":" << counts[type] << L",\"bytes\":" << bytes[type] << L"}";
+    }
+    ss << L"}}";
+    return ss.str();
+}
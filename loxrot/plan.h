@@ -0,0 +1,129 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * \class Plan
+ * \brief The operations of a rotation, decided from the generation index before anything is touched.
+ */
+class Plan
+{
+public:
+    /**
+     * \enum Type
+     * \brief The kind of an operation.
+     */
+    enum Type {
+        remove,     ///< Delete source.
+        rename,     ///< Rename source to target.
+        copy,       ///< Copy source to target.
+        truncate,   ///< Truncate source to zero bytes.
+        compress,   ///< Compress source to target and delete source.
+        merge       ///< Append source, a compressed file, to the container target and delete source.
+    };
+
+    /**
+     * \struct Operation
+     * \brief A single operation of a plan.
+     */
+    struct Operation {
+        Type type; ///< The kind of the operation.
+        std::wstring source; ///< The file the operation works on.
+        std::wstring target; ///< The file the operation creates, empty for remove and truncate.
+        unsigned long long bytes; ///< Estimated number of bytes the operation reads, writes or frees.
+    };
+
+    /**
+     * \brief Default constructor for Plan.
+     */
+    Plan();
+
+    /**
+     * \brief Destructor for Plan.
+     */
+    ~Plan();
+
+    /**
+     * \brief Append an operation.
+     * \param type The kind of the operation.
+     * \param source The file the operation works on.
+     * \param target The file the operation creates.
+     * \param bytes Estimated number of bytes the operation reads, writes or frees.
+     */
+    void add(Type type, const std::wstring& source, const std::wstring& target, unsigned long long bytes);
+
+    /**
+     * \brief Append all operations of another plan.
+     * \param other The plan to append.
+     */
+    void append(const Plan& other);
+
+    /**
+     * \brief Get the operations in the order they were planned.
+     * \return The operations.
+     */
+    const std::vector<Operation>& getOperations() const;
+
+    /**
+     * \brief Check whether the plan has no operations.
+     * \return True if there is nothing to do.
+     */
+    bool empty() const;
+
+    /**
+     * \brief Sum up the estimated bytes of all operations.
+     * \return The estimated bytes.
+     */
+    unsigned long long getTotalBytes() const;
+
+    /**
+     * \brief Render the plan as a JSON object with the operations and the totals per kind.
+     * \param section The name of the section the plan belongs to.
+     * \return The JSON text.
+     */
+    std::wstring toJson(const std::wstring& section) const;
+
+    /**
+     * \brief Get the name of a kind of operation.
+     * \param type The kind.
+     * \return The name as used in JSON.
+     */
+    static std::wstring typeName(Type type);
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \brief Escape a string for a JSON string literal.
+     * \param text The string.
+     * \return The escaped string without quotes.
+     */
+    static std::wstring escape(const std::wstring& text);
+
+    std::vector<Operation> operations; ///< The planned operations.
+};
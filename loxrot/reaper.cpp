@@ -0,0 +1,140 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "reaper.h"
+#include "logging.h"
+#include <filesystem>
+#include <windows.h>
+
+const wchar_t* Reaper::suffix = L".loxrot-delete";
+
+// Constructor
+Reaper::Reaper() : counter(0), stopping(false) {
+}
+
+// Destructor
+Reaper::~Reaper() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+// Check whether a file is one renamed out of the way for deletion
+bool Reaper::isQueuedName(const std::wstring& path) {
+    std::wstring end(suffix);
+    return path.size() > end.size() && path.compare(path.size() - end.size(), end.size(), end) == 0;
+}
+
+// Rename a file out of the way and queue it for deletion
+bool Reaper::remove(const std::wstring& path, unsigned long long shrinkStep) {
+    std::wstring renamed = path + L"." + std::to_wstring(GetCurrentProcessId()) + L"-" + std::to_wstring(counter++) + suffix;
+    std::error_code ec;
+    std::filesystem::rename(path, renamed, ec);
+    if (ec) {
+        if (!std::filesystem::exists(path, ec)) {
+            return true;
+        }
+        Logging::error(L"Could not move " + path + L" out of the way for deletion");
+        return false;
+    }
+    Logging::debug(L"Queued " + path + L" for deletion");
+    reap(renamed, shrinkStep);
+    return true;
+}
+
+// Queue a file that was renamed out of the way before
+void Reaper::reap(const std::wstring& path, unsigned long long shrinkStep) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& item : queue) {
+            if (item.path == path) {
+                return;
+            }
+        }
+        queue.push_back({ path, shrinkStep });
+        if (!thread.joinable()) {
+            thread = std::thread(&Reaper::work, this);
+        }
+    }
+    condition.notify_one();
+}
+
+// Delete the queued files until the reaper is destroyed
+void Reaper::work() {
+    for (;;) {
+        Item item;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+            // Finish the queue before stopping, the names would only be picked up again by the next scan
+            if (queue.empty()) {
+                return;
+            }
+            item = queue.front();
+        }
+        unsigned long long bytes = destroy(item);
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.pop_front();
+        if (bytes > 0) {
+            Logging::info(L"Deleted " + item.path + L" in the background, reclaimed " + std::to_wstring(bytes) + L" bytes");
+        }
+    }
+}
+
+// Delete a file, truncating it in steps first
+unsigned long long Reaper::destroy(const Item& item) {
+    std::error_code ec;
+    unsigned long long size = std::filesystem::file_size(item.path, ec);
+    if (ec) {
+        // Already gone
+        return 0;
+    }
+    if (item.shrinkStep > 0 && size > item.shrinkStep) {
+        // Freeing the extents in steps keeps each journal transaction small
+        HANDLE handle = CreateFileW(item.path.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle != INVALID_HANDLE_VALUE) {
+            for (unsigned long long remaining = size; remaining > item.shrinkStep;) {
+                remaining -= item.shrinkStep;
+                LARGE_INTEGER position;
+                position.QuadPart = static_cast<LONGLONG>(remaining);
+                if (!SetFilePointerEx(handle, position, NULL, FILE_BEGIN) || !SetEndOfFile(handle)) {
+                    Logging::error(L"Could not shrink " + item.path);
+                    break;
+                }
+            }
+            CloseHandle(handle);
+        }
+    }
+    if (!std::filesystem::remove(item.path, ec) && ec) {
+        Logging::error(L"Could not delete " + item.path);
+        return 0;
+    }
+    return size;
+}
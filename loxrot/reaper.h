@@ -0,0 +1,106 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * \class Reaper
+ * \brief A class to delete files on a background thread, so deleting large generations does not stall the rotations.
+ */
+class Reaper
+{
+public:
+    /**
+     * \brief Default constructor for Reaper.
+     */
+    Reaper();
+
+    /**
+     * \brief Destructor for Reaper. Deletes the files still queued before it returns.
+     */
+    ~Reaper();
+
+    /**
+     * \brief Rename a file out of the way and queue it for deletion. The rename is quick, so the name is free again
+     *        when this returns, while the actual deletion happens later.
+     * \param path The file to delete.
+     * \param shrinkStep If not 0, a file larger than this is truncated in steps of this many bytes before it is deleted.
+     * \return True if the file was queued or did not exist.
+     */
+    bool remove(const std::wstring& path, unsigned long long shrinkStep);
+
+    /**
+     * \brief Queue a file that was renamed out of the way before but not deleted, e.g. because the program was stopped.
+     * \param path The renamed file.
+     * \param shrinkStep If not 0, a file larger than this is truncated in steps of this many bytes before it is deleted.
+     */
+    void reap(const std::wstring& path, unsigned long long shrinkStep);
+
+    /**
+     * \brief Check whether a file is one renamed out of the way for deletion.
+     * \param path The file.
+     * \return True if the file is waiting for deletion.
+     */
+    static bool isQueuedName(const std::wstring& path);
+
+    static const wchar_t* suffix; ///< Appended to the names of files waiting for deletion.
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \struct Item
+     * \brief A file waiting for deletion.
+     */
+    struct Item {
+        std::wstring path; ///< The renamed file.
+        unsigned long long shrinkStep; ///< Step size for truncating before deletion, 0 for none.
+    };
+
+    /**
+     * \brief Delete the queued files until the reaper is destroyed.
+     */
+    void work();
+
+    /**
+     * \brief Delete a file, truncating it in steps first if it is larger than the step size.
+     * \param item The file.
+     * \return The number of bytes reclaimed.
+     */
+    static unsigned long long destroy(const Item& item);
+
+    std::deque<Item> queue; ///< Files waiting for deletion.
+    std::mutex mutex; ///< Guards queue and stopping.
+    std::condition_variable condition; ///< Wakes the thread for new files and for stopping.
+    std::thread thread; ///< The background thread, started with the first file.
+    std::atomic<unsigned long long> counter; ///< Makes the renamed names unique.
+    bool stopping; ///< Set by the destructor.
+};
@@ -23,63 +23,57 @@
     OF SUCH DAMAGE.
 */
 
-#ifdef WITH_ZLIB
-#ifdef _STATIC
-#pragma comment(lib, "zlibstat.lib") // Link with zlib statically
-#else
-#pragma comment(lib, "zlib.lib") // Link with zlib dynamically
-#endif
-#endif
 #include "rotate.h"
 #include "logging.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <list>
 #include <regex>
+#include <set>
+#include <thread>
 #include <windows.h>
 #include "tools.h"
+#include "container.h"
+#include "catalog.h"
+#include "bloom.h"
 #ifdef WITH_ZLIB
 #include <zlib.h>
 #endif
 
 // Constructor
-Rotate::Rotate() {
+Rotate::Rotate() : Rotate(FileSystem::disk(), Clock::system()) {
+}
+
+// Constructor for another file system and clock
+Rotate::Rotate(FileSystem& fileSystem, const Clock& clock) : fileSystem(fileSystem), clock(clock), executor(fileSystem), coordinator(nullptr), leaseToken(0) {
 }
 
 // Destructor
 Rotate::~Rotate() {
 }
 
-#ifdef WITH_ZLIB
-bool Rotate::compressFile(const std::wstring& filename) {
-	std::ifstream ifs(filename, std::ios::binary);
-    gzFile gz = gzopen_w(std::wstring(filename + L".gz").c_str(), "wb");
-    if (!gz) {
-		Logging::error(L"Could not open " + filename + L".gz for writing");
-        ifs.close();
-        return false;
-	}
-    const int bufsize = 1024;
-    char buffer[bufsize];
-    memset(buffer, 0, bufsize);
-    while (ifs.read(buffer, bufsize)) {
-        gzwrite(gz, buffer, static_cast<int>(ifs.gcount()));
-    }
-	gzclose(gz);
-	ifs.close();
-    return true;
+// Get the directories of a section
+std::vector<std::wstring> Rotate::getDirectories(Config::Section& config) {
+    if (!config.directories) {
+        return { config.entries[L"Directory"] };
+    }
+    return config.directories->expand(fileSystem);
 }
-#endif
 
 // Get a list of files in a directory that match a pattern
 std::vector<std::wstring> Rotate::getFilesInDirectory(const std::wstring directory, const std::wstring pattern, bool returnFullPath) {
     std::vector<std::wstring> files;
     std::wregex re(pattern);
-    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
-        if (entry.is_regular_file() && std::regex_match(entry.path().filename().wstring(), re)) {
-            files.push_back(returnFullPath ? entry.path().wstring() : entry.path().filename().wstring());
+    for (const auto& entry : fileSystem.list(directory)) {
+        std::wstring filename = std::filesystem::path(entry.path).filename().wstring();
+        if (entry.regular && std::regex_match(filename, re)) {
+            files.push_back(returnFullPath ? entry.path : filename);
         }
     }
     return files;
@@ -87,216 +81,725 @@ std::vector<std::wstring> Rotate::getFilesInDirectory(const std::wstring directo
 
 // Get the age of a file in seconds
 long long Rotate::getFileAgeInSeconds(const std::wstring filename) {
-	// Open the file
-	HANDLE hFile = CreateFileW(filename.c_str(), FILE_WRITE_ATTRIBUTES, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (hFile == INVALID_HANDLE_VALUE)
-		Logging::error(L"Could not open file " + filename + L" for getting creation time");
-
-    FILETIME ftFile;
-	// Get the creation time of the file
-	if (!GetFileTime(hFile, &ftFile, NULL, NULL)) {
-		CloseHandle(hFile);
-		Logging::error(L"Could not get creation time of " + filename);
-	}
-	CloseHandle(hFile);
-
-	// Get the current system time
-	FILETIME ftNow;
-	GetSystemTimeAsFileTime(&ftNow);
-
-	// Convert FILETIME in ULARGE_INTEGER
-	ULARGE_INTEGER creationULI, currentULI;
-	creationULI.LowPart = ftFile.dwLowDateTime;
-	creationULI.HighPart = ftFile.dwHighDateTime;
-	currentULI.LowPart = ftNow.dwLowDateTime;
-	currentULI.HighPart = ftNow.dwHighDateTime;
-
-	// Calculate the difference in intervals of 100 nanoseconds
-	ULONGLONG diff = currentULI.QuadPart - creationULI.QuadPart;
-
-	// Convert the difference to seconds
-	long long diffSeconds = diff / 10000000ULL;
-    return diffSeconds;
+    time_t created = fileSystem.creationTime(filename);
+    if (created == -1) {
+        Logging::error(L"Could not get creation time of " + filename);
+        return 0;
+    }
+    return static_cast<long long>(clock.now() - created);
 }
 
-// Set the creation time of a file
-void Rotate::setCreationTime(const std::wstring& filename) {
-    // Open the file
-    HANDLE hFile = CreateFileW(filename.c_str(), FILE_WRITE_ATTRIBUTES, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (hFile == INVALID_HANDLE_VALUE)
-        Logging::error(L"Could not open file " + filename + L" for setting creation time");
+// Scan a directory once and group the rotated generations by the file they belong to
+std::map<std::wstring, std::vector<Rotate::Generation>> Rotate::scanGenerations(const std::wstring& directory, std::vector<std::wstring>* leftovers) {
+    std::map<std::wstring, std::vector<Generation>> generations;
+    std::set<std::wstring> blooms;
+    for (const auto& entry : fileSystem.list(directory)) {
+        if (!entry.regular) {
+            continue;
+        }
+        const std::wstring& path = entry.path;
+        std::filesystem::path name(path);
+        if (name.extension() == L".bloom") {
+            blooms.insert(name.stem().wstring());
+            continue;
+        }
+        if (Reaper::isQueuedName(path)) {
+            if (leftovers) {
+                leftovers->push_back(path);
+            }
+            continue;
+        }
+        Generation generation;
+        generation.path = path;
+        std::wstring file;
+        if (!parseGeneration(path, file, generation)) {
+            continue;
+        }
+        // Size and modification time are taken from the directory entry, so no additional stat is needed
+        generation.size = entry.size;
+        generation.modified = entry.modified;
+        generations[file].push_back(generation);
+    }
+    // Sort the generations newest first: numbered ones by ascending suffix, timestamped ones by descending time,
+    // containers last by descending period
+    for (auto& item : generations) {
+        for (auto& generation : item.second) {
+            generation.bloom = generation.compressed && blooms.count(std::filesystem::path(generation.path).filename().wstring()) > 0;
+        }
+        std::sort(item.second.begin(), item.second.end(), [](const Generation& a, const Generation& b) {
+            if (a.merged != b.merged) {
+                return b.merged;
+            }
+            if ((a.timestamp == 0) != (b.timestamp == 0)) {
+                return a.timestamp == 0;
+            }
+            if (a.timestamp != b.timestamp) {
+                return a.timestamp > b.timestamp;
+            }
+            return a.timestamp == 0 ? a.index < b.index : a.index > b.index;
+        });
+    }
+    return generations;
+}
 
-    // Get the current system time
-    FILETIME ft;
-    GetSystemTimeAsFileTime(&ft);
+// Split the name of a rotated generation into the file it belongs to and its suffix
+bool Rotate::parseGeneration(const std::wstring& path, std::wstring& file, Generation& generation) {
+    auto digits = [&path](size_t begin, size_t end) {
+        return begin < end && std::all_of(path.begin() + begin, path.begin() + end, [](wchar_t c) { return c >= L'0' && c <= L'9'; });
+    };
+    size_t end = path.size();
+    bool compressed = end > 3 && path.compare(end - 3, 3, L".gz") == 0;
+    if (compressed) {
+        end -= 3;
+    }
+    // The suffix has no dot, the file name before it at least one character
+    size_t dot = path.rfind(L'.', end == 0 ? 0 : end - 1);
+    if (dot == std::wstring::npos || dot == 0 || dot + 1 >= end) {
+        return false;
+    }
+    size_t begin = dot + 1;
+    size_t length = end - begin;
+    if (length >= 15 && path[begin + 8] == L'-' && digits(begin, begin + 8) && digits(begin + 9, begin + 15)
+        && (length == 15 || (length <= 25 && path[begin + 15] == L'_' && digits(begin + 16, end)))) {
+        // yyyymmdd-hhmmss with an optional collision counter
+        generation.timestamp = parseTimestamp(path.substr(begin, 15));
+        if (generation.timestamp == -1) {
+            return false;
+        }
+        generation.index = length == 15 ? 0 : std::stoi(path.substr(begin + 16, end - begin - 16));
+    }
+    else if (compressed && (length == 7 || length == 8) && path[begin + 4] == L'-' && digits(begin, begin + 4)
+        && (length == 7 ? digits(begin + 5, end) : path[begin + 5] == L'W' && digits(begin + 6, end))) {
+        // yyyy-mm or yyyy-Www of a container
+        generation.timestamp = Container::parsePeriod(path.substr(begin, length));
+        if (generation.timestamp == -1) {
+            return false;
+        }
+        generation.merged = true;
+    }
+    else if (length <= 9 && digits(begin, end)) {
+        generation.index = std::stoi(path.substr(begin, length));
+    }
+    else {
+        return false;
+    }
+    generation.compressed = compressed;
+    file = path.substr(0, dot);
+    return true;
+}
+
+// Format a point in time as a generation suffix
+std::wstring Rotate::formatTimestamp(time_t t) {
+    tm ltm;
+    localtime_s(&ltm, &t);
+    wchar_t buffer[32];
+    wcsftime(buffer, sizeof(buffer) / sizeof(buffer[0]), L"%Y%m%d-%H%M%S", &ltm);
+    return buffer;
+}
+
+// Parse a generation suffix
+time_t Rotate::parseTimestamp(const std::wstring& suffix) {
+    if (suffix.length() != 15 || suffix[8] != L'-') {
+        return -1;
+    }
+    tm ltm = {};
+    ltm.tm_year = std::stoi(suffix.substr(0, 4)) - 1900;
+    ltm.tm_mon = std::stoi(suffix.substr(4, 2)) - 1;
+    ltm.tm_mday = std::stoi(suffix.substr(6, 2));
+    ltm.tm_hour = std::stoi(suffix.substr(9, 2));
+    ltm.tm_min = std::stoi(suffix.substr(11, 2));
+    ltm.tm_sec = std::stoi(suffix.substr(13, 2));
+    ltm.tm_isdst = -1;
+    return mktime(&ltm);
+}
 
-    // Set the creation time of the file
-    if (!SetFileTime(hFile, &ft, NULL, NULL)) {
-        CloseHandle(hFile);
-        Logging::error(L"Could not set creation time of " + filename);
+// Rotate the files of a section in each of its directories
+int Rotate::rotateFile(const std::wstring& name, Config::Section& config) {
+    int operations = 0;
+    std::exception_ptr error;
+    for (const auto& directory : getDirectories(config)) {
+        try {
+            operations += rotateDirectory(name, config, directory);
+        }
+        catch (const std::filesystem::filesystem_error& e) {
+            Logging::error(L"Rotation of section " + name + L" in " + directory + L" failed: " + Tools::stringToWstring(e.what()));
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
     }
-    
-    CloseHandle(hFile);
+    return operations;
 }
 
-// Rotate a file based on a configuration
-int Rotate::rotateFile(Config::Section& config) {
-    // Initialize the total number of renames
-    int renamesTotal = 0;
+// Rotate the files of a section in one directory
+int Rotate::rotateDirectory(const std::wstring& name, Config::Section& config, const std::wstring& directory) {
+    bool simulation = config.entries[L"Simulation"] == L"true";
+    Executor::Options options;
+    options.batched = config.entries[L"Executor"] == L"batched";
+    options.durable = config.entries[L"Durable"] == L"true";
+    options.backgroundDelete = config.entries[L"BackgroundDelete"] == L"true";
+    options.shrinkStep = std::stoull(config.entries[L"ShrinkStep"]);
+    options.blockSize = std::stoull(config.entries[L"BlockSize"]);
+    options.bloomRate = std::stod(config.entries[L"BloomFalsePositiveRate"]);
+    options.bloomTokenChars = Tools::wstringToString(config.entries[L"BloomTokenChars"]);
+    options.tailMarker = config.entries[L"TailMarker"] == L"true";
+    Plan plan;
     try {
         // Get a list of files to process
-        std::vector<std::wstring> files2process = getFilesInDirectory(config.entries[L"Directory"], config.entries[L"FilePattern"], true);
-        // Process each file
+        std::vector<std::wstring> files2process = getFilesInDirectory(directory, config.entries[L"FilePattern"], true);
+        // Get the existing generations of all files in one pass over the directory
+        std::vector<std::wstring> leftovers;
+        std::map<std::wstring, std::vector<Generation>> generations = scanGenerations(directory, &leftovers);
+        // Files of an interrupted background deletion are picked up again
+        for (size_t i = 0; !simulation && options.backgroundDelete && i < leftovers.size(); i++) {
+            executor.reap(leftovers[i], options.shrinkStep);
+        }
+        // Plan each file
+        std::vector<std::wstring> rotated;
         for (auto& file2process : files2process) {
-            // Initialize the number of renames for this file
-            int renames = 0;
             // If the file is too young to rotate, skip it
             if (getFileAgeInSeconds(file2process) < std::stoi(config.entries[L"MinAge"])) {
-                if(config.entries[L"Simulation"] == L"true") {
+                if (simulation) {
 					Logging::info(L"File " + file2process + L" is too young to rotate. Skipping.");
 				}
                 continue;
             }
-            int appendix = 0;
-            std::list<std::wstring> files;
-            while (1) {
-                std::wstring fff = file2process + L"." + std::to_wstring(appendix);
-                if (std::filesystem::exists(file2process + L"." + std::to_wstring(appendix))) {
-                    files.push_back(file2process + L"." + std::to_wstring(appendix));
-                }
-#if WITH_ZLIB
-                else if (std::filesystem::exists(file2process + L"." + std::to_wstring(appendix) + L".gz")) {
-                    files.push_back(file2process + L"." + std::to_wstring(appendix) + L".gz");
+            // Containers take no part in the rotation itself
+            std::vector<Generation>& list = generations[file2process];
+            std::vector<Generation> containers;
+            std::copy_if(list.begin(), list.end(), std::back_inserter(containers), [](const Generation& g) { return g.merged; });
+            list.erase(std::remove_if(list.begin(), list.end(), [](const Generation& g) { return g.merged; }), list.end());
+            if (config.entries[L"Suffix"] == L"timestamp") {
+                planTimestamped(config, file2process, list, plan);
+            }
+            else {
+                planIndexed(config, file2process, list, plan);
+            }
+            planMerge(config, file2process, list, containers, plan);
+            list.insert(list.end(), containers.begin(), containers.end());
+            rotated.push_back(file2process);
+        }
+
+        // Nothing is changed once another instance has taken over the section
+        if (!simulation && coordinator != nullptr && !coordinator->check(name, leaseToken)) {
+            return 0;
+        }
+        // What the catalog has to follow, only the operations that were executed if some failed
+        Plan executed;
+        if (!simulation && !plan.empty()) {
+            std::map<std::wstring, uintmax_t> sizes;
+            bool ok = executor.execute(plan, sizes, options);
+            // Put the real sizes of the compressed generations into the index
+            for (auto& item : generations) {
+                for (auto& generation : item.second) {
+                    std::map<std::wstring, uintmax_t>::iterator it = sizes.find(generation.path);
+                    if (it != sizes.end()) {
+                        generation.size = it->second;
+                    }
+                    else if (generation.merged) {
+                        // The size of a container was estimated from its members before they were compressed
+                        try {
+                            generation.size = fileSystem.fileSize(generation.path);
+                        }
+                        catch (const std::filesystem::filesystem_error&) {
+                        }
+                    }
                 }
-#endif
-                else
-                    break;
-                appendix++;
             }
-            files.sort(std::greater<std::wstring>());
-            while (files.size() >= std::stoi(config.entries[L"KeepFiles"])) {
-                if (files.size() == 0) {
-                    break;
+            for (auto& file2process : rotated) {
+                if (executor.hasFailed(file2process)) {
+                    Logging::error(L"Rotation of " + file2process + L" stopped at a failed operation");
                 }
                 else {
-                    if (config.entries[L"Simulation"] != L"true") {
-                        std::filesystem::remove(files.front());
-                    }
-                    else {
-                        Logging::info(L"Simulated removal of " + files.front());
-                    }
-                    files.pop_front();
+                    Logging::info(L"Rotated " + file2process);
                 }
             }
-            files.push_back(file2process);
-            // If the file is old enough to rotate
-            if (files.size() > 0) {
-                int suffix(0);
+            executed = ok ? plan : executor.getExecuted(plan);
+            if (!ok) {
+                // The index was updated as if every chain had been executed, the directory knows what really happened
+                generations = scanGenerations(directory);
+            }
+        }
 
-                std::wstring new_file(L"");
-                // For each file
-                for (auto& file : files) {
-                    std::wsmatch match;
-                    if (std::regex_match(file, match, std::wregex(L"^(.+)\\.(\\d+)$"))) {
-                        std::wstring base = match[1].str();
-                        suffix = match[2].matched ? std::stoi(match[2].str()) + 1 : 0;
+        // Enforce the size and age limits of the whole section on the updated generation index
+        std::vector<Generation*> sectionGenerations;
+        for (auto& file2process : files2process) {
+            for (auto& generation : generations[file2process]) {
+                sectionGenerations.push_back(&generation);
+            }
+        }
+        Plan retention;
+        planRetention(config, sectionGenerations, retention);
+        if (!simulation && !retention.empty() && coordinator != nullptr && !coordinator->check(name, leaseToken)) {
+            return static_cast<int>(plan.getOperations().size());
+        }
+        if (!simulation && !retention.empty()) {
+            std::map<std::wstring, uintmax_t> sizes;
+            executed.append(executor.execute(retention, sizes, options) ? retention : executor.getExecuted(retention));
+        }
+        plan.append(retention);
+        if (!simulation && !executed.empty() && !config.entries[L"TimestampRegex"].empty()) {
+            updateCatalog(name, config, directory, executed);
+        }
 
-                        new_file = base + L"." + std::to_wstring(suffix);
-                    }
-#if WITH_ZLIB
-                    else if (std::regex_match(file, match, std::wregex(L"^(.+)\\.(\\d+\\.gz)$"))) {
-                        std::wstring base = match[1].str();
-                        suffix = match[2].matched ? std::stoi(match[2].str()) + 1 : 0;
+        if (simulation && !plan.empty()) {
+            Logging::info(plan.toJson(name));
+        }
+    }
+    catch (const std::regex_error& e) {
+        std::cout << "regex_error caught: " << e.what() << '\n';
+    }
+    return static_cast<int>(plan.getOperations().size());
+}
 
-                        new_file = base + L"." + std::to_wstring(suffix) + L".gz";
-                    }
+// Update the time ranges in the catalog of a section
+void Rotate::updateCatalog(const std::wstring& name, Config::Section& config, const std::wstring& directory, const Plan& plan) {
+    Catalog catalog;
+    catalog.setFormat(config.entries[L"TimestampRegex"], config.entries[L"TimestampFormat"]);
+    std::wstring filename = Catalog::fileName(directory, name);
+    catalog.load(filename);
+    catalog.apply(plan);
+    std::vector<std::wstring> names;
+    for (const auto& entry : catalog.getEntries()) {
+        names.push_back(entry.first);
+    }
+    for (const auto& generation : names) {
+        std::wstring path = (std::filesystem::path(directory) / generation).wstring();
+        if (!fileSystem.exists(path)) {
+            catalog.erase(generation);
+            continue;
+        }
+        if (catalog.getEntries().at(generation).first == -1) {
+            // A generation without timestamps is left out, a query always reads generations it does not know
+            Catalog::Entry entry;
+            if (catalog.scanFile(path, entry)) {
+                catalog.set(generation, entry);
+            }
+            else {
+                catalog.erase(generation);
+            }
+        }
+    }
+    catalog.save(filename, config.entries[L"Durable"] == L"true");
+}
+
+// Plan the rotation of a file that shifts its numbered generations up by one
+void Rotate::planIndexed(Config::Section& config, const std::wstring& file2process, std::vector<Generation>& generations, Plan& plan) {
+    int keepFiles = std::stoi(config.entries[L"KeepFiles"]);
+
+    // Only the numbered generations take part, timestamped leftovers of the other scheme are left alone
+    generations.erase(std::remove_if(generations.begin(), generations.end(), [](const Generation& g) { return g.timestamp != 0; }), generations.end());
+
+    // Delete the oldest generations, so that the new .0 still fits into KeepFiles
+    while (keepFiles >= 0 && !generations.empty() && static_cast<int>(generations.size()) >= keepFiles) {
+        planRemoval(generations.back(), plan);
+        generations.pop_back();
+    }
+
+    // Shift the remaining generations up by one, oldest first, so that no rename overwrites an existing generation
+    for (auto it = generations.rbegin(); it != generations.rend(); it++) {
+        it->index++;
+        std::wstring new_file = file2process + L"." + std::to_wstring(it->index) + (it->compressed ? L".gz" : L"");
+        plan.add(Plan::rename, it->path, new_file, 0);
+        if (it->bloom) {
+            plan.add(Plan::rename, Bloom::fileName(it->path), Bloom::fileName(new_file), 0);
+        }
+        it->path = new_file;
+    }
+
+    // The original file becomes .0
+    long long size = static_cast<long long>(fileSystem.fileSize(file2process));
+    if (keepFiles == -1) {
+        plan.add(Plan::remove, file2process, L"", size);
+    }
+    else {
+        if (keepFiles > 0) {
+            Generation generation;
+            generation.path = file2process + L".0";
+            generation.size = size;
+            generation.modified = clock.now();
+            plan.add(Plan::copy, file2process, generation.path, size);
+            generations.insert(generations.begin(), generation);
+        }
+        plan.add(Plan::truncate, file2process, L"", size);
+    }
+
+#ifdef WITH_ZLIB
+    int firstCompress = std::stoi(config.entries[L"FirstCompress"]);
+    for (auto& generation : generations) {
+        if (firstCompress >= 0 && generation.index >= firstCompress && !generation.compressed) {
+            planCompression(config, generation, plan);
+        }
+    }
 #endif
-                    else {
-                        suffix = 0;
-                        new_file = file + L".0";
-                    }
+}
+
+// Plan the rotation of a file into a new timestamp-suffixed generation
+void Rotate::planTimestamped(Config::Section& config, const std::wstring& file2process, std::vector<Generation>& generations, Plan& plan) {
+    int keepFiles = std::stoi(config.entries[L"KeepFiles"]);
+
+    // Only the timestamped generations take part, numbered leftovers of the other scheme are left alone
+    generations.erase(std::remove_if(generations.begin(), generations.end(), [](const Generation& g) { return g.timestamp == 0; }), generations.end());
+
+    // Delete the oldest generations, so that the new one still fits into KeepFiles
+    while (keepFiles >= 0 && !generations.empty() && static_cast<int>(generations.size()) >= keepFiles) {
+        planRemoval(generations.back(), plan);
+        generations.pop_back();
+    }
+
+    long long size = static_cast<long long>(fileSystem.fileSize(file2process));
+    if (keepFiles == -1) {
+        plan.add(Plan::remove, file2process, L"", size);
+        return;
+    }
+
+    if (keepFiles > 0) {
+        Generation generation;
+        generation.timestamp = clock.now();
+        generation.modified = generation.timestamp;
+        generation.size = size;
+        // A second rotation within the same second gets a collision counter
+        for (const auto& existing : generations) {
+            if (existing.timestamp == generation.timestamp) {
+                generation.index = std::max(generation.index, existing.index + 1);
+            }
+        }
+        generation.path = file2process + L"." + formatTimestamp(generation.timestamp);
+        if (generation.index > 0) {
+            generation.path += L"_" + std::to_wstring(generation.index);
+        }
+        plan.add(Plan::copy, file2process, generation.path, size);
+        generations.insert(generations.begin(), generation);
+    }
+    plan.add(Plan::truncate, file2process, L"", size);
 
-                    // If the file is the original file
-                    if (file == file2process) {
-                        if (std::stoi(config.entries[L"KeepFiles"]) == -1) {
-                            if (config.entries[L"Simulation"] != L"true") {
-								Logging::debug(L"Removing file " + file2process);
-                                std::filesystem::remove(file2process);
-                            }
-							else {
-								Logging::debug(L"Simulated removal of " + file2process);
-							}
-                            Logging::debug(L"Deleted " + file2process);
-                        }
-                        else {
-                            if (config.entries[L"Simulation"] != L"true") {
-                                if (std::stoi(config.entries[L"KeepFiles"]) > 0) {
-                                    std::filesystem::copy(file, new_file);
-                                }
-                                std::ofstream ofs(file, std::ios::trunc);
-                                ofs.close();
-                                // Set the creation time of the truncated file to now
-                                setCreationTime(file);
-                                Logging::info(L"Truncated " + file2process);
-                            }
-                            else {
-                                Logging::info(L"Simulated copy of " + file + L" to " + new_file);
-							}
-                        }
-                    }
-                    // If the file is not the original file
-                    else {
-                        if (config.entries[L"Simulation"] != L"true") {
-							std::filesystem::rename(file, new_file);
-                            Logging::debug(L"Renamed " + file + L"to " + new_file);
 #ifdef WITH_ZLIB
-                            if ((suffix >= std::stoi(config.entries[L"FirstCompress"])) && (new_file.rfind(L".gz") != (new_file.length() - 3))) {
-                                if (compressFile(new_file)) {
-									Logging::info(L"Compressed " + new_file);
-                                    std::filesystem::remove(new_file);
-								}
-                                else {
-                                    Logging::error(L"Could not compress " + new_file);
-                                }
-							}
+    // Positions shift by exactly one per rotation, so normally only one generation reaches FirstCompress
+    int firstCompress = std::stoi(config.entries[L"FirstCompress"]);
+    for (size_t position = (firstCompress >= 0 ? firstCompress : generations.size()); position < generations.size(); position++) {
+        if (!generations[position].compressed) {
+            planCompression(config, generations[position], plan);
+        }
+    }
 #endif
-                        }
-                        else {
-                            Logging::info(L"Simulated rename of " + file + L" to " + new_file);
-                        }
-                    }
-                    // Increment the number of renames
-                    renames++;
+}
+
+// Plan the compression of a generation and update its entry in the generation index
+void Rotate::planCompression(Config::Section& config, Generation& generation, Plan& plan) {
+    plan.add(Plan::compress, generation.path, generation.path + L".gz", generation.size);
+    generation.path += L".gz";
+    generation.compressed = true;
+    generation.bloom = std::stod(config.entries[L"BloomFalsePositiveRate"]) > 0;
+}
+
+// Plan the deletion of a generation together with its index or Bloom filter
+void Rotate::planRemoval(const Generation& generation, Plan& plan) {
+    plan.add(Plan::remove, generation.path, L"", generation.size);
+    if (generation.merged) {
+        plan.add(Plan::remove, Container::indexName(generation.path), L"", 0);
+    }
+    if (generation.bloom) {
+        plan.add(Plan::remove, Bloom::fileName(generation.path), L"", 0);
+    }
+}
+
+#ifdef WITH_ZLIB
+// Compress a generation and update its entry in the generation index
+bool Rotate::compressGeneration(Generation& generation, bool simulation, unsigned long long blockSize) {
+    if (simulation) {
+        Logging::info(L"Simulated compression of " + generation.path);
+        return true;
+    }
+    if (!fileSystem.compress(generation.path, blockSize, nullptr)) {
+        Logging::error(L"Could not compress " + generation.path);
+        return false;
+    }
+    Logging::info(L"Compressed " + generation.path);
+    fileSystem.remove(generation.path);
+    generation.path += L".gz";
+    generation.compressed = true;
+    generation.size = fileSystem.fileSize(generation.path);
+    return true;
+}
+#endif
+
+// Plan merging the old compressed generations of a file into containers
+void Rotate::planMerge(Config::Section& config, const std::wstring& file2process, std::vector<Generation>& generations, std::vector<Generation>& containers, Plan& plan) {
+    long long mergeAfter = std::stoll(config.entries[L"MergeAfter"]);
+    if (mergeAfter < 0) {
+        return;
+    }
+    bool weekly = config.entries[L"MergeInto"] == L"week";
+    time_t now = clock.now();
+
+    // Oldest first, so the members of a container stay in chronological order
+    for (size_t i = generations.size(); i-- > 0;) {
+        Generation& generation = generations[i];
+        if (!generation.compressed || now - generation.modified <= mergeAfter) {
+            continue;
+        }
+        std::wstring period = Container::formatPeriod(generation.modified, weekly);
+        std::wstring path = file2process + L"." + period + L".gz";
+        auto container = std::find_if(containers.begin(), containers.end(), [&path](const Generation& g) { return g.path == path; });
+        if (container == containers.end()) {
+            Generation created;
+            created.path = path;
+            created.timestamp = Container::parsePeriod(period);
+            created.compressed = true;
+            created.merged = true;
+            containers.push_back(created);
+            container = containers.end() - 1;
+        }
+        container->size += generation.size;
+        container->modified = std::max(container->modified, generation.modified);
+        plan.add(Plan::merge, generation.path, path, generation.size);
+        generations.erase(generations.begin() + i);
+    }
+}
+
+// Plan the deletion of the oldest generations of a section until it is within MaxAge and MaxTotalSize
+void Rotate::planRetention(Config::Section& config, std::vector<Generation*>& generations, Plan& plan) {
+    long long maxTotalSize = std::stoll(config.entries[L"MaxTotalSize"]);
+    long long maxAge = std::stoll(config.entries[L"MaxAge"]);
+    if (maxTotalSize < 0 && maxAge < 0) {
+        return;
+    }
+
+    // Oldest first across all files of the section
+    std::sort(generations.begin(), generations.end(), [](const Generation* a, const Generation* b) {
+        return a->modified < b->modified;
+    });
+    unsigned long long totalSize = 0;
+    for (const Generation* generation : generations) {
+        totalSize += generation->size;
+    }
+
+    time_t now = clock.now();
+    for (const Generation* generation : generations) {
+        bool tooOld = maxAge >= 0 && now - generation->modified > maxAge;
+        bool tooBig = maxTotalSize >= 0 && totalSize > static_cast<unsigned long long>(maxTotalSize);
+        if (!tooOld && !tooBig) {
+            break;
+        }
+        planRemoval(*generation, plan);
+        totalSize -= generation->size;
+    }
+}
+
+// Reclaim space on a volume under pressure, largest gains first
+unsigned long long Rotate::reclaimSpace(std::vector<std::pair<const std::wstring, Config::Section>*>& sections, unsigned long long needed) {
+    // A generation of one of the sections and whether it may be deleted
+    struct Candidate {
+        std::pair<const std::wstring, Config::Section>* section;
+        std::wstring directory;
+        Generation generation;
+        bool deletable;
+    };
+    std::vector<Candidate> candidates;
+    // Like a rotation, the pass only changes sections whose lease it holds
+    std::map<std::wstring, unsigned long long> leases;
+    try {
+        for (auto* section : sections) {
+            unsigned long long token = 0;
+            if (coordinator != nullptr) {
+                if (!coordinator->acquire(section->first, token)) {
+                    Logging::warning(L"Section " + section->first + L" is left out of the emergency pass, another instance holds its lease");
+                    continue;
                 }
+                leases[section->first] = token;
             }
-            renamesTotal += renames;
-            if (renames > 0) {
-                if (config.entries[L"Simulation"] != L"true") {
-                    Logging::info(L"Rotated " + file2process);
-                }
-                else {
-                    Logging::info(L"Simulated rotation of " + file2process + L" done.");
+            Config::Section* config = &section->second;
+            int minKeepFiles = std::stoi(config->entries[L"MinKeepFiles"]);
+            for (const auto& directory : getDirectories(*config)) {
+                std::vector<std::wstring> files = getFilesInDirectory(directory, config->entries[L"FilePattern"], true);
+                std::map<std::wstring, std::vector<Generation>> generations = scanGenerations(directory);
+                for (auto& file : files) {
+                    std::vector<Generation>& list = generations[file];
+                    for (size_t position = 0; position < list.size(); position++) {
+                        candidates.push_back({ section, directory, list[position], minKeepFiles >= 0 && static_cast<int>(position) >= minKeepFiles });
+                    }
                 }
             }
         }
     }
     catch (const std::regex_error& e) {
-        std::cout << "regex_error caught: " << e.what() << '\n';
+        Logging::error(L"Invalid regular expression in an emergency pass: " + Tools::stringToWstring(e.what()));
+    }
+    // What was done in each directory of a section, for its catalog
+    std::map<std::pair<std::pair<const std::wstring, Config::Section>*, std::wstring>, Plan> changes;
+    // The oldest history goes first, the largest of generations of the same age
+    auto oldestFirst = [](const Candidate& a, const Candidate& b) {
+        if (a.generation.modified != b.generation.modified) {
+            return a.generation.modified < b.generation.modified;
+        }
+        return a.generation.size > b.generation.size;
+    };
+
+    unsigned long long reclaimed = 0;
+#ifdef WITH_ZLIB
+    // Compress the largest uncompressed generations first
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.generation.size > b.generation.size; });
+    for (auto& candidate : candidates) {
+        if (reclaimed >= needed) {
+            break;
+        }
+        if (candidate.generation.compressed) {
+            continue;
+        }
+        Config::Section& config = candidate.section->second;
+        uintmax_t before = candidate.generation.size;
+        std::wstring source = candidate.generation.path;
+        bool simulation = config.entries[L"Simulation"] == L"true";
+        if (!compressGeneration(candidate.generation, simulation, std::stoull(config.entries[L"BlockSize"]))) {
+            continue;
+        }
+        if (!simulation) {
+            changes[{ candidate.section, candidate.directory }].add(Plan::compress, source, candidate.generation.path, before);
+        }
+        if (candidate.generation.size < before) {
+            reclaimed += before - candidate.generation.size;
+        }
     }
-    return renamesTotal;
+#endif
+    // Then trim the retention down to MinKeepFiles, oldest generations first
+    std::sort(candidates.begin(), candidates.end(), oldestFirst);
+    for (auto& candidate : candidates) {
+        if (reclaimed >= needed) {
+            break;
+        }
+        if (!candidate.deletable) {
+            continue;
+        }
+        if (candidate.section->second.entries[L"Simulation"] != L"true") {
+            if (!fileSystem.remove(candidate.generation.path)) {
+                Logging::error(L"Could not remove " + candidate.generation.path);
+                continue;
+            }
+            if (candidate.generation.merged) {
+                fileSystem.remove(Container::indexName(candidate.generation.path));
+            }
+            if (candidate.generation.bloom) {
+                fileSystem.remove(Bloom::fileName(candidate.generation.path));
+            }
+            Logging::info(L"Removed " + candidate.generation.path + L" to reclaim space");
+            changes[{ candidate.section, candidate.directory }].add(Plan::remove, candidate.generation.path, L"", 0);
+        }
+        else {
+            Logging::info(L"Simulated removal of " + candidate.generation.path + L" to reclaim space");
+        }
+        reclaimed += candidate.generation.size;
+    }
+    for (auto& change : changes) {
+        std::pair<const std::wstring, Config::Section>* section = change.first.first;
+        if (!section->second.entries[L"TimestampRegex"].empty()) {
+            updateCatalog(section->first, section->second, change.first.second, change.second);
+        }
+    }
+    for (const auto& lease : leases) {
+        coordinator->release(lease.first, lease.second);
+    }
+    return reclaimed;
 }
 
 // Rotate files based on a configuration
-void Rotate::doRotates(std::pair<std::wstring, Config::Section>* config) {
+bool Rotate::doRotates(std::pair<std::wstring, Config::Section>* config) {
     // Log that we have entered the doRotates function
     Logging::debug(L"Entered doRotates");
-    try {
-        // If it is time to rotate
-        if (config->second.crontab.isTimeToRotate()) {
-            // Rotate the file
-            rotateFile(config->second);
+    // If it is time to rotate
+    bool due = config->second.crontab.isTimeToRotate(clock.now());
+    if (due) {
+        // Rotate the file
+        rotateSection(config->first, config->second);
+    }
+    // Log that we are leaving the doRotates function
+    Logging::debug(L"Leaving doRotates");
+    return due;
+}
+
+// Perform the due rotations of all sections on a bounded number of threads
+size_t Rotate::doRotates(std::map<std::wstring, Config::Section>& configs, size_t maxConcurrent, std::vector<std::wstring>* rotated) {
+    // Every timer is checked once per pass, whether or not a thread is free
+    std::vector<std::pair<const std::wstring, Config::Section>*> due;
+    time_t now = clock.now();
+    for (auto& config : configs) {
+        if (config.second.crontab.isTimeToRotate(now)) {
+            due.push_back(&config);
         }
     }
+    std::vector<char> done(due.size(), 0);
+    if (maxConcurrent <= 1 || due.size() <= 1) {
+        for (size_t i = 0; i < due.size(); i++) {
+            done[i] = rotateSection(due[i]->first, due[i]->second);
+        }
+    }
+    else {
+        rotateConcurrently(due, done, maxConcurrent);
+    }
+    for (size_t i = 0; rotated != nullptr && i < due.size(); i++) {
+        if (done[i]) {
+            rotated->push_back(due[i]->first);
+        }
+    }
+    return due.size();
+}
+
+// Rotate due sections on a bounded number of threads
+void Rotate::rotateConcurrently(std::vector<std::pair<const std::wstring, Config::Section>*>& due, std::vector<char>& done, size_t maxConcurrent) {
+    // Each thread takes the next due section, so a slow section does not hold up the others
+    std::atomic<size_t> next(0);
+    auto worker = [&](Rotate& rotate) {
+        for (size_t i = next++; i < due.size(); i = next++) {
+            done[i] = rotate.rotateSection(due[i]->first, due[i]->second);
+        }
+    };
+    size_t threadCount = std::min(maxConcurrent, due.size());
+    // A new Rotate per pass would wait for its background deletions and restart their names
+    while (workers.size() + 1 < threadCount) {
+        workers.push_back(std::make_unique<Rotate>(fileSystem, clock));
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+        Rotate& rotate = *workers[i - 1];
+        rotate.setCoordinator(coordinator);
+        try {
+            threads.emplace_back([&rotate, &worker]() {
+                worker(rotate);
+            });
+        }
+        catch (const std::system_error&) {
+            // The threads that did start and this one share the rest
+            break;
+        }
+    }
+    worker(*this);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Share the sections with other instances
+void Rotate::setCoordinator(Coordinator* coordinator) {
+    this->coordinator = coordinator;
+}
+
+// Check whether a section belongs to this instance
+bool Rotate::isOwner(const std::wstring& name) {
+    return coordinator == nullptr || coordinator->isOwner(name);
+}
+
+// Rotate the files of a section and log the errors
+bool Rotate::rotateSection(const std::wstring& name, Config::Section& config) {
+    // Another instance rotates the section, or is still rotating it
+    if (coordinator != nullptr && !coordinator->acquire(name, leaseToken)) {
+        return false;
+    }
+    try {
+        // Rotate the file
+        rotateFile(name, config);
+    }
     // Catch any filesystem errors
     catch (std::filesystem::filesystem_error& e) {
         // Log the error
@@ -307,6 +810,8 @@ void Rotate::doRotates(std::pair<std::wstring, Config::Section>* config) {
         // Log the error
         Logging::error(L"Unknown exception in doRotates");
     }
-    // Log that we are leaving the doRotates function
-    Logging::debug(L"Leaving doRotates");
+    if (coordinator != nullptr) {
+        coordinator->release(name, leaseToken);
+    }
+    return true;
 }
@@ -25,9 +25,17 @@
 
 #pragma once
 #include <chrono>
+#include <ctime>
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
+#include "clock.h"
 #include "config.h"
+#include "coordinator.h"
+#include "executor.h"
+#include "plan.h"
+#include "vfs.h"
 
 // The rotation functionality
 /**
@@ -42,6 +50,14 @@ public:
      */
     Rotate();
 
+    /**
+     * \brief Constructor for a Rotate that works on another file system and clock, e.g. to simulate rotations.
+     *        Catalogs need the content of the files and are always read from and written to the disk.
+     * \param fileSystem The file system the files are found and rotated on.
+     * \param clock The clock that decides which rotations are due and how old files are.
+     */
+    Rotate(FileSystem& fileSystem, const Clock& clock);
+
     /**
      * \brief Destructor for Rotate.
      */
@@ -50,10 +66,85 @@ public:
     /**
      * \brief Perform file rotations based on a configuration.
      * \param config The configuration to use for rotations.
+     * \return True if the section was due.
      */
-    void doRotates(std::pair<std::wstring, Config::Section>* config);
+    bool doRotates(std::pair<std::wstring, Config::Section>* config);
+
+    /**
+     * \brief Perform the due rotations of all sections. The timers are checked in the order of the sections, the due
+     *        sections are then rotated on up to maxConcurrent threads, each with a Rotate of its own. With 1 they are
+     *        rotated one after the other on the calling thread.
+     * \param configs The sections.
+     * \param maxConcurrent The maximum number of sections rotated at the same time.
+     * \param rotated If given, receives the names of the sections this instance rotated.
+     * \return The number of sections due.
+     */
+    size_t doRotates(std::map<std::wstring, Config::Section>& configs, size_t maxConcurrent, std::vector<std::wstring>* rotated = nullptr);
+
+    /**
+     * \brief Rotate the files of a section and log the errors instead of passing them on. With a coordinator the
+     *        section is skipped unless this instance gets its lease.
+     * \param name The name of the section.
+     * \param config The configuration of the section.
+     * \return False if the section was skipped.
+     */
+    bool rotateSection(const std::wstring& name, Config::Section& config);
+
+    /**
+     * \brief Share the sections with other instances. A due section is then only rotated by the instance it belongs
+     *        to, under the lease of the section, and the plans are only carried out while the lease is held.
+     * \param coordinator The coordinator, nullptr to rotate all sections. The Rotates of the threads of doRotates
+     *        use it as well.
+     */
+    void setCoordinator(Coordinator* coordinator);
+
+    /**
+     * \brief Check whether a section belongs to this instance.
+     * \param name The name of the section.
+     * \return True without a coordinator.
+     */
+    bool isOwner(const std::wstring& name);
+
+    /**
+     * \brief Reclaim space outside of the schedule: compress the largest uncompressed generations first,
+     *        then delete the oldest generations beyond MinKeepFiles. The catalogs follow the changed generations.
+     *        With a coordinator, a section is only included if its lease can be taken.
+     * \param sections The sections located on the volume under pressure.
+     * \param needed The number of bytes to reclaim.
+     * \return The number of bytes reclaimed.
+     */
+    unsigned long long reclaimSpace(std::vector<std::pair<const std::wstring, Config::Section>*>& sections, unsigned long long needed);
+
+    /**
+     * \struct Generation
+     * \brief A rotated generation of a log file as found by the directory scan.
+     */
+    struct Generation {
+        std::wstring path; ///< Full path of the generation.
+        int index = 0; ///< The numeric suffix (.N) or, for timestamp suffixes, the collision counter.
+        time_t timestamp = 0; ///< The parsed timestamp suffix, 0 for numeric suffixes.
+        bool compressed = false; ///< Whether the generation ends with .gz.
+        uintmax_t size = 0; ///< The size in bytes as reported by the directory scan.
+        time_t modified = 0; ///< The last write time as reported by the directory scan.
+        bool merged = false; ///< Whether the generation is a container of merged generations, timestamp is the start of its period.
+        bool bloom = false; ///< Whether a Bloom filter of the generation is stored next to it.
+    };
+
+    /**
+     * \brief Scan a directory once and group the rotated generations by the file they belong to.
+     * \param directory The directory to scan.
+     * \param leftovers If given, files still waiting for a background deletion are returned here.
+     * \return A map of the full path of the rotated file to its generations, newest first.
+     */
+    std::map<std::wstring, std::vector<Generation>> scanGenerations(const std::wstring& directory, std::vector<std::wstring>* leftovers = nullptr);
+
+    /**
+     * \brief Get the directories of a section, the expansion of Directory.
+     * \param config The configuration of the section.
+     * \return The directories.
+     */
+    std::vector<std::wstring> getDirectories(Config::Section& config);
 
-private:
     /**
      * \brief Get files in a directory that match a pattern.
      * \param directory The directory to search.
@@ -62,14 +153,36 @@ private:
      * \return A vector of matching file names.
      */
     std::vector<std::wstring> getFilesInDirectory(const std::wstring directory, const std::wstring pattern, bool returnFullPath = false);
-#ifdef WITH_ZLIB
+
+#ifndef UNITTEST
+private:
+#endif
     /**
-     * \brief Compresses a file with zlib.
-     * \param filename The filename to be compressed. The orifinal file will not be deleted.
-     * \return true or false
+     * \brief Split the name of a rotated generation into the file it belongs to and its suffix. Equivalent to matching
+     *        <file>.<index>[.gz], <file>.<yyyymmdd-hhmmss>[_<counter>][.gz] and <file>.<period>.gz without a regular
+     *        expression, which would take most of the time of a scan of a large directory.
+     * \param path The full path of the generation.
+     * \param file The full path of the file it belongs to is returned here.
+     * \param generation The suffix is parsed into index, timestamp, compressed and merged of this generation.
+     * \return False if the path is not the name of a generation.
      */
-    bool compressFile(const std::wstring& filename);
-#endif
+    static bool parseGeneration(const std::wstring& path, std::wstring& file, Generation& generation);
+
+
+    /**
+     * \brief Format a point in time as a generation suffix (YYYYMMDD-HHMMSS, local time).
+     * \param t The point in time.
+     * \return The formatted suffix.
+     */
+    static std::wstring formatTimestamp(time_t t);
+
+    /**
+     * \brief Parse a generation suffix (YYYYMMDD-HHMMSS, local time).
+     * \param suffix The suffix to parse.
+     * \return The point in time or -1 if the suffix is invalid.
+     */
+    static time_t parseTimestamp(const std::wstring& suffix);
+
     /**
      * \brief Get the age of a file in seconds.
      * \param filename The name of the file.
@@ -78,17 +191,110 @@ private:
     long long getFileAgeInSeconds(const std::wstring filename);
 
     /**
-     * \brief Set the creation time of the truncated file to now.
-     * \param filename The name of the file.
-     * \return void
+     * \brief Rotate due sections on up to maxConcurrent threads, each with its own Rotate that is kept for later passes.
+     * \param due The due sections.
+     * \param done Set to 1 at the index of each section this instance rotated.
+     * \param maxConcurrent The maximum number of threads.
      */
-    void setCreationTime(const std::wstring& filename);
+    void rotateConcurrently(std::vector<std::pair<const std::wstring, Config::Section>*>& due, std::vector<char>& done, size_t maxConcurrent);
 
     /**
-     * \brief Rotate a file based on a configuration.
+     * \brief Rotate the files of a section in each of its directories. An error in one directory does not keep the
+     *        others from being rotated, the first one is passed on afterwards.
+     * \param name The name of the section.
      * \param config The configuration to use for rotation.
-     * \return The status of the rotation.
+     * \return The number of planned operations.
      */
-    int rotateFile(Config::Section& config);
-};
+    int rotateFile(const std::wstring& name, Config::Section& config);
+
+    /**
+     * \brief Rotate the files of a section in one directory. The rotation is planned first and then executed,
+     *        or only printed as JSON if the section is a simulation. Size and age limits apply per directory.
+     * \param name The name of the section.
+     * \param config The configuration to use for rotation.
+     * \param directory The directory.
+     * \return The number of planned operations.
+     */
+    int rotateDirectory(const std::wstring& name, Config::Section& config, const std::wstring& directory);
+
+    /**
+     * \brief Plan the rotation of a single file that shifts its numbered generations (.0, .1, ...) up by one.
+     * \param config The configuration to use for rotation.
+     * \param file2process The file to rotate.
+     * \param generations The generations of the file, newest first. Updated to the state after the plan.
+     * \param plan The plan to append the operations to.
+     */
+    void planIndexed(Config::Section& config, const std::wstring& file2process, std::vector<Generation>& generations, Plan& plan);
+
+    /**
+     * \brief Plan the rotation of a single file into a new timestamp-suffixed generation. Existing generations are
+     *        not touched except for retention and compression.
+     * \param config The configuration to use for rotation.
+     * \param file2process The file to rotate.
+     * \param generations The generations of the file, newest first. Updated to the state after the plan.
+     * \param plan The plan to append the operations to.
+     */
+    void planTimestamped(Config::Section& config, const std::wstring& file2process, std::vector<Generation>& generations, Plan& plan);
+
+    /**
+     * \brief Plan the compression of a generation and update its path, compressed and bloom flag.
+     * \param config The configuration of the section.
+     * \param generation The generation to compress.
+     * \param plan The plan to append the operation to.
+     */
+    void planCompression(Config::Section& config, Generation& generation, Plan& plan);
+
+    /**
+     * \brief Plan the deletion of a generation together with its index or Bloom filter.
+     * \param generation The generation to delete.
+     * \param plan The plan to append the operations to.
+     */
+    void planRemoval(const Generation& generation, Plan& plan);
+
+    /**
+     * \brief Plan merging the compressed generations older than MergeAfter into one container per week or month, and
+     *        move them from the generation index into the entries of their containers.
+     * \param config The configuration of the section.
+     * \param file2process The full path of the rotated file.
+     * \param generations The generations of the file after its rotation was planned, without containers.
+     * \param containers The existing containers of the file, new ones are added.
+     * \param plan The plan to append the operations to.
+     */
+    void planMerge(Config::Section& config, const std::wstring& file2process, std::vector<Generation>& generations, std::vector<Generation>& containers, Plan& plan);
+
+    /**
+     * \brief Plan the deletion of the oldest generations of a section until it is within MaxAge and MaxTotalSize.
+     *        Works on the sizes and times of the generation index only.
+     * \param config The configuration of the section.
+     * \param generations The generations of all files of the section.
+     * \param plan The plan to append the operations to.
+     */
+    void planRetention(Config::Section& config, std::vector<Generation*>& generations, Plan& plan);
 
+    /**
+     * \brief Update the time ranges in the catalog of a section after a plan was executed. New generations are scanned
+     *        for their first and last timestamp, generations that no longer exist are dropped.
+     * \param name The name of the section.
+     * \param config The configuration of the section.
+     * \param directory The directory the plan was executed in.
+     * \param plan The executed plan.
+     */
+    void updateCatalog(const std::wstring& name, Config::Section& config, const std::wstring& directory, const Plan& plan);
+#ifdef WITH_ZLIB
+    /**
+     * \brief Compress a generation right away and update its path, size and compressed flag.
+     * \param generation The generation to compress.
+     * \param simulation Only log what would be done.
+     * \param blockSize If not 0, compress into the seekable format with blocks of this size.
+     * \return true or false
+     */
+    bool compressGeneration(Generation& generation, bool simulation, unsigned long long blockSize);
+#endif
+
+    FileSystem& fileSystem; ///< The file system the files are found and rotated on.
+    const Clock& clock; ///< The source of the current time.
+    Executor executor; ///< Carries out the plans.
+    Coordinator* coordinator; ///< Shares the sections with other instances, nullptr to rotate all of them.
+    unsigned long long leaseToken; ///< The fencing token of the lease of the section being rotated.
+    std::vector<std::unique_ptr<Rotate>> workers; ///< The Rotates of the other threads, their background deletions outlive a pass.
+};
@@ -0,0 +1,361 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+#include "search.h"
+#include "bloom.h"
+#include "logging.h"
+#include "rotate.h"
+#include "seekable.h"
+#include "tools.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <regex>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+// Write the lines of a section within a time window
+bool Search::queryTime(const std::wstring& name, Config::Section& config, time_t from, time_t to, std::ostream& out) {
+    if (config.entries[L"TimestampRegex"].empty()) {
+        Logging::error(L"Section " + name + L" has no TimestampRegex");
+        return false;
+    }
+    std::list<Catalog> catalogs;
+    std::vector<Source> sources = listSources(name, config, catalogs);
+    size_t total = sources.size();
+    sources.erase(std::remove_if(sources.begin(), sources.end(), [&](const Source& source) {
+        return source.range.first != -1 && (source.range.last < from || source.range.first > to);
+    }), sources.end());
+    std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.order < b.order; });
+    Logging::debug(L"Query of section " + name + L" reads " + std::to_wstring(sources.size()) + L" of " + std::to_wstring(total) + L" files");
+
+    bool ok = true;
+    for (const auto& source : sources) {
+        bool partial = false;
+        unsigned long long offset = source.merged ? 0 : findStart(source.path, *source.catalog, from, partial);
+        bool inWindow = false;
+        ok = Seekable::readLines(source.path, offset, partial, [&](const char* line, size_t length) {
+            time_t timestamp = source.catalog->parse(line, length);
+            if (timestamp != -1) {
+                // Lines are in order, nothing after the window follows
+                if (timestamp > to) {
+                    return false;
+                }
+                inWindow = timestamp >= from;
+            }
+            if (inWindow) {
+                out.write(line, length);
+                if (line[length - 1] != '\n') {
+                    out.put('\n');
+                }
+            }
+            return true;
+        }) && ok;
+    }
+    return ok && out.good();
+}
+
+// Write the lines of a section that contain a token
+bool Search::searchToken(const std::wstring& name, Config::Section& config, const std::string& token, std::ostream& out) {
+    std::string tokenChars = Tools::wstringToString(config.entries[L"BloomTokenChars"]);
+    Bloom matcher(tokenChars);
+    if (!matcher.isToken(token)) {
+        Logging::error(L"Search term of section " + name + L" is not a single token");
+        return false;
+    }
+    std::list<Catalog> catalogs;
+    std::vector<Source> sources = listSources(name, config, catalogs);
+    std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.order < b.order; });
+
+    bool ok = true;
+    size_t skipped = 0;
+    for (const auto& source : sources) {
+        if (!Bloom::fileMayContain(Bloom::fileName(source.path), tokenChars, token)) {
+            skipped++;
+            continue;
+        }
+        ok = Seekable::readLines(source.path, 0, false, [&](const char* line, size_t length) {
+            if (matcher.lineContains(line, length, token)) {
+                out.write(line, length);
+                if (line[length - 1] != '\n') {
+                    out.put('\n');
+                }
+            }
+            return true;
+        }) && ok;
+    }
+    Logging::debug(L"Search of section " + name + L" skipped " + std::to_wstring(skipped) + L" of " + std::to_wstring(sources.size()) + L" files");
+    return ok && out.good();
+}
+
+// Write the matching lines of the live files and all generations of a section
+bool Search::grep(const std::wstring& name, Config::Section& config, bool regex, const std::string& pattern, std::ostream& out) {
+    std::regex expression;
+    if (regex) {
+        expression = std::regex(pattern, std::regex::optimize);
+    }
+    std::list<Catalog> catalogs;
+    std::vector<Source> sources = listSources(name, config, catalogs);
+    std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.order < b.order; });
+
+    // Workers search the files in order, the calling thread writes the results in the same order as they complete
+    std::vector<std::string> results(sources.size());
+    std::vector<bool> done(sources.size(), false);
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t next = 0;
+    size_t written = 0;
+    size_t ahead = 0;
+    std::atomic<bool> ok(true);
+    auto worker = [&]() {
+        for (;;) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return next >= sources.size() || next < written + ahead; });
+                if (next >= sources.size()) {
+                    return;
+                }
+                i = next++;
+            }
+            std::string result;
+            if (!grepFile(sources[i].path, pattern, regex ? &expression : nullptr, result)) {
+                ok = false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                results[i].swap(result);
+                done[i] = true;
+            }
+            changed.notify_all();
+        }
+    };
+    size_t threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), sources.size());
+    ahead = threadCount * grepAhead;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threadCount; i++) {
+        try {
+            threads.emplace_back(worker);
+        }
+        catch (const std::system_error&) {
+            break;
+        }
+    }
+    if (threads.empty()) {
+        // No thread could be started, search here one file after the other
+        ahead = sources.size();
+        worker();
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        std::string result;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return done[i]; });
+            result.swap(results[i]);
+            written = i + 1;
+        }
+        changed.notify_all();
+        out.write(result.data(), result.size());
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return ok && out.good();
+}
+
+// Collect the matching lines of one file
+bool Search::grepFile(const std::wstring& path, const std::string& literal, const std::regex* regex, std::string& result) {
+    std::string prefix = Tools::wstringToString(std::filesystem::path(path).filename().wstring()) + ":";
+    auto emit = [&](const char* line, size_t length) {
+        result += prefix;
+        result.append(line, length);
+        if (line[length - 1] != '\n') {
+            result += '\n';
+        }
+    };
+    auto matches = [&](const char* line, size_t length) {
+        return regex ? std::regex_search(line, line + length, *regex) : findLiteral(line, line + length, literal) != nullptr;
+    };
+    std::string pending;
+    bool ok = Seekable::read(path, 0, [&](const char* data, size_t length) {
+        const char* end = data + length;
+        // Complete the line the last piece ended in
+        if (!pending.empty()) {
+            const char* feed = static_cast<const char*>(memchr(data, '\n', length));
+            if (!feed) {
+                pending.append(data, length);
+                return true;
+            }
+            pending.append(data, feed + 1);
+            if (matches(pending.data(), pending.size())) {
+                emit(pending.data(), pending.size());
+            }
+            pending.clear();
+            data = feed + 1;
+        }
+        const char* complete = end;
+        while (complete > data && complete[-1] != '\n') {
+            complete--;
+        }
+        if (regex) {
+            for (const char* line = data; line < complete;) {
+                const char* feed = static_cast<const char*>(memchr(line, '\n', complete - line));
+                if (matches(line, feed + 1 - line)) {
+                    emit(line, feed + 1 - line);
+                }
+                line = feed + 1;
+            }
+        }
+        else {
+            // Search the whole piece, only a match is widened to its line
+            for (const char* match = findLiteral(data, complete, literal); match; match = findLiteral(match, complete, literal)) {
+                const char* line = match;
+                while (line > data && line[-1] != '\n') {
+                    line--;
+                }
+                match = static_cast<const char*>(memchr(match, '\n', complete - match)) + 1;
+                emit(line, match - line);
+            }
+        }
+        pending.assign(complete, end);
+        return true;
+    });
+    if (ok && !pending.empty() && matches(pending.data(), pending.size())) {
+        emit(pending.data(), pending.size());
+    }
+    return ok;
+}
+
+// Find a literal in a range with memchr on its first byte
+const char* Search::findLiteral(const char* begin, const char* end, const std::string& literal) {
+    size_t length = literal.size();
+    while (static_cast<size_t>(end - begin) >= length) {
+        begin = static_cast<const char*>(memchr(begin, literal[0], end - begin - length + 1));
+        if (!begin) {
+            return nullptr;
+        }
+        if (memcmp(begin + 1, literal.data() + 1, length - 1) == 0) {
+            return begin;
+        }
+        begin++;
+    }
+    return nullptr;
+}
+
+// Parse a point in time given on the command line
+time_t Search::parseTime(const std::wstring& text) {
+    std::wstring value = text;
+    std::replace(value.begin(), value.end(), L'T', L' ');
+    static const wchar_t* formats[] = { L"%Y-%m-%d %H:%M:%S", L"%Y-%m-%d %H:%M", L"%Y-%m-%d" };
+    for (const wchar_t* format : formats) {
+        std::wistringstream stream(value);
+        std::tm tm = {};
+        stream >> std::get_time(&tm, format);
+        if (!stream.fail() && (stream >> std::ws).eof()) {
+            tm.tm_isdst = -1;
+            return mktime(&tm);
+        }
+    }
+    return -1;
+}
+
+// Get the live files and the generations of a section in all its directories
+std::vector<Search::Source> Search::listSources(const std::wstring& name, Config::Section& config, std::list<Catalog>& catalogs) {
+    std::vector<Source> sources;
+    std::wregex pattern(config.entries[L"FilePattern"]);
+    Rotate rotate;
+    for (const auto& directory : rotate.getDirectories(config)) {
+        // Each directory has a catalog of its own
+        catalogs.emplace_back();
+        Catalog& catalog = catalogs.back();
+        catalog.setFormat(config.entries[L"TimestampRegex"], config.entries[L"TimestampFormat"]);
+        catalog.load(Catalog::fileName(directory, name));
+        std::map<std::wstring, std::vector<Rotate::Generation>> generations = rotate.scanGenerations(directory);
+        for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+            if (entry.is_regular_file()) {
+                generations[entry.path().wstring()];
+            }
+        }
+        for (const auto& item : generations) {
+            if (!std::regex_match(std::filesystem::path(item.first).filename().wstring(), pattern)) {
+                continue;
+            }
+            for (const auto& generation : item.second) {
+                Source source;
+                source.path = generation.path;
+                source.merged = generation.merged;
+                source.catalog = &catalog;
+                std::map<std::wstring, Catalog::Entry>::const_iterator it = catalog.getEntries().find(std::filesystem::path(generation.path).filename().wstring());
+                if (it != catalog.getEntries().end()) {
+                    source.range = it->second;
+                }
+                source.order = source.range.first != -1 ? source.range.first : generation.modified;
+                sources.push_back(source);
+            }
+            // The live file is not in the catalog, its head and tail are cheap to read
+            std::error_code ec;
+            if (std::filesystem::is_regular_file(item.first, ec)) {
+                Source source;
+                source.path = item.first;
+                source.catalog = &catalog;
+                source.order = !config.entries[L"TimestampRegex"].empty() && catalog.scanFile(item.first, source.range) ? source.range.first : time(nullptr);
+                sources.push_back(source);
+            }
+        }
+    }
+    return sources;
+}
+
+// Find the block of a seekable file to start reading a time window at
+unsigned long long Search::findStart(const std::wstring& path, const Catalog& catalog, time_t from, bool& partial) {
+    std::vector<Seekable::Block> blocks;
+    partial = false;
+    if (!Seekable::readIndex(path, blocks) || blocks.size() < 3) {
+        return 0;
+    }
+    // The last entry is the end of the data, the last block to start at is the one before it
+    size_t low = 0;
+    size_t high = blocks.size() - 2;
+    while (low < high) {
+        size_t middle = (low + high + 1) / 2;
+        time_t first = -1;
+        Seekable::readLines(path, blocks[middle].compressed, true, [&](const char* line, size_t length) {
+            first = catalog.parse(line, length);
+            return first == -1;
+        });
+        if (first != -1 && first <= from) {
+            low = middle;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    partial = low > 0;
+    return blocks[low].compressed;
+}
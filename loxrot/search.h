@@ -0,0 +1,145 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <ctime>
+#include <list>
+#include <regex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "catalog.h"
+#include "config.h"
+
+/**
+ * \class Search
+ * \brief A class for reading the log lines of a section across its rotated and compressed generations without
+ *        decompressing them to disk.
+ */
+class Search
+{
+public:
+    /**
+     * \struct Source
+     * \brief A file of a section that may hold lines of a query.
+     */
+    struct Source {
+        std::wstring path; ///< Full path of the file.
+        Catalog::Entry range; ///< The time range from the catalog, first is -1 if unknown.
+        time_t order = 0; ///< Sort key, the first timestamp or the last write time if the range is unknown.
+        bool merged = false; ///< Whether the file is a container of merged generations.
+        const Catalog* catalog = nullptr; ///< The catalog of the directory of the file.
+    };
+
+    /**
+     * \brief Write the lines of a section within a time window, oldest generation first. Generations whose catalog
+     *        range is outside the window are not opened, in seekable generations reading starts at the block the
+     *        window starts in. Lines without a timestamp belong to the line before them.
+     * \param name The name of the section.
+     * \param config The configuration of the section.
+     * \param from The start of the window.
+     * \param to The end of the window, inclusive.
+     * \param out The stream to write the lines to.
+     * \return False if the section has no TimestampRegex or a file could not be read.
+     */
+    static bool queryTime(const std::wstring& name, Config::Section& config, time_t from, time_t to, std::ostream& out);
+
+    /**
+     * \brief Write the lines of a section that contain a token as a whole token, oldest generation first. Compressed
+     *        generations whose Bloom filter rules the token out are not opened.
+     * \param name The name of the section.
+     * \param config The configuration of the section.
+     * \param token The token, a run of letters, digits and the characters of BloomTokenChars.
+     * \param out The stream to write the lines to.
+     * \return False if the token is not a single token or a file could not be read.
+     */
+    static bool searchToken(const std::wstring& name, Config::Section& config, const std::string& token, std::ostream& out);
+
+    /**
+     * \brief Write the lines of the live files and all generations of a section, plain or compressed, that contain a
+     *        literal or match a regular expression, prefixed with the file name. The files are searched on parallel
+     *        threads and written oldest generation first, the live file last.
+     * \param name The name of the section.
+     * \param config The configuration of the section.
+     * \param regex If true, the pattern is a regular expression (ECMAScript), else a literal.
+     * \param pattern The literal or regular expression, not empty.
+     * \param out The stream to write the lines to.
+     * \return False if a file could not be read.
+     */
+    static bool grep(const std::wstring& name, Config::Section& config, bool regex, const std::string& pattern, std::ostream& out);
+
+    /**
+     * \brief Parse a point in time given on the command line (YYYY-MM-DD[ HH:MM[:SS]], a T instead of the space is
+     *        accepted), local time.
+     * \param text The text.
+     * \return The point in time or -1 if the text is invalid.
+     */
+    static time_t parseTime(const std::wstring& text);
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \brief Get the live files and the generations of a section in all its directories with their catalog ranges.
+     * \param name The name of the section.
+     * \param config The configuration of the section.
+     * \param catalogs The catalogs of the directories are loaded into this list, the sources point to them.
+     * \return The files in no particular order.
+     */
+    static std::vector<Source> listSources(const std::wstring& name, Config::Section& config, std::list<Catalog>& catalogs);
+
+    /**
+     * \brief Find the block of a seekable file to start reading a time window at, by a binary search over the first
+     *        timestamp of the blocks.
+     * \param path The file.
+     * \param catalog Parses the timestamps.
+     * \param from The start of the window.
+     * \param partial Set to true if the block starts within a line.
+     * \return The offset of the block in the file, 0 if the file is not seekable.
+     */
+    static unsigned long long findStart(const std::wstring& path, const Catalog& catalog, time_t from, bool& partial);
+
+    /**
+     * \brief Collect the matching lines of one file. Literals are found in whole pieces of data with memchr on their
+     *        first byte and memcmp, so lines without a match are never looked at one by one.
+     * \param path The file.
+     * \param literal The literal, used if regex is null.
+     * \param regex The regular expression or null.
+     * \param result Receives the matching lines, prefixed with the file name.
+     * \return False if the file could not be read.
+     */
+    static bool grepFile(const std::wstring& path, const std::string& literal, const std::regex* regex, std::string& result);
+
+    /**
+     * \brief Find a literal in a range with memchr on its first byte.
+     * \param begin The start of the range.
+     * \param end The end of the range.
+     * \param literal The literal, not empty.
+     * \return The start of the first match or null.
+     */
+    static const char* findLiteral(const char* begin, const char* end, const std::string& literal);
+
+    static const size_t grepAhead = 2; ///< Files searched ahead of the one being written, per thread, bounds the buffered output.
+};
@@ -0,0 +1,263 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "seekable.h"
+#include "fileio.h"
+#include "logging.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <windows.h>
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+// A gzip header without a name, flags to be set, followed by an empty deflate block and the trailer of empty data
+static const unsigned char header[] = { 0x1f, 0x8b, 0x08, 0x00, 0, 0, 0, 0, 0x00, 0xff };
+static const unsigned char emptyMember[] = { 0x03, 0x00, 0, 0, 0, 0, 0, 0, 0, 0 };
+static const unsigned char FEXTRA = 0x04;
+static const unsigned char FCOMMENT = 0x10;
+
+// Format the index members that end a seekable file
+std::string Seekable::formatIndex(const std::vector<Block>& blocks, unsigned long long blockSize) {
+    // The index is the comment of an empty member, so it is plain text without a null character
+    std::ostringstream text;
+    text << "loxrot-index 1 " << blockSize << "\n";
+    for (const auto& block : blocks) {
+        text << block.compressed << " " << block.uncompressed << " " << block.lines << "\n";
+    }
+    std::string result(reinterpret_cast<const char*>(header), sizeof(header));
+    result[3] = FCOMMENT;
+    result += text.str();
+    result += '\0';
+    result.append(reinterpret_cast<const char*>(emptyMember), sizeof(emptyMember));
+
+    // The last member has a fixed size and an extra field "LX" with the offset of the index member
+    unsigned long long offset = blocks.back().compressed;
+    std::string trailer(reinterpret_cast<const char*>(header), sizeof(header));
+    trailer[3] = FEXTRA;
+    trailer += std::string("\x0c\x00" "LX" "\x08\x00", 6);
+    for (int i = 0; i < 8; i++) {
+        trailer += static_cast<char>((offset >> (8 * i)) & 0xff);
+    }
+    trailer.append(reinterpret_cast<const char*>(emptyMember), sizeof(emptyMember));
+    return result + trailer;
+}
+
+// Read the index of a seekable file
+bool Seekable::readIndex(const std::wstring& filename, std::vector<Block>& blocks) {
+    blocks.clear();
+    HANDLE handle = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    // Read a range of the file completely
+    auto readAt = [handle](unsigned long long offset, std::string& data) {
+        LARGE_INTEGER position;
+        position.QuadPart = static_cast<LONGLONG>(offset);
+        DWORD bytes = 0;
+        return SetFilePointerEx(handle, position, NULL, FILE_BEGIN) && ReadFile(handle, &data[0], static_cast<DWORD>(data.size()), &bytes, NULL) && bytes == data.size();
+    };
+    LARGE_INTEGER size;
+    std::string trailer(trailerSize, '\0');
+    bool ok = GetFileSizeEx(handle, &size) && static_cast<unsigned long long>(size.QuadPart) >= trailerSize && readAt(size.QuadPart - trailerSize, trailer);
+    ok = ok && memcmp(trailer.data(), header, 3) == 0 && trailer[3] == FEXTRA && trailer.compare(10, 6, std::string("\x0c\x00" "LX" "\x08\x00", 6)) == 0;
+    unsigned long long offset = 0;
+    for (int i = 7; ok && i >= 0; i--) {
+        offset = (offset << 8) | static_cast<unsigned char>(trailer[16 + i]);
+    }
+    ok = ok && offset < static_cast<unsigned long long>(size.QuadPart) - trailerSize;
+    std::string member;
+    if (ok) {
+        member.resize(static_cast<size_t>(size.QuadPart - trailerSize - offset));
+        ok = readAt(offset, member) && member.size() > sizeof(header) && memcmp(member.data(), header, 3) == 0 && member[3] == FCOMMENT;
+    }
+    CloseHandle(handle);
+    if (!ok) {
+        return false;
+    }
+
+    std::istringstream text(member.substr(sizeof(header), member.find('\0', sizeof(header)) - sizeof(header)));
+    std::string magic;
+    int version = 0;
+    unsigned long long blockSize = 0;
+    if (!(text >> magic >> version >> blockSize) || magic != "loxrot-index" || version != 1) {
+        return false;
+    }
+    Block block;
+    while (text >> block.compressed >> block.uncompressed >> block.lines) {
+        blocks.push_back(block);
+    }
+    // At least one block and the end of the data
+    return blocks.size() >= 2 && blocks.back().compressed == offset;
+}
+
+// Stream the uncompressed data of a file
+bool Seekable::read(const std::wstring& filename, unsigned long long offset, const Consumer& consumer) {
+    HANDLE handle = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        Logging::error(L"Could not open " + filename);
+        return false;
+    }
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(offset);
+    if (!SetFilePointerEx(handle, position, NULL, FILE_BEGIN)) {
+        CloseHandle(handle);
+        return false;
+    }
+    FileIO::Buffer input(FileIO::bufferSize);
+    bool compressed = filename.size() > 3 && filename.compare(filename.size() - 3, 3, L".gz") == 0;
+    bool ok = true;
+    if (!compressed) {
+        DWORD bytes = 0;
+        while (ReadFile(handle, input.data, input.size, &bytes, NULL) && bytes > 0 && consumer(input.data, bytes)) {
+        }
+        CloseHandle(handle);
+        return true;
+    }
+#ifdef WITH_ZLIB
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+        CloseHandle(handle);
+        return false;
+    }
+    FileIO::Buffer output(FileIO::bufferSize);
+    bool more = true;
+    while (more) {
+        if (stream.avail_in == 0) {
+            DWORD bytes = 0;
+            if (!ReadFile(handle, input.data, input.size, &bytes, NULL) || bytes == 0) {
+                break;
+            }
+            stream.next_in = reinterpret_cast<Bytef*>(input.data);
+            stream.avail_in = bytes;
+        }
+        stream.next_out = reinterpret_cast<Bytef*>(output.data);
+        stream.avail_out = output.size;
+        int result = inflate(&stream, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+            Logging::error(L"Could not inflate " + filename);
+            ok = false;
+            break;
+        }
+        if (output.size > stream.avail_out) {
+            more = consumer(output.data, output.size - stream.avail_out);
+        }
+        // Blocks, merged generations and the index are gzip members of their own, the empty ones produce no data
+        if (result == Z_STREAM_END) {
+            inflateReset(&stream);
+        }
+    }
+    inflateEnd(&stream);
+#else
+    ok = false;
+#endif
+    CloseHandle(handle);
+    return ok;
+}
+
+// Stream the uncompressed data of a file line by line
+bool Seekable::readLines(const std::wstring& filename, unsigned long long offset, bool partial, const Consumer& consumer) {
+    std::string pending;
+    bool skipping = partial;
+    bool more = true;
+    bool ok = read(filename, offset, [&](const char* data, size_t length) {
+        while (length > 0 && more) {
+            const char* feed = static_cast<const char*>(memchr(data, '\n', length));
+            size_t part = feed ? feed - data + 1 : length;
+            if (!skipping) {
+                // Lines within one piece are passed on without copying them
+                if (feed && pending.empty()) {
+                    more = consumer(data, part);
+                }
+                else {
+                    pending.append(data, part);
+                    if (feed) {
+                        more = consumer(pending.data(), pending.size());
+                        pending.clear();
+                    }
+                }
+            }
+            skipping = skipping && !feed;
+            data += part;
+            length -= part;
+        }
+        return more;
+    });
+    if (ok && more && !pending.empty()) {
+        consumer(pending.data(), pending.size());
+    }
+    return ok;
+}
+
+#ifdef WITH_ZLIB
+// Write a range of the uncompressed data of a seekable file
+bool Seekable::extract(const std::wstring& filename, bool lines, unsigned long long first, unsigned long long last, std::ostream& out) {
+    std::vector<Block> blocks;
+    if (!readIndex(filename, blocks)) {
+        Logging::error(filename + L" has no block index");
+        return false;
+    }
+    if (first > last || (lines && first == 0)) {
+        return true;
+    }
+    // The block the range starts in, for lines the one with the line feed before the first line
+    size_t start = 0;
+    for (size_t i = 1; i + 1 < blocks.size(); i++) {
+        if (lines ? blocks[i].lines < first - 1 : blocks[i].uncompressed <= first) {
+            start = i;
+        }
+    }
+    unsigned long long position = blocks[start].uncompressed;
+    unsigned long long lineFeeds = blocks[start].lines;
+    bool ok = read(filename, blocks[start].compressed, [&](const char* data, size_t length) {
+        if (!lines) {
+            unsigned long long from = std::max(position, first);
+            unsigned long long to = std::min(position + length, last + 1);
+            if (from < to) {
+                out.write(data + (from - position), to - from);
+            }
+            position += length;
+            return position <= last;
+        }
+        // Emit the bytes of the lines first to last, line feeds are found with memchr
+        while (length > 0) {
+            const char* feed = static_cast<const char*>(memchr(data, '\n', length));
+            size_t part = feed ? feed - data + 1 : length;
+            if (lineFeeds + 1 >= first) {
+                out.write(data, part);
+            }
+            if (feed && ++lineFeeds >= last) {
+                return false;
+            }
+            data += part;
+            length -= part;
+        }
+        return true;
+    });
+    return ok && out.good();
+}
+#endif
@@ -0,0 +1,104 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * \class Seekable
+ * \brief A class for the seekable compressed format: independent gzip members of a fixed uncompressed block size, followed
+ *        by an empty member whose comment holds the block index and an empty member of fixed size pointing to it. gzip
+ *        and zcat read the file like any other gzip file, while a reader using the index only inflates the blocks it needs.
+ */
+class Seekable
+{
+public:
+    /**
+     * \struct Block
+     * \brief Where a block starts.
+     */
+    struct Block {
+        unsigned long long compressed; ///< Offset of the gzip member in the file.
+        unsigned long long uncompressed; ///< Offset of the first byte of the block in the uncompressed data.
+        unsigned long long lines; ///< Number of line feeds before the block.
+    };
+
+    /**
+     * \brief Receives consecutive pieces of uncompressed data and returns false to stop reading.
+     */
+    typedef std::function<bool(const char* data, size_t length)> Consumer;
+
+    /**
+     * \brief Format the index members that end a seekable file.
+     * \param blocks The blocks, followed by an entry for the end of the data: offset of the index, total size and total lines.
+     * \param blockSize The uncompressed size of the blocks.
+     * \return The bytes to append to the file.
+     */
+    static std::string formatIndex(const std::vector<Block>& blocks, unsigned long long blockSize);
+
+    /**
+     * \brief Read the index of a seekable file.
+     * \param filename The file.
+     * \param blocks The blocks are returned here, followed by the entry for the end of the data.
+     * \return True if the file is seekable, false if it is a plain gzip file or cannot be read.
+     */
+    static bool readIndex(const std::wstring& filename, std::vector<Block>& blocks);
+
+    /**
+     * \brief Stream the uncompressed data of a file. Files ending with .gz are inflated member by member, so plain,
+     *        seekable and merged files are all read completely; other files are read as they are.
+     * \param filename The file.
+     * \param offset Where to start in the file, for a seekable file the compressed offset of a block.
+     * \param consumer Receives the data.
+     * \return False if the file could not be read.
+     */
+    static bool read(const std::wstring& filename, unsigned long long offset, const Consumer& consumer);
+
+    /**
+     * \brief Stream the uncompressed data of a file line by line.
+     * \param filename The file.
+     * \param offset Where to start in the file, as for read.
+     * \param partial If true, the data up to the first line feed is skipped because it is the rest of a line.
+     * \param consumer Receives each line including its line feed, the last line may have none.
+     * \return False if the file could not be read.
+     */
+    static bool readLines(const std::wstring& filename, unsigned long long offset, bool partial, const Consumer& consumer);
+#ifdef WITH_ZLIB
+    /**
+     * \brief Write a range of the uncompressed data of a seekable file, inflating only the blocks the range touches.
+     * \param filename The file.
+     * \param lines False for a range of bytes counted from 0, true for a range of lines counted from 1.
+     * \param first The first byte or line of the range.
+     * \param last The last byte or line of the range, inclusive.
+     * \param out The stream to write to.
+     * \return true or false
+     */
+    static bool extract(const std::wstring& filename, bool lines, unsigned long long first, unsigned long long last, std::ostream& out);
+#endif
+    static const size_t trailerSize = 34; ///< Size of the member pointing to the index.
+};
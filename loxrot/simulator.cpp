@@ -0,0 +1,321 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "simulator.h"
+#include "logging.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <regex>
+#include <set>
+#include <sstream>
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+// Constructor
+Simulator::Simulator(std::map<std::wstring, Config::Section>& configs, time_t start, double compressionRatio, double secondsPerByte)
+    : clock(start), fileSystem(clock, compressionRatio), rotate(fileSystem, clock), secondsPerByte(secondsPerByte), start(start), peakBytes(0) {
+    std::set<std::wstring> seeded;
+    for (auto& config : configs) {
+        Config::Section section = config.second;
+        // These work on real files only
+        section.entries[L"TailMarker"] = L"false";
+        section.entries[L"BackgroundDelete"] = L"false";
+        section.entries[L"Durable"] = L"false";
+        section.entries[L"TimestampRegex"] = L"";
+        section.entries[L"BloomFalsePositiveRate"] = L"0";
+        section.entries[L"Simulation"] = L"false";
+        // Globs are expanded on the disk to find the files to start with
+        std::vector<std::wstring> directories = { section.entries[L"Directory"] };
+        if (section.directories) {
+            directories = section.directories->expand(FileSystem::disk());
+        }
+        for (const auto& directory : directories) {
+            // Sections sharing a directory share its files
+            if (seeded.insert(directory).second && FileSystem::disk().exists(directory)) {
+                try {
+                    for (const auto& entry : FileSystem::disk().list(directory)) {
+                        if (entry.regular) {
+                            fileSystem.create(entry.path, entry.size, entry.modified, entry.modified);
+                        }
+                    }
+                }
+                catch (const std::filesystem::filesystem_error&) {
+                    Logging::warning(L"Could not read " + directory + L", section " + config.first + L" starts without files");
+                }
+            }
+        }
+        // Files that do not exist yet start empty, only a literal directory tells where to put them
+        if (!DirectoryGlob::isPattern(section.entries[L"Directory"])) {
+            std::wstringstream names(section.entries[L"SimulatedFiles"]);
+            std::wstring name;
+            while (std::getline(names, name, L',')) {
+                name.erase(0, name.find_first_not_of(L" \t"));
+                name.erase(name.find_last_not_of(L" \t") + 1);
+                std::wstring path = (std::filesystem::path(section.entries[L"Directory"]) / name).wstring();
+                if (!name.empty() && !fileSystem.exists(path)) {
+                    fileSystem.create(path, 0, start, start);
+                }
+            }
+        }
+        std::vector<Growth> growth;
+        std::wstring rate = section.entries[L"SimulatedGrowth"];
+        try {
+            std::vector<std::wstring> files;
+            for (const auto& directory : rotate.getDirectories(section)) {
+                std::vector<std::wstring> found = rotate.getFilesInDirectory(directory, section.entries[L"FilePattern"], true);
+                files.insert(files.end(), found.begin(), found.end());
+            }
+            for (const auto& file : files) {
+                Growth item = { file, 0 };
+                if (rate != L"observed") {
+                    item.bytesPerSecond = std::stod(rate) / (24 * 60 * 60);
+                }
+                else {
+                    // The file has been growing since its last truncation
+                    time_t created = FileSystem::disk().creationTime(file);
+                    unsigned long long size = fileSystem.fileSize(file);
+                    if (created != -1) {
+                        fileSystem.create(file, size, start, created);
+                        item.bytesPerSecond = static_cast<double>(size) / std::max(start - created, minimumAge);
+                    }
+                    else {
+                        Logging::warning(L"No growth observed for " + file + L", set SimulatedGrowth of section " + config.first);
+                    }
+                }
+                growth.push_back(item);
+            }
+        }
+        catch (const std::regex_error&) {
+            Logging::warning(L"Invalid FilePattern in section " + config.first);
+        }
+        if (growth.empty()) {
+            Logging::warning(L"Section " + config.first + L" has no log files to simulate");
+        }
+        results[config.first].files = growth.size();
+        sections.push_back({ config.first, section });
+        growths.push_back(growth);
+        grown.push_back(start);
+    }
+}
+
+// Measure how well and how fast log data compresses
+void Simulator::calibrate(std::map<std::wstring, Config::Section>& configs, double& compressionRatio, double& secondsPerByte) {
+    compressionRatio = 1;
+    secondsPerByte = 0;
+#ifdef WITH_ZLIB
+    // Up to a MiB from the start of each log file on the disk
+    std::string sample;
+    Rotate rotate;
+    for (auto it = configs.begin(); it != configs.end() && sample.size() < sampleSize; it++) {
+        try {
+            std::vector<std::wstring> files;
+            for (const auto& directory : rotate.getDirectories(it->second)) {
+                std::vector<std::wstring> found = rotate.getFilesInDirectory(directory, it->second.entries[L"FilePattern"], true);
+                files.insert(files.end(), found.begin(), found.end());
+            }
+            for (const auto& file : files) {
+                std::ifstream in(file, std::ios::binary);
+                std::vector<char> buffer(std::min<size_t>(1024 * 1024, sampleSize - sample.size()));
+                in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                sample.append(buffer.data(), static_cast<size_t>(in.gcount()));
+                if (sample.size() >= sampleSize) {
+                    break;
+                }
+            }
+        }
+        catch (const std::exception&) {
+            // Sections without readable files are left out
+        }
+    }
+    // Without enough real log data, lines with the usual mix of timestamps, levels, ids and text
+    if (sample.size() < 64 * 1024) {
+        static const char* levels[] = { "INFO", "DEBUG", "WARN", "ERROR" };
+        unsigned long long random = 88172645463325252ULL;
+        auto next = [&random]() {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            return random;
+        };
+        sample.clear();
+        while (sample.size() < sampleSize) {
+            char line[160];
+            unsigned long long value = next();
+            snprintf(line, sizeof(line), "2026-10-%02d %02d:%02d:%02d.%03d %s [worker-%d] request %llu served in %d ms for 10.%d.%d.%d\n",
+                static_cast<int>(value % 28 + 1), static_cast<int>(value / 28 % 24), static_cast<int>(value / 672 % 60), static_cast<int>(value / 40320 % 60),
+                static_cast<int>(value / 2419200 % 1000), levels[value / 2419200000ULL % 4], static_cast<int>(value >> 40 & 15), next() % 1000000,
+                static_cast<int>(next() % 2000), static_cast<int>(value >> 44 & 255), static_cast<int>(value >> 52 & 255), static_cast<int>(value >> 56 & 255));
+            sample += line;
+        }
+    }
+    // Deflate as FileIO::compressFile does
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+    std::vector<char> compressed(deflateBound(&stream, static_cast<uLong>(sample.size())));
+    stream.next_in = reinterpret_cast<Bytef*>(&sample[0]);
+    stream.avail_in = static_cast<uInt>(sample.size());
+    stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_out = static_cast<uInt>(compressed.size());
+    auto begin = std::chrono::steady_clock::now();
+    int result = deflate(&stream, Z_FINISH);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (result == Z_STREAM_END) {
+        compressionRatio = static_cast<double>(stream.total_out) / sample.size();
+        secondsPerByte = seconds / sample.size();
+    }
+    deflateEnd(&stream);
+#endif
+}
+
+// Let the log files of a section grow up to a point in time
+void Simulator::grow(size_t index, time_t t) {
+    for (const auto& growth : growths[index]) {
+        unsigned long long bytes = static_cast<unsigned long long>(growth.bytesPerSecond * (t - grown[index]));
+        if (bytes > 0) {
+            fileSystem.write(growth.path, bytes);
+        }
+    }
+    grown[index] = t;
+}
+
+// Get the size of the log files of a section and their generations
+unsigned long long Simulator::usage(size_t index) {
+    Config::Section& section = sections[index].second;
+    unsigned long long bytes = 0;
+    try {
+        for (const auto& directory : rotate.getDirectories(section)) {
+            std::map<std::wstring, std::vector<Rotate::Generation>> generations = rotate.scanGenerations(directory);
+            for (const auto& file : rotate.getFilesInDirectory(directory, section.entries[L"FilePattern"], true)) {
+                bytes += fileSystem.fileSize(file);
+                for (const auto& generation : generations[file]) {
+                    bytes += generation.size;
+                }
+            }
+        }
+    }
+    catch (const std::regex_error&) {
+    }
+    return bytes;
+}
+
+// Run the simulation
+void Simulator::run(time_t seconds) {
+    time_t end = start + seconds;
+    // The next instant each section is due at, earliest first
+    typedef std::pair<time_t, size_t> Event;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+    // The size of all sections together at time t is base + rate * t, as long as no section rotates
+    double base = 0;
+    double rate = 0;
+    std::vector<unsigned long long> stored(sections.size());
+    std::vector<double> rates(sections.size(), 0);
+    for (size_t i = 0; i < sections.size(); i++) {
+        time_t t = sections[i].second.crontab.nextRotation(start);
+        if (t != -1 && t <= end) {
+            events.push({ std::max(t, start), i });
+        }
+        for (const auto& growth : growths[i]) {
+            rates[i] += growth.bytesPerSecond;
+        }
+        stored[i] = usage(i);
+        results[sections[i].first].peakBytes = stored[i];
+        base += stored[i] - rates[i] * start;
+        rate += rates[i];
+    }
+    peakBytes = static_cast<unsigned long long>(base + rate * start);
+    while (!events.empty()) {
+        Event event = events.top();
+        events.pop();
+        time_t t = event.first;
+        size_t i = event.second;
+        clock.set(t);
+        // Every section has grown until now, the largest total is right before a rotation frees space
+        peakBytes = std::max(peakBytes, static_cast<unsigned long long>(base + rate * t));
+        base -= stored[i] - rates[i] * grown[i];
+        grow(i, t);
+        Result& result = results[sections[i].first];
+        result.peakBytes = std::max(result.peakBytes, usage(i));
+        unsigned long long compressed = fileSystem.getCompressedBytes();
+        if (rotate.doRotates(&sections[i])) {
+            result.rotations++;
+        }
+        result.compressedBytes += fileSystem.getCompressedBytes() - compressed;
+        stored[i] = usage(i);
+        base += stored[i] - rates[i] * t;
+        time_t next = sections[i].second.crontab.nextRotation(t);
+        if (next != -1 && next <= end) {
+            events.push({ std::max(next, t + 1), i });
+        }
+    }
+    clock.set(end);
+    unsigned long long total = 0;
+    for (size_t i = 0; i < sections.size(); i++) {
+        grow(i, end);
+        Result& result = results[sections[i].first];
+        result.finalBytes = usage(i);
+        result.peakBytes = std::max(result.peakBytes, result.finalBytes);
+        result.compressionSeconds = result.compressedBytes * secondsPerByte;
+        total += result.finalBytes;
+    }
+    peakBytes = std::max(peakBytes, total);
+}
+
+// Get the results of the sections
+const std::map<std::wstring, Simulator::Result>& Simulator::getResults() {
+    return results;
+}
+
+// Get the largest size of the files of all sections together
+unsigned long long Simulator::getPeakBytes() {
+    return peakBytes;
+}
+
+// Write the results as a table
+void Simulator::report(std::wostream& out) {
+    out << L"Section\tFiles\tRotations\tPeak bytes\tFinal bytes\tCompressed bytes\tCompression seconds" << std::endl;
+    Result sum;
+    for (const auto& item : results) {
+        const Result& result = item.second;
+        out << item.first << L"\t" << result.files << L"\t" << result.rotations << L"\t" << result.peakBytes << L"\t" << result.finalBytes << L"\t"
+            << result.compressedBytes << L"\t" << result.compressionSeconds << std::endl;
+        sum.files += result.files;
+        sum.rotations += result.rotations;
+        sum.finalBytes += result.finalBytes;
+        sum.compressedBytes += result.compressedBytes;
+        sum.compressionSeconds += result.compressionSeconds;
+    }
+    // The sections do not peak at the same time, so the peak of the total is not the sum of the peaks
+    out << L"Total\t" << sum.files << L"\t" << sum.rotations << L"\t" << peakBytes << L"\t" << sum.finalBytes << L"\t"
+        << sum.compressedBytes << L"\t" << sum.compressionSeconds << std::endl;
+}
@@ -0,0 +1,144 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <ctime>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "clock.h"
+#include "config.h"
+#include "memfs.h"
+#include "rotate.h"
+
+/**
+ * \class Simulator
+ * \brief A class to replay the schedule and the rotations of a configuration for days at full speed, on a copy of the
+ *        log directories in memory whose log files grow at a steady rate. It reports the peak disk usage, the number of
+ *        rotations and the time spent compressing of each section, so retention can be sized before deploying.
+ */
+class Simulator
+{
+public:
+    /**
+     * \struct Result
+     * \brief What happened to a section during the simulation.
+     */
+    struct Result {
+        unsigned long long files = 0; ///< The number of growing log files.
+        unsigned long long rotations = 0; ///< The number of rotations.
+        unsigned long long peakBytes = 0; ///< The largest size of the log files and their generations together.
+        unsigned long long finalBytes = 0; ///< The size of the log files and their generations at the end.
+        unsigned long long compressedBytes = 0; ///< The number of bytes compressed.
+        double compressionSeconds = 0; ///< The estimated time spent compressing.
+    };
+
+    /**
+     * \brief Constructor for Simulator. Each section starts from the files in its Directory on the disk, if there is
+     *        one, plus empty files named in SimulatedFiles. A log file grows by SimulatedGrowth per day or, with
+     *        observed, at the rate it grew since its creation. The files on the disk are only read.
+     * \param configs The sections to simulate. They are copied, with TailMarker, BackgroundDelete, Durable,
+     *        TimestampRegex, BloomFalsePositiveRate and Simulation turned off, as those need real files.
+     * \param start The time the simulation starts at.
+     * \param compressionRatio The size of a compressed file relative to the original.
+     * \param secondsPerByte The time compressing a byte takes.
+     */
+    Simulator(std::map<std::wstring, Config::Section>& configs, time_t start, double compressionRatio, double secondsPerByte);
+
+    /**
+     * \brief Measure how well and how fast log data compresses, on a sample of the log files of the sections on the
+     *        disk or, if there are none, on generated log lines.
+     * \param configs The sections.
+     * \param compressionRatio The size of the compressed sample relative to the sample is returned here.
+     * \param secondsPerByte The time compressing a byte of the sample took is returned here.
+     */
+    static void calibrate(std::map<std::wstring, Config::Section>& configs, double& compressionRatio, double& secondsPerByte);
+
+    static const size_t sampleSize = 4 * 1024 * 1024; ///< The size of the sample calibrate compresses.
+    static const time_t minimumAge = 3600; ///< A log file younger than this counts as this old when its growth is observed.
+
+    /**
+     * \brief Run the simulation. Only the instants at which a section is due are visited.
+     * \param seconds How long to simulate.
+     */
+    void run(time_t seconds);
+
+    /**
+     * \brief Get the results of the sections.
+     * \return The results by section name.
+     */
+    const std::map<std::wstring, Result>& getResults();
+
+    /**
+     * \brief Get the largest size of the files of all sections together.
+     * \return The size in bytes.
+     */
+    unsigned long long getPeakBytes();
+
+    /**
+     * \brief Write the results as a table.
+     * \param out The stream to write to.
+     */
+    void report(std::wostream& out);
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \struct Growth
+     * \brief A growing log file.
+     */
+    struct Growth {
+        std::wstring path; ///< The log file.
+        double bytesPerSecond; ///< How fast it grows.
+    };
+
+    /**
+     * \brief Let the log files of a section grow up to a point in time.
+     * \param index The index of the section.
+     * \param t The point in time.
+     */
+    void grow(size_t index, time_t t);
+
+    /**
+     * \brief Get the size of the log files of a section and their generations.
+     * \param index The index of the section.
+     * \return The size in bytes.
+     */
+    unsigned long long usage(size_t index);
+
+    VirtualClock clock; ///< The simulated time.
+    MemoryFileSystem fileSystem; ///< The simulated files.
+    Rotate rotate; ///< Rotates the simulated files at the simulated time.
+    double secondsPerByte; ///< The time compressing a byte takes.
+    time_t start; ///< The time the simulation starts at.
+    std::vector<std::pair<std::wstring, Config::Section>> sections; ///< The simulated sections.
+    std::vector<std::vector<Growth>> growths; ///< The growing log files of each section.
+    std::vector<time_t> grown; ///< Up to when the log files of each section have grown.
+    std::map<std::wstring, Result> results; ///< The results by section name.
+    unsigned long long peakBytes; ///< The largest size of the files of all sections together.
+};
@@ -0,0 +1,222 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "tail.h"
+#include "fileio.h"
+#include "logging.h"
+#include "tools.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <windows.h>
+
+// Constructor
+Tail::Tail(const std::wstring& path, bool wholeLines) : path(path), wholeLines(wholeLines), offset(0), sequence(0) {
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(path, ec);
+    offset = ec ? 0 : size;
+    // A truncation under way at the start is handled when it is done, the copy ends before the current end anyway
+    Marker marker;
+    if (readMarker(markerName(path), marker) && marker.done) {
+        sequence = marker.sequence;
+    }
+}
+
+// Destructor
+Tail::~Tail() {
+}
+
+// Pass on everything written to the live file since the last call
+bool Tail::poll(const Seekable::Consumer& consumer) {
+    std::wstring markerFile = markerName(path);
+    Marker marker;
+    bool marked = readMarker(markerFile, marker);
+    if (marked && !marker.done && time(nullptr) - marker.time < staleAfter) {
+        // The old data is being copied away, wait until the file has been truncated
+        return true;
+    }
+    if (marked && marker.sequence != sequence) {
+        if (marker.sequence > sequence + 1 && sequence != 0) {
+            Logging::warning(L"Missed " + std::to_wstring(marker.sequence - sequence - 1) + L" rotations of " + path + L", data may be missing");
+        }
+        if (!marker.generation.empty() && marker.size > offset) {
+            drain(marker.generation, offset, marker.size, consumer);
+        }
+        offset = 0;
+        sequence = marker.sequence;
+    }
+
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size)) {
+        CloseHandle(handle);
+        return false;
+    }
+    // A truncation that started after the marker was read is handled on the next call
+    auto changed = [&]() {
+        Marker current;
+        bool stillMarked = readMarker(markerFile, current);
+        return stillMarked != marked || current.sequence != marker.sequence || current.done != marker.done;
+    };
+    if (static_cast<unsigned long long>(size.QuadPart) < offset) {
+        if (changed()) {
+            CloseHandle(handle);
+            return true;
+        }
+        Logging::warning(path + L" was truncated without a marker, data written before the truncation may be missing");
+        offset = 0;
+    }
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(offset);
+    bool ok = SetFilePointerEx(handle, position, NULL, FILE_BEGIN) != 0;
+    FileIO::Buffer buffer(FileIO::bufferSize);
+    DWORD bytes = 0;
+    while (ok && ReadFile(handle, buffer.data, buffer.size, &bytes, NULL) && bytes > 0) {
+        // If a truncation started meanwhile, the data may already be from the new file, the generation has the old one
+        if (changed()) {
+            break;
+        }
+        offset += bytes;
+        ok = deliver(buffer.data, bytes, consumer);
+    }
+    CloseHandle(handle);
+    return ok;
+}
+
+// Get the name of the marker of a live file
+std::wstring Tail::markerName(const std::wstring& path) {
+    return path + L".loxrot-tail";
+}
+
+// Read a marker
+bool Tail::readMarker(const std::wstring& filename, Marker& marker) {
+    std::ifstream file(filename, std::ios::binary);
+    std::string line;
+    if (!file.is_open() || !std::getline(file, line)) {
+        return false;
+    }
+    // sequence time state size <tab> generation
+    std::istringstream fields(line);
+    Marker result;
+    long long time = 0;
+    char state = 0;
+    if (!(fields >> result.sequence >> time >> state >> result.size) || (state != 'T' && state != 'D')) {
+        return false;
+    }
+    result.time = static_cast<time_t>(time);
+    result.done = state == 'D';
+    size_t tab = line.find('\t');
+    if (tab != std::string::npos) {
+        result.generation = Tools::stringToWstring(line.substr(tab + 1));
+    }
+    marker = result;
+    return true;
+}
+
+// Replace a marker at once
+bool Tail::writeMarker(const std::wstring& filename, const Marker& marker) {
+    std::wstring temporary = filename + L".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file << marker.sequence << ' ' << static_cast<long long>(marker.time) << ' ' << (marker.done ? 'D' : 'T') << ' ' << marker.size << '\t' << Tools::wstringToString(marker.generation) << '\n';
+        if (!file) {
+            Logging::error(L"Could not write " + temporary);
+            return false;
+        }
+    }
+    if (!MoveFileExW(temporary.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        Logging::error(L"Could not replace " + filename);
+        return false;
+    }
+    return true;
+}
+
+// Pass on a range of the uncompressed data of a generation
+bool Tail::drain(const std::wstring& generation, unsigned long long from, unsigned long long to, const Seekable::Consumer& consumer) {
+    std::error_code ec;
+    std::wstring file = generation;
+    if (!std::filesystem::exists(file, ec)) {
+        file = generation + L".gz";
+        if (!std::filesystem::exists(file, ec)) {
+            Logging::warning(L"Rotated file " + generation + L" is gone, data of " + path + L" is missing");
+            return false;
+        }
+    }
+    unsigned long long start = from;
+    unsigned long long position = from;
+    if (file != generation) {
+        start = 0;
+        position = 0;
+        std::vector<Seekable::Block> blocks;
+        if (Seekable::readIndex(file, blocks)) {
+            for (size_t i = 0; i + 1 < blocks.size() && blocks[i].uncompressed <= from; i++) {
+                start = blocks[i].compressed;
+                position = blocks[i].uncompressed;
+            }
+        }
+    }
+    bool more = true;
+    bool ok = Seekable::read(file, start, [&](const char* data, size_t length) {
+        unsigned long long end = position + length;
+        unsigned long long first = from > position ? from : position;
+        unsigned long long last = to < end ? to : end;
+        if (first < last) {
+            more = deliver(data + (first - position), static_cast<size_t>(last - first), consumer);
+        }
+        position = end;
+        return more && position < to;
+    });
+    return ok && more;
+}
+
+// Pass on data
+bool Tail::deliver(const char* data, size_t length, const Seekable::Consumer& consumer) {
+    if (!wholeLines) {
+        return consumer(data, length);
+    }
+    const char* end = data + length;
+    while (end > data && end[-1] != '\n') {
+        end--;
+    }
+    if (end == data) {
+        pending.append(data, length);
+        return true;
+    }
+    bool ok = true;
+    if (!pending.empty()) {
+        pending.append(data, end - data);
+        ok = consumer(pending.data(), pending.size());
+        pending.clear();
+    }
+    else {
+        ok = consumer(data, end - data);
+    }
+    pending.append(end, data + length - end);
+    return ok;
+}
@@ -0,0 +1,126 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <ctime>
+#include <string>
+#include "seekable.h"
+
+/**
+ * \class Tail
+ * \brief A class to follow a live log file across its rotations. Before the executor truncates a live file it writes a
+ *        marker next to it with the size of the copy, so a follower knows exactly where the truncation happened: it
+ *        reads the rest of the copied generation up to that size and then the live file from its start, without losing
+ *        or repeating a byte.
+ */
+class Tail
+{
+public:
+    /**
+     * \struct Marker
+     * \brief The last truncation of a live file, stored in <file>.loxrot-tail.
+     */
+    struct Marker {
+        unsigned long long sequence = 0; ///< Counts the truncations of the file, 0 if there was none.
+        time_t time = 0; ///< When the truncation started.
+        bool done = false; ///< False while the file is being truncated.
+        unsigned long long size = 0; ///< The size of the copy, the position in the old file the truncation happened at.
+        std::wstring generation; ///< The copy of the old file, empty if it was not copied.
+    };
+
+    /**
+     * \brief Start following a live file at its current end.
+     * \param path The live file.
+     * \param wholeLines If true, only complete lines are passed on, so several followers can share one output.
+     */
+    Tail(const std::wstring& path, bool wholeLines);
+
+    /**
+     * \brief Destructor for Tail.
+     */
+    ~Tail();
+
+    /**
+     * \brief Pass on everything written to the live file since the last call. If the file was truncated since, the rest
+     *        of the generation it was copied to comes first. Data read while a truncation is under way is dropped and
+     *        read again from the generation on the next call.
+     * \param consumer Receives the data.
+     * \return False if the live file could not be read.
+     */
+    bool poll(const Seekable::Consumer& consumer);
+
+    /**
+     * \brief Get the name of the marker of a live file.
+     * \param path The live file.
+     * \return The name of the marker.
+     */
+    static std::wstring markerName(const std::wstring& path);
+
+    /**
+     * \brief Read a marker.
+     * \param filename The marker.
+     * \param marker The marker is returned here, unchanged if there is none.
+     * \return True if the marker exists and is valid.
+     */
+    static bool readMarker(const std::wstring& filename, Marker& marker);
+
+    /**
+     * \brief Replace a marker at once, so a follower never sees a partial one.
+     * \param filename The marker.
+     * \param marker The marker.
+     * \return True on success.
+     */
+    static bool writeMarker(const std::wstring& filename, const Marker& marker);
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \brief Pass on a range of the uncompressed data of a generation. If it has been compressed since, the .gz file is
+     *        read instead, of a seekable file only the blocks from the one the range starts in.
+     * \param generation The generation as named in the marker.
+     * \param from The first byte.
+     * \param to The byte after the last one.
+     * \param consumer Receives the data.
+     * \return False if the generation could not be read.
+     */
+    bool drain(const std::wstring& generation, unsigned long long from, unsigned long long to, const Seekable::Consumer& consumer);
+
+    /**
+     * \brief Pass on data, with wholeLines only up to the last line feed and the rest later.
+     * \param data The data.
+     * \param length The length of the data.
+     * \param consumer Receives the data.
+     * \return The result of the consumer.
+     */
+    bool deliver(const char* data, size_t length, const Seekable::Consumer& consumer);
+
+    std::wstring path; ///< The live file.
+    bool wholeLines; ///< Only pass on complete lines.
+    std::string pending; ///< With wholeLines, the start of a line not yet passed on.
+    unsigned long long offset; ///< The position in the live file up to which the data was passed on.
+    unsigned long long sequence; ///< The sequence of the last truncation handled.
+    static const time_t staleAfter = 60; ///< Seconds after which an unfinished truncation is taken as finished, e.g. after a crash.
+};
@@ -37,6 +37,8 @@ std::wstring Tools::stringToWstring(const std::string& str, int codepage)
 		wstr.resize(len);
 		// Convert the string to a wide string
 		MultiByteToWideChar(codepage, 0, str.c_str(), -1, &wstr[0], len);
+		// Drop the terminating null character that the conversion counted
+		wstr.resize(len - 1);
 		// Return the wide string
 		return wstr;
 	}
@@ -57,9 +59,26 @@ std::string Tools::wstringToString(const std::wstring& wstr, int codepage)
 		str.resize(len);
 		// Convert the wide string to a string
 		WideCharToMultiByte(codepage, 0, wstr.c_str(), -1, &str[0], len, NULL, NULL);
+		// Drop the terminating null character that the conversion counted
+		str.resize(len - 1);
 		// Return the string
 		return str;
 	}
 	// If the length is not greater than 0, return an empty string
 	return std::string();
 }
+
+// Hash a wide string with FNV-1a and a finalizer
+unsigned long long Tools::hash(const std::wstring& wstr)
+{
+	unsigned long long value = 14695981039346656037ULL;
+	for (wchar_t c : wstr) {
+		// Both bytes of the code unit, low byte first
+		value = (value ^ (static_cast<unsigned int>(c) & 0xff)) * 1099511628211ULL;
+		value = (value ^ (static_cast<unsigned int>(c) >> 8 & 0xff)) * 1099511628211ULL;
+	}
+	// The low bits of FNV-1a hardly differ between similar strings, the finalizer of SplitMix64 spreads all bits
+	value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+	return value ^ (value >> 31);
+}
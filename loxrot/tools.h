@@ -48,4 +48,13 @@ class Tools
    * \return The converted string.
    */
 		static std::string wstringToString(const std::wstring& wstr, int codepage = CP_UTF8);
+
+		/**
+   * \brief Hash a wide string with FNV-1a over its UTF-16 code units, finished with the finalizer of SplitMix64 so
+   *        that every bit depends on every character. Unlike std::hash the result is the same for every build and
+   *        every run, so it can place things deterministically.
+   * \param wstr The wide string to hash.
+   * \return The hash.
+   */
+		static unsigned long long hash(const std::wstring& wstr);
 };
@@ -0,0 +1,145 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "vfs.h"
+#include "bloom.h"
+#include "container.h"
+#include "fileio.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <windows.h>
+
+// Get the file system of the disk
+FileSystem& FileSystem::disk() {
+    static DiskFileSystem fileSystem;
+    return fileSystem;
+}
+
+// List the entries of a directory
+std::vector<FileSystem::Entry> DiskFileSystem::list(const std::wstring& directory) {
+    std::vector<Entry> entries;
+    for (const auto& item : std::filesystem::directory_iterator(directory)) {
+        Entry entry;
+        entry.path = item.path().wstring();
+        entry.regular = item.is_regular_file();
+        entry.directory = item.is_directory();
+        entry.link = entry.directory && !std::filesystem::is_directory(item.symlink_status());
+        // Size and modification time are taken from the directory entry, so no additional stat is needed
+        if (entry.regular) {
+            entry.size = item.file_size();
+            entry.modified = std::chrono::system_clock::to_time_t(std::chrono::clock_cast<std::chrono::system_clock>(item.last_write_time()));
+        }
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+// Get the size of a file
+unsigned long long DiskFileSystem::fileSize(const std::wstring& path) {
+    return std::filesystem::file_size(path);
+}
+
+// Get the creation time of a file
+time_t DiskFileSystem::creationTime(const std::wstring& path) {
+    // The writer of a log file usually has it open, so share everything
+    HANDLE hFile = CreateFileW(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    FILETIME ftFile;
+    BOOL ok = GetFileTime(hFile, &ftFile, NULL, NULL);
+    CloseHandle(hFile);
+    if (!ok) {
+        return -1;
+    }
+    // FILETIME counts intervals of 100 nanoseconds since 1601
+    ULARGE_INTEGER creation;
+    creation.LowPart = ftFile.dwLowDateTime;
+    creation.HighPart = ftFile.dwHighDateTime;
+    return static_cast<time_t>((creation.QuadPart - 116444736000000000ULL) / 10000000ULL);
+}
+
+// Check whether a file exists
+bool DiskFileSystem::exists(const std::wstring& path) {
+    std::error_code ec;
+    return std::filesystem::exists(path, ec);
+}
+
+// Delete a file
+bool DiskFileSystem::remove(const std::wstring& path) {
+    std::error_code ec;
+    return std::filesystem::remove(path, ec) || !ec;
+}
+
+// Rename a file
+bool DiskFileSystem::rename(const std::wstring& source, const std::wstring& target) {
+    std::error_code ec;
+    std::filesystem::rename(source, target, ec);
+    return !ec;
+}
+
+// Copy a file
+bool DiskFileSystem::copy(const std::wstring& source, const std::wstring& target) {
+    return FileIO::copyFile(source, target);
+}
+
+// Truncate a file
+bool DiskFileSystem::truncate(const std::wstring& path, const std::wstring& copy, bool durable, unsigned long long& size) {
+    if (!copy.empty()) {
+        // What was written during the copy goes to the copy as well
+        if (!FileIO::catchUpAndTruncate(path, copy, durable, size)) {
+            return false;
+        }
+    }
+    else {
+        std::ofstream ofs(path, std::ios::trunc);
+        if (!ofs.is_open()) {
+            return false;
+        }
+    }
+    // Set the creation time of the truncated file to now
+    FileIO::setCreationTime(path);
+    return true;
+}
+
+// Compress a file
+bool DiskFileSystem::compress(const std::wstring& path, unsigned long long blockSize, Bloom* bloom) {
+#ifdef WITH_ZLIB
+    return FileIO::compressFile(path, blockSize, bloom);
+#else
+    return false;
+#endif
+}
+
+// Append a compressed file to a container
+bool DiskFileSystem::append(const std::wstring& container, const std::wstring& member, bool durable) {
+    bool first = Container::readIndex(container).empty();
+    if (!Container::append(container, member, durable)) {
+        return false;
+    }
+    Bloom::mergeFile(member, container, first, durable);
+    return true;
+}
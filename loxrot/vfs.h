@@ -0,0 +1,167 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <ctime>
+#include <string>
+#include <vector>
+
+class Bloom;
+
+/**
+ * \class FileSystem
+ * \brief The file operations a rotation needs. Rotate and Executor only touch files through this interface, so the
+ *        same planning and execution runs on the disk (DiskFileSystem) or on files that only exist in memory
+ *        (MemoryFileSystem), e.g. to simulate weeks of rotations. Paths are passed on as they are given.
+ */
+class FileSystem
+{
+public:
+    /**
+     * \struct Entry
+     * \brief A directory entry.
+     */
+    struct Entry {
+        std::wstring path; ///< Full path of the entry.
+        bool regular = false; ///< Whether the entry is a regular file.
+        bool directory = false; ///< Whether the entry is a directory.
+        bool link = false; ///< Whether the entry is a symbolic link or a junction, which may point anywhere.
+        unsigned long long size = 0; ///< The size in bytes, 0 for anything but regular files.
+        time_t modified = 0; ///< The last write time.
+    };
+
+    /**
+     * \brief Destructor for FileSystem.
+     */
+    virtual ~FileSystem() {};
+
+    /**
+     * \brief List the entries of a directory.
+     * \param directory The directory.
+     * \return The entries in no particular order.
+     * \throws std::filesystem::filesystem_error if the directory cannot be read.
+     */
+    virtual std::vector<Entry> list(const std::wstring& directory) = 0;
+
+    /**
+     * \brief Get the size of a file.
+     * \param path The file.
+     * \return The size in bytes.
+     * \throws std::filesystem::filesystem_error if the file does not exist.
+     */
+    virtual unsigned long long fileSize(const std::wstring& path) = 0;
+
+    /**
+     * \brief Get the creation time of a file, which a truncation sets to the time of the truncation.
+     * \param path The file.
+     * \return The creation time or -1 if the file does not exist.
+     */
+    virtual time_t creationTime(const std::wstring& path) = 0;
+
+    /**
+     * \brief Check whether a file exists.
+     * \param path The file.
+     * \return True if it exists.
+     */
+    virtual bool exists(const std::wstring& path) = 0;
+
+    /**
+     * \brief Delete a file.
+     * \param path The file.
+     * \return True if the file was deleted or did not exist.
+     */
+    virtual bool remove(const std::wstring& path) = 0;
+
+    /**
+     * \brief Rename a file, replacing the target.
+     * \param source The file.
+     * \param target The new name.
+     * \return True on success.
+     */
+    virtual bool rename(const std::wstring& source, const std::wstring& target) = 0;
+
+    /**
+     * \brief Copy a file.
+     * \param source The file.
+     * \param target The copy, it must not exist yet.
+     * \return True on success, false if the target exists.
+     */
+    virtual bool copy(const std::wstring& source, const std::wstring& target) = 0;
+
+    /**
+     * \brief Truncate a file to size 0 and set its creation time to now. With a copy, what was written to the file
+     *        since it was copied is appended to the copy first.
+     * \param path The file.
+     * \param copy The copy of the file or empty.
+     * \param durable Flush the copy to disk before the file is truncated.
+     * \param size The size of the copy when the file was truncated is returned here.
+     * \return True on success.
+     */
+    virtual bool truncate(const std::wstring& path, const std::wstring& copy, bool durable, unsigned long long& size) = 0;
+
+    /**
+     * \brief Compress a file to <file>.gz. The file itself is kept.
+     * \param path The file.
+     * \param blockSize If not 0, compress into the seekable format with blocks of this size.
+     * \param bloom If given, the tokens of the file are added to this filter.
+     * \return True on success.
+     */
+    virtual bool compress(const std::wstring& path, unsigned long long blockSize, Bloom* bloom) = 0;
+
+    /**
+     * \brief Append a compressed file to a container and merge its Bloom filter into the one of the container. The
+     *        file itself is kept.
+     * \param container The container, created if it does not exist.
+     * \param member The compressed file.
+     * \param durable Flush the container to disk.
+     * \return True on success.
+     */
+    virtual bool append(const std::wstring& container, const std::wstring& member, bool durable) = 0;
+
+    /**
+     * \brief Get the file system of the disk shared by everything that is not simulated.
+     * \return The file system.
+     */
+    static FileSystem& disk();
+};
+
+/**
+ * \class DiskFileSystem
+ * \brief The file system of the disk, through std::filesystem, FileIO and Container.
+ */
+class DiskFileSystem : public FileSystem
+{
+public:
+    std::vector<Entry> list(const std::wstring& directory) override;
+    unsigned long long fileSize(const std::wstring& path) override;
+    time_t creationTime(const std::wstring& path) override;
+    bool exists(const std::wstring& path) override;
+    bool remove(const std::wstring& path) override;
+    bool rename(const std::wstring& source, const std::wstring& target) override;
+    bool copy(const std::wstring& source, const std::wstring& target) override;
+    bool truncate(const std::wstring& path, const std::wstring& copy, bool durable, unsigned long long& size) override;
+    bool compress(const std::wstring& path, unsigned long long blockSize, Bloom* bloom) override;
+    bool append(const std::wstring& container, const std::wstring& member, bool durable) override;
+};
@@ -0,0 +1,109 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#include "watchdog.h"
+#include "logging.h"
+#include <algorithm>
+#include <vector>
+#include <windows.h>
+
+// Constructor
+Watchdog::Watchdog() {
+}
+
+// Destructor
+Watchdog::~Watchdog() {
+}
+
+// Get the volume a directory is located on
+std::wstring Watchdog::getVolume(const std::wstring& directory) {
+    std::map<std::wstring, std::wstring>::iterator it = volumes.find(directory);
+    if (it != volumes.end()) {
+        return it->second;
+    }
+    wchar_t volume[MAX_PATH];
+    if (!GetVolumePathNameW(directory.c_str(), volume, MAX_PATH)) {
+        Logging::error(L"Could not get the volume of " + directory);
+        return L"";
+    }
+    volumes[directory] = volume;
+    return volume;
+}
+
+// Convert a MinFreeSpace value to bytes
+unsigned long long Watchdog::getThreshold(const std::wstring& minFreeSpace, unsigned long long totalBytes) {
+    if (!minFreeSpace.empty() && minFreeSpace.back() == L'%') {
+        return totalBytes / 100 * std::stoull(minFreeSpace.substr(0, minFreeSpace.length() - 1));
+    }
+    return std::stoull(minFreeSpace);
+}
+
+// Check the free space of every volume and start an emergency pass on volumes under pressure
+void Watchdog::check(std::map<std::wstring, Config::Section>& configs, Rotate& rotate) {
+    // Group the watched sections by volume
+    std::map<std::wstring, std::vector<std::pair<const std::wstring, Config::Section>*>> sectionsByVolume;
+    for (std::map<std::wstring, Config::Section>::iterator it = configs.begin(); it != configs.end(); it++) {
+        // The sections of other instances are left to them
+        if (it->second.entries[L"MinFreeSpace"] == L"0" || !rotate.isOwner(it->first)) {
+            continue;
+        }
+        // All directories of a pattern are below its fixed part
+        std::wstring volume = getVolume(it->second.directories ? it->second.directories->getRoot() : it->second.entries[L"Directory"]);
+        if (!volume.empty()) {
+            sectionsByVolume[volume].push_back(&*it);
+        }
+    }
+
+    time_t now = time(0);
+    for (auto& item : sectionsByVolume) {
+        const std::wstring& volume = item.first;
+        // Give the last pass some time to show effect before starting the next one
+        if (now - lastPass[volume] < passInterval) {
+            continue;
+        }
+        ULARGE_INTEGER freeBytes, totalBytes;
+        if (!GetDiskFreeSpaceExW(volume.c_str(), &freeBytes, &totalBytes, NULL)) {
+            Logging::error(L"Could not get the free space of " + volume);
+            continue;
+        }
+        // The strictest section on the volume sets the threshold
+        unsigned long long threshold = 0;
+        for (auto* section : item.second) {
+            threshold = std::max(threshold, getThreshold(section->second.entries[L"MinFreeSpace"], totalBytes.QuadPart));
+        }
+        if (freeBytes.QuadPart >= threshold) {
+            continue;
+        }
+        lastPass[volume] = now;
+        Logging::warning(L"Free space on " + volume + L" is " + std::to_wstring(freeBytes.QuadPart) + L" bytes, below " + std::to_wstring(threshold) + L" bytes. Starting emergency pass.");
+        unsigned long long reclaimed = rotate.reclaimSpace(item.second, threshold - freeBytes.QuadPart);
+        if (reclaimed < threshold - freeBytes.QuadPart) {
+            Logging::error(L"Emergency pass on " + volume + L" reclaimed only " + std::to_wstring(reclaimed) + L" bytes");
+        }
+        else {
+            Logging::info(L"Emergency pass on " + volume + L" reclaimed " + std::to_wstring(reclaimed) + L" bytes");
+        }
+    }
+}
@@ -0,0 +1,78 @@
+/*
+    Copyright (c) 2024 Thomas Kuhn
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided
+    that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+    the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+    the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+    promote products derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+    WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+    TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+    NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+    OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include <ctime>
+#include <string>
+#include <map>
+#include "config.h"
+#include "rotate.h"
+
+/**
+ * \class Watchdog
+ * \brief A class to watch the free space of the volumes holding the log directories.
+ */
+class Watchdog
+{
+public:
+    /**
+     * \brief Default constructor for Watchdog.
+     */
+    Watchdog();
+
+    /**
+     * \brief Destructor for Watchdog.
+     */
+    ~Watchdog();
+
+    /**
+     * \brief Check the free space of every volume with a MinFreeSpace and start an emergency pass on volumes under pressure.
+     * \param configs All sections of the configuration.
+     * \param rotate The Rotate object to run the emergency pass with.
+     */
+    void check(std::map<std::wstring, Config::Section>& configs, Rotate& rotate);
+
+#ifndef UNITTEST
+private:
+#endif
+    /**
+     * \brief Get the volume a directory is located on.
+     * \param directory The directory.
+     * \return The root path of the volume.
+     */
+    std::wstring getVolume(const std::wstring& directory);
+
+    /**
+     * \brief Convert a MinFreeSpace value to bytes.
+     * \param minFreeSpace The value, either in bytes or in percent of the volume (e.g. 10%).
+     * \param totalBytes The size of the volume.
+     * \return The threshold in bytes.
+     */
+    static unsigned long long getThreshold(const std::wstring& minFreeSpace, unsigned long long totalBytes);
+
+    std::map<std::wstring, std::wstring> volumes; ///< Cache of directory to volume.
+    std::map<std::wstring, time_t> lastPass; ///< The time of the last emergency pass per volume.
+    static const int passInterval = 60; ///< Minimum number of seconds between two emergency passes on the same volume.
+};